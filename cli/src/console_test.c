@@ -13,11 +13,6 @@
 #endif
 
 
-int match_str(const char *name, void *query)
-{
-	return !strstr(name, (char *)query);
-}
-
 int match_regex(const char *name, void *query)
 {
 	regmatch_t subs;
@@ -30,6 +25,28 @@ int progress_function(uint32_t count, const char* cur_file, void* param) {
 	return 0;
 }
 
+// keep the index in step with a change of fsbuf, path is the name inserted or renamed to (0 if none)
+static void update_index(fs_index *fsi, fs_buf *fsbuf, fs_change *changes, uint32_t change_count, const char *path)
+{
+	if (fsi == 0)
+		return;
+
+	// a no-op for indices of node ids
+	for (uint32_t i = 0; i < change_count; i++)
+		add_fsbuf_offsets(fsi, changes[i].start_off, changes[i].delta);
+
+	uint32_t path_off = 0, start_off, end_off;
+	if (path)
+		get_path_range(fsbuf, path, &path_off, &start_off, &end_off);
+	if (path_off == 0)
+		return;
+	add_index(fsi, get_name(fsbuf, path_off), path_off);
+	// names of a folder renamed are removed & inserted again at new offsets (ids of them are kept, adding is a no-op)
+	for (uint32_t off = start_off; off && off < end_off; off = next_name(fsbuf, off))
+		if (*get_name(fsbuf, off))
+			add_index(fsi, get_name(fsbuf, off), off);
+}
+
 static uint32_t search_by_fsbuf(fs_buf *fsbuf, const char *query)
 {
 	uint32_t name_offs[MAX_RESULTS], end_off = get_tail(fsbuf);
@@ -57,7 +74,7 @@ static uint32_t search_by_fsbuf(fs_buf *fsbuf, const char *query)
 	}
 	else
 	{
-		search_files(fsbuf, &start_off, end_off, name_offs, &count, match_str, query, progress_function, NULL);
+		search_files_literal(fsbuf, &start_off, end_off, name_offs, &count, query, progress_function, NULL);
 		char path[PATH_MAX];
 		for (uint32_t i = 0; i < count; i++)
 		{
@@ -67,15 +84,14 @@ static uint32_t search_by_fsbuf(fs_buf *fsbuf, const char *query)
 		uint32_t total = count;
 		while (count == MAX_RESULTS)
 		{
-			search_files(fsbuf, &start_off, end_off, name_offs, &count, match_str, query, progress_function, NULL);
-			// search_files(fsbuf, &start_off, end_off, query, name_offs, &count, comparison_by_regex);
+			search_files_literal(fsbuf, &start_off, end_off, name_offs, &count, query, progress_function, NULL);
 			total += count;
 		}
 		return total;
 	}
 }
 
-static int get_short_query(char *cmd, char *short_cmd)
+static int get_short_query(char *cmd, char *short_cmd, uint32_t limit)
 {
 	if (strlen(cmd) == 0)
 		return -1;
@@ -86,29 +102,10 @@ static int get_short_query(char *cmd, char *short_cmd)
 	if (strlen(cmd) == 0)
 		return 1;
 
-	wchar_t wquery[NAME_MAX], wshort_query[MAX_KW_LEN + 1];
-	wchar_t *ws = 0;
-
-	if (utf8_to_wchar_t(cmd, wquery, sizeof(wquery) - sizeof(wchar_t)) != 0)
-	{
-		printf("utf8 conversion failed for %s\n", cmd);
-		return 2;
-	}
-
-	if (wcslen(wquery) > MAX_KW_LEN)
-	{
-		wcsncpy(wshort_query, wquery, MAX_KW_LEN);
-		wshort_query[MAX_KW_LEN] = 0;
-		ws = wshort_query;
-	}
-	else
-		ws = wquery;
-
-	if (wchar_t_to_utf8(ws, short_cmd, NAME_MAX) != 0)
-	{
-		printf("wchar_t conversion failed for %S\n", ws);
-		return 3;
-	}
+	// the index answers queries of any length if limit is 0
+	uint32_t len = limit ? utf8_prefix(cmd, limit) : strlen(cmd);
+	memcpy(short_cmd, cmd, len);
+	short_cmd[len] = 0;
 	return 0;
 }
 
@@ -120,8 +117,8 @@ static uint32_t search_by_index(fs_index *fsi, fs_buf *fsbuf, char *query)
 		return 0;
 	}
 
-	char short_query[NAME_MAX + 1];
-	int ret = get_short_query(query, short_query);
+	char short_query[1024];
+	int ret = get_short_query(query, short_query, get_query_limit(fsi));
 	if (ret != 0)
 		return 0;
 
@@ -145,11 +142,53 @@ static uint32_t search_by_index(fs_index *fsi, fs_buf *fsbuf, char *query)
 	return n - 1;
 }
 
+// names containing all the space separated words of query
+static uint32_t search_by_index_all(fs_index *fsi, fs_buf *fsbuf, char *query)
+{
+	if (fsi == 0)
+	{
+		printf("    index empty :P\n");
+		return 0;
+	}
+
+	char words_buf[1024];
+	const char *words[32];
+	uint32_t count = 0;
+	strcpy(words_buf, query);
+	for (char *w = strtok(words_buf, " "); w && count < sizeof(words) / sizeof(words[0]); w = strtok(0, " "))
+		words[count++] = w;
+	if (count == 0)
+		return 0;
+
+	char path[PATH_MAX];
+	index_keyword *inkw = get_index_keywords(fsi, words, count);
+	uint32_t n = 1;
+	for (uint32_t i = 0; inkw && i < inkw->len; i++)
+	{
+		// words longer than the limit were cut
+		int matched = 1;
+		for (uint32_t j = 0; j < count && get_query_limit(fsi) != 0; j++)
+			if (strstr(get_name(fsbuf, inkw->fsbuf_offsets[i]), words[j]) == 0)
+				matched = 0;
+		if (!matched)
+			continue;
+
+		if (n <= MAX_RESULTS)
+		{
+			char *p = get_path_by_name_off(fsbuf, inkw->fsbuf_offsets[i], path, sizeof(path));
+			printf("\t%'d: %c %'u %s\n", n, is_file(fsbuf, inkw->fsbuf_offsets[i]) ? 'F' : 'D', inkw->fsbuf_offsets[i], p);
+		}
+		n++;
+	}
+	free_index_keyword(inkw, 1);
+	return n - 1;
+}
+
 void console_test(fs_buf *fsbuf, fs_index *fsi)
 {
 	char cmd[1024];
 	struct timeval s, e;
-	printf("*** input any string to query, or s/XXX to search XXX with index, if/XXX to insert file /XXX, id/XXX to insert directory /XXX, d/XXX to remove path /XXX, r/XXX /YYY to rename path /XXX to /YYY ***\n");
+	printf("*** input any string to query, or s/XXX to search XXX with index, a/XXX YYY to search names with both XXX and YYY with index, if/XXX to insert file /XXX, id/XXX to insert directory /XXX, d/XXX to remove path /XXX, r/XXX /YYY to rename path /XXX to /YYY ***\n");
 	while (1)
 	{
 		printf(" $ ");
@@ -195,6 +234,10 @@ void console_test(fs_buf *fsbuf, fs_index *fsi)
 		{
 			cmd_type = 5;
 		}
+		else if (strstr(r, "a/") == r)
+		{
+			cmd_type = 6;
+		}
 		else
 		{
 			cmd_type = 0;
@@ -215,16 +258,25 @@ void console_test(fs_buf *fsbuf, fs_index *fsi)
 			break;
 		case 2:
 			result = insert_path(fsbuf, r + 2, r[1] == 'd', changes);
+			if (result == 0)
+				update_index(fsi, fsbuf, changes, 1, r + 2);
 			break;
 		case 3:
 			result = remove_path(fsbuf, r + 1, changes, &change_count);
+			if (result == 0)
+				update_index(fsi, fsbuf, changes, change_count, 0);
 			break;
 		case 4:
 			result = rename_path(fsbuf, src, dst, changes, &change_count);
+			if (result == 0)
+				update_index(fsi, fsbuf, changes, change_count, dst);
 			break;
 		case 5:
 			get_path_range(fsbuf, r + 1, &path_off, &start_off, &end_off);
 			break;
+		case 6:
+			n = search_by_index_all(fsi, fsbuf, r + 2);
+			break;
 		}
 		gettimeofday(&e, 0);
 		uint64_t dur = (e.tv_usec + e.tv_sec * 1000000) - (s.tv_usec + s.tv_sec * 1000000);
@@ -261,6 +313,9 @@ void console_test(fs_buf *fsbuf, fs_index *fsi)
 			printf("    path %s info: start %'u, kids-start %'u, kids-end %'u\n", r + 1,
 				   path_off, start_off, end_off);
 			break;
+		case 6:
+			printf("    found %'u entries for all of %s in %'lu ms\n", n, r + 2, dur / 1000);
+			break;
 		}
 	}
 }
@@ -11,6 +11,7 @@
 #include "fs_buf.h"
 #include "index.h"
 #include "index_allmem.h"
+#include "index_trigram.h"
 #include "walkdir.h"
 #include "monitor_vfs.h"
 #include "stats.h"
@@ -38,8 +39,8 @@ static int report_progress(uint32_t file_count, uint32_t dir_count, const char*
 static int scan(int argc, char* argv[])
 {
 	char dir[NAME_MAX] = ".";
-	int opt, use_index = 0, merge_partition = 0;
-	while ((opt = getopt(argc, argv, "d:im")) != -1) {
+	int opt, use_index = 0, trigram = 0, merge_partition = 0, large = 0, sorted = 0, huge = 0;
+	while ((opt = getopt(argc, argv, "d:itmLsH")) != -1) {
 		switch(opt) {
 		case 'd':
 			strcpy(dir, optarg);
@@ -47,9 +48,22 @@ static int scan(int argc, char* argv[])
 		case 'i':
 			use_index = 1;
 			break;
+		case 't':
+			use_index = 1;
+			trigram = 1;
+			break;
 		case 'm':
 			merge_partition = 1;
 			break;
+		case 'L':
+			large = 1;
+			break;
+		case 's':
+			sorted = 1;
+			break;
+		case 'H':
+			huge = 1;
+			break;
 		default:
 			printf("unknown options: %c\n", opt);
 			return 1;
@@ -63,7 +77,11 @@ static int scan(int argc, char* argv[])
 			path[strlen(path)] = '/';
 	}
 
-	fs_buf* fsbuf = new_fs_buf(FSBUF_SIZE, argc <= optind ? "/" : path);
+	fs_buf* fsbuf = large ? new_large_fs_buf(FSBUF_SIZE, argc <= optind ? "/" : path) : new_fs_buf(FSBUF_SIZE, argc <= optind ? "/" : path);
+	if (sorted)
+		enable_sorted_kids(fsbuf);
+	if (huge && enable_huge_pages(fsbuf) != 0)
+		printf("failed to map the linear file tree with huge pages\n");
 
 	// walk dir to make indice
 	struct timeval s, e;
@@ -84,10 +102,18 @@ static int scan(int argc, char* argv[])
 
 	fs_index* fsi = 0;
 	fs_allmem_index* ami = 0;
+	fs_trigram_index* tgi = 0;
 	if (use_index) {
 		gettimeofday(&s, 0);
-		ami = new_allmem_index(INDEX_COUNT);
-		fsi = (fs_index*)ami;
+		if (trigram) {
+			// postings of node ids are left as they are by changes
+			enable_node_ids(fsbuf);
+			tgi = new_trigram_index(INDEX_COUNT, fsbuf);
+			fsi = (fs_index*)tgi;
+		} else {
+			ami = new_allmem_index(INDEX_COUNT);
+			fsi = (fs_index*)ami;
+		}
 		uint32_t name_off = first_name(fsbuf);
 		while (name_off < get_tail(fsbuf)) {
 			char* s = get_name(fsbuf, name_off);
@@ -95,13 +121,15 @@ static int scan(int argc, char* argv[])
 				add_index(fsi, s, name_off);
 			name_off = next_name(fsbuf, name_off);
 		}
+		if (trigram)
+			shrink_trigram_index(tgi);
 		gettimeofday(&e, 0);
 		dur = (e.tv_usec + e.tv_sec*1000000) - (s.tv_usec + s.tv_sec*1000000);
 		printf("indexing dur: %'lu ms\n", dur/1000);
 
 		gettimeofday(&s, 0);
 		sprintf(fullpath, "%s/%s", dir, INDEX_FILE);
-		printf("save index %s: %d\n", fullpath, save_allmem_index(ami, fullpath));
+		printf("save index %s: %d\n", fullpath, trigram ? save_trigram_index(tgi, fullpath) : save_allmem_index(ami, fullpath));
 		gettimeofday(&e, 0);
 		dur = (e.tv_usec + e.tv_sec*1000000) - (s.tv_usec + s.tv_sec*1000000);
 		printf("save index dur: %'lu ms\n", dur/1000);
@@ -120,11 +148,17 @@ static int scan(int argc, char* argv[])
 static int load(int argc, char* argv[])
 {
 	char dir[NAME_MAX] = ".";
-	int load_policy = LOAD_NONE, opt;
+	int load_policy = LOAD_NONE, opt, use_mmap = 0, huge = 0;
 	char fullpath[PATH_MAX];
 
-	while ((opt = getopt(argc, argv, "d:l:f:")) != -1) {
+	while ((opt = getopt(argc, argv, "d:l:f:mH")) != -1) {
 		switch(opt) {
+		case 'm':
+			use_mmap = 1;
+			break;
+		case 'H':
+			huge = 1;
+			break;
 		case 'f':
 			strcpy(fullpath, optarg);
 			break;
@@ -150,16 +184,19 @@ static int load(int argc, char* argv[])
 	struct timeval s, e;
 	gettimeofday(&s, 0);
 
-	int r = load_fs_buf(&fsbuf, fullpath);
+	int r = use_mmap ? load_fs_buf_mmap(&fsbuf, fullpath) : load_fs_buf(&fsbuf, fullpath);
 	if (r != 0) {
 		printf("load linear file tree file %s failed: %d\n", fullpath, r);
 		return 4;
 	}
 	printf("load linear file tree file %s done, root: %s\n", fullpath, get_root_path(fsbuf));
+	if (huge && enable_huge_pages(fsbuf) != 0)
+		printf("failed to map the linear file tree with huge pages\n");
 
 	fs_index* fsi = 0;
 	sprintf(fullpath, "%s/%s", dir, INDEX_FILE);
-	if (load_fs_index(&fsi, fullpath, load_policy) != 0)
+	enable_node_ids(fsbuf);
+	if (load_trigram_index(&fsi, fullpath, load_policy, fsbuf) != 0 && load_fs_index(&fsi, fullpath, load_policy) != 0)
 		printf("load index file %s failed\n", fullpath);
 	else
 		printf("load index file %s done\n", fullpath);
@@ -205,8 +242,8 @@ struct {
 	const char* desc;
 } commands[] = {
 	{"help", help, 0, "Print this help information"},
-	{"scan", scan, "[-d $dir] [-i] [-m] [$root]", "Scan directories $root (default to /), merge all partitions (if -m), make indice(if -i), save data to $dir and test search"},
-	{"load", load, "[-d $dir] [-l #load_policy]", "Load previously saved indice from $dir all into memory if -l 0 or none into memory if -l 1 and test search"},
+	{"scan", scan, "[-d $dir] [-i] [-t] [-m] [-L] [-s] [-H] [$root]", "Scan directories $root (default to /), merge all partitions (if -m), make indice(if -i, or of trigrams if -t), save data to $dir and test search, -L builds a large linear file tree (over 1 GB), -s sorts the kids of each folder, -H keeps it in huge pages"},
+	{"load", load, "[-d $dir] [-l #load_policy] [-m] [-H]", "Load previously saved indice from $dir all into memory if -l 0 or none into memory if -l 1 and test search, -m maps the linear file tree instead of reading it, -H then moves it into huge pages"},
 	{"partitions", get_parts, 0, "Get partitions"},
 	{0, 0, 0, 0}
 };
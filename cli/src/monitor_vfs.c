@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/types.h>
@@ -58,40 +59,55 @@ static void poll_vfs_change(fs_buf* fsbuf)
 		if (ira.size == 0)
 			break;
 
-		fs_change changes[10];
-		int off = 0, result;
+		fs_op* ops = malloc(ira.size * sizeof(fs_op));
+		if (ops == 0)
+			break;
+
+		int off = 0;
+		uint32_t count = 0;
 		for (int i = 0; i < ira.size; i++) {
 			unsigned char action = *(ira.data + off);
 			off++;
 			char* src = ira.data + off, *dst = 0;
 			off += strlen(src) + 1;
 
-			uint32_t change_count = sizeof(changes)/sizeof(fs_change);
+			fs_op* op = ops + count;
+			op->path = src;
 			switch(action) {
 			case ACT_NEW_FILE:
 			case ACT_NEW_SYMLINK:
 			case ACT_NEW_LINK:
 			case ACT_NEW_FOLDER:
 				printf("    %s: %s\n", act_names[action], src);
-				result = insert_path(fsbuf, src, action == ACT_NEW_FOLDER, changes);
-				printf("    insert_path result: %d\n", result);
+				op->type = FS_OP_INSERT;
+				op->is_dir = action == ACT_NEW_FOLDER;
+				count++;
 				break;
 			case ACT_DEL_FILE:
 			case ACT_DEL_FOLDER:
 				printf("    %s: %s\n", act_names[action], src);
-				result = remove_path(fsbuf, src, changes, &change_count);
-				printf("    remove_path result: %d\n", result);
+				op->type = FS_OP_REMOVE;
+				count++;
 				break;
 			case ACT_RENAME_FILE:
 			case ACT_RENAME_FOLDER:
 				dst = ira.data + off;
 				off += strlen(dst) + 1;
 				printf("    %s: %s -> %s\n", act_names[action], src, dst);
-				result = rename_path(fsbuf, src, dst, changes, &change_count);
-				printf("    rename_path result: %d\n", result);
+				op->type = FS_OP_RENAME;
+				op->dst_path = dst;
+				count++;
 				break;
 			}
 		}
+
+		// the whole chunk of changes is applied in one go
+		uint32_t done = apply_changes(fsbuf, ops, count);
+		printf("    apply_changes: %u of %u done\n", done, count);
+		for (uint32_t i = 0; i < count; i++)
+			if (ops[i].result != 0)
+				printf("    %s failed: %d\n", ops[i].path, ops[i].result);
+		free(ops);
 	}
 	close(fd);
 }
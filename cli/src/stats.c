@@ -2,7 +2,6 @@
 
 #include <stdio.h>
 #include <string.h>
-#include <wchar.h>
 #include <limits.h>
 
 #include "fs_buf.h"
@@ -18,11 +17,13 @@ static uint64_t print_file_info(fs_buf* fsbuf)
 	uint32_t name_off = first_name(fsbuf);
 	while (name_off < get_tail(fsbuf)) {
 		char* s = get_name(fsbuf, name_off);
-		if (strlen(s) > 0)
+		uint32_t len = strlen(s);
+		if (len > 0) {
 			files_count++;
-		wchar_t converted[NAME_MAX];
-		if (utf8_to_wchar_t(s, converted, sizeof(converted) - sizeof(wchar_t)) == 0)
-			filename_lens[wcslen(converted)-1]++;
+			uint32_t chars = utf8_count(s, len);
+			if (chars <= NAME_MAX)
+				filename_lens[chars-1]++;
+		}
 		name_off = next_name(fsbuf, name_off);
 	}
 
@@ -52,4 +53,14 @@ void collect_print_statistics(fs_buf* fsbuf, fs_index* fsi)
 	total_alloced += mem;
 	printf("file-count: %'lu, mem: %'lu (%'lu KB), fs-buf-off: %'u, keywords: %'u, indice: %'u\n", 
 		files_count, total_alloced, total_alloced >> 10, get_tail(fsbuf), keywords, offsets);
+
+	index_table_stats table;
+	if (fsi && get_table_stats(fsi, &table) == 0 && table.keywords > 0)
+		printf("index-table slots: %'u, load: %.2f, probe mean: %.2f, max: %u\n", table.slots,
+			(double)table.keywords / table.slots, (double)table.total_probe / table.keywords, table.max_probe);
+
+	fs_buf_usage usage;
+	get_fs_buf_usage(fsbuf, &usage);
+	printf("fs-buf reserved: %'lu (%'lu KB), used: %'lu (%'lu KB), huge-pages: %'lu KB\n",
+		usage.reserved, usage.reserved >> 10, usage.used, usage.used >> 10, usage.huge >> 10);
 }
@@ -8,6 +8,7 @@
 #define ERR_NESTED		4
 #define ERR_PATH_DIFFER	5
 #define ERR_NOTEMPTY	6
+#define ERR_NOT_SORTED	7
 
 typedef struct __fs_buf__ fs_buf;
 
@@ -18,6 +19,20 @@ typedef struct __fs_change__ {
 } fs_change;
 
 uint32_t get_capacity(fs_buf* fsbuf);
+
+typedef struct __fs_buf_usage__ {
+	// bytes allocated for names: the buffer (or its segments), the case-folded copy & the name dictionary
+	uint64_t reserved;
+	// bytes of them holding names, the rest is room for changes to come
+	uint64_t used;
+	// bytes of reserved mapped for transparent huge pages, see enable_huge_pages
+	uint64_t huge;
+} fs_buf_usage;
+
+void get_fs_buf_usage(fs_buf* fsbuf, fs_buf_usage* usage);
+// give back the room behind the names, which grows by an eighth of the buffer once changes need it again.
+// build_fstree calls it when done, load_fs_buf reads a file into a buffer of its size
+void shrink_fs_buf(fs_buf* fsbuf);
 uint32_t first_name(fs_buf* fsbuf);
 const char* get_root_path(fs_buf* fsbuf);
 
@@ -25,21 +40,99 @@ uint32_t get_tail(fs_buf* fsbuf);
 // thread-unsafe
 char* get_name(fs_buf* fsbuf, uint32_t name_off);
 fs_buf* new_fs_buf(uint32_t capacity, const char* root_path);
+// large buffers lift the 1 GB limit of new_fs_buf (to nearly 4 GB) with 8-byte dir tags, at the cost of
+// 4 more bytes per folder. save_fs_buf keeps the mode, which load_fs_buf & load_fs_buf_mmap detect
+fs_buf* new_large_fs_buf(uint32_t capacity, const char* root_path);
+int is_large_fs_buf(fs_buf* fsbuf);
 void free_fs_buf(fs_buf* fsbuf);
 
+// a snapshot is a read-only fs_buf of fsbuf's version when taken, for searches & paths of their results
+// which never wait for writers of fsbuf: acquire returns a snapshot of the current version, or the latest one
+// taken if a writer holds fsbuf now (0 if out of memory). segments are shared with fsbuf until changed
+// (see enable_segments), a flat buffer is copied. a snapshot must not be changed, and stays valid until released
+fs_buf* acquire_fs_snapshot(fs_buf* fsbuf);
+void release_fs_snapshot(fs_buf* snapshot);
+
+// generation of fsbuf, bumped by each change (a snapshot keeps the one it was taken of)
+uint32_t get_fs_generation(fs_buf* fsbuf);
+
+// search range whose offsets follow the changes of the fs_buf, e.g. to fetch the next page of results
+typedef struct __fs_cursor__ {
+	// generation of fsbuf start_off & end_off belong to
+	uint32_t generation;
+	uint32_t start_off;
+	uint32_t end_off;
+} fs_cursor;
+
+// cursor of [start_off, end_off) of fsbuf now, the offsets must be got from fsbuf at its current generation
+void init_fs_cursor(fs_buf* fsbuf, fs_cursor* cursor, uint32_t start_off, uint32_t end_off);
+// move cursor on to fsbuf's generation (e.g. of a snapshot to be searched): names inserted in front of start_off
+// are not scanned, removed ones are dropped from the range. returns 1 and leaves cursor as it is
+// if fsbuf does not keep the changes since cursor's generation (only the latest few thousands are kept)
+int seek_fs_cursor(fs_buf* fsbuf, fs_cursor* cursor);
+
 int is_file(fs_buf* fsbuf, uint32_t name_off);
 // thread-unsafe
 uint32_t next_name(fs_buf* fsbuf, uint32_t name_off);
 
 char* get_path_by_name_off(fs_buf* fsbuf, uint32_t name_off, char *path, uint32_t path_size);
+// get_path_by_name_off for count names, paths are stored one after another in buf with paths[i] pointing to the i-th.
+// names sharing folders with the previous one (e.g. a page of search results) reuse its prefix.
+// returns the number of paths stored, less than count if buf is full
+uint32_t get_paths_by_name_offs(fs_buf* fsbuf, const uint32_t* name_offs, uint32_t count, char* buf, uint32_t buf_size, char** paths);
+
+// raw dump of the buffer, can be mapped by load_fs_buf_mmap
+#define FS_FORMAT_LFT	1
+// front-coded names in compressed blocks, decompressed into the buffer by load_fs_buf
+#define FS_FORMAT_LFT2	2
 
+// format written by save_fs_buf, load sets it to the format of the file loaded
+void set_save_format(fs_buf* fsbuf, int format);
+int get_save_format(fs_buf* fsbuf);
 int save_fs_buf(fs_buf* fsbuf, const char* filename);
 int load_fs_buf(fs_buf** pfsbuf, const char* filename);
+// same as load_fs_buf but maps the file (MAP_PRIVATE) instead of reading it, so pages are read on first access
+// and copied on first change. the file must be replaced by rename (as save_fs_buf does), not rewritten in place.
+// FS_FORMAT_LFT2 files can not be mapped and are loaded by load_fs_buf
+int load_fs_buf_mmap(fs_buf** pfsbuf, const char* filename);
 
 int insert_path(fs_buf* fsbuf, const char *path, int is_dir, fs_change* change);
 int remove_path(fs_buf* fsbuf, const char *path, fs_change* changes, uint32_t* change_count);
 int rename_path(fs_buf* fsbuf, const char* src_path, const char* dst_path, fs_change* changes, uint32_t* change_count);
 
+#define FS_OP_INSERT	0
+#define FS_OP_REMOVE	1
+#define FS_OP_RENAME	2
+
+typedef struct __fs_op__ {
+	int type;
+	// FS_OP_INSERT only
+	int is_dir;
+	const char* path;
+	// FS_OP_RENAME only
+	const char* dst_path;
+	// set by apply_changes, 0 or ERR_*
+	int result;
+} fs_op;
+
+// apply ops in order under one write lock. runs of inserts are sorted & grouped by parent folder,
+// so that all new kids of a folder are inserted in one pass (e.g. bursts of tar x).
+// returns the number of ops succeeded
+uint32_t apply_changes(fs_buf* fsbuf, fs_op* ops, uint32_t count);
+
+#define FS_JOURNAL_SUFFIX	".journal"
+
+// journal changes applied from now on to filename + FS_JOURNAL_SUFFIX, filename being the saved fs_buf
+// (its journal is replayed by load_fs_buf call by call, so names get the offsets they had before).
+// records of the saved file are kept, those of an older one dropped
+int open_fs_journal(fs_buf* fsbuf, const char* filename);
+void close_fs_journal(fs_buf* fsbuf);
+// 0 if the journal was closed, e.g. after a write error
+int has_fs_journal(fs_buf* fsbuf);
+uint32_t get_journal_size(fs_buf* fsbuf);
+// save fsbuf over filename (via a temporary file) and empty its journal, save_fs_buf to the journal's file does the same
+int checkpoint_fs_buf(fs_buf* fsbuf, const char* filename);
+
 void get_path_range(fs_buf *fsbuf, const char *path, uint32_t *path_off, uint32_t *start_off, uint32_t *end_off);
 
 // do not check null pointer.
@@ -47,8 +140,110 @@ typedef int (*progress_fn)(uint32_t count, const char* cur_file, void* param);
 typedef int (*comparator_fn)(const char *file_name, void* param);
 void search_files(fs_buf* fsbuf, uint32_t* start_off, uint32_t end_off, uint32_t* results, uint32_t* count,
 		comparator_fn comparator, void *comparator_param, progress_fn pcf, void *pcf_param);
+// same as search_files with a built-in case-sensitive substring matcher (no comparator callback),
+// pcf is invoked every 1024 names instead of every name
+void search_files_literal(fs_buf* fsbuf, uint32_t* start_off, uint32_t end_off, uint32_t* results, uint32_t* count,
+		const char* keyword, progress_fn pcf, void *pcf_param);
+// splits [*start_off, end_off) into name-aligned chunks scanned by up to threads threads (<= 0 means one per cpu),
+// uses keyword as in search_files_literal if comparator is 0, otherwise comparator and pcf must be thread-safe.
+// results and *start_off are the same as search_files would give.
+void search_files_parallel(fs_buf* fsbuf, uint32_t* start_off, uint32_t end_off, uint32_t* results, uint32_t* count,
+		comparator_fn comparator, void *comparator_param, const char* keyword, progress_fn pcf, void *pcf_param, int threads);
+// keep the buffer in a mapping of 2 MB pages (transparent huge pages, MADV_HUGEPAGE), so that scans over
+// hundreds of MB miss the TLB far less, and growth moves pages instead of copying them. call it on a new fs_buf
+// before build_fstree, or after load. if the kernel has them turned off the buffer is kept as it is
+// (has_huge_pages returns 0). segmented buffers (see enable_segments) and the case-folded copy are not covered
+int enable_huge_pages(fs_buf* fsbuf);
+int has_huge_pages(fs_buf* fsbuf);
+// builds the case-folded copy of all names, which is then kept in step by insert/remove/rename_path.
+// it costs another capacity bytes of memory
+int enable_fold_names(fs_buf* fsbuf);
+int has_fold_names(fs_buf* fsbuf);
+// hash index folders with at least min_kids (0 means 1024) kids for path lookup, kept in step by insert/remove/rename_path
+int enable_dir_hash(fs_buf* fsbuf, uint32_t min_kids);
+// move names into fixed-size segments with slack space, so that insert/remove/rename_path only shift bytes
+// inside a segment instead of the whole buffer tail. offsets and save_fs_buf output are unchanged
+int enable_segments(fs_buf* fsbuf);
+// keep the kids of each folder in strcmp order, so lookups stop early (and binary search hashed folders)
+// and results of a folder come out sorted. call it on a new fs_buf before build_fstree, which then sorts
+// each folder once; a non-empty fs_buf is only accepted (ERR_NOT_SORTED otherwise) if already sorted,
+// e.g. one saved in sorted mode, which load_fs_buf & load_fs_buf_mmap turn on by themselves
+int enable_sorted_kids(fs_buf* fsbuf);
+int is_sorted_kids(fs_buf* fsbuf);
+// case-insensitive substring search (see fold_char in utils.h), scans the folded copy if enabled, otherwise folds name by name.
+// otherwise the same as search_files_parallel
+void search_files_nocase(fs_buf* fsbuf, uint32_t* start_off, uint32_t end_off, uint32_t* results, uint32_t* count,
+		const char* keyword, progress_fn pcf, void *pcf_param, int threads);
+
+typedef struct __fs_meta__ {
+	uint64_t size;
+	// seconds since the epoch
+	int64_t mtime;
+	// st_mode, 0 if not known
+	uint32_t mode;
+} fs_meta;
+
+// keep size, mtime & mode (of lstat) of each name in memory, so search_files_meta filters names without touching
+// the disk. build_fstree fills them as it walks, insert_path & apply_changes stat the new names (and the folders
+// changed), rename_path carries them along. files written in place keep what was got when they were inserted.
+// names already in fsbuf are stat-ed here, so call it on a new fs_buf before build_fstree.
+// costs 24 bytes per name, is not saved, and is dropped (has_fs_meta returns 0) if a change runs out of memory
+int enable_fs_meta(fs_buf* fsbuf);
+int has_fs_meta(fs_buf* fsbuf);
+// returns 1 if the metadata of name_off is not known
+int get_fs_meta(fs_buf* fsbuf, uint32_t name_off, fs_meta* meta);
+
+typedef struct __fs_meta_filter__ {
+	// inclusive ranges, a max of 0 means no limit
+	uint64_t min_size;
+	uint64_t max_size;
+	int64_t min_mtime;
+	int64_t max_mtime;
+	// (mode & mode_mask) == mode_value, e.g. S_IFMT & S_IFREG for regular files only
+	uint32_t mode_mask;
+	uint32_t mode_value;
+} fs_meta_filter;
+
+// names in [*start_off, end_off) whose metadata matches filter, e.g. files over 1 GB changed this week.
+// only the metadata columns are scanned, results & start_off are the same as search_files gives.
+// names of unknown metadata never match, nothing matches if not enabled
+void search_files_meta(fs_buf* fsbuf, uint32_t* start_off, uint32_t end_off, uint32_t* results, uint32_t* count,
+		const fs_meta_filter* filter);
+
+// index names by extension (behind the last '.', case-folded), so that search_files_ext only visits
+// the names of one extension. kept in step by insert/remove/rename_path, names appended by build_fstree
+// only touch the list of their extension, but building it in one pass after build_fstree (or load) is cheaper
+// still. costs about 4 bytes per name with an extension
+int enable_ext_index(fs_buf* fsbuf);
+int has_ext_index(fs_buf* fsbuf);
+// names in [*start_off, end_off) whose extension is ext (without the '.', case-insensitive), e.g. "pdf" for *.pdf.
+// results & start_off are the same as search_files gives. names are scanned if the index is not enabled
+void search_files_ext(fs_buf* fsbuf, uint32_t* start_off, uint32_t end_off, uint32_t* results, uint32_t* count,
+		const char* ext);
+
+// store names repeated across folders (index.js, __init__.py, .gitignore...) once in a dictionary, entries of
+// them keep a 4-byte reference. names are recoded once here (offsets all change, cursors taken before can not
+// follow), so call it after build_fstree or load. names inserted later are only interned if already in the
+// dictionary, get_name still returns the plain name. scans match a dictionary name once per query.
+// save_fs_buf writes the plain layout, which takes a plain copy of fsbuf while saving
+int enable_interned_names(fs_buf* fsbuf);
+int has_interned_names(fs_buf* fsbuf);
+
+// give each name a node id that stays the same while names around it are inserted or removed, so that
+// whatever keeps names by id (e.g. the trigram index) is not shifted by each change. names moved by rename_path
+// keep their ids, the renamed name itself gets a new one. ids are never reused, costs 12 bytes per name
+// and is not saved. dropped (has_node_ids returns 0) if a change runs out of memory
+int enable_node_ids(fs_buf* fsbuf);
+int has_node_ids(fs_buf* fsbuf);
+// 0 if name_off is not a name or ids are not enabled
+uint32_t get_node_id(fs_buf* fsbuf, uint32_t name_off);
+// 0 if the name of id was removed
+uint32_t get_node_offset(fs_buf* fsbuf, uint32_t id);
+// offsets of the ids whose names are still there to offs (in the order of ids), returns their count
+uint32_t get_node_offsets(fs_buf* fsbuf, const uint32_t* ids, uint32_t count, uint32_t* offs);
 
 // functions below are used internally
 void set_kids_off(fs_buf* fsbuf, uint32_t name_off, uint32_t kids_off);
 int append_new_name(fs_buf* fsbuf, char* name, int is_dir);
 int append_parent(fs_buf* fsbuf, uint32_t parent_off);
+void set_fs_meta(fs_buf* fsbuf, uint32_t name_off, const fs_meta* meta);
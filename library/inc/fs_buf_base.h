@@ -0,0 +1,363 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "fs_buf.h"
+
+#define DATA_START 8
+// head grows by this
+#define FS_NEW_BLK_SIZE (1 << 20)
+
+// fs-tags below are all for little endian archs, such as x86/loongson
+
+#define FS_TAG_BITS 2
+#define FS_TAG_MASK ((1 << FS_TAG_BITS) - 1)
+#define MAX_FSBUF_SIZE (1 << (8 * sizeof(uint32_t) - FS_TAG_BITS))
+// large buffers have 8-byte dir & parent tags, so any uint32_t offset fits in a tag,
+// the headroom below 4 GB keeps tail + size of an insertion from wrapping around
+#define MAX_LARGE_FSBUF_SIZE 0xff000000u
+
+#define FS_TAG_FILE 0
+#define FS_TAG_DIR 1
+
+// kids lists with at least this many names get a hash index once enabled
+#define DIR_HASH_MIN_KIDS 1024
+
+typedef struct __dir_hash__
+{
+	uint32_t kids_off;
+	// parent-tag offset of the list
+	uint32_t tail_off;
+	uint32_t count;
+	// slots not empty, including deleted ones
+	uint32_t used;
+	uint32_t mask;
+	uint32_t *slots;
+	// sorted slot values of kids being folders, so offsets of their kids lists can be updated without walking files
+	uint32_t *dirs;
+	uint32_t dir_count;
+	uint32_t dir_capacity;
+	// slot values of all kids in list order (i.e. by name), for binary search in sorted mode only
+	uint32_t *kids;
+	uint32_t kid_count;
+	uint32_t kid_capacity;
+} dir_hash;
+
+// delta bytes were inserted at (or removed from) off by a change of generation
+typedef struct __fs_shift__
+{
+	uint32_t generation;
+	uint32_t off;
+	int delta;
+} fs_shift;
+
+// shifts kept for cursors
+#define FS_SHIFT_LOG_SIZE 4096
+
+// extensions longer than this are not indexed
+#define EXT_MAX_LEN 15
+
+typedef struct __ext_list__
+{
+	// case-folded, without the dot
+	char ext[EXT_MAX_LEN + 1];
+	// sorted offsets of the names with the extension
+	uint32_t *offs;
+	uint32_t count;
+	uint32_t capacity;
+	// names being added by a sync, and where the next one goes
+	uint32_t pending;
+	uint32_t fill;
+} ext_list;
+
+// interned names, see fs_intern.c: a name of the dictionary is stored as NAME_REF and 3 bytes of its id
+// (7 bits each, high bits set so that no byte is \0), a name starting with NAME_REF itself gets another one ahead
+#define NAME_REF 1
+#define NAME_REF_SIZE 4
+#define MAX_NAME_REFS (1 << 21)
+
+typedef struct __name_dict__
+{
+	// fs_buf & snapshots sharing the dictionary, which never changes once built
+	uint32_t refs;
+	uint32_t count;
+	// offset of each name in pool by id, names are in id order and each is followed by a file tag,
+	// so that scan kernels run over the pool as over names of a buffer
+	uint32_t *offs;
+	char *pool;
+	uint32_t pool_size;
+	// open addressing table of id + 1 by name hash
+	uint32_t *slots;
+	uint32_t mask;
+} name_dict;
+
+typedef struct __fs_segment__
+{
+	char *data;
+	// case-folded copy of data if fs_buf::seg_fold
+	char *fold;
+	uint32_t used;
+} fs_segment;
+
+struct __fs_buf__
+{
+	char *head;
+	uint32_t capacity;
+	uint32_t tail;
+	uint32_t first_name_off;
+	// optional case-folded copy of head, same offsets, only name bytes are kept in step (tags may be stale)
+	char *fold;
+	// sorted offsets of all parent-tags, see fs_parent.c, 0 if not available
+	uint32_t *list_tails;
+	uint32_t list_tail_count;
+	uint32_t list_tail_capacity;
+	// number of lists in the subtree of each list (itself included) in step with list_tails, 0 if not known yet,
+	// list_spans_known tells if any is known, so that changes have spans to keep in step
+	uint32_t *list_spans;
+	int list_spans_known;
+	// hash index of big kids lists sorted by kids_off, see fs_dirhash.c, dir_hash_min_kids is 0 if not enabled
+	dir_hash *dir_hashes;
+	uint32_t dir_hash_count;
+	uint32_t dir_hash_min_kids;
+	// names behind the header kept in segments, see fs_segment.c, head then holds the header only
+	fs_segment *segs;
+	// logical offset of each segment's first byte
+	uint32_t *seg_starts;
+	uint32_t seg_count;
+	uint32_t seg_capacity;
+	int seg_fold;
+	// segments were enabled on a mapped buffer, they are built by the first change
+	int seg_pending;
+	// head is a private file mapping of mapped_size bytes if not 0, see load_fs_buf_mmap
+	uint32_t mapped_size;
+	// head is an anonymous mapping of huge_size bytes advised for transparent huge pages if not 0, see fs_huge.c
+	uint64_t huge_size;
+	// enable_huge_pages succeeded, a head replaced later is mapped the same way
+	int huge_pages;
+	// append-only journal of changes since the last save, see fs_journal.c, -1 if none
+	int journal_fd;
+	uint32_t journal_size;
+	// the saved fs_buf the journal belongs to
+	char *journal_base;
+	// FS_FORMAT_*
+	int save_format;
+	// dir & parent tags are uint64_t instead of uint32_t, see new_large_fs_buf
+	int large;
+	// kids lists are kept in strcmp order, see fs_sorted.c
+	int sorted;
+	// bumped by each change, a snapshot keeps the generation it was taken of
+	uint32_t generation;
+	// ring of the byte shifts of the latest changes for cursors, see fs_cursor.c,
+	// cursors of generations before shift_floor can not follow the changes since
+	fs_shift *shifts;
+	uint32_t shift_head;
+	uint32_t shift_count;
+	uint32_t shift_floor;
+	// size, mtime & mode of each name in columns, rows sorted by name offset, see fs_meta.c, 0 if not enabled
+	uint32_t *meta_offs;
+	uint64_t *meta_sizes;
+	int64_t *meta_mtimes;
+	uint32_t *meta_modes;
+	uint32_t meta_count;
+	uint32_t meta_capacity;
+	// node id of each name, rows sorted by name offset, & the offset of each id, see fs_node.c, 0 if not enabled
+	uint32_t *node_offs;
+	uint32_t *node_ids;
+	uint32_t node_count;
+	uint32_t node_capacity;
+	uint32_t *id_offs;
+	uint32_t id_capacity;
+	uint32_t next_node_id;
+	// posting lists of names by extension sorted by extension, see fs_ext.c, 0 if not enabled
+	ext_list *ext_lists;
+	uint32_t ext_count;
+	uint32_t ext_capacity;
+	// dictionary of interned names, see fs_intern.c, 0 if not enabled
+	name_dict *names;
+	// the latest snapshot taken (holding a reference), see fs_snapshot.c
+	fs_buf *snapshot;
+	pthread_mutex_t snapshot_lock;
+	// references of a snapshot
+	uint32_t refs;
+	pthread_rwlock_t lock;
+};
+
+// functions below are shared between fs_buf modules, callers must hold fsbuf->lock
+void free_head(fs_buf *fsbuf);
+uint32_t get_aligned_offset(fs_buf *fsbuf, uint32_t off);
+// realloc for head, which moves a mapped head to the heap
+int resize_head(fs_buf *fsbuf, uint32_t size);
+// move head into a huge page mapping of at least size bytes, which keeps head as it is if failed
+int map_huge_head(fs_buf *fsbuf, uint32_t size);
+// resize_head of a huge page mapped head
+int remap_huge_head(fs_buf *fsbuf, uint32_t size);
+// atomic writes a temporary file and renames it over filename
+int do_save_fs_buf(fs_buf *fsbuf, const char *filename, int atomic);
+char *do_get_path_by_name_off(fs_buf *fsbuf, uint32_t name_off, char *path, uint32_t path_size);
+
+int build_parent_index(fs_buf *fsbuf);
+void free_parent_index(fs_buf *fsbuf);
+int copy_parent_index(fs_buf *dst, fs_buf *src);
+// delta bytes were inserted at (or removed from) off, fsbuf->tail must already be updated
+void sync_parent_index(fs_buf *fsbuf, uint32_t off, int delta);
+// tail (parent-tag offset) of the kids list holding off, 0 if none
+uint32_t lookup_list_tail(fs_buf *fsbuf, uint32_t off);
+// end of the kids list at kids_off and of all lists below it, 0 if there is no parent index
+uint32_t lookup_tree_end(fs_buf *fsbuf, uint32_t kids_off);
+
+dir_hash *find_dir_hash(fs_buf *fsbuf, uint32_t kids_off);
+// hash index of the list holding off (or whose tail is off)
+dir_hash *find_dir_hash_holding(fs_buf *fsbuf, uint32_t off);
+// count is a hint of the list size
+int add_dir_hash(fs_buf *fsbuf, uint32_t kids_off, uint32_t tail_off, uint32_t count);
+void free_dir_hashes(fs_buf *fsbuf);
+// return 0 if the list has no hash index, otherwise *name_off is the kid named by path's first component (0 if none)
+int lookup_dir_hash(fs_buf *fsbuf, uint32_t kids_off, const char *path, uint32_t *name_off);
+void sync_dir_hashes(fs_buf *fsbuf, uint32_t off, int delta);
+// (re)build hash indices of the lists with at least dir_hash_min_kids names
+int build_dir_hashes(fs_buf *fsbuf);
+
+void free_meta_index(fs_buf *fsbuf);
+int copy_meta_index(fs_buf *dst, fs_buf *src);
+// rows of inserted names are unknown, the index is dropped if out of memory
+void sync_meta_index(fs_buf *fsbuf, uint32_t off, int delta);
+// 1 if name_off has no row
+int get_meta_row(fs_buf *fsbuf, uint32_t name_off, fs_meta *meta);
+// no-op if name_off has no row
+void set_meta_row(fs_buf *fsbuf, uint32_t name_off, const fs_meta *meta);
+// rows of the names in [start_off, end_off) to be put back at start_off after the same names are moved there,
+// 0 if the index is not enabled (or out of memory)
+fs_meta *copy_meta_rows(fs_buf *fsbuf, uint32_t start_off, uint32_t end_off, uint32_t *count);
+void put_meta_rows(fs_buf *fsbuf, uint32_t start_off, const fs_meta *rows, uint32_t count);
+// lstat of path, 1 if failed
+int stat_meta(const char *path, fs_meta *meta);
+
+void free_node_index(fs_buf *fsbuf);
+int copy_node_index(fs_buf *dst, fs_buf *src);
+// inserted names get new ids, the index is dropped if out of memory
+void sync_node_index(fs_buf *fsbuf, uint32_t off, int delta);
+// 0 if name_off has no row
+uint32_t get_node_row(fs_buf *fsbuf, uint32_t name_off);
+// ids of the names in [start_off, end_off) to be put back like copy_meta_rows
+uint32_t *copy_node_ids(fs_buf *fsbuf, uint32_t start_off, uint32_t end_off, uint32_t *count);
+void put_node_ids(fs_buf *fsbuf, uint32_t start_off, const uint32_t *ids, uint32_t count);
+// offsets of the ids from the rows, after the rows were moved all at once
+void remap_node_index(fs_buf *fsbuf);
+
+// fold of the size bytes of whole entries at src to dst: names are folded one by one, their tags & the ids
+// of interned names are copied as they are
+void fold_entries(fs_buf *fsbuf, char *dst, const char *src, uint32_t size);
+// fold of the whole head, header included
+void fold_head(fs_buf *fsbuf);
+
+// size of name as stored with dict (0 for none), without its \0
+uint32_t stored_name_len(const name_dict *dict, const char *name);
+// store name & its \0 at dst, which has stored_name_len + 1 bytes
+void store_name(const name_dict *dict, char *dst, const char *name);
+void release_name_dict(name_dict *dict);
+uint64_t name_dict_size(const name_dict *dict);
+// a flat copy of fsbuf without interned names, which save writes. only head, tail, first_name_off & large are set
+int expand_names(fs_buf *fsbuf, fs_buf *flat);
+
+void free_ext_index(fs_buf *fsbuf);
+int copy_ext_index(fs_buf *dst, fs_buf *src);
+// the index is dropped if out of memory
+void sync_ext_index(fs_buf *fsbuf, uint32_t off, int delta);
+
+// record a shift of the current generation
+void log_shift(fs_buf *fsbuf, uint32_t off, int delta);
+int copy_shift_log(fs_buf *dst, fs_buf *src);
+void free_shift_log(fs_buf *fsbuf);
+
+// strcmp of name against the first len bytes of p
+static inline int compare_kid_name(const char *name, const char *p, uint32_t len)
+{
+	int r = strncmp(name, p, len);
+	return r != 0 ? r : (unsigned char)name[len];
+}
+// 1 if the names of each kids list are in strcmp order
+int kids_sorted(fs_buf *fsbuf);
+// the first kid of the sorted list at list_off not less than the len bytes of name, or the list's parent-tag.
+// *found tells if it is name. *count (if not 0) is set to the number of kids in a list without hash index
+uint32_t find_sorted_kid(fs_buf *fsbuf, uint32_t list_off, const char *name, uint32_t len, int *found, uint32_t *count);
+
+char *seg_ptr(fs_buf *fsbuf, uint32_t off);
+char *seg_wptr(fs_buf *fsbuf, uint32_t off);
+// address of the byte at off, which is valid until the next change of the buffer
+static inline char *fs_ptr(fs_buf *fsbuf, uint32_t off)
+{
+	return fsbuf->segs == 0 || off < fsbuf->first_name_off ? fsbuf->head + off : seg_ptr(fsbuf, off);
+}
+
+static inline uint32_t name_ref_id(const char *p)
+{
+	return (p[1] & 0x7f) | (p[2] & 0x7f) << 7 | (uint32_t)(p[3] & 0x7f) << 14;
+}
+
+// the name stored at p (fs_ptr of a name offset, or the same offset in a folded copy)
+static inline const char *entry_name(fs_buf *fsbuf, const char *p)
+{
+	if (*p != NAME_REF || fsbuf->names == 0)
+		return p;
+	return p[1] == NAME_REF ? p + 1 : fsbuf->names->pool + fsbuf->names->offs[name_ref_id(p)];
+}
+
+// fs_ptr of an entry to be changed in place, its segment is copied first if shared with a snapshot
+static inline char *fs_wptr(fs_buf *fsbuf, uint32_t off)
+{
+	return fsbuf->segs == 0 || off < fsbuf->first_name_off ? fsbuf->head + off : seg_wptr(fsbuf, off);
+}
+
+static inline uint32_t dir_tag_size(fs_buf *fsbuf)
+{
+	return fsbuf->large ? sizeof(uint64_t) : sizeof(uint32_t);
+}
+
+static inline uint32_t max_fsbuf_size(fs_buf *fsbuf)
+{
+	return fsbuf->large ? MAX_LARGE_FSBUF_SIZE : MAX_FSBUF_SIZE;
+}
+
+// relative offset held by the dir or parent tag at p
+static inline uint32_t get_tag_reloff(fs_buf *fsbuf, const char *p)
+{
+	uint64_t tag = 0;
+	// little endian, the low bytes of a large tag are read as a compact one
+	memcpy(&tag, p, dir_tag_size(fsbuf));
+	return tag >> FS_TAG_BITS;
+}
+
+static inline void set_dir_tag(fs_buf *fsbuf, char *p, uint32_t rel_off)
+{
+	uint64_t tag = ((uint64_t)rel_off << FS_TAG_BITS) + FS_TAG_DIR;
+	memcpy(p, &tag, dir_tag_size(fsbuf));
+}
+
+// segments are changed in whole entries, see fs_segment.c
+void free_segments(fs_buf *fsbuf);
+uint32_t seg_index(fs_buf *fsbuf, uint32_t off);
+// offsets behind the segment's bytes which may still be read (but hold garbage)
+uint32_t seg_readable_end(fs_buf *fsbuf, uint32_t i);
+uint64_t seg_allocated(fs_buf *fsbuf);
+// room made at off lies inside one segment
+int seg_make_room(fs_buf *fsbuf, uint32_t off, uint32_t size);
+int seg_insert_block(fs_buf *fsbuf, uint32_t off, const char *block, uint32_t size);
+void seg_remove(fs_buf *fsbuf, uint32_t off, uint32_t size);
+void seg_copy_out(fs_buf *fsbuf, uint32_t off, uint32_t size, char *dst);
+void seg_fold_range(fs_buf *fsbuf, uint32_t off, uint32_t size);
+int seg_enable_fold(fs_buf *fsbuf);
+// move the names of a flat buffer into segments
+int seg_convert(fs_buf *fsbuf);
+// dst gets the segments of src, shared until one of them changes
+int share_segments(fs_buf *dst, fs_buf *src);
+
+// LFT v2 body behind the magic & size read by load, head & tail must be set
+int read_lft2(fs_buf *fsbuf, int fd);
+int write_lft2(fs_buf *fsbuf, int fd);
+
+// apply the journal of the saved fs_buf filename, called by load before fsbuf is shared
+int replay_journal(fs_buf *fsbuf, const char *filename);
+// append the ops of a call to the journal if any succeeded (result 0)
+void journal_ops(fs_buf *fsbuf, const fs_op *ops, uint32_t count);
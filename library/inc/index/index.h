@@ -21,22 +21,32 @@ typedef struct __index_keyword__ {
 	uint32_t empty:4;
 } index_keyword;
 
-typedef struct __index_hash__ {
-	index_keyword* keywords;
-	uint32_t len:28;
-	uint32_t empty:4;
-} index_hash;
-
 #pragma pack(pop)
 
+// occupancy of the keyword table of an index kept in memory
+typedef struct __index_table_stats__ {
+	uint32_t slots;
+	uint32_t keywords;
+	// probe length is how far a keyword is from its home slot
+	uint32_t max_probe;
+	uint64_t total_probe;
+} index_table_stats;
+
 typedef struct __fs_index__ fs_index;
 
 void free_index_keyword(index_keyword* inkw, int free_all);
 void get_stats(fs_index* fsi, uint64_t *memory, uint32_t* keywords, uint32_t* fsbuf_offsets);
+// 1 if the index has no keyword table
+int get_table_stats(fs_index* fsi, index_table_stats* stats);
 
 int load_fs_index(fs_index** pfsi, const char* filename, int load_policy);
 int get_load_policy(fs_index* fsi);
 void free_fs_index(fs_index* fsi);
 index_keyword* get_index_keyword(fs_index* fsi, const char* query_utf8);
+// longer queries have to be cut to this many characters (and their results checked), 0 if any length is answered
+uint32_t get_query_limit(fs_index* fsi);
+// names containing all count queries, which are cut to get_query_limit characters as well. the result is always
+// freed by the caller with free_index_keyword(inkw, 1)
+index_keyword* get_index_keywords(fs_index* fsi, const char* queries_utf8[], uint32_t count);
 void add_index(fs_index* fsi, char* name, uint32_t fsbuf_offset);
 void add_fsbuf_offsets(fs_index* fsi, uint32_t start_off, int delta);
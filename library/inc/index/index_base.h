@@ -8,16 +8,30 @@ typedef void (*free_fs_index_fn)(fs_index*);
 typedef index_keyword* (*get_index_keyword_fn)(fs_index*, const char*);
 typedef void (*add_index_fn)(fs_index*, const char*, uint32_t);
 typedef void (*add_fsbuf_offsets_fn)(fs_index*, uint32_t, int);
+typedef void (*add_name_fn)(fs_index*, const char*, uint32_t);
+typedef index_keyword* (*get_index_keywords_fn)(fs_index*, const char*[], uint32_t);
+typedef int (*get_table_stats_fn)(fs_index*, index_table_stats*);
 
 struct __fs_index__ {
 	uint32_t count;
+	// longest query in characters get_index_keyword answers, 0 for any length
+	uint32_t query_limit;
 	get_statistics_fn get_statistics;
 	get_load_policy_fn get_load_policy;
 	get_index_keyword_fn get_index_keyword;
 	add_index_fn add_index;
 	add_fsbuf_offsets_fn add_fsbuf_offsets;
 	free_fs_index_fn free_fs_index;
+	// 0 if add_index splits names into keywords of up to MAX_KW_LEN characters for add_index_fn
+	add_name_fn add_name;
+	// 0 if get_index_keywords intersects the results of get_index_keyword
+	get_index_keywords_fn get_index_keywords;
+	// 0 if the index has no keyword table
+	get_table_stats_fn get_table_stats;
 };
 
 int load_index_keyword(int fd, index_keyword* inkw, int load_policy, const char* query);
 uint64_t save_index_keyword(int fd, index_keyword* inkw);
+index_keyword* new_query_keyword(const char* queries[], uint32_t count, uint32_t* offsets, uint32_t len);
+int open_index_file(const char* filename, const char* magic, uint32_t* count);
+int load_index_file(fs_index** pfsi, int fd, uint32_t count, int load_policy);
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "fs_buf.h"
+#include "index.h"
+
+// names are split into 3-byte grams instead of all their keywords up to MAX_KW_LEN characters: the index is
+// smaller & faster to build, and get_index_keyword answers queries of any length. the posting list of each gram
+// is compressed in memory, get_index_keywords intersects those of all queries at once. results are checked
+// against the names of fsbuf (unchecked candidates if 0, and queries shorter than 3 bytes find nothing then).
+// if fsbuf has node ids (see enable_node_ids) when the index is made or loaded in memory, the lists keep ids:
+// changes of fsbuf need no add_fsbuf_offsets, only add_index of the names inserted
+typedef struct __fs_trigram_index__ fs_trigram_index;
+
+fs_trigram_index* new_trigram_index(uint32_t count, fs_buf* fsbuf);
+// gives back the room the posting lists keep for adds, e.g. when all names are added
+void shrink_trigram_index(fs_trigram_index* tgi);
+int save_trigram_index(fs_trigram_index* tgi, const char* filename);
+// 2 if filename is not a trigram index, e.g. one of save_allmem_index for load_fs_index
+int load_trigram_index(fs_index** pfsi, const char* filename, int load_policy, fs_buf* fsbuf);
@@ -7,7 +7,12 @@ typedef struct __attribute__((__packed__)) __inkw_count_off__ {
 	uint64_t off;
 } inkw_count_off;
 
+// buckets of the index files, kept for files already saved
 uint32_t hash(const char* name);
+// hash of the keyword tables in memory
+uint32_t hash_keyword(const char* s, uint32_t len);
 inkw_count_off* load_inkw_count_offs(int fd, uint32_t count);
 uint32_t get_insert_pos(uint32_t value, uint32_t* sorted, uint32_t size, int favor_big);
+// adds delta to the offsets no less than start_off, a negative delta drops those in [start_off, start_off - delta)
+// of the names removed. returns how many were moved
 uint32_t add_inkw_fsbuf_offsets(index_keyword* inkw, uint32_t start_off, int delta);
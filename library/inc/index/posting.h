@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+// sorted fs_buf offsets compressed in blocks: each block keeps its first offset & length in a header, followed by
+// varint deltas of the others. headers are hopped over as skip pointers, so intersections and shifts only decode
+// the blocks they have to
+typedef struct __posting_list__ posting_list;
+
+// the list with value added (0 if out of memory, pl is kept then), pl may be 0 for a new list
+posting_list* posting_add(posting_list* pl, uint32_t value);
+// adds delta to the offsets no less than start, a negative delta drops those in [start, start - delta) of the names
+// removed (the list may be left empty). returns the list as posting_add does
+posting_list* posting_shift(posting_list* pl, uint32_t start, int delta);
+// gives back the room kept for adds
+posting_list* posting_shrink(posting_list* pl);
+uint32_t posting_count(posting_list* pl);
+uint64_t posting_memory(posting_list* pl);
+// out takes posting_count offsets
+uint32_t posting_decode(posting_list* pl, uint32_t* out);
+
+// both keep the offsets of sorted a also found in the other list at the head of a, and return their count
+uint32_t posting_intersect(posting_list* pl, uint32_t* a, uint32_t na);
+uint32_t intersect_offsets(uint32_t* a, uint32_t na, const uint32_t* b, uint32_t nb);
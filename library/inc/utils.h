@@ -20,5 +20,18 @@
 int utf8_to_wchar_t(char* input, wchar_t* output, size_t output_bytes);
 int wchar_t_to_utf8(const wchar_t* input, char* output, size_t output_bytes);
 
+// bytes of the utf8 character at s (of size bytes at most) with its code point in *cp, 0 if invalid
+uint32_t utf8_decode(const char* s, uint32_t size, uint32_t* cp);
+// bytes of cp written to out (4 at most), 0 if cp is not a character
+uint32_t utf8_encode(uint32_t cp, char* out);
+// characters in size bytes of utf8 (bytes other than continuation ones)
+uint32_t utf8_count(const char* s, uint32_t size);
+// bytes of the first chars characters of s, strlen(s) if it is shorter
+uint32_t utf8_prefix(const char* s, uint32_t chars);
+// simple case folding of cp to a character of the same utf8 length
+uint32_t fold_char(uint32_t cp);
+// case-folding used by the fold buffer, keeps the length (and \0s) of src
+void fold_bytes(char *dst, const char *src, uint32_t size);
+
 int read_file(int fd, char* head, uint32_t size);
 int write_file(int fd, char* head, uint32_t size);
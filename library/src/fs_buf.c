@@ -7,37 +7,59 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <regex.h>
+#include <limits.h>
+#include <sys/mman.h>
 
 #include "fs_buf.h"
+#include "fs_buf_base.h"
 #include "utils.h"
 
-#define DATA_START 8
-#define FS_NEW_BLK_SIZE (1 << 20)
-
-// fs-tags below are all for little endian archs, such as x86/loongson
-
-#define FS_TAG_BITS 2
-#define FS_TAG_MASK ((1 << FS_TAG_BITS) - 1)
-#define MAX_FSBUF_SIZE (1 << (8 * sizeof(uint32_t) - FS_TAG_BITS))
+// Linear File Tree
+static const char fsbuf_magic[] = "LFT";
+// front-coded & compressed, see fs_compress.c
+static const char fsbuf_magic_v2[] = "LFT2";
+// the same formats of large buffers
+static const char fsbuf_magic_large[] = "LFTL";
+static const char fsbuf_magic_large_v2[] = "LFL2";
 
-#define FS_TAG_FILE 0
-#define FS_TAG_DIR 1
+void free_head(fs_buf *fsbuf)
+{
+	if (fsbuf->huge_size)
+		munmap(fsbuf->head, fsbuf->huge_size);
+	else if (fsbuf->mapped_size)
+		munmap(fsbuf->head, fsbuf->mapped_size);
+	else
+		free(fsbuf->head);
+}
 
-struct __fs_buf__
+int resize_head(fs_buf *fsbuf, uint32_t size)
 {
-	char *head;
-	uint32_t capacity;
-	uint32_t tail;
-	uint32_t first_name_off;
-	pthread_rwlock_t lock;
-};
+	if (fsbuf->huge_size)
+		return remap_huge_head(fsbuf, size);
 
-// Linear File Tree
-static const char fsbuf_magic[] = "LFT";
+	if (fsbuf->mapped_size == 0)
+	{
+		char *p = realloc(fsbuf->head, size);
+		if (p == 0)
+			return ERR_NO_MEM;
+		fsbuf->head = p;
+		return 0;
+	}
 
-__attribute__((visibility("default"))) fs_buf *new_fs_buf(uint32_t capacity, const char *root_path)
+	// a mapping can not grow in place, its pages move to the heap
+	char *p = malloc(size);
+	if (p == 0)
+		return ERR_NO_MEM;
+	memcpy(p, fsbuf->head, size < fsbuf->tail ? size : fsbuf->tail);
+	munmap(fsbuf->head, fsbuf->mapped_size);
+	fsbuf->head = p;
+	fsbuf->mapped_size = 0;
+	return 0;
+}
+
+static fs_buf *create_fs_buf(uint32_t capacity, const char *root_path, int large)
 {
-	if (capacity > MAX_FSBUF_SIZE || root_path == 0)
+	if (capacity > (large ? MAX_LARGE_FSBUF_SIZE : MAX_FSBUF_SIZE) || root_path == 0)
 		return 0;
 
 	if (strlen(root_path) + FS_NEW_BLK_SIZE > capacity)
@@ -68,24 +90,127 @@ __attribute__((visibility("default"))) fs_buf *new_fs_buf(uint32_t capacity, con
 	// first DATA_START bytes left for serialization magic & size
 	strcpy(fsbuf->head + DATA_START, root_path);
 	fsbuf->first_name_off = fsbuf->tail = DATA_START + strlen(root_path) + 1;
+	fsbuf->fold = 0;
+	fsbuf->dir_hashes = 0;
+	fsbuf->dir_hash_count = fsbuf->dir_hash_min_kids = 0;
+	fsbuf->list_tails = fsbuf->list_spans = 0;
+	fsbuf->list_spans_known = 0;
+	fsbuf->meta_offs = 0;
+	fsbuf->meta_sizes = 0;
+	fsbuf->meta_mtimes = 0;
+	fsbuf->meta_modes = 0;
+	fsbuf->meta_count = fsbuf->meta_capacity = 0;
+	fsbuf->node_offs = fsbuf->node_ids = fsbuf->id_offs = 0;
+	fsbuf->node_count = fsbuf->node_capacity = 0;
+	fsbuf->id_capacity = fsbuf->next_node_id = 0;
+	fsbuf->ext_lists = 0;
+	fsbuf->ext_count = fsbuf->ext_capacity = 0;
+	fsbuf->names = 0;
+	fsbuf->segs = 0;
+	fsbuf->seg_starts = 0;
+	fsbuf->seg_count = fsbuf->seg_capacity = 0;
+	fsbuf->seg_fold = fsbuf->seg_pending = 0;
+	fsbuf->mapped_size = 0;
+	fsbuf->huge_size = 0;
+	fsbuf->huge_pages = 0;
+	fsbuf->journal_fd = -1;
+	fsbuf->journal_size = 0;
+	fsbuf->journal_base = 0;
+	fsbuf->save_format = FS_FORMAT_LFT;
+	fsbuf->large = large;
+	fsbuf->sorted = 0;
+	fsbuf->generation = 0;
+	fsbuf->shifts = 0;
+	fsbuf->shift_head = fsbuf->shift_count = fsbuf->shift_floor = 0;
+	fsbuf->snapshot = 0;
+	fsbuf->refs = 0;
+	pthread_mutex_init(&fsbuf->snapshot_lock, 0);
+	// without parent index paths are built by walking names
+	build_parent_index(fsbuf);
 	return fsbuf;
 }
 
+__attribute__((visibility("default"))) fs_buf *new_fs_buf(uint32_t capacity, const char *root_path)
+{
+	return create_fs_buf(capacity, root_path, 0);
+}
+
+__attribute__((visibility("default"))) fs_buf *new_large_fs_buf(uint32_t capacity, const char *root_path)
+{
+	return create_fs_buf(capacity, root_path, 1);
+}
+
+__attribute__((visibility("default"))) int is_large_fs_buf(fs_buf *fsbuf)
+{
+	return fsbuf->large;
+}
+
 __attribute__((visibility("default"))) void free_fs_buf(fs_buf *fsbuf)
 {
 	if (0 == fsbuf)
 		return;
 
 	if (fsbuf->head)
-		free(fsbuf->head);
-
+		free_head(fsbuf);
+
+	if (fsbuf->fold)
+		free(fsbuf->fold);
+
+	free_parent_index(fsbuf);
+	free_dir_hashes(fsbuf);
+	free_meta_index(fsbuf);
+	free_node_index(fsbuf);
+	free_ext_index(fsbuf);
+	release_name_dict(fsbuf->names);
+	free_segments(fsbuf);
+	free_shift_log(fsbuf);
+	close_fs_journal(fsbuf);
+	// readers still holding the snapshot free it by their release
+	if (fsbuf->snapshot)
+		release_fs_snapshot(fsbuf->snapshot);
+	pthread_mutex_destroy(&fsbuf->snapshot_lock);
 	pthread_rwlock_destroy(&fsbuf->lock);
 	free(fsbuf);
 }
 
 __attribute__((visibility("default"))) uint32_t get_capacity(fs_buf *fsbuf)
 {
-	return fsbuf->capacity;
+	uint64_t capacity = fsbuf->capacity + name_dict_size(fsbuf->names);
+	if (fsbuf->segs)
+		capacity += seg_allocated(fsbuf);
+	return capacity > UINT32_MAX ? UINT32_MAX : capacity;
+}
+
+__attribute__((visibility("default"))) void get_fs_buf_usage(fs_buf *fsbuf, fs_buf_usage *usage)
+{
+	pthread_rwlock_rdlock(&fsbuf->lock);
+	int folded = fsbuf->fold != 0 || fsbuf->seg_fold;
+	usage->reserved = fsbuf->huge_size ? fsbuf->huge_size : fsbuf->capacity;
+	usage->huge = fsbuf->huge_size;
+	if (fsbuf->fold)
+		usage->reserved += fsbuf->capacity;
+	if (fsbuf->segs)
+		usage->reserved += seg_allocated(fsbuf);
+	usage->used = (uint64_t)fsbuf->tail * (folded ? 2 : 1);
+	usage->reserved += name_dict_size(fsbuf->names);
+	usage->used += name_dict_size(fsbuf->names);
+	pthread_rwlock_unlock(&fsbuf->lock);
+}
+
+__attribute__((visibility("default"))) void shrink_fs_buf(fs_buf *fsbuf)
+{
+	pthread_rwlock_wrlock(&fsbuf->lock);
+	// a mapped head is backed by its file, segments keep their own slack
+	if (fsbuf->mapped_size == 0 && fsbuf->segs == 0 && fsbuf->tail < fsbuf->capacity &&
+		resize_head(fsbuf, fsbuf->tail) == 0)
+	{
+		fsbuf->capacity = fsbuf->tail;
+		// a bigger fold than capacity does no harm if it can not shrink
+		char *p = fsbuf->fold ? realloc(fsbuf->fold, fsbuf->tail) : 0;
+		if (p)
+			fsbuf->fold = p;
+	}
+	pthread_rwlock_unlock(&fsbuf->lock);
 }
 
 __attribute__((visibility("default"))) const char *get_root_path(fs_buf *fsbuf)
@@ -105,73 +230,235 @@ __attribute__((visibility("default"))) uint32_t first_name(fs_buf *fsbuf)
 
 __attribute__((visibility("default"))) char *get_name(fs_buf *fsbuf, uint32_t name_off)
 {
-	return fsbuf->head + name_off;
+	return (char *)entry_name(fsbuf, fs_ptr(fsbuf, name_off));
+}
+
+// called by writers before the first change
+static void prepare_change(fs_buf *fsbuf)
+{
+	fsbuf->generation++;
+	// segments asked for while the buffer was mapped, the copy is made now that pages are to be changed anyway
+	if (fsbuf->seg_pending)
+		seg_convert(fsbuf);
 }
 
 static int add_capacity(fs_buf *fsbuf, uint32_t size)
 {
-	uint32_t alloc_size = size / FS_NEW_BLK_SIZE;
-	alloc_size = alloc_size * FS_NEW_BLK_SIZE;
-	if (alloc_size < size)
-		alloc_size += FS_NEW_BLK_SIZE;
-	if (fsbuf->capacity + alloc_size > MAX_FSBUF_SIZE)
-		return 1;
+	// grow by an eighth at least, so that a build reallocs a few dozen times instead of once per block
+	uint32_t alloc_size = size > fsbuf->capacity / 8 ? size : fsbuf->capacity / 8;
+	alloc_size = (alloc_size + FS_NEW_BLK_SIZE - 1) / FS_NEW_BLK_SIZE * FS_NEW_BLK_SIZE;
+	if ((uint64_t)fsbuf->capacity + alloc_size > max_fsbuf_size(fsbuf))
+	{
+		// the last step up to the limit
+		if ((uint64_t)fsbuf->capacity + size > max_fsbuf_size(fsbuf))
+			return ERR_NO_MEM;
+		alloc_size = max_fsbuf_size(fsbuf) - fsbuf->capacity;
+	}
 
-	char *p = realloc(fsbuf->head, fsbuf->capacity + alloc_size);
-	if (p == 0) // TODO alert here
-		return 1;
+	// the fold grows first: if head can not follow, a fold bigger than capacity does no harm, while a head
+	// bigger than its fold would let names be inserted behind the end of the fold
+	if (fsbuf->fold)
+	{
+		char *p = realloc(fsbuf->fold, fsbuf->capacity + alloc_size);
+		if (p == 0)
+			return ERR_NO_MEM;
+		fsbuf->fold = p;
+	}
+
+	int r = resize_head(fsbuf, fsbuf->capacity + alloc_size);
+	if (r != 0)
+		return r;
 
-	fsbuf->head = p;
 	fsbuf->capacity += alloc_size;
 	return 0;
 }
 
+void fold_entries(fs_buf *fsbuf, char *dst, const char *src, uint32_t size)
+{
+	for (uint32_t i = 0; i < size;)
+	{
+		const char *p = src + i;
+		uint32_t len = strlen(p), n = len + 1 + (p[len + 1] == FS_TAG_FILE ? 1 : dir_tag_size(fsbuf));
+		// id bytes of an interned name may look like utf8 letters
+		if (fsbuf->names && p[0] == NAME_REF && p[1] != NAME_REF)
+			len = 0;
+		fold_bytes(dst + i, p, len);
+		memcpy(dst + i + len, p + len, n - len);
+		i += n;
+	}
+}
+
+void fold_head(fs_buf *fsbuf)
+{
+	memcpy(fsbuf->fold, fsbuf->head, fsbuf->first_name_off);
+	fold_entries(fsbuf, fsbuf->fold + fsbuf->first_name_off, fsbuf->head + fsbuf->first_name_off,
+				 fsbuf->tail - fsbuf->first_name_off);
+}
+
+// keep optional copies of head in step after delta bytes were inserted at (or removed from) off,
+// fsbuf->tail must already be updated
+static void sync_sidecars(fs_buf *fsbuf, uint32_t off, int delta)
+{
+	log_shift(fsbuf, off, delta);
+	sync_parent_index(fsbuf, off, delta);
+	sync_dir_hashes(fsbuf, off, delta);
+	sync_meta_index(fsbuf, off, delta);
+	sync_node_index(fsbuf, off, delta);
+	sync_ext_index(fsbuf, off, delta);
+
+	// segments move their folded bytes along with the names
+	if (fsbuf->seg_fold && delta > 0)
+		seg_fold_range(fsbuf, off, delta);
+
+	if (fsbuf->fold)
+	{
+		if (delta > 0)
+		{
+			if (fsbuf->tail > off + delta)
+				memmove(fsbuf->fold + off + delta, fsbuf->fold + off, fsbuf->tail - off - delta);
+			fold_entries(fsbuf, fsbuf->fold + off, fsbuf->head + off, delta);
+		}
+		else if (fsbuf->tail > off)
+		{
+			memmove(fsbuf->fold + off, fsbuf->fold + off - delta, fsbuf->tail - off);
+		}
+	}
+}
+
+__attribute__((visibility("default"))) int enable_fold_names(fs_buf *fsbuf)
+{
+	pthread_rwlock_wrlock(&fsbuf->lock);
+	// snapshots taken from now on carry the fold
+	fsbuf->generation++;
+	if (fsbuf->segs)
+	{
+		int r = seg_enable_fold(fsbuf);
+		pthread_rwlock_unlock(&fsbuf->lock);
+		return r;
+	}
+
+	if (fsbuf->fold == 0)
+	{
+		fsbuf->fold = malloc(fsbuf->capacity);
+		if (fsbuf->fold == 0)
+		{
+			pthread_rwlock_unlock(&fsbuf->lock);
+			return ERR_NO_MEM;
+		}
+		fold_head(fsbuf);
+	}
+	pthread_rwlock_unlock(&fsbuf->lock);
+	return 0;
+}
+
+__attribute__((visibility("default"))) int has_fold_names(fs_buf *fsbuf)
+{
+	return fsbuf->fold != 0 || fsbuf->seg_fold;
+}
+
+__attribute__((visibility("default"))) void set_save_format(fs_buf *fsbuf, int format)
+{
+	pthread_rwlock_wrlock(&fsbuf->lock);
+	fsbuf->save_format = format == FS_FORMAT_LFT2 ? FS_FORMAT_LFT2 : FS_FORMAT_LFT;
+	pthread_rwlock_unlock(&fsbuf->lock);
+}
+
+__attribute__((visibility("default"))) int get_save_format(fs_buf *fsbuf)
+{
+	return fsbuf->save_format;
+}
+
+// make room for size bytes at off (a name offset), the caller fills them and updates tail
+static int make_room(fs_buf *fsbuf, uint32_t off, uint32_t size)
+{
+	if (fsbuf->segs)
+		return fsbuf->tail + size >= max_fsbuf_size(fsbuf) ? ERR_NO_MEM : seg_make_room(fsbuf, off, size);
+
+	if (size + fsbuf->tail >= fsbuf->capacity)
+	{
+		int r = add_capacity(fsbuf, size);
+		if (r != 0)
+			return r;
+	}
+
+	if (fsbuf->tail > off)
+		memmove(fsbuf->head + off + size, fsbuf->head + off, fsbuf->tail - off);
+	return 0;
+}
+
+// insert whole entries in block at off, the caller updates tail
+static int insert_bytes(fs_buf *fsbuf, uint32_t off, const char *block, uint32_t size)
+{
+	if (fsbuf->segs)
+		return fsbuf->tail + size >= max_fsbuf_size(fsbuf) ? ERR_NO_MEM : seg_insert_block(fsbuf, off, block, size);
+
+	if (make_room(fsbuf, off, size) != 0)
+		return ERR_NO_MEM;
+	memcpy(fsbuf->head + off, block, size);
+	return 0;
+}
+
+// remove whole entries in [off, off + size), the caller updates tail
+static void remove_bytes(fs_buf *fsbuf, uint32_t off, uint32_t size)
+{
+	if (fsbuf->segs)
+		seg_remove(fsbuf, off, size);
+	else if (off + size < fsbuf->tail)
+		memmove(fsbuf->head + off, fsbuf->head + off + size, fsbuf->tail - off - size);
+}
+
+static void copy_bytes(fs_buf *fsbuf, uint32_t off, uint32_t size, char *dst)
+{
+	if (fsbuf->segs)
+		seg_copy_out(fsbuf, off, size, dst);
+	else
+		memcpy(dst, fsbuf->head + off, size);
+}
+
 static void set_parent_offset(fs_buf *fsbuf, uint32_t name_off, uint32_t parent_off)
 {
 	// set empty string
-	*(fsbuf->head + name_off) = 0;
+	char *p = fs_wptr(fsbuf, name_off);
+	*p = 0;
 	// set parent tag
-	uint32_t *tag = (uint32_t *)(fsbuf->head + name_off + 1);
 	// internally we use relative offset w.r.t. to the tag (not the name)
 	// and note that parent is always ahead
 	// 0 means root
 	if (parent_off > 0)
 		parent_off = name_off + 1 - parent_off;
-	*tag = (parent_off << FS_TAG_BITS) + FS_TAG_DIR;
+	set_dir_tag(fsbuf, p + 1, parent_off);
 }
 
 static int insert_new_name(fs_buf *fsbuf, uint32_t off, char *name, int is_dir, int create_parent_tag)
 {
-	uint32_t tag_size = is_dir ? sizeof(uint32_t) : 1;
-	uint32_t extra_size = strlen(name) + 1 + tag_size + (create_parent_tag ? 1 + sizeof(uint32_t) : 0);
+	uint32_t tag_size = is_dir ? dir_tag_size(fsbuf) : 1, name_size = stored_name_len(fsbuf->names, name) + 1;
+	uint32_t extra_size = name_size + tag_size + (create_parent_tag ? 1 + dir_tag_size(fsbuf) : 0);
 
-	if (extra_size + fsbuf->tail >= fsbuf->capacity)
-		if (add_capacity(fsbuf, extra_size) != 0)
-			return ERR_NO_MEM;
+	if (make_room(fsbuf, off, extra_size) != 0)
+		return ERR_NO_MEM;
 
-	if (fsbuf->tail > off)
-		memmove(fsbuf->head + off + extra_size, fsbuf->head + off, fsbuf->tail - off);
-
-	strcpy(fsbuf->head + off, name);
-	off += strlen(name) + 1;
+	uint32_t name_off = off;
+	store_name(fsbuf->names, fs_wptr(fsbuf, off), name);
+	off += name_size;
 
 	if (is_dir)
-	{
-		uint32_t *tag = (uint32_t *)(fsbuf->head + off);
-		*tag = FS_TAG_DIR;
-	}
+		set_dir_tag(fsbuf, fs_wptr(fsbuf, off), 0);
 	else
-	{
-		*(fsbuf->head + off) = FS_TAG_FILE;
-	}
+		*fs_wptr(fsbuf, off) = FS_TAG_FILE;
+
+	// placeholder parent-tag, the real parent is set by caller
+	if (create_parent_tag)
+		set_parent_offset(fsbuf, off + tag_size, 0);
 
 	fsbuf->tail += extra_size;
+	sync_sidecars(fsbuf, name_off, extra_size);
 	return 0;
 }
 
 int append_new_name(fs_buf *fsbuf, char *name, int is_dir)
 {
 	pthread_rwlock_wrlock(&fsbuf->lock);
+	fsbuf->generation++;
 	int r = insert_new_name(fsbuf, fsbuf->tail, name, is_dir, 0);
 	pthread_rwlock_unlock(&fsbuf->lock);
 	return r;
@@ -180,22 +467,25 @@ int append_new_name(fs_buf *fsbuf, char *name, int is_dir)
 int append_parent(fs_buf *fsbuf, uint32_t parent_off)
 {
 	pthread_rwlock_wrlock(&fsbuf->lock);
-	if (sizeof(uint32_t) + 1 + fsbuf->tail >= fsbuf->capacity)
-		if (add_capacity(fsbuf, 1 + sizeof(uint32_t)) != 0)
-		{
-			pthread_rwlock_unlock(&fsbuf->lock);
-			return ERR_NO_MEM;
-		}
+	fsbuf->generation++;
+	uint32_t size = 1 + dir_tag_size(fsbuf);
+	if (make_room(fsbuf, fsbuf->tail, size) != 0)
+	{
+		pthread_rwlock_unlock(&fsbuf->lock);
+		return ERR_NO_MEM;
+	}
 
 	set_parent_offset(fsbuf, fsbuf->tail, parent_off);
-	fsbuf->tail += 1 + sizeof(uint32_t);
+	fsbuf->tail += size;
+	sync_sidecars(fsbuf, fsbuf->tail - size, size);
 	pthread_rwlock_unlock(&fsbuf->lock);
 	return 0;
 }
 
 static int do_is_file(fs_buf *fsbuf, uint32_t name_off)
 {
-	return *(fsbuf->head + name_off + strlen(fsbuf->head + name_off) + 1) == FS_TAG_FILE;
+	const char *name = fs_ptr(fsbuf, name_off);
+	return *(name + strlen(name) + 1) == FS_TAG_FILE;
 }
 
 __attribute__((visibility("default"))) int is_file(fs_buf *fsbuf, uint32_t name_off)
@@ -208,55 +498,71 @@ __attribute__((visibility("default"))) int is_file(fs_buf *fsbuf, uint32_t name_
 
 __attribute__((visibility("default"))) uint32_t next_name(fs_buf *fsbuf, uint32_t name_off)
 {
-	uint32_t tag_off = name_off + strlen(fsbuf->head + name_off) + 1;
-	return *(fsbuf->head + tag_off) == FS_TAG_FILE ? tag_off + 1 : tag_off + sizeof(uint32_t);
+	const char *name = fs_ptr(fsbuf, name_off);
+	uint32_t len = strlen(name);
+	return *(name + len + 1) == FS_TAG_FILE ? name_off + len + 2 : name_off + len + 1 + dir_tag_size(fsbuf);
 }
 
 static void do_set_kids_off(fs_buf *fsbuf, uint32_t name_off, uint32_t kids_off)
 {
 	// we don't check if the name is a dir here
-	uint32_t *tag = (uint32_t *)(fsbuf->head + name_off + strlen(fsbuf->head + name_off) + 1);
+	char *name = fs_wptr(fsbuf, name_off);
+	uint32_t len = strlen(name);
 	// internally we use relative offset w.r.t. to the tag (not the name)
 	// and note that kid is always after parent
 	if (kids_off != 0)
-		kids_off = kids_off - (name_off + strlen(fsbuf->head + name_off) + 1);
-	*tag = (kids_off << FS_TAG_BITS) + FS_TAG_DIR;
+		kids_off = kids_off - (name_off + len + 1);
+	set_dir_tag(fsbuf, name + len + 1, kids_off);
 }
 
 void set_kids_off(fs_buf *fsbuf, uint32_t name_off, uint32_t kids_off)
 {
 	pthread_rwlock_wrlock(&fsbuf->lock);
+	fsbuf->generation++;
 	do_set_kids_off(fsbuf, name_off, kids_off);
 	pthread_rwlock_unlock(&fsbuf->lock);
 }
 
 static uint32_t get_reloff_by_tag(fs_buf *fsbuf, uint32_t tag_off)
 {
-	uint32_t *tag = (uint32_t *)(fsbuf->head + tag_off);
-	return (*tag - (*tag & FS_TAG_MASK)) >> FS_TAG_BITS;
+	return get_tag_reloff(fsbuf, fs_ptr(fsbuf, tag_off));
 }
 
-static char *do_get_path_by_name_off(fs_buf *fsbuf, uint32_t name_off, char *path, uint32_t path_size)
+static uint32_t get_folder_tail_offset(fs_buf *fsbuf, uint32_t name_off)
 {
-	// dst用于存储文件路径，从后往前写入整个文件全路径，-1是为了保证末尾存在'\0'字符
-	char *src = fsbuf->head + name_off, *dst = path + path_size - strlen(src) - 1;
-	strcpy(dst, src);
-	while (1)
+	if (fsbuf->list_tails)
+		return lookup_list_tail(fsbuf, name_off);
+
+	while (name_off < fsbuf->tail)
 	{
-		if (*src != 0)
+		if (*fs_ptr(fsbuf, name_off))
 		{
-			src = fsbuf->head + next_name(fsbuf, src - fsbuf->head);
+			name_off = next_name(fsbuf, name_off);
 			continue;
 		}
 
-		src++;
-		uint32_t rel_off = get_reloff_by_tag(fsbuf, src - fsbuf->head);
+		return name_off;
+	}
+	return 0;
+}
+
+char *do_get_path_by_name_off(fs_buf *fsbuf, uint32_t name_off, char *path, uint32_t path_size)
+{
+	// dst用于存储文件路径，从后往前写入整个文件全路径，-1是为了保证末尾存在'\0'字符
+	const char *src = entry_name(fsbuf, fs_ptr(fsbuf, name_off));
+	char *dst = path + path_size - strlen(src) - 1;
+	strcpy(dst, src);
+	while (1)
+	{
+		uint32_t tail = get_folder_tail_offset(fsbuf, name_off);
+		uint32_t rel_off = get_reloff_by_tag(fsbuf, tail + 1);
 		// we have reached the root
 		if (rel_off == 0)
 			break;
 
-		src = src - rel_off;
-		dbg_msg("name: %s, offset: %'ld\n", src, src - fsbuf->head);
+		name_off = tail + 1 - rel_off;
+		src = entry_name(fsbuf, fs_ptr(fsbuf, name_off));
+		dbg_msg("name: %s, offset: %'u\n", src, name_off);
 		dst--;
 		*dst = '/';
 		dst -= strlen(src);
@@ -276,46 +582,241 @@ __attribute__((visibility("default"))) char *get_path_by_name_off(fs_buf *fsbuf,
 	return dst;
 }
 
-__attribute__((visibility("default"))) int save_fs_buf(fs_buf *fsbuf, const char *filename)
+// folders of the previous path, from root down to the list holding its name
+typedef struct __path_chain__ {
+	const char *path;
+	uint32_t depth;
+	uint32_t tails[PATH_MAX / 2];
+	// length of path's prefix up to the names in tails[i]
+	uint32_t prefix_lens[PATH_MAX / 2];
+} path_chain;
+
+// store the path of name_off to dst, reusing the longest prefix shared with chain, which is then updated.
+// return path length, or 0 if not enough room
+static uint32_t build_path_on_chain(fs_buf *fsbuf, uint32_t name_off, path_chain *chain, char *dst, uint32_t dst_size)
 {
-	int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	uint32_t offs[PATH_MAX / 2], tails[PATH_MAX / 2], count = 0, names_len = 0, prefix_level = 0, prefix_len = 0;
+	const char *prefix = fsbuf->head + DATA_START;
+	// walk up until a folder of the previous path or the root is met
+	while (count < PATH_MAX / 2)
+	{
+		uint32_t tail = get_folder_tail_offset(fsbuf, name_off);
+		offs[count] = name_off;
+		tails[count] = tail;
+		names_len += strlen(entry_name(fsbuf, fs_ptr(fsbuf, name_off))) + 1;
+		count++;
+
+		uint32_t level = chain->depth;
+		while (level > 0 && chain->tails[level - 1] != tail)
+			level--;
+		if (level > 0)
+		{
+			prefix = chain->path;
+			prefix_level = level - 1;
+			prefix_len = chain->prefix_lens[prefix_level];
+			break;
+		}
+
+		uint32_t rel_off = get_reloff_by_tag(fsbuf, tail + 1);
+		if (rel_off == 0)
+		{
+			prefix_len = fsbuf->first_name_off - DATA_START - 1;
+			break;
+		}
+		name_off = tail + 1 - rel_off;
+	}
+
+	if (prefix_len + names_len > dst_size)
+		return 0;
+
+	memcpy(dst, prefix, prefix_len);
+	uint32_t len = prefix_len;
+	for (uint32_t i = count; i > 0; i--)
+	{
+		chain->tails[prefix_level + count - i] = tails[i - 1];
+		chain->prefix_lens[prefix_level + count - i] = len;
+		const char *name = entry_name(fsbuf, fs_ptr(fsbuf, offs[i - 1]));
+		strcpy(dst + len, name);
+		len += strlen(name);
+		if (i > 1)
+			dst[len++] = '/';
+	}
+	chain->depth = prefix_level + count;
+	chain->path = dst;
+	return len;
+}
+
+__attribute__((visibility("default"))) uint32_t get_paths_by_name_offs(fs_buf *fsbuf, const uint32_t *name_offs, uint32_t count, char *buf, uint32_t buf_size, char **paths)
+{
+	path_chain *chain = malloc(sizeof(path_chain));
+	if (chain == 0)
+		return 0;
+	chain->depth = 0;
+
+	uint32_t i = 0, used = 0;
+	pthread_rwlock_rdlock(&fsbuf->lock);
+	for (; i < count; i++)
+	{
+		uint32_t len = build_path_on_chain(fsbuf, name_offs[i], chain, buf + used, buf_size - used);
+		if (len == 0)
+			break;
+
+		paths[i] = buf + used;
+		used += len + 1;
+	}
+	pthread_rwlock_unlock(&fsbuf->lock);
+	free(chain);
+	return i;
+}
+
+int do_save_fs_buf(fs_buf *fsbuf, const char *filename, int atomic)
+{
+	// interned names are saved plain, files do not depend on the dictionary
+	if (fsbuf->names)
+	{
+		fs_buf flat;
+		if (expand_names(fsbuf, &flat) != 0)
+			return 2;
+		flat.save_format = fsbuf->save_format;
+		int r = do_save_fs_buf(&flat, filename, atomic);
+		free(flat.head);
+		return r;
+	}
+
+	char tmp_name[PATH_MAX];
+	int fd;
+	if (atomic)
+	{
+		if (snprintf(tmp_name, sizeof(tmp_name), "%s.XXXXXX", filename) >= (int)sizeof(tmp_name))
+			return 1;
+		fd = mkstemp(tmp_name);
+		if (fd >= 0)
+			fchmod(fd, 0644);
+	}
+	else
+	{
+		fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
 	if (fd < 0)
 		return 1;
 
-	pthread_rwlock_rdlock(&fsbuf->lock);
-	memcpy(fsbuf->head, fsbuf_magic, strlen(fsbuf_magic) + 1);
-	memcpy(fsbuf->head + strlen(fsbuf_magic) + 1, &fsbuf->tail, sizeof(fsbuf->tail));
+	int r;
+	if (fsbuf->save_format == FS_FORMAT_LFT2)
+	{
+		r = write_lft2(fsbuf, fd);
+	}
+	else
+	{
+		memcpy(fsbuf->head, fsbuf->large ? fsbuf_magic_large : fsbuf_magic, sizeof(uint32_t));
+		memcpy(fsbuf->head + sizeof(uint32_t), &fsbuf->tail, sizeof(fsbuf->tail));
 
-	if (write_file(fd, fsbuf->head, fsbuf->tail) != 0)
+		// segments are written one after another, the same as a flat buffer
+		r = fsbuf->segs ? write_file(fd, fsbuf->head, fsbuf->first_name_off) : write_file(fd, fsbuf->head, fsbuf->tail);
+		for (uint32_t i = 0; fsbuf->segs && r == 0 && i < fsbuf->seg_count; i++)
+			r = write_file(fd, fsbuf->segs[i].data, fsbuf->segs[i].used);
+	}
+	close(fd);
+	if (r != 0 || (atomic && rename(tmp_name, filename) != 0))
 	{
-		pthread_rwlock_unlock(&fsbuf->lock);
-		close(fd);
+		if (atomic)
+			unlink(tmp_name);
 		return 2;
 	}
+	return 0;
+}
+
+__attribute__((visibility("default"))) int save_fs_buf(fs_buf *fsbuf, const char *filename)
+{
+	pthread_rwlock_rdlock(&fsbuf->lock);
+	// the journal of filename would be stale once it is rewritten
+	if (fsbuf->journal_fd >= 0 && strcmp(filename, fsbuf->journal_base) == 0)
+	{
+		pthread_rwlock_unlock(&fsbuf->lock);
+		return checkpoint_fs_buf(fsbuf, filename);
+	}
+
+	// a mapped buffer may be backed by filename itself, which must not be truncated under it,
+	// so write to a temporary file and rename it over
+	int r = do_save_fs_buf(fsbuf, filename, fsbuf->mapped_size != 0);
 	pthread_rwlock_unlock(&fsbuf->lock);
+	return r;
+}
 
-	close(fd);
+// check magic & size of a saved fs_buf, 0 or the error code of load_fs_buf
+static int read_header(int fd, uint32_t *size, int *format, int *large)
+{
+	char magic[4];
+	if (read(fd, magic, sizeof(magic)) != sizeof(magic))
+		return 2;
+
+	*large = memcmp(magic, fsbuf_magic_large, sizeof(magic)) == 0 || memcmp(magic, fsbuf_magic_large_v2, sizeof(magic)) == 0;
+	if (memcmp(magic, fsbuf_magic, sizeof(magic)) == 0 || memcmp(magic, fsbuf_magic_large, sizeof(magic)) == 0)
+		*format = FS_FORMAT_LFT;
+	else if (memcmp(magic, fsbuf_magic_v2, sizeof(magic)) == 0 || memcmp(magic, fsbuf_magic_large_v2, sizeof(magic)) == 0)
+		*format = FS_FORMAT_LFT2;
+	else
+		return 2;
+
+	if (read(fd, size, sizeof(*size)) != sizeof(*size) || *size < sizeof(uint32_t) * 2 + 5)
+		return 3;
+	if (*size > (*large ? MAX_LARGE_FSBUF_SIZE : MAX_FSBUF_SIZE))
+		return 3;
 	return 0;
 }
 
+// fields other than head & capacity of a fs_buf holding size loaded bytes
+static void init_loaded_fs_buf(fs_buf *fsbuf, uint32_t size)
+{
+	fsbuf->tail = size;
+	fsbuf->fold = 0;
+	fsbuf->first_name_off = DATA_START + strlen(fsbuf->head + DATA_START) + 1;
+	fsbuf->dir_hashes = 0;
+	fsbuf->dir_hash_count = fsbuf->dir_hash_min_kids = 0;
+	fsbuf->list_tails = fsbuf->list_spans = 0;
+	fsbuf->list_spans_known = 0;
+	fsbuf->meta_offs = 0;
+	fsbuf->meta_sizes = 0;
+	fsbuf->meta_mtimes = 0;
+	fsbuf->meta_modes = 0;
+	fsbuf->meta_count = fsbuf->meta_capacity = 0;
+	fsbuf->node_offs = fsbuf->node_ids = fsbuf->id_offs = 0;
+	fsbuf->node_count = fsbuf->node_capacity = 0;
+	fsbuf->id_capacity = fsbuf->next_node_id = 0;
+	fsbuf->ext_lists = 0;
+	fsbuf->ext_count = fsbuf->ext_capacity = 0;
+	fsbuf->names = 0;
+	fsbuf->segs = 0;
+	fsbuf->seg_starts = 0;
+	fsbuf->seg_count = fsbuf->seg_capacity = 0;
+	fsbuf->seg_fold = fsbuf->seg_pending = 0;
+	fsbuf->huge_size = 0;
+	fsbuf->huge_pages = 0;
+	fsbuf->journal_fd = -1;
+	fsbuf->journal_size = 0;
+	fsbuf->journal_base = 0;
+	fsbuf->generation = 0;
+	fsbuf->shifts = 0;
+	fsbuf->shift_head = fsbuf->shift_count = fsbuf->shift_floor = 0;
+	fsbuf->snapshot = 0;
+	fsbuf->refs = 0;
+	pthread_mutex_init(&fsbuf->snapshot_lock, 0);
+	// saved in sorted mode, which is then kept by the journal replayed & changes to come
+	fsbuf->sorted = kids_sorted(fsbuf);
+	build_parent_index(fsbuf);
+}
+
 __attribute__((visibility("default"))) int load_fs_buf(fs_buf **pfsbuf, const char *filename)
 {
 	int fd = open(filename, O_RDONLY);
 	if (fd < 0)
 		return 1;
 
-	char magic[4];
-	if (read(fd, magic, sizeof(magic)) != sizeof(magic) || memcmp(magic, fsbuf_magic, sizeof(magic)) != 0)
-	{
-		close(fd);
-		return 2;
-	}
-
 	uint32_t size;
-	if (read(fd, &size, sizeof(size)) != sizeof(size) || size < sizeof(uint32_t) * 2 + 5)
+	int format, large, r = read_header(fd, &size, &format, &large);
+	if (r != 0)
 	{
 		close(fd);
-		return 3;
+		return r;
 	}
 
 	fs_buf *fsbuf = malloc(sizeof(fs_buf));
@@ -343,7 +844,10 @@ __attribute__((visibility("default"))) int load_fs_buf(fs_buf **pfsbuf, const ch
 
 	posix_fadvise(fd, sizeof(uint32_t) * 2, 0, POSIX_FADV_SEQUENTIAL);
 
-	if (read_file(fd, fsbuf->head + sizeof(uint32_t) * 2, size - sizeof(uint32_t) * 2) != 0)
+	// v2 blocks are decompressed straight into head
+	fsbuf->tail = size;
+	fsbuf->large = large;
+	if (format == FS_FORMAT_LFT2 ? read_lft2(fsbuf, fd) != 0 : read_file(fd, fsbuf->head + sizeof(uint32_t) * 2, size - sizeof(uint32_t) * 2) != 0)
 	{
 		free(fsbuf->head);
 		pthread_rwlock_destroy(&fsbuf->lock);
@@ -354,8 +858,85 @@ __attribute__((visibility("default"))) int load_fs_buf(fs_buf **pfsbuf, const ch
 
 	close(fd);
 
-	fsbuf->capacity = fsbuf->tail = size;
-	fsbuf->first_name_off = DATA_START + strlen(fsbuf->head + DATA_START) + 1;
+	fsbuf->capacity = size;
+	fsbuf->mapped_size = 0;
+	init_loaded_fs_buf(fsbuf, size);
+	fsbuf->save_format = format;
+	// changes made after the file was saved
+	replay_journal(fsbuf, filename);
+	*pfsbuf = fsbuf;
+	return 0;
+}
+
+__attribute__((visibility("default"))) int load_fs_buf_mmap(fs_buf **pfsbuf, const char *filename)
+{
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return 1;
+
+	uint32_t size;
+	int format, large, r = read_header(fd, &size, &format, &large);
+	// only raw files can be mapped
+	if (r == 0 && format != FS_FORMAT_LFT)
+	{
+		close(fd);
+		return load_fs_buf(pfsbuf, filename);
+	}
+
+	struct stat st;
+	if (r == 0 && (fstat(fd, &st) != 0 || st.st_size < size))
+		r = 7;
+	if (r != 0)
+	{
+		close(fd);
+		return r;
+	}
+
+	fs_buf *fsbuf = malloc(sizeof(fs_buf));
+	if (fsbuf == 0)
+	{
+		close(fd);
+		return 4;
+	}
+
+	if (pthread_rwlock_init(&fsbuf->lock, 0) != 0)
+	{
+		free(fsbuf);
+		close(fd);
+		return 5;
+	}
+
+	// anonymous room behind the file pages, so that a few inserts do not copy the buffer
+	uint64_t capacity = (uint64_t)size + FS_NEW_BLK_SIZE;
+	if (capacity > (large ? MAX_LARGE_FSBUF_SIZE : MAX_FSBUF_SIZE))
+		capacity = size;
+	char *p = mmap(0, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+	{
+		pthread_rwlock_destroy(&fsbuf->lock);
+		free(fsbuf);
+		close(fd);
+		return 6;
+	}
+
+	if (mmap(p, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+	{
+		munmap(p, capacity);
+		pthread_rwlock_destroy(&fsbuf->lock);
+		free(fsbuf);
+		close(fd);
+		return 7;
+	}
+
+	close(fd);
+
+	fsbuf->head = p;
+	fsbuf->capacity = fsbuf->mapped_size = capacity;
+	fsbuf->large = large;
+	init_loaded_fs_buf(fsbuf, size);
+	fsbuf->save_format = FS_FORMAT_LFT;
+	// changes made after the file was saved
+	replay_journal(fsbuf, filename);
 	*pfsbuf = fsbuf;
 	return 0;
 }
@@ -366,7 +947,7 @@ static uint32_t get_kids_offset(fs_buf *fsbuf, uint32_t name_off)
 	if (do_is_file(fsbuf, name_off))
 		return 0;
 
-	uint32_t tag_off = name_off + strlen(fsbuf->head + name_off) + 1;
+	uint32_t tag_off = name_off + strlen(fs_ptr(fsbuf, name_off)) + 1;
 	uint32_t rel_off = get_reloff_by_tag(fsbuf, tag_off);
 	if (rel_off == 0)
 		return 0;
@@ -388,10 +969,21 @@ static uint32_t do_get_path_offset(fs_buf *fsbuf, const char *path)
 	if (*p == 0)
 		return DATA_START;
 
-	uint32_t offset = fsbuf->first_name_off;
+	uint32_t offset = fsbuf->first_name_off, len = strcspn(p, "/");
+	int list_head = 1;
 	while (offset < fsbuf->tail)
 	{
-		char *name = fsbuf->head + offset;
+		// jump to the kid directly in hashed folders
+		uint32_t kid_off;
+		if (list_head && lookup_dir_hash(fsbuf, offset, p, &kid_off))
+		{
+			if (kid_off == 0)
+				return 0;
+			offset = kid_off;
+		}
+		list_head = 0;
+
+		const char *name = entry_name(fsbuf, fs_ptr(fsbuf, offset));
 		if (*name == 0) // parent-tag met, not found
 			return 0;
 
@@ -405,8 +997,13 @@ static uint32_t do_get_path_offset(fs_buf *fsbuf, const char *path)
 			if (kids_off == 0)
 				return 0;
 			p += name_len + 1;
+			len = strcspn(p, "/");
 			offset = kids_off;
+			list_head = 1;
 		}
+		// the rest of a sorted list is greater
+		else if (fsbuf->sorted && compare_kid_name(name, p, len) > 0)
+			return 0;
 		else
 			offset = next_name(fsbuf, offset);
 	}
@@ -440,10 +1037,15 @@ static uint32_t get_path_offset(fs_buf *fsbuf, const char *path)
 // recursively get last-kids-off
 static uint32_t get_tree_end_offset(fs_buf *fsbuf, uint32_t start_off)
 {
+	// the parent index keeps the number of lists in each subtree
+	uint32_t end_off = lookup_tree_end(fsbuf, start_off);
+	if (end_off)
+		return end_off;
+
 	uint32_t name_off = start_off, last_kids_off = 0;
 	while (name_off < fsbuf->tail)
 	{
-		if (*(fsbuf->head + name_off))
+		if (*fs_ptr(fsbuf, name_off))
 		{
 			uint32_t kids_off = get_kids_offset(fsbuf, name_off);
 			if (kids_off)
@@ -459,12 +1061,38 @@ static uint32_t get_tree_end_offset(fs_buf *fsbuf, uint32_t start_off)
 			continue;
 		}
 
-		return name_off + 1 + sizeof(uint32_t);
+		return name_off + 1 + dir_tag_size(fsbuf);
 	}
 
 	return fsbuf->tail;
 }
 
+// first name (or parent-tag) offset at or behind off, found by descending into the kids lists holding off
+uint32_t get_aligned_offset(fs_buf *fsbuf, uint32_t off)
+{
+	uint32_t list_off = fsbuf->first_name_off;
+	while (1)
+	{
+		uint32_t name_off = list_off, last_kids_off = 0;
+		while (name_off < off && name_off < fsbuf->tail && *fs_ptr(fsbuf, name_off))
+		{
+			uint32_t kids_off = get_kids_offset(fsbuf, name_off);
+			if (kids_off && kids_off <= off && kids_off > last_kids_off)
+				last_kids_off = kids_off;
+			name_off = next_name(fsbuf, name_off);
+		}
+
+		if (name_off >= off || name_off >= fsbuf->tail)
+			return name_off;
+
+		// name_off is the parent-tag of this list and off lies behind it
+		uint32_t list_end = next_name(fsbuf, name_off);
+		if (off <= list_end || last_kids_off == 0)
+			return list_end;
+		list_off = last_kids_off;
+	}
+}
+
 // any silbing folder's kids which(the silbing folder) is after the empty-folder
 // or any ancestor's silbing folder's kids which(the ancestor's silbling folder) is after the ancestor folder
 static uint32_t get_insert_offset(fs_buf *fsbuf, uint32_t empty_folder_off)
@@ -472,7 +1100,7 @@ static uint32_t get_insert_offset(fs_buf *fsbuf, uint32_t empty_folder_off)
 	uint32_t name_off = empty_folder_off, off = name_off;
 	while (off < fsbuf->tail)
 	{
-		if (*(fsbuf->head + off) == 0)
+		if (*fs_ptr(fsbuf, off) == 0)
 		{
 			uint32_t rel_off = get_reloff_by_tag(fsbuf, off + 1);
 			if (rel_off == 0) // root met
@@ -493,21 +1121,6 @@ static uint32_t get_insert_offset(fs_buf *fsbuf, uint32_t empty_folder_off)
 	return fsbuf->tail;
 }
 
-static uint32_t get_folder_tail_offset(fs_buf *fsbuf, uint32_t name_off)
-{
-	while (name_off < fsbuf->tail)
-	{
-		if (*(fsbuf->head + name_off))
-		{
-			name_off = next_name(fsbuf, name_off);
-			continue;
-		}
-
-		return name_off;
-	}
-	return 0;
-}
-
 static uint32_t get_parent_offset(fs_buf *fsbuf, uint32_t name_off)
 {
 	uint32_t tail = get_folder_tail_offset(fsbuf, name_off);
@@ -537,7 +1150,7 @@ static uint32_t get_1st_sibling_offset(fs_buf *fsbuf, uint32_t name_off)
 		if (kids_off)                                                                            \
 		{                                                                                        \
 			dbg_msg("update offset: delta: %'d, kid-off: %'u -> %'u, parent: [%'u] %s\n", delta, \
-					kids_off, kids_off + delta, off, fsbuf->head + off);                         \
+					kids_off, kids_off + delta, off, fs_ptr(fsbuf, off));                        \
 			kids_off += delta;                                                                   \
 			do_set_kids_off(fsbuf, off, kids_off);                                               \
 			set_parent_offset(fsbuf, get_folder_tail_offset(fsbuf, kids_off), off);              \
@@ -554,7 +1167,15 @@ static void update_offsets(fs_buf *fsbuf, uint32_t start_off, int delta, int upd
 		if (off == 0)
 			return;
 
-		while (off < start_off)
+		// hashed folders know which kids are folders
+		dir_hash *dh = find_dir_hash(fsbuf, off);
+		for (uint32_t i = 0; dh && i < dh->dir_count && dh->kids_off + dh->dirs[i] - 1 < start_off; i++)
+		{
+			uint32_t dir_off = dh->kids_off + dh->dirs[i] - 1;
+			UPDATE_KIDS_OFF(fsbuf, dir_off, delta);
+		}
+
+		while (dh == 0 && off < start_off)
 		{
 			UPDATE_KIDS_OFF(fsbuf, off, delta);
 			off = next_name(fsbuf, off);
@@ -566,7 +1187,7 @@ static void update_offsets(fs_buf *fsbuf, uint32_t start_off, int delta, int upd
 	// recursively update parent's post sibling dirs' offsets
 	while (off && off < fsbuf->tail)
 	{
-		if (*(fsbuf->head + off) == 0)
+		if (*fs_ptr(fsbuf, off) == 0)
 		{
 			uint32_t rel_off = get_reloff_by_tag(fsbuf, off + 1);
 			if (rel_off == 0) // root met
@@ -576,6 +1197,19 @@ static void update_offsets(fs_buf *fsbuf, uint32_t start_off, int delta, int upd
 			continue;
 		}
 
+		dir_hash *dh = off == start_off ? find_dir_hash_holding(fsbuf, off) : 0;
+		if (dh)
+		{
+			for (uint32_t i = 0; i < dh->dir_count; i++)
+			{
+				uint32_t dir_off = dh->kids_off + dh->dirs[i] - 1;
+				if (dir_off > start_off)
+					UPDATE_KIDS_OFF(fsbuf, dir_off, delta);
+			}
+			off = dh->tail_off;
+			continue;
+		}
+
 		if (off > start_off)
 			UPDATE_KIDS_OFF(fsbuf, off, delta);
 		off = next_name(fsbuf, off);
@@ -595,16 +1229,35 @@ static int do_insert_path(fs_buf *fsbuf, const char *path, int is_dir, fs_change
 		return ERR_NO_PATH;
 
 	uint32_t kids_off = DATA_START == parent_off ? fsbuf->first_name_off : get_kids_offset(fsbuf, parent_off);
-	dbg_msg("parent-off: %u, parent-path: %s, kids-off: %u\n", parent_off, fsbuf->head + parent_off, kids_off);
+	dbg_msg("parent-off: %u, parent-path: %s, kids-off: %u\n", parent_off, fs_ptr(fsbuf, parent_off), kids_off);
 	// kids_off might be 0 because parent might be an empty folder
 	int empty_folder = kids_off == 0;
-	if (kids_off)
+	uint32_t list_off = kids_off, kids_count = 0;
+	dir_hash *dh = kids_off ? find_dir_hash(fsbuf, kids_off) : 0;
+	if (kids_off && fsbuf->sorted)
+	{
+		// the new name goes before the first kid greater than it
+		int found;
+		kids_off = find_sorted_kid(fsbuf, kids_off, last_slash + 1, strlen(last_slash + 1), &found, dh == 0 && fsbuf->dir_hash_min_kids ? &kids_count : 0);
+		if (found)
+			return ERR_PATH_EXISTS;
+	}
+	else if (dh)
 	{
-		while (kids_off < fsbuf->tail && *(fsbuf->head + kids_off))
+		uint32_t kid_off;
+		lookup_dir_hash(fsbuf, kids_off, last_slash + 1, &kid_off);
+		if (kid_off)
+			return ERR_PATH_EXISTS;
+		kids_off = dh->tail_off;
+	}
+	else if (kids_off)
+	{
+		while (kids_off < fsbuf->tail && *fs_ptr(fsbuf, kids_off))
 		{
-			if (strcmp(fsbuf->head + kids_off, last_slash + 1) == 0)
+			if (strcmp(entry_name(fsbuf, fs_ptr(fsbuf, kids_off)), last_slash + 1) == 0)
 				return ERR_PATH_EXISTS;
 			kids_off = next_name(fsbuf, kids_off);
+			kids_count++;
 		}
 	}
 	else
@@ -612,16 +1265,16 @@ static int do_insert_path(fs_buf *fsbuf, const char *path, int is_dir, fs_change
 		kids_off = get_insert_offset(fsbuf, parent_off);
 	}
 
-	// kids_off points to parent-tag of parent node (empty_folder == 0) or a new node (empty_folder == 1)
+	// kids_off points to parent-tag of parent node (or the place of a sorted list, empty_folder == 0) or a new node (empty_folder == 1)
 	int result = insert_new_name(fsbuf, kids_off, last_slash + 1, is_dir, empty_folder);
 	if (result)
 		return result;
 
-	change->delta = strlen(last_slash + 1) + 1 + (is_dir ? sizeof(uint32_t) : 1);
+	change->delta = stored_name_len(fsbuf->names, last_slash + 1) + 1 + (is_dir ? dir_tag_size(fsbuf) : 1);
 	if (empty_folder)
 	{
 		set_parent_offset(fsbuf, kids_off + change->delta, parent_off);
-		change->delta += 1 + sizeof(uint32_t);
+		change->delta += 1 + dir_tag_size(fsbuf);
 		do_set_kids_off(fsbuf, parent_off, kids_off);
 	}
 	else if (DATA_START != parent_off)
@@ -631,14 +1284,95 @@ static int do_insert_path(fs_buf *fsbuf, const char *path, int is_dir, fs_change
 	}
 	change->start_off = kids_off;
 	update_offsets(fsbuf, kids_off, change->delta, 1);
+
+	// the list has just grown big enough
+	if (!empty_folder && dh == 0 && fsbuf->dir_hash_min_kids && kids_count + 1 >= fsbuf->dir_hash_min_kids)
+		add_dir_hash(fsbuf, list_off, get_folder_tail_offset(fsbuf, kids_off), kids_count + 1);
 	return 0;
 }
 
+// metadata of an op stat-ed before taking the lock: the name inserted,
+// and the folders whose mtime changes with their kids
+typedef struct __op_meta__ {
+	fs_meta name;
+	fs_meta parent;
+	// FS_OP_RENAME only
+	fs_meta dst_parent;
+} op_meta;
+
+static void stat_parent(const char *path, fs_meta *meta)
+{
+	char parent[PATH_MAX];
+	uint32_t len = strrchr(path, '/') ? strrchr(path, '/') - path : 0;
+	if (len == 0 || len >= PATH_MAX)
+		return;
+
+	memcpy(parent, path, len);
+	parent[len] = 0;
+	stat_meta(parent, meta);
+}
+
+static void set_parent_meta(fs_buf *fsbuf, const char *path, const fs_meta *meta)
+{
+	char parent[PATH_MAX];
+	uint32_t len = strrchr(path, '/') ? strrchr(path, '/') - path : 0;
+	if (len == 0 || len >= PATH_MAX || meta->mode == 0)
+		return;
+
+	memcpy(parent, path, len);
+	parent[len] = 0;
+	uint32_t parent_off = get_path_offset(fsbuf, parent);
+	if (parent_off > DATA_START)
+		set_meta_row(fsbuf, parent_off, meta);
+}
+
+// 0 if metadata is not kept
+static op_meta *stat_ops(fs_buf *fsbuf, const fs_op *ops, uint32_t count)
+{
+	op_meta *metas = has_fs_meta(fsbuf) ? calloc(count, sizeof(op_meta)) : 0;
+	for (uint32_t i = 0; metas && i < count; i++)
+	{
+		if (ops[i].type == FS_OP_INSERT)
+			stat_meta(ops[i].path, &metas[i].name);
+		stat_parent(ops[i].path, &metas[i].parent);
+		if (ops[i].type == FS_OP_RENAME)
+			stat_parent(ops[i].dst_path, &metas[i].dst_parent);
+	}
+	return metas;
+}
+
+// after all ops, as inserts are grouped out of order. names renamed carry their metadata along by themselves
+static void set_ops_meta(fs_buf *fsbuf, const fs_op *ops, uint32_t count, const op_meta *metas)
+{
+	for (uint32_t i = 0; metas && i < count && fsbuf->meta_offs; i++)
+	{
+		if (ops[i].result != 0)
+			continue;
+
+		if (ops[i].type == FS_OP_INSERT)
+		{
+			// it might have been removed by a later op
+			uint32_t name_off = get_path_offset(fsbuf, ops[i].path);
+			if (name_off > DATA_START)
+				set_meta_row(fsbuf, name_off, &metas[i].name);
+		}
+		set_parent_meta(fsbuf, ops[i].path, &metas[i].parent);
+		if (ops[i].type == FS_OP_RENAME)
+			set_parent_meta(fsbuf, ops[i].dst_path, &metas[i].dst_parent);
+	}
+}
+
 __attribute__((visibility("default"))) int insert_path(fs_buf *fsbuf, const char *path, int is_dir, fs_change *change)
 {
+	fs_op op = {FS_OP_INSERT, is_dir, path, 0, 0};
+	op_meta *meta = stat_ops(fsbuf, &op, 1);
 	pthread_rwlock_wrlock(&fsbuf->lock);
-	int r = do_insert_path(fsbuf, path, is_dir, change);
+	prepare_change(fsbuf);
+	int r = op.result = do_insert_path(fsbuf, path, is_dir, change);
+	set_ops_meta(fsbuf, &op, 1, meta);
+	journal_ops(fsbuf, &op, 1);
 	pthread_rwlock_unlock(&fsbuf->lock);
+	free(meta);
 	return r;
 }
 
@@ -651,7 +1385,7 @@ __attribute__((visibility("default"))) int insert_path(fs_buf *fsbuf, const char
 			*kids_tree = malloc(*kids_tree_size);                              \
 			if (*kids_tree == 0)                                               \
 				return ERR_NO_MEM;                                             \
-			memcpy(*kids_tree, fsbuf->head + tree_start_off, *kids_tree_size); \
+			copy_bytes(fsbuf, tree_start_off, *kids_tree_size, *kids_tree);    \
 		}                                                                      \
 	} while (0);
 
@@ -668,7 +1402,9 @@ static int do_remove_path(fs_buf *fsbuf, const char *path, fs_change *changes, u
 		changes[0].start_off = fsbuf->first_name_off;
 		changes[0].delta = fsbuf->first_name_off - fsbuf->tail;
 		*change_count = 1;
+		remove_bytes(fsbuf, fsbuf->first_name_off, fsbuf->tail - fsbuf->first_name_off);
 		fsbuf->tail = fsbuf->first_name_off;
+		sync_sidecars(fsbuf, changes[0].start_off, changes[0].delta);
 		return 0;
 	}
 
@@ -679,14 +1415,14 @@ static int do_remove_path(fs_buf *fsbuf, const char *path, fs_change *changes, u
 	{
 		uint32_t tree_end_off = get_tree_end_offset(fsbuf, kids_off);
 		dbg_msg("kids-off: %'u, kids-name: %s, tree-end: %'u, next-name: %s\n",
-				kids_off, fsbuf->head + kids_off, tree_end_off, fsbuf->head + tree_end_off);
+				kids_off, fs_ptr(fsbuf, kids_off), tree_end_off, fs_ptr(fsbuf, tree_end_off));
 
 		COPY_TREE(kids_tree, kids_tree_size, kids_off, tree_end_off);
 
 		do_set_kids_off(fsbuf, name_off, 0);
-		if (tree_end_off < fsbuf->tail)
-			memmove(fsbuf->head + kids_off, fsbuf->head + tree_end_off, fsbuf->tail - tree_end_off);
+		remove_bytes(fsbuf, kids_off, tree_end_off - kids_off);
 		fsbuf->tail -= (tree_end_off - kids_off);
+		sync_sidecars(fsbuf, kids_off, kids_off - tree_end_off);
 		update_offsets(fsbuf, name_off, kids_off - tree_end_off, 0);
 		changes[0].start_off = kids_off;
 		changes[0].delta = kids_off - tree_end_off;
@@ -696,11 +1432,11 @@ static int do_remove_path(fs_buf *fsbuf, const char *path, fs_change *changes, u
 	// remove name_off node itself
 	uint32_t parent_off = get_parent_offset(fsbuf, name_off), sibling1 = get_1st_sibling_offset(fsbuf, name_off);
 	uint32_t size = next_name(fsbuf, name_off) - name_off;
-	char *name = fsbuf->head + name_off + size;
+	char *name = fs_ptr(fsbuf, name_off + size);
 	int only_kid = (*name == 0 && sibling1 == name_off);
 	if (only_kid)
 	{
-		size += 1 + sizeof(uint32_t);
+		size += 1 + dir_tag_size(fsbuf);
 		if (parent_off)
 			do_set_kids_off(fsbuf, parent_off, 0);
 	}
@@ -710,9 +1446,9 @@ static int do_remove_path(fs_buf *fsbuf, const char *path, fs_change *changes, u
 		set_parent_offset(fsbuf, tail, parent_off + size);
 	}
 
-	if (name_off + size < fsbuf->tail)
-		memmove(fsbuf->head + name_off, fsbuf->head + name_off + size, fsbuf->tail - name_off - size);
+	remove_bytes(fsbuf, name_off, size);
 	fsbuf->tail -= size;
+	sync_sidecars(fsbuf, name_off, -size);
 	if (only_kid)
 	{
 		if (parent_off)
@@ -730,9 +1466,15 @@ static int do_remove_path(fs_buf *fsbuf, const char *path, fs_change *changes, u
 
 __attribute__((visibility("default"))) int remove_path(fs_buf *fsbuf, const char *path, fs_change *changes, uint32_t *change_count)
 {
+	fs_op op = {FS_OP_REMOVE, 0, path, 0, 0};
+	op_meta *meta = stat_ops(fsbuf, &op, 1);
 	pthread_rwlock_wrlock(&fsbuf->lock);
-	int r = do_remove_path(fsbuf, path, changes, change_count, 0, 0);
+	prepare_change(fsbuf);
+	int r = op.result = do_remove_path(fsbuf, path, changes, change_count, 0, 0);
+	set_ops_meta(fsbuf, &op, 1, meta);
+	journal_ops(fsbuf, &op, 1);
 	pthread_rwlock_unlock(&fsbuf->lock);
+	free(meta);
 	return r;
 }
 
@@ -766,15 +1508,31 @@ static int do_rename_path(fs_buf *fsbuf, const char *src_path, const char *dst_p
 	*last_slash = 0;
 	uint32_t dst_parent_off = get_path_offset(fsbuf, dst_path);
 	*last_slash = '/';
-	if (dst_parent_off == 0 || (dst_parent_off == DATA_START && do_is_file(fsbuf, dst_parent_off)))
+	if (dst_parent_off == 0 || (dst_parent_off != DATA_START && do_is_file(fsbuf, dst_parent_off)))
 		return ERR_NO_PATH;
 
+	// metadata & node ids (but the renamed name's) go along with the names
+	fs_meta src_meta = {0}, *kids_meta = 0;
+	uint32_t *kids_ids = 0, kids_id_count = 0;
+	uint32_t kids_meta_count = 0, src_kids_off = src_is_file ? 0 : get_kids_offset(fsbuf, src_off);
+	get_meta_row(fsbuf, src_off, &src_meta);
+	if (src_kids_off)
+	{
+		uint32_t tree_end_off = get_tree_end_offset(fsbuf, src_kids_off);
+		kids_meta = copy_meta_rows(fsbuf, src_kids_off, tree_end_off, &kids_meta_count);
+		kids_ids = copy_node_ids(fsbuf, src_kids_off, tree_end_off, &kids_id_count);
+	}
+
 	// folder with kids, backup its kids first
 	char *old_kids_tree = 0;
 	uint32_t tree_size = 0;
 	int result = do_remove_path(fsbuf, src_path, changes, change_count, &old_kids_tree, &tree_size);
 	if (result != 0)
+	{
+		free(kids_meta);
+		free(kids_ids);
 		return result;
+	}
 
 	if (dst_off == 0)
 	{
@@ -784,24 +1542,25 @@ static int do_rename_path(fs_buf *fsbuf, const char *src_path, const char *dst_p
 	}
 	// do_remove_path might change dst_off, so we must get it again
 	dst_off = get_path_offset(fsbuf, dst_path);
+	set_meta_row(fsbuf, dst_off, &src_meta);
 
 	// copy back kids tree, dst_off must point to a folder
 	if (old_kids_tree)
 	{
 		dbg_msg("old-kids-tree: %p (%s), size: %'u\n", old_kids_tree, old_kids_tree, tree_size);
-		if (tree_size + fsbuf->tail >= fsbuf->capacity)
-			if (add_capacity(fsbuf, tree_size) != 0)
-			{
-				free(old_kids_tree);
-				return ERR_NO_MEM;
-			}
-
 		uint32_t kids_off = get_insert_offset(fsbuf, dst_off);
-		if (fsbuf->tail > kids_off)
-			memmove(fsbuf->head + kids_off + tree_size, fsbuf->head + kids_off, fsbuf->tail - kids_off);
-		memcpy(fsbuf->head + kids_off, old_kids_tree, tree_size);
+		if (insert_bytes(fsbuf, kids_off, old_kids_tree, tree_size) != 0)
+		{
+			free(old_kids_tree);
+			free(kids_meta);
+			free(kids_ids);
+			return ERR_NO_MEM;
+		}
 		free(old_kids_tree);
 		fsbuf->tail += tree_size;
+		sync_sidecars(fsbuf, kids_off, tree_size);
+		put_meta_rows(fsbuf, kids_off, kids_meta, kids_meta_count);
+		put_node_ids(fsbuf, kids_off, kids_ids, kids_id_count);
 		// set kids-off, parent-off & update-offsets
 		do_set_kids_off(fsbuf, dst_off, kids_off);
 		set_parent_offset(fsbuf, get_folder_tail_offset(fsbuf, kids_off), dst_off);
@@ -812,6 +1571,8 @@ static int do_rename_path(fs_buf *fsbuf, const char *src_path, const char *dst_p
 		*change_count = *change_count + 1;
 	}
 
+	free(kids_meta);
+	free(kids_ids);
 	return 0;
 }
 
@@ -827,7 +1588,8 @@ static void do_get_path_range(fs_buf *fsbuf, const char *path, uint32_t *path_of
 			*end_off = get_tail(fsbuf);
 		} else {
 			*start_off = get_kids_offset(fsbuf, *path_off);
-			*end_off = get_tree_end_offset(fsbuf, *start_off);
+			// files & empty folders have no range, do not walk from offset 0 (the header)
+			*end_off = *start_off ? get_tree_end_offset(fsbuf, *start_off) : 0;
 		}
 	}
 	pthread_rwlock_unlock(&fsbuf->lock);
@@ -840,12 +1602,359 @@ __attribute__((visibility("default"))) void get_path_range(fs_buf *fsbuf, const
 
 __attribute__((visibility("default"))) int rename_path(fs_buf *fsbuf, const char *src_path, const char *dst_path, fs_change *changes, uint32_t *change_count)
 {
+	fs_op op = {FS_OP_RENAME, 0, src_path, dst_path, 0};
+	op_meta *meta = stat_ops(fsbuf, &op, 1);
 	pthread_rwlock_wrlock(&fsbuf->lock);
-	int r = do_rename_path(fsbuf, src_path, dst_path, changes, change_count);
+	prepare_change(fsbuf);
+	int r = op.result = do_rename_path(fsbuf, src_path, dst_path, changes, change_count);
+	set_ops_meta(fsbuf, &op, 1, meta);
+	journal_ops(fsbuf, &op, 1);
 	pthread_rwlock_unlock(&fsbuf->lock);
+	free(meta);
 	return r;
 }
 
+// insert the entries of names[first, last) with results 0 at off (behind a placeholder parent-tag if empty_folder)
+// in one block & one offset fix-up, return the number of names inserted
+static uint32_t insert_kids_block(fs_buf *fsbuf, uint32_t parent_off, uint32_t off, const char **names, const int *is_dirs, int *results,
+								  uint32_t first, uint32_t last, int empty_folder)
+{
+	uint32_t names_size = 0, added = 0;
+	for (uint32_t i = first; i < last; i++)
+		if (results[i] == 0)
+			names_size += stored_name_len(fsbuf->names, names[i]) + 1 + (is_dirs[i] ? dir_tag_size(fsbuf) : 1);
+	if (names_size == 0)
+		return 0;
+
+	uint32_t size = names_size + (empty_folder ? 1 + dir_tag_size(fsbuf) : 0);
+	char *block = malloc(size), *p = block;
+	if (block == 0)
+	{
+		for (uint32_t i = first; i < last; i++)
+			if (results[i] == 0)
+				results[i] = ERR_NO_MEM;
+		return 0;
+	}
+
+	for (uint32_t i = first; i < last; i++)
+	{
+		if (results[i] != 0)
+			continue;
+
+		store_name(fsbuf->names, p, names[i]);
+		p += strlen(p) + 1;
+		if (is_dirs[i])
+		{
+			set_dir_tag(fsbuf, p, 0);
+			p += dir_tag_size(fsbuf);
+		}
+		else
+		{
+			*p++ = FS_TAG_FILE;
+		}
+		added++;
+	}
+	// placeholder parent-tag of the new kids list, set below
+	if (empty_folder)
+	{
+		*p++ = 0;
+		set_dir_tag(fsbuf, p, 0);
+	}
+
+	int result = insert_bytes(fsbuf, off, block, size);
+	free(block);
+	if (result != 0)
+	{
+		for (uint32_t i = first; i < last; i++)
+			if (results[i] == 0)
+				results[i] = result;
+		return 0;
+	}
+	fsbuf->tail += size;
+	sync_sidecars(fsbuf, off, size);
+
+	// the same as do_insert_path, only with more names
+	if (empty_folder)
+	{
+		set_parent_offset(fsbuf, off + names_size, parent_off);
+		do_set_kids_off(fsbuf, parent_off, off);
+	}
+	else if (DATA_START != parent_off)
+	{
+		set_parent_offset(fsbuf, get_folder_tail_offset(fsbuf, off), parent_off);
+	}
+	update_offsets(fsbuf, off, size, 1);
+	return added;
+}
+
+// insert the new kids of parent (names[i] with is_dirs[i], sorted) in one block & one offset fix-up
+// (one block per place in a sorted list), results[i] is set for each name
+static void insert_kids(fs_buf *fsbuf, const char *parent, const char **names, const int *is_dirs, int *results, uint32_t count)
+{
+	uint32_t parent_off = get_path_offset(fsbuf, parent);
+	if (parent_off == 0 || (DATA_START != parent_off && do_is_file(fsbuf, parent_off)))
+	{
+		for (uint32_t i = 0; i < count; i++)
+			results[i] = ERR_NO_PATH;
+		return;
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+		results[i] = i > 0 && strcmp(names[i - 1], names[i]) == 0 ? ERR_PATH_EXISTS : 0;
+
+	uint32_t kids_off = DATA_START == parent_off ? fsbuf->first_name_off : get_kids_offset(fsbuf, parent_off);
+	int empty_folder = kids_off == 0;
+	uint32_t list_off = kids_off, kids_count = 0, added = 0;
+	dir_hash *dh = kids_off ? find_dir_hash(fsbuf, kids_off) : 0;
+	if (kids_off && fsbuf->sorted)
+	{
+		uint32_t *places = malloc(count * sizeof(uint32_t));
+		if (places == 0)
+		{
+			for (uint32_t i = 0; i < count; i++)
+				if (results[i] == 0)
+					results[i] = ERR_NO_MEM;
+			return;
+		}
+
+		// names & kids are both sorted, so places are found by merging them (or by binary search in a hashed list)
+		for (uint32_t i = 0; i < count; i++)
+		{
+			if (results[i] != 0)
+				continue;
+
+			int found = 0;
+			if (dh)
+			{
+				places[i] = find_sorted_kid(fsbuf, list_off, names[i], strlen(names[i]), &found, 0);
+			}
+			else
+			{
+				int r = 1;
+				while (kids_off < fsbuf->tail && *fs_ptr(fsbuf, kids_off) && (r = strcmp(entry_name(fsbuf, fs_ptr(fsbuf, kids_off)), names[i])) < 0)
+				{
+					kids_off = next_name(fsbuf, kids_off);
+					kids_count++;
+				}
+				found = *fs_ptr(fsbuf, kids_off) && r == 0;
+				places[i] = kids_off;
+			}
+			if (found)
+				results[i] = ERR_PATH_EXISTS;
+		}
+		while (dh == 0 && kids_off < fsbuf->tail && *fs_ptr(fsbuf, kids_off))
+		{
+			kids_off = next_name(fsbuf, kids_off);
+			kids_count++;
+		}
+
+		// from the last place on, so that places ahead are not moved
+		for (uint32_t last = count; last > 0;)
+		{
+			if (results[last - 1] != 0)
+			{
+				last--;
+				continue;
+			}
+
+			// names sharing the place of names[last - 1], failed ones among them are skipped
+			uint32_t first = last - 1;
+			while (first > 0 && (results[first - 1] != 0 || places[first - 1] == places[last - 1]))
+				first--;
+			added += insert_kids_block(fsbuf, parent_off, places[last - 1], names, is_dirs, results, first, last, 0);
+			last = first;
+		}
+		free(places);
+	}
+	else
+	{
+		if (dh)
+		{
+			for (uint32_t i = 0; i < count; i++)
+			{
+				uint32_t kid_off;
+				lookup_dir_hash(fsbuf, kids_off, names[i], &kid_off);
+				if (kid_off)
+					results[i] = ERR_PATH_EXISTS;
+			}
+			kids_off = dh->tail_off;
+		}
+		else if (kids_off)
+		{
+			while (kids_off < fsbuf->tail && *fs_ptr(fsbuf, kids_off))
+			{
+				// names are sorted, look the kid up by binary search
+				const char *kid = entry_name(fsbuf, fs_ptr(fsbuf, kids_off));
+				uint32_t lo = 0, hi = count;
+				while (lo < hi)
+				{
+					uint32_t mid = lo + (hi - lo) / 2;
+					if (strcmp(names[mid], kid) < 0)
+						lo = mid + 1;
+					else
+						hi = mid;
+				}
+				if (lo < count && strcmp(names[lo], kid) == 0)
+					results[lo] = ERR_PATH_EXISTS;
+				kids_off = next_name(fsbuf, kids_off);
+				kids_count++;
+			}
+		}
+		else
+		{
+			kids_off = get_insert_offset(fsbuf, parent_off);
+		}
+		added = insert_kids_block(fsbuf, parent_off, kids_off, names, is_dirs, results, 0, count, empty_folder);
+	}
+
+	if (added && !empty_folder && dh == 0 && fsbuf->dir_hash_min_kids && kids_count + added >= fsbuf->dir_hash_min_kids)
+		add_dir_hash(fsbuf, list_off, get_folder_tail_offset(fsbuf, list_off), kids_count + added);
+}
+
+static uint32_t parent_len(const char *path)
+{
+	const char *last_slash = strrchr(path, '/');
+	return last_slash ? last_slash - path : 0;
+}
+
+// by parent folder, then by name
+static int compare_insert_ops(const void *a, const void *b)
+{
+	const fs_op *x = *(const fs_op **)a, *y = *(const fs_op **)b;
+	uint32_t xlen = parent_len(x->path), ylen = parent_len(y->path);
+	int r = memcmp(x->path, y->path, xlen < ylen ? xlen : ylen);
+	if (r == 0 && xlen != ylen)
+		return xlen < ylen ? -1 : 1;
+	if (r == 0)
+		r = strcmp(x->path + xlen, y->path + ylen);
+	return r != 0 ? r : (x < y ? -1 : 1);
+}
+
+// a folder's kids before itself
+static int compare_remove_ops(const void *a, const void *b)
+{
+	const fs_op *x = *(const fs_op **)a, *y = *(const fs_op **)b;
+	int r = strcmp(y->path, x->path);
+	return r != 0 ? r : (x < y ? -1 : 1);
+}
+
+static void apply_op(fs_buf *fsbuf, fs_op *op)
+{
+	fs_change changes[8];
+	uint32_t change_count = sizeof(changes) / sizeof(fs_change);
+	char src[PATH_MAX], dst[PATH_MAX];
+	// the path functions cut paths in place
+	if (strlen(op->path) >= PATH_MAX || (op->type == FS_OP_RENAME && strlen(op->dst_path) >= PATH_MAX))
+	{
+		op->result = ERR_NO_PATH;
+		return;
+	}
+	strcpy(src, op->path);
+
+	switch (op->type)
+	{
+	case FS_OP_INSERT:
+		op->result = do_insert_path(fsbuf, src, op->is_dir, changes);
+		break;
+	case FS_OP_REMOVE:
+		op->result = do_remove_path(fsbuf, src, changes, &change_count, 0, 0);
+		break;
+	case FS_OP_RENAME:
+		strcpy(dst, op->dst_path);
+		op->result = do_rename_path(fsbuf, src, dst, changes, &change_count);
+		break;
+	}
+}
+
+// inserts of the run are grouped by parent folder, which comes before its kids' folders
+static void apply_inserts(fs_buf *fsbuf, fs_op **ops, uint32_t count)
+{
+	const char **names = malloc(count * sizeof(char *));
+	int *is_dirs = malloc(count * sizeof(int)), *results = malloc(count * sizeof(int));
+	if (names == 0 || is_dirs == 0 || results == 0)
+	{
+		for (uint32_t i = 0; i < count; i++)
+			apply_op(fsbuf, ops[i]);
+		goto out;
+	}
+
+	uint32_t n = 0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		const char *last_slash = strrchr(ops[i]->path, '/');
+		if (last_slash == 0 || last_slash[1] == 0 || last_slash - ops[i]->path >= PATH_MAX)
+			ops[i]->result = ERR_NO_PATH;
+		else
+			ops[n++] = ops[i];
+	}
+	qsort(ops, n, sizeof(fs_op *), compare_insert_ops);
+
+	char parent[PATH_MAX];
+	for (uint32_t i = 0, j; i < n; i = j)
+	{
+		uint32_t len = parent_len(ops[i]->path);
+		for (j = i; j < n && parent_len(ops[j]->path) == len && memcmp(ops[j]->path, ops[i]->path, len) == 0; j++)
+		{
+			names[j - i] = ops[j]->path + len + 1;
+			is_dirs[j - i] = ops[j]->is_dir;
+		}
+
+		memcpy(parent, ops[i]->path, len);
+		parent[len] = 0;
+		insert_kids(fsbuf, parent, names, is_dirs, results, j - i);
+		for (uint32_t k = i; k < j; k++)
+			ops[k]->result = results[k - i];
+	}
+
+out:
+	free(names);
+	free(is_dirs);
+	free(results);
+}
+
+__attribute__((visibility("default"))) uint32_t apply_changes(fs_buf *fsbuf, fs_op *ops, uint32_t count)
+{
+	fs_op **run = malloc(count * sizeof(fs_op *));
+	op_meta *metas = stat_ops(fsbuf, ops, count);
+	uint32_t done = 0;
+	pthread_rwlock_wrlock(&fsbuf->lock);
+	prepare_change(fsbuf);
+	for (uint32_t i = 0, j; i < count; i = j)
+	{
+		// consecutive inserts (or removes) commute, except for folders & their kids which sorting takes care of
+		for (j = i + 1; run && ops[i].type != FS_OP_RENAME && j < count && ops[j].type == ops[i].type; j++)
+			;
+		if (j - i == 1)
+		{
+			apply_op(fsbuf, ops + i);
+			continue;
+		}
+
+		for (uint32_t k = i; k < j; k++)
+			run[k - i] = ops + k;
+		if (ops[i].type == FS_OP_INSERT)
+		{
+			apply_inserts(fsbuf, run, j - i);
+		}
+		else
+		{
+			qsort(run, j - i, sizeof(fs_op *), compare_remove_ops);
+			for (uint32_t k = 0; k < j - i; k++)
+				apply_op(fsbuf, run[k]);
+		}
+	}
+	set_ops_meta(fsbuf, ops, count, metas);
+	// replaying the ops as one call gives the same buffer
+	journal_ops(fsbuf, ops, count);
+	pthread_rwlock_unlock(&fsbuf->lock);
+	free(run);
+	free(metas);
+
+	for (uint32_t i = 0; i < count; i++)
+		done += ops[i].result == 0;
+	return done;
+}
+
 __attribute__((visibility("default"))) void search_files(fs_buf *fsbuf, uint32_t *start_off, uint32_t end_off, uint32_t *results, uint32_t *count,
 							comparator_fn comparator, void *comparator_param, progress_fn pcf, void *pcf_param)
 {
@@ -856,7 +1965,7 @@ __attribute__((visibility("default"))) void search_files(fs_buf *fsbuf, uint32_t
 
 	while (name_off < min_off && *count < size)
 	{
-		char *name = fsbuf->head + name_off;
+		const char *name = entry_name(fsbuf, fs_ptr(fsbuf, name_off));
 
 		if (pcf && (*pcf)(*count, name, pcf_param) != 0) {
 			break;
@@ -0,0 +1,341 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include "fs_buf.h"
+#include "fs_buf_base.h"
+#include "utils.h"
+
+// LFT v2: "LFT2", tail, root path, then blocks of whole entries until tail is reached.
+// names are front-coded against the previous name (shared prefix length, suffix),
+// dir tags (uint64_t ones of large buffers too) are varints (never starting with FS_TAG_FILE since their low bits are FS_TAG_DIR),
+// and each block is compressed by a small LZ77 codec (LZ4-like sequences, 64 KB window).
+// a block header holds the front-coded size and the compressed size.
+
+#define BLOCK_SIZE (1 << 16)
+#define MIN_MATCH 4
+#define HASH_BITS 15
+#define CHAIN_DEPTH 16
+#define NO_POS ((uint32_t)-1)
+// room for the worst case of a front-coded entry or of incompressible data
+#define BLOCK_BOUND(size) ((size) + (size) / 255 + 16)
+
+static const char lft2_magic[] = "LFT2";
+static const char lft2_magic_large[] = "LFL2";
+
+static uint32_t put_varint(char *p, uint64_t v)
+{
+	uint32_t n = 0;
+	while (v >= 0x80)
+	{
+		p[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+	return n;
+}
+
+// 0 if p runs past end
+static uint32_t get_varint(const char *p, const char *end, uint64_t *v)
+{
+	uint32_t n = 0, shift = 0;
+	*v = 0;
+	while (p + n < end && shift < 64)
+	{
+		unsigned char c = p[n++];
+		*v |= (uint64_t)(c & 0x7f) << shift;
+		if ((c & 0x80) == 0)
+			return n;
+		shift += 7;
+	}
+	return 0;
+}
+
+static uint32_t hash4(const char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static char *put_length(char *op, uint32_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = (char)255;
+	*op++ = len;
+	return op;
+}
+
+// longest match for ip among the last CHAIN_DEPTH positions of the same hash, 0 if none
+static uint32_t find_match(const char *src, const char *ip, const char *end, const uint32_t *chain, uint32_t ref, const char **match)
+{
+	uint32_t best = 0;
+	for (uint32_t depth = 0; ref != NO_POS && depth < CHAIN_DEPTH && ip - (src + ref) <= UINT16_MAX; depth++, ref = chain[ref])
+	{
+		const char *p = src + ref;
+		uint32_t len = 0;
+		while (ip + len < end && p[len] == ip[len])
+			len++;
+		if (len > best)
+		{
+			best = len;
+			*match = p;
+		}
+	}
+	return best >= MIN_MATCH ? best : 0;
+}
+
+// greedy LZ77 over hash chains, returns the compressed size
+static uint32_t lz_compress(const char *src, uint32_t size, char *dst, uint32_t *table, uint32_t *chain)
+{
+	memset(table, 0xff, sizeof(uint32_t) << HASH_BITS);
+
+	const char *ip = src, *anchor = src, *end = src + size;
+	char *op = dst;
+	while (ip + MIN_MATCH <= end)
+	{
+		uint32_t h = hash4(ip);
+		const char *match;
+		uint32_t len = find_match(src, ip, end, chain, table[h], &match);
+		chain[ip - src] = table[h];
+		table[h] = ip - src;
+		if (len == 0)
+		{
+			ip++;
+			continue;
+		}
+
+		uint32_t lit = ip - anchor;
+		char *token = op++;
+		*token = (lit < 15 ? lit : 15) << 4 | (len - MIN_MATCH < 15 ? len - MIN_MATCH : 15);
+		if (lit >= 15)
+			op = put_length(op, lit - 15);
+		memcpy(op, anchor, lit);
+		op += lit;
+		uint16_t offset = ip - match;
+		memcpy(op, &offset, sizeof(offset));
+		op += sizeof(offset);
+		if (len - MIN_MATCH >= 15)
+			op = put_length(op, len - MIN_MATCH - 15);
+
+		// positions inside the match are hashed too, so later names find them
+		for (const char *p = ip + 1; p < ip + len && p + MIN_MATCH <= end; p++)
+		{
+			h = hash4(p);
+			chain[p - src] = table[h];
+			table[h] = p - src;
+		}
+		ip += len;
+		anchor = ip;
+	}
+
+	// the last sequence holds literals only
+	uint32_t lit = end - anchor;
+	*op++ = (lit < 15 ? lit : 15) << 4;
+	if (lit >= 15)
+		op = put_length(op, lit - 15);
+	memcpy(op, anchor, lit);
+	op += lit;
+	return op - dst;
+}
+
+static int get_length(const char **ip, const char *end, uint32_t *len)
+{
+	unsigned char c;
+	do
+	{
+		if (*ip >= end)
+			return 1;
+		c = *(*ip)++;
+		*len += c;
+	} while (c == 255);
+	return 0;
+}
+
+// 0 if src does not decompress to exactly size bytes
+static int lz_decompress(const char *src, uint32_t src_size, char *dst, uint32_t size)
+{
+	const char *ip = src, *end = src + src_size;
+	char *op = dst, *dst_end = dst + size;
+	while (ip < end)
+	{
+		unsigned char token = *ip++;
+		uint32_t lit = token >> 4;
+		if (lit == 15 && get_length(&ip, end, &lit) != 0)
+			return 0;
+		if (lit > (uint32_t)(end - ip) || lit > (uint32_t)(dst_end - op))
+			return 0;
+		memcpy(op, ip, lit);
+		ip += lit;
+		op += lit;
+		if (ip == end)
+			break;
+
+		uint16_t offset;
+		if (end - ip < (int)sizeof(offset))
+			return 0;
+		memcpy(&offset, ip, sizeof(offset));
+		ip += sizeof(offset);
+		uint32_t len = (token & 15) + MIN_MATCH;
+		if ((token & 15) == 15 && get_length(&ip, end, &len) != 0)
+			return 0;
+		if (offset == 0 || offset > op - dst || len > (uint32_t)(dst_end - op))
+			return 0;
+		// matches may overlap their own output
+		for (const char *match = op - offset; len > 0; len--)
+			*op++ = *match++;
+	}
+	return op == dst_end;
+}
+
+// front-code the entry at off after prev (0 for none), returns the coded size
+static uint32_t code_entry(fs_buf *fsbuf, uint32_t off, const char *prev, char *dst)
+{
+	const char *name = fs_ptr(fsbuf, off);
+	uint32_t shared = 0, len = strlen(name), n;
+	if (prev)
+		while (shared < len && prev[shared] == name[shared])
+			shared++;
+
+	n = put_varint(dst, shared);
+	memcpy(dst + n, name + shared, len - shared + 1);
+	n += len - shared + 1;
+
+	const char *tag = name + len + 1;
+	if (*tag == FS_TAG_FILE)
+	{
+		dst[n++] = FS_TAG_FILE;
+	}
+	else
+	{
+		uint64_t v = 0;
+		memcpy(&v, tag, dir_tag_size(fsbuf));
+		n += put_varint(dst + n, v);
+	}
+	return n;
+}
+
+int write_lft2(fs_buf *fsbuf, int fd)
+{
+	char header[DATA_START];
+	memcpy(header, fsbuf->large ? lft2_magic_large : lft2_magic, sizeof(uint32_t));
+	memcpy(header + sizeof(uint32_t), &fsbuf->tail, sizeof(fsbuf->tail));
+	if (write_file(fd, header, DATA_START) != 0 || write_file(fd, fsbuf->head + DATA_START, fsbuf->first_name_off - DATA_START) != 0)
+		return 1;
+
+	// an entry is at most a name, \0 and a 10-byte varint tag behind its shared-prefix varint
+	char *block = malloc(BLOCK_SIZE + NAME_MAX + 16), *out = malloc(sizeof(uint32_t) * 2 + BLOCK_BOUND(BLOCK_SIZE + NAME_MAX + 16));
+	uint32_t *table = malloc(sizeof(uint32_t) << HASH_BITS), *chain = malloc((BLOCK_SIZE + NAME_MAX + 16) * sizeof(uint32_t));
+	if (block == 0 || out == 0 || table == 0 || chain == 0)
+	{
+		free(block);
+		free(out);
+		free(table);
+		free(chain);
+		return 1;
+	}
+
+	int r = 0;
+	const char *prev = 0;
+	for (uint32_t off = fsbuf->first_name_off; r == 0 && off < fsbuf->tail;)
+	{
+		uint32_t size = 0;
+		for (; off < fsbuf->tail && size < BLOCK_SIZE; off = next_name(fsbuf, off))
+		{
+			size += code_entry(fsbuf, off, prev, block + size);
+			prev = fs_ptr(fsbuf, off);
+		}
+
+		uint32_t packed = lz_compress(block, size, out + sizeof(uint32_t) * 2, table, chain);
+		memcpy(out, &size, sizeof(size));
+		memcpy(out + sizeof(uint32_t), &packed, sizeof(packed));
+		r = write_file(fd, out, sizeof(uint32_t) * 2 + packed);
+	}
+	free(block);
+	free(out);
+	free(table);
+	free(chain);
+	return r;
+}
+
+// decode the front-coded entries of block to head + *off, prev_off is the previous name (0 for none)
+static int decode_entries(fs_buf *fsbuf, const char *block, uint32_t size, uint32_t *off, uint32_t *prev_off)
+{
+	const char *p = block, *end = block + size;
+	while (p < end)
+	{
+		uint64_t shared;
+		uint32_t n = get_varint(p, end, &shared);
+		if (n == 0)
+			return 1;
+		p += n;
+
+		const char *suffix = p;
+		while (p < end && *p)
+			p++;
+		if (p == end)
+			return 1;
+		p++;
+
+		uint32_t prev_len = *prev_off ? strlen(fsbuf->head + *prev_off) : 0, len = shared + (p - suffix);
+		if (shared > prev_len || *off + len + dir_tag_size(fsbuf) > fsbuf->tail)
+			return 1;
+		char *name = fsbuf->head + *off;
+		memmove(name, fsbuf->head + *prev_off, shared);
+		memcpy(name + shared, suffix, p - suffix);
+
+		if (p == end)
+			return 1;
+		if (*p == FS_TAG_FILE)
+		{
+			name[len] = FS_TAG_FILE;
+			p++;
+			len++;
+		}
+		else
+		{
+			uint64_t v;
+			n = get_varint(p, end, &v);
+			if (n == 0 || (!fsbuf->large && v > UINT32_MAX))
+				return 1;
+			memcpy(name + len, &v, dir_tag_size(fsbuf));
+			p += n;
+			len += dir_tag_size(fsbuf);
+		}
+		*prev_off = *off;
+		*off += len;
+	}
+	return 0;
+}
+
+int read_lft2(fs_buf *fsbuf, int fd)
+{
+	// head & tail are set, the header up to the root path is already read
+	uint32_t off = DATA_START;
+	while (off < fsbuf->tail)
+	{
+		if (read(fd, fsbuf->head + off, 1) != 1)
+			return 1;
+		if (fsbuf->head[off++] == 0)
+			break;
+	}
+	fsbuf->first_name_off = off;
+
+	char *in = malloc(BLOCK_BOUND(BLOCK_SIZE + NAME_MAX + 16)), *block = malloc(BLOCK_SIZE + NAME_MAX + 16);
+	int r = in == 0 || block == 0;
+	uint32_t prev_off = 0;
+	while (r == 0 && off < fsbuf->tail)
+	{
+		uint32_t sizes[2];
+		if (read_file(fd, (char *)sizes, sizeof(sizes)) != 0 || sizes[0] > BLOCK_SIZE + NAME_MAX + 16 || sizes[1] > BLOCK_BOUND(BLOCK_SIZE + NAME_MAX + 16))
+			r = 1;
+		else if (read_file(fd, in, sizes[1]) != 0 || !lz_decompress(in, sizes[1], block, sizes[0]))
+			r = 1;
+		else
+			r = decode_entries(fsbuf, block, sizes[0], &off, &prev_off);
+	}
+	free(in);
+	free(block);
+	return r != 0 || off != fsbuf->tail;
+}
@@ -0,0 +1,110 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs_buf.h"
+#include "fs_buf_base.h"
+#include "utils.h"
+
+// cursors: offsets are only meaningful for the generation they were got at. each change logs the bytes it
+// inserted or removed (the same shifts sync_sidecars applies to the parent index etc.), so an offset of an
+// older generation is moved along by replaying the shifts since. only the latest FS_SHIFT_LOG_SIZE are kept.
+
+void log_shift(fs_buf *fsbuf, uint32_t off, int delta)
+{
+	if (fsbuf->shifts == 0 && (fsbuf->shifts = malloc(FS_SHIFT_LOG_SIZE * sizeof(fs_shift))) == 0)
+	{
+		// cursors of older generations can not follow this change
+		fsbuf->shift_floor = fsbuf->generation;
+		return;
+	}
+
+	// the oldest shift is dropped
+	if (fsbuf->shift_count == FS_SHIFT_LOG_SIZE)
+		fsbuf->shift_floor = fsbuf->shifts[fsbuf->shift_head].generation;
+	else
+		fsbuf->shift_count++;
+
+	fs_shift *shift = fsbuf->shifts + fsbuf->shift_head;
+	shift->generation = fsbuf->generation;
+	shift->off = off;
+	shift->delta = delta;
+	fsbuf->shift_head = (fsbuf->shift_head + 1) % FS_SHIFT_LOG_SIZE;
+}
+
+int copy_shift_log(fs_buf *dst, fs_buf *src)
+{
+	free_shift_log(dst);
+	dst->shift_floor = src->shift_floor;
+	if (src->shifts == 0)
+		return 0;
+
+	dst->shifts = malloc(FS_SHIFT_LOG_SIZE * sizeof(fs_shift));
+	if (dst->shifts == 0)
+		return ERR_NO_MEM;
+	memcpy(dst->shifts, src->shifts, FS_SHIFT_LOG_SIZE * sizeof(fs_shift));
+	dst->shift_head = src->shift_head;
+	dst->shift_count = src->shift_count;
+	return 0;
+}
+
+void free_shift_log(fs_buf *fsbuf)
+{
+	free(fsbuf->shifts);
+	fsbuf->shifts = 0;
+	fsbuf->shift_head = fsbuf->shift_count = 0;
+}
+
+// names inserted at off itself lie behind it, i.e. are still to be scanned from a start offset,
+// but are not taken into a range ending at off
+static uint32_t shift_offset(uint32_t off, const fs_shift *shift)
+{
+	if (shift->delta > 0)
+		return off > shift->off ? off + shift->delta : off;
+
+	uint32_t size = -shift->delta;
+	if (off >= shift->off + size)
+		return off - size;
+	// inside the removed bytes
+	return off > shift->off ? shift->off : off;
+}
+
+__attribute__((visibility("default"))) uint32_t get_fs_generation(fs_buf *fsbuf)
+{
+	pthread_rwlock_rdlock(&fsbuf->lock);
+	uint32_t generation = fsbuf->generation;
+	pthread_rwlock_unlock(&fsbuf->lock);
+	return generation;
+}
+
+__attribute__((visibility("default"))) void init_fs_cursor(fs_buf *fsbuf, fs_cursor *cursor, uint32_t start_off, uint32_t end_off)
+{
+	cursor->generation = get_fs_generation(fsbuf);
+	cursor->start_off = start_off;
+	cursor->end_off = end_off;
+}
+
+__attribute__((visibility("default"))) int seek_fs_cursor(fs_buf *fsbuf, fs_cursor *cursor)
+{
+	pthread_rwlock_rdlock(&fsbuf->lock);
+	int r = 0;
+	if (cursor->generation > fsbuf->generation || cursor->generation < fsbuf->shift_floor)
+	{
+		r = 1;
+	}
+	else if (cursor->generation < fsbuf->generation)
+	{
+		uint32_t first = (fsbuf->shift_head + FS_SHIFT_LOG_SIZE - fsbuf->shift_count) % FS_SHIFT_LOG_SIZE;
+		for (uint32_t i = 0; i < fsbuf->shift_count; i++)
+		{
+			const fs_shift *shift = fsbuf->shifts + (first + i) % FS_SHIFT_LOG_SIZE;
+			if (shift->generation <= cursor->generation)
+				continue;
+
+			cursor->start_off = shift_offset(cursor->start_off, shift);
+			cursor->end_off = shift_offset(cursor->end_off, shift);
+		}
+		cursor->generation = fsbuf->generation;
+	}
+	pthread_rwlock_unlock(&fsbuf->lock);
+	return r;
+}
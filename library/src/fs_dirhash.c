@@ -0,0 +1,353 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs_buf.h"
+#include "fs_buf_base.h"
+#include "utils.h"
+
+// slots hold name_off - kids_off + 1, so that 0 means an empty slot
+#define SLOT_EMPTY 0
+#define SLOT_DELETED ((uint32_t)-1)
+
+// per-folder hash index of big kids lists: name -> name_off.
+// offsets are kept relative to the list, so changes outside a list only move its kids_off & tail_off
+
+static uint32_t hash_name(const char *name, uint32_t len)
+{
+	uint32_t result = 0;
+	for (uint32_t i = 0; i < len; i++)
+		result = result * 31 + (unsigned char)name[i];
+	return result;
+}
+
+static void put_slot(dir_hash *dh, uint32_t h, uint32_t value)
+{
+	uint32_t i = h & dh->mask;
+	while (dh->slots[i] != SLOT_EMPTY && dh->slots[i] != SLOT_DELETED)
+		i = (i + 1) & dh->mask;
+	if (dh->slots[i] == SLOT_EMPTY)
+		dh->used++;
+	dh->slots[i] = value;
+	dh->count++;
+}
+
+static int is_dir_entry(fs_buf *fsbuf, uint32_t off)
+{
+	const char *name = fs_ptr(fsbuf, off);
+	return *(name + strlen(name) + 1) != FS_TAG_FILE;
+}
+
+// add rel to the sorted array rels
+static int add_rel(uint32_t **rels, uint32_t *count, uint32_t *capacity, uint32_t rel)
+{
+	if (*count == *capacity)
+	{
+		uint32_t new_capacity = *capacity ? *capacity * 2 : 16;
+		uint32_t *p = realloc(*rels, new_capacity * sizeof(uint32_t));
+		if (p == 0)
+			return ERR_NO_MEM;
+		*rels = p;
+		*capacity = new_capacity;
+	}
+
+	uint32_t i = *count;
+	while (i > 0 && (*rels)[i - 1] > rel)
+	{
+		(*rels)[i] = (*rels)[i - 1];
+		i--;
+	}
+	(*rels)[i] = rel;
+	(*count)++;
+	return 0;
+}
+
+// drop rel from the sorted array rels, moving those behind it by delta
+static void remove_rel(uint32_t *rels, uint32_t *count, uint32_t rel, int delta)
+{
+	uint32_t j = 0;
+	for (uint32_t i = 0; i < *count; i++)
+	{
+		if (rels[i] == rel)
+			continue;
+		rels[j++] = rels[i] > rel ? rels[i] + delta : rels[i];
+	}
+	*count = j;
+}
+
+static int add_kid_rel(fs_buf *fsbuf, dir_hash *dh, uint32_t off)
+{
+	uint32_t rel = off - dh->kids_off + 1;
+	if (is_dir_entry(fsbuf, off) && add_rel(&dh->dirs, &dh->dir_count, &dh->dir_capacity, rel) != 0)
+		return ERR_NO_MEM;
+	if (fsbuf->sorted && add_rel(&dh->kids, &dh->kid_count, &dh->kid_capacity, rel) != 0)
+		return ERR_NO_MEM;
+	return 0;
+}
+
+// (re)build dh from the names of its list
+static int fill_dir_hash(fs_buf *fsbuf, dir_hash *dh, uint32_t count)
+{
+	uint32_t size = 16;
+	while (size < count * 2)
+		size <<= 1;
+
+	uint32_t *slots = calloc(size, sizeof(uint32_t));
+	if (slots == 0)
+		return ERR_NO_MEM;
+
+	free(dh->slots);
+	dh->slots = slots;
+	dh->mask = size - 1;
+	dh->count = dh->used = dh->dir_count = dh->kid_count = 0;
+	for (uint32_t off = dh->kids_off; off < dh->tail_off; off = next_name(fsbuf, off))
+	{
+		const char *name = entry_name(fsbuf, fs_ptr(fsbuf, off));
+		put_slot(dh, hash_name(name, strlen(name)), off - dh->kids_off + 1);
+		if (add_kid_rel(fsbuf, dh, off) != 0)
+			return ERR_NO_MEM;
+	}
+	return 0;
+}
+
+// index of the first table whose kids_off >= off, tables are sorted by kids_off since lists never overlap
+static uint32_t lower_bound(fs_buf *fsbuf, uint32_t off)
+{
+	uint32_t lo = 0, hi = fsbuf->dir_hash_count;
+	while (lo < hi)
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (fsbuf->dir_hashes[mid].kids_off < off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void drop_dir_hash(fs_buf *fsbuf, uint32_t i)
+{
+	free(fsbuf->dir_hashes[i].slots);
+	free(fsbuf->dir_hashes[i].dirs);
+	free(fsbuf->dir_hashes[i].kids);
+	memmove(fsbuf->dir_hashes + i, fsbuf->dir_hashes + i + 1, (fsbuf->dir_hash_count - i - 1) * sizeof(dir_hash));
+	fsbuf->dir_hash_count--;
+}
+
+dir_hash *find_dir_hash(fs_buf *fsbuf, uint32_t kids_off)
+{
+	uint32_t i = lower_bound(fsbuf, kids_off);
+	return i < fsbuf->dir_hash_count && fsbuf->dir_hashes[i].kids_off == kids_off ? fsbuf->dir_hashes + i : 0;
+}
+
+int add_dir_hash(fs_buf *fsbuf, uint32_t kids_off, uint32_t tail_off, uint32_t count)
+{
+	uint32_t i = lower_bound(fsbuf, kids_off);
+	if (i < fsbuf->dir_hash_count && fsbuf->dir_hashes[i].kids_off == kids_off)
+		return 0;
+
+	dir_hash *p = realloc(fsbuf->dir_hashes, (fsbuf->dir_hash_count + 1) * sizeof(dir_hash));
+	if (p == 0)
+		return ERR_NO_MEM;
+	fsbuf->dir_hashes = p;
+
+	dir_hash dh = {.kids_off = kids_off, .tail_off = tail_off};
+	if (fill_dir_hash(fsbuf, &dh, count) != 0)
+	{
+		free(dh.slots);
+		free(dh.dirs);
+		free(dh.kids);
+		return ERR_NO_MEM;
+	}
+
+	memmove(fsbuf->dir_hashes + i + 1, fsbuf->dir_hashes + i, (fsbuf->dir_hash_count - i) * sizeof(dir_hash));
+	fsbuf->dir_hashes[i] = dh;
+	fsbuf->dir_hash_count++;
+	return 0;
+}
+
+void free_dir_hashes(fs_buf *fsbuf)
+{
+	for (uint32_t i = 0; i < fsbuf->dir_hash_count; i++)
+	{
+		free(fsbuf->dir_hashes[i].slots);
+		free(fsbuf->dir_hashes[i].dirs);
+		free(fsbuf->dir_hashes[i].kids);
+	}
+	free(fsbuf->dir_hashes);
+	fsbuf->dir_hashes = 0;
+	fsbuf->dir_hash_count = 0;
+}
+
+dir_hash *find_dir_hash_holding(fs_buf *fsbuf, uint32_t off)
+{
+	uint32_t i = lower_bound(fsbuf, off + 1);
+	if (i == 0)
+		return 0;
+
+	dir_hash *dh = fsbuf->dir_hashes + i - 1;
+	return off <= dh->tail_off ? dh : 0;
+}
+
+int lookup_dir_hash(fs_buf *fsbuf, uint32_t kids_off, const char *path, uint32_t *name_off)
+{
+	dir_hash *dh = find_dir_hash(fsbuf, kids_off);
+	if (dh == 0)
+		return 0;
+
+	const char *slash = strchr(path, '/');
+	uint32_t len = slash ? slash - path : strlen(path);
+	*name_off = 0;
+	for (uint32_t i = hash_name(path, len) & dh->mask; dh->slots[i] != SLOT_EMPTY; i = (i + 1) & dh->mask)
+	{
+		if (dh->slots[i] == SLOT_DELETED)
+			continue;
+
+		const char *name = entry_name(fsbuf, fs_ptr(fsbuf, dh->kids_off + dh->slots[i] - 1));
+		if (strncmp(name, path, len) == 0 && name[len] == 0)
+		{
+			*name_off = dh->kids_off + dh->slots[i] - 1;
+			break;
+		}
+	}
+	return 1;
+}
+
+// delta bytes (whole entries) were inserted at off inside the list of dh, they are already in the buffer
+static void insert_entries(fs_buf *fsbuf, dir_hash *dh, uint32_t off, int delta)
+{
+	uint32_t rel = off - dh->kids_off + 1, count = 0;
+	for (uint32_t i = 0; i <= dh->mask; i++)
+		if (dh->slots[i] != SLOT_EMPTY && dh->slots[i] != SLOT_DELETED && dh->slots[i] >= rel)
+			dh->slots[i] += delta;
+	for (uint32_t i = 0; i < dh->dir_count; i++)
+		if (dh->dirs[i] >= rel)
+			dh->dirs[i] += delta;
+	for (uint32_t i = 0; i < dh->kid_count; i++)
+		if (dh->kids[i] >= rel)
+			dh->kids[i] += delta;
+	dh->tail_off += delta;
+
+	for (uint32_t name_off = off; name_off < off + delta; name_off = next_name(fsbuf, name_off))
+		count++;
+
+	if ((dh->used + count) * 4 > (dh->mask + 1) * 3)
+	{
+		if (fill_dir_hash(fsbuf, dh, dh->count + count) != 0)
+			dh->count = (uint32_t)-1; // mark for dropping
+		return;
+	}
+
+	for (uint32_t name_off = off; name_off < off + delta; name_off = next_name(fsbuf, name_off))
+	{
+		const char *name = entry_name(fsbuf, fs_ptr(fsbuf, name_off));
+		put_slot(dh, hash_name(name, strlen(name)), name_off - dh->kids_off + 1);
+		if (add_kid_rel(fsbuf, dh, name_off) != 0)
+			dh->count = (uint32_t)-1;
+	}
+}
+
+// -delta bytes (exactly one entry) were removed at off inside the list of dh
+static void remove_entry(dir_hash *dh, uint32_t off, int delta)
+{
+	uint32_t rel = off - dh->kids_off + 1;
+	for (uint32_t i = 0; i <= dh->mask; i++)
+	{
+		if (dh->slots[i] == SLOT_EMPTY || dh->slots[i] == SLOT_DELETED || dh->slots[i] < rel)
+			continue;
+
+		if (dh->slots[i] == rel)
+		{
+			dh->slots[i] = SLOT_DELETED;
+			dh->count--;
+		}
+		else
+		{
+			dh->slots[i] += delta;
+		}
+	}
+
+	remove_rel(dh->dirs, &dh->dir_count, rel, delta);
+	remove_rel(dh->kids, &dh->kid_count, rel, delta);
+	dh->tail_off += delta;
+}
+
+void sync_dir_hashes(fs_buf *fsbuf, uint32_t off, int delta)
+{
+	for (uint32_t i = 0; i < fsbuf->dir_hash_count;)
+	{
+		dir_hash *dh = fsbuf->dir_hashes + i;
+		if (delta > 0)
+		{
+			// bytes inserted at a list's head belong to some list before it
+			if (off <= dh->kids_off)
+			{
+				dh->kids_off += delta;
+				dh->tail_off += delta;
+			}
+			else if (off <= dh->tail_off)
+			{
+				insert_entries(fsbuf, dh, off, delta);
+				if (dh->count == (uint32_t)-1)
+				{
+					drop_dir_hash(fsbuf, i);
+					continue;
+				}
+			}
+		}
+		else
+		{
+			uint32_t end_off = off - delta;
+			if (end_off <= dh->kids_off)
+			{
+				dh->kids_off += delta;
+				dh->tail_off += delta;
+			}
+			else if (off <= dh->tail_off && dh->tail_off < end_off)
+			{
+				// the whole list is gone
+				drop_dir_hash(fsbuf, i);
+				continue;
+			}
+			else if (off >= dh->kids_off && end_off <= dh->tail_off)
+			{
+				remove_entry(dh, off, delta);
+			}
+		}
+		i++;
+	}
+}
+
+int build_dir_hashes(fs_buf *fsbuf)
+{
+	free_dir_hashes(fsbuf);
+
+	// kids lists follow one another, each ended by its parent-tag
+	uint32_t list_off = fsbuf->first_name_off, count = 0;
+	for (uint32_t off = list_off; off < fsbuf->tail; off = next_name(fsbuf, off))
+	{
+		if (*fs_ptr(fsbuf, off))
+		{
+			count++;
+			continue;
+		}
+
+		if (count >= fsbuf->dir_hash_min_kids && add_dir_hash(fsbuf, list_off, off, count) != 0)
+		{
+			free_dir_hashes(fsbuf);
+			fsbuf->dir_hash_min_kids = 0;
+			return ERR_NO_MEM;
+		}
+		list_off = next_name(fsbuf, off);
+		count = 0;
+	}
+	return 0;
+}
+
+__attribute__((visibility("default"))) int enable_dir_hash(fs_buf *fsbuf, uint32_t min_kids)
+{
+	pthread_rwlock_wrlock(&fsbuf->lock);
+	fsbuf->dir_hash_min_kids = min_kids ? min_kids : DIR_HASH_MIN_KIDS;
+	int r = build_dir_hashes(fsbuf);
+	pthread_rwlock_unlock(&fsbuf->lock);
+	return r;
+}
@@ -0,0 +1,296 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs_buf.h"
+#include "fs_buf_base.h"
+#include "utils.h"
+
+#define EXT_LISTS_BLK_SIZE 64
+#define EXT_OFFS_BLK_SIZE 64
+
+// extension index: sorted offsets of the names of each extension, the lists sorted by extension.
+// lists are kept in step with the names like the parent index, new names of a sync are counted first,
+// so that each list makes room for them once
+
+// case-folded extension of name, 0 if it has none (or one too long to be indexed)
+static int name_ext(const char *name, char *ext)
+{
+	// as *.ext matches it, .bashrc has extension bashrc
+	const char *dot = strrchr(name, '.');
+	if (dot == 0 || dot[1] == 0 || strlen(dot + 1) > EXT_MAX_LEN)
+		return 0;
+
+	fold_bytes(ext, dot + 1, strlen(dot + 1) + 1);
+	return 1;
+}
+
+// first index of the list whose offset >= off
+static uint32_t lower_bound(const ext_list *el, uint32_t off)
+{
+	uint32_t lo = 0, hi = el->count;
+	while (lo < hi)
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (el->offs[mid] < off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+// the list of ext, created if create is set (0 if out of memory)
+static ext_list *find_ext_list(fs_buf *fsbuf, const char *ext, int create)
+{
+	uint32_t lo = 0, hi = fsbuf->ext_count;
+	while (lo < hi)
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		int r = strcmp(fsbuf->ext_lists[mid].ext, ext);
+		if (r == 0)
+			return fsbuf->ext_lists + mid;
+		if (r < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (!create)
+		return 0;
+
+	if (fsbuf->ext_count == fsbuf->ext_capacity)
+	{
+		uint32_t capacity = fsbuf->ext_capacity + EXT_LISTS_BLK_SIZE;
+		ext_list *p = realloc(fsbuf->ext_lists, capacity * sizeof(ext_list));
+		if (p == 0)
+			return 0;
+		fsbuf->ext_lists = p;
+		fsbuf->ext_capacity = capacity;
+	}
+
+	ext_list *el = fsbuf->ext_lists + lo;
+	memmove(el + 1, el, (fsbuf->ext_count - lo) * sizeof(ext_list));
+	memset(el, 0, sizeof(ext_list));
+	strcpy(el->ext, ext);
+	fsbuf->ext_count++;
+	return el;
+}
+
+static int reserve_ext_offs(ext_list *el, uint32_t count)
+{
+	if (count <= el->capacity)
+		return 0;
+
+	uint32_t capacity = el->capacity * 2;
+	if (capacity < count)
+		capacity = (count + EXT_OFFS_BLK_SIZE - 1) / EXT_OFFS_BLK_SIZE * EXT_OFFS_BLK_SIZE;
+	uint32_t *p = realloc(el->offs, capacity * sizeof(uint32_t));
+	if (p == 0)
+		return 1;
+
+	el->offs = p;
+	el->capacity = capacity;
+	return 0;
+}
+
+// add the names in [start_off, end_off), which must start with a name, the lists hold no offsets inside it
+static int add_ext_names(fs_buf *fsbuf, uint32_t start_off, uint32_t end_off)
+{
+	char ext[EXT_MAX_LEN + 1];
+	ext_list *el;
+	int added = 0;
+	for (uint32_t off = start_off; off < end_off; off = next_name(fsbuf, off))
+	{
+		if (!name_ext(entry_name(fsbuf, fs_ptr(fsbuf, off)), ext))
+			continue;
+		if ((el = find_ext_list(fsbuf, ext, 1)) == 0)
+			return ERR_NO_MEM;
+		el->pending++;
+		added = 1;
+	}
+	if (!added)
+		return 0;
+
+	for (uint32_t i = 0; i < fsbuf->ext_count; i++)
+	{
+		el = fsbuf->ext_lists + i;
+		if (el->pending == 0)
+			continue;
+
+		if (reserve_ext_offs(el, el->count + el->pending) != 0)
+			return ERR_NO_MEM;
+		el->fill = lower_bound(el, start_off);
+		memmove(el->offs + el->fill + el->pending, el->offs + el->fill, (el->count - el->fill) * sizeof(uint32_t));
+		el->count += el->pending;
+		el->pending = 0;
+	}
+
+	for (uint32_t off = start_off; off < end_off; off = next_name(fsbuf, off))
+	{
+		if (name_ext(entry_name(fsbuf, fs_ptr(fsbuf, off)), ext))
+		{
+			el = find_ext_list(fsbuf, ext, 0);
+			el->offs[el->fill++] = off;
+		}
+	}
+	return 0;
+}
+
+// add the names in [start_off, end_off) behind all others (e.g. appended by build_fstree), which only go
+// to the end of their own lists
+static int append_ext_names(fs_buf *fsbuf, uint32_t start_off, uint32_t end_off)
+{
+	char ext[EXT_MAX_LEN + 1];
+	for (uint32_t off = start_off; off < end_off; off = next_name(fsbuf, off))
+	{
+		if (!name_ext(entry_name(fsbuf, fs_ptr(fsbuf, off)), ext))
+			continue;
+		ext_list *el = find_ext_list(fsbuf, ext, 1);
+		if (el == 0 || reserve_ext_offs(el, el->count + 1) != 0)
+			return ERR_NO_MEM;
+		el->offs[el->count++] = off;
+	}
+	return 0;
+}
+
+void free_ext_index(fs_buf *fsbuf)
+{
+	for (uint32_t i = 0; i < fsbuf->ext_count; i++)
+		free(fsbuf->ext_lists[i].offs);
+	free(fsbuf->ext_lists);
+	fsbuf->ext_lists = 0;
+	fsbuf->ext_count = fsbuf->ext_capacity = 0;
+}
+
+int copy_ext_index(fs_buf *dst, fs_buf *src)
+{
+	free_ext_index(dst);
+	if (src->ext_lists == 0)
+		return 0;
+
+	dst->ext_lists = calloc(src->ext_capacity, sizeof(ext_list));
+	if (dst->ext_lists == 0)
+		return ERR_NO_MEM;
+	dst->ext_capacity = src->ext_capacity;
+
+	for (uint32_t i = 0; i < src->ext_count; i++)
+	{
+		ext_list *el = dst->ext_lists + i;
+		strcpy(el->ext, src->ext_lists[i].ext);
+		dst->ext_count++;
+		if (src->ext_lists[i].count == 0)
+			continue;
+
+		if (reserve_ext_offs(el, src->ext_lists[i].count) != 0)
+		{
+			free_ext_index(dst);
+			return ERR_NO_MEM;
+		}
+		memcpy(el->offs, src->ext_lists[i].offs, src->ext_lists[i].count * sizeof(uint32_t));
+		el->count = src->ext_lists[i].count;
+	}
+	return 0;
+}
+
+void sync_ext_index(fs_buf *fsbuf, uint32_t off, int delta)
+{
+	if (fsbuf->ext_lists == 0)
+		return;
+
+	// no list holds an offset behind the tail, appends shift nothing
+	if (delta > 0 && off + delta == fsbuf->tail)
+	{
+		if (append_ext_names(fsbuf, off, off + delta) != 0)
+			free_ext_index(fsbuf);
+		return;
+	}
+
+	for (uint32_t i = 0; i < fsbuf->ext_count; i++)
+	{
+		ext_list *el = fsbuf->ext_lists + i;
+		uint32_t first = lower_bound(el, off);
+		if (delta < 0)
+		{
+			// drop the removed names
+			uint32_t last = lower_bound(el, off - delta);
+			memmove(el->offs + first, el->offs + last, (el->count - last) * sizeof(uint32_t));
+			el->count -= last - first;
+		}
+
+		for (uint32_t j = first; j < el->count; j++)
+			el->offs[j] += delta;
+	}
+
+	if (delta > 0 && add_ext_names(fsbuf, off, off + delta) != 0)
+		free_ext_index(fsbuf);
+}
+
+__attribute__((visibility("default"))) int enable_ext_index(fs_buf *fsbuf)
+{
+	pthread_rwlock_wrlock(&fsbuf->lock);
+	int r = 0;
+	if (fsbuf->ext_lists == 0)
+	{
+		// snapshots taken from now on carry the index
+		fsbuf->generation++;
+		// an empty index is told from a missing one by its allocated lists
+		fsbuf->ext_lists = malloc(EXT_LISTS_BLK_SIZE * sizeof(ext_list));
+		fsbuf->ext_capacity = fsbuf->ext_lists ? EXT_LISTS_BLK_SIZE : 0;
+		if (fsbuf->ext_lists == 0 || add_ext_names(fsbuf, fsbuf->first_name_off, fsbuf->tail) != 0)
+		{
+			free_ext_index(fsbuf);
+			r = ERR_NO_MEM;
+		}
+	}
+	pthread_rwlock_unlock(&fsbuf->lock);
+	return r;
+}
+
+__attribute__((visibility("default"))) int has_ext_index(fs_buf *fsbuf)
+{
+	return fsbuf->ext_lists != 0;
+}
+
+__attribute__((visibility("default"))) void search_files_ext(fs_buf *fsbuf, uint32_t *start_off, uint32_t end_off, uint32_t *results, uint32_t *count,
+							const char *ext)
+{
+	uint32_t size = *count;
+	*count = 0;
+	pthread_rwlock_rdlock(&fsbuf->lock);
+	uint32_t min_off = fsbuf->tail > end_off ? end_off : fsbuf->tail, name_off = *start_off;
+	char folded[EXT_MAX_LEN + 1], name_ext_buf[EXT_MAX_LEN + 1];
+	int indexed = strlen(ext) <= EXT_MAX_LEN;
+	if (indexed)
+		fold_bytes(folded, ext, strlen(ext) + 1);
+
+	if (indexed && fsbuf->ext_lists)
+	{
+		ext_list *el = find_ext_list(fsbuf, folded, 0);
+		uint32_t i = el ? lower_bound(el, name_off) : 0;
+		for (; el && i < el->count && el->offs[i] < min_off && *count < size; i++)
+		{
+			results[*count] = el->offs[i];
+			*count = *count + 1;
+		}
+		// as search_files, a full page stops right behind its last result
+		if (name_off < min_off && size > 0)
+			name_off = *count == size ? next_name(fsbuf, results[size - 1]) : min_off;
+	}
+	else if (indexed)
+	{
+		for (; name_off < min_off && *count < size; name_off = next_name(fsbuf, name_off))
+		{
+			if (name_ext(entry_name(fsbuf, fs_ptr(fsbuf, name_off)), name_ext_buf) && strcmp(name_ext_buf, folded) == 0)
+			{
+				results[*count] = name_off;
+				*count = *count + 1;
+			}
+		}
+	}
+	else if (name_off < min_off && size > 0)
+	{
+		// extensions too long to be indexed match no name either
+		name_off = min_off;
+	}
+	pthread_rwlock_unlock(&fsbuf->lock);
+	*start_off = name_off;
+}
@@ -0,0 +1,117 @@
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "fs_buf.h"
+#include "fs_buf_base.h"
+#include "utils.h"
+
+// transparent huge pages: head is kept in an anonymous mapping aligned to & sized in huge pages and advised
+// with MADV_HUGEPAGE, so that scans over hundreds of MB take a TLB entry per 2 MB instead of per 4 KB.
+// the mapping grows by mremap, which moves pages instead of copying them
+
+#define HUGE_PAGE_SIZE (2 << 20)
+
+static uint64_t huge_len(uint32_t size)
+{
+	return ((uint64_t)size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+}
+
+// 0 if the kernel has no transparent huge pages, or they are turned off
+static int huge_pages_available()
+{
+	FILE *fp = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+	if (fp == 0)
+		return 0;
+
+	char mode[64] = {0};
+	int r = fgets(mode, sizeof(mode), fp) != 0 && strstr(mode, "[never]") == 0;
+	fclose(fp);
+	return r;
+}
+
+// len bytes of anonymous mapping aligned to a huge page, 0 if failed
+static char *reserve_huge(uint64_t len)
+{
+	char *p = mmap(0, len + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return 0;
+
+	char *start = (char *)(((uintptr_t)p + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+	if (start > p)
+		munmap(p, start - p);
+	munmap(start + len, p + HUGE_PAGE_SIZE - start);
+	return start;
+}
+
+int map_huge_head(fs_buf *fsbuf, uint32_t size)
+{
+	uint64_t len = huge_len(size);
+	char *p = reserve_huge(len);
+	if (p == 0)
+		return ERR_NO_MEM;
+
+	if (madvise(p, len, MADV_HUGEPAGE) != 0)
+	{
+		munmap(p, len);
+		return ERR_NO_MEM;
+	}
+
+	memcpy(p, fsbuf->head, size < fsbuf->tail ? size : fsbuf->tail);
+	free_head(fsbuf);
+	fsbuf->head = p;
+	fsbuf->huge_size = len;
+	fsbuf->mapped_size = 0;
+	return 0;
+}
+
+int remap_huge_head(fs_buf *fsbuf, uint32_t size)
+{
+	uint64_t len = huge_len(size);
+	if (len == fsbuf->huge_size)
+		return 0;
+
+	// in place if the room behind is free (always when shrinking), otherwise the pages move to a new aligned room
+	char *p = mremap(fsbuf->head, fsbuf->huge_size, len, 0);
+	if (p == MAP_FAILED)
+	{
+		char *room = reserve_huge(len);
+		if (room == 0)
+			return ERR_NO_MEM;
+
+		p = mremap(fsbuf->head, fsbuf->huge_size, len, MREMAP_MAYMOVE | MREMAP_FIXED, room);
+		if (p == MAP_FAILED)
+		{
+			munmap(room, len);
+			return ERR_NO_MEM;
+		}
+	}
+
+	// the advice is kept by pages moved, not by those added
+	madvise(p, len, MADV_HUGEPAGE);
+	fsbuf->head = p;
+	fsbuf->huge_size = len;
+	return 0;
+}
+
+__attribute__((visibility("default"))) int enable_huge_pages(fs_buf *fsbuf)
+{
+	pthread_rwlock_wrlock(&fsbuf->lock);
+	int r = 0;
+	// segments are small blocks of their own, the head of a segmented buffer holds only the header
+	if (fsbuf->huge_size == 0 && fsbuf->segs == 0 && fsbuf->seg_pending == 0 && huge_pages_available())
+	{
+		r = map_huge_head(fsbuf, fsbuf->capacity);
+		fsbuf->huge_pages = r == 0;
+	}
+	pthread_rwlock_unlock(&fsbuf->lock);
+	return r;
+}
+
+__attribute__((visibility("default"))) int has_huge_pages(fs_buf *fsbuf)
+{
+	return fsbuf->huge_size != 0;
+}
@@ -0,0 +1,389 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs_buf.h"
+#include "fs_buf_base.h"
+#include "utils.h"
+
+// interned names: names repeated across the tree are kept once in a dictionary shared by the fs_buf & its
+// snapshots, their entries hold a reference (see NAME_REF) instead. enabling recodes all names into a new flat
+// buffer, offsets are then moved by a map of the entries changed, which is like the shifts of many changes at once.
+// the dictionary is never changed afterwards, so it is read without locks
+
+// bytes a dictionary name costs besides its text: its \0 & tag, offs & two slots
+#define DICT_NAME_COST (2 + sizeof(uint32_t) * 3)
+
+// an entry whose stored size changes, total is the change up to and including it
+typedef struct __name_shift__
+{
+	uint32_t off;
+	int32_t total;
+} name_shift;
+
+// copies of a name by the offset of the first one
+typedef struct __name_count__
+{
+	uint32_t off;
+	uint32_t count;
+} name_count;
+
+static uint32_t hash_name(const char *name)
+{
+	uint32_t result = 0;
+	for (; *name; name++)
+		result = result * 31 + (unsigned char)*name;
+	return result;
+}
+
+// id of name, -1 if not in dict
+static int lookup_name(const name_dict *dict, const char *name)
+{
+	for (uint32_t i = hash_name(name) & dict->mask; dict->slots[i]; i = (i + 1) & dict->mask)
+		if (strcmp(dict->pool + dict->offs[dict->slots[i] - 1], name) == 0)
+			return dict->slots[i] - 1;
+	return -1;
+}
+
+// names too short to save a byte or starting with NAME_REF are never interned
+static int name_ref(const name_dict *dict, const char *name)
+{
+	return dict && *name != NAME_REF && strlen(name) > NAME_REF_SIZE ? lookup_name(dict, name) : -1;
+}
+
+uint32_t stored_name_len(const name_dict *dict, const char *name)
+{
+	if (name_ref(dict, name) >= 0)
+		return NAME_REF_SIZE;
+	return strlen(name) + (dict && *name == NAME_REF);
+}
+
+void store_name(const name_dict *dict, char *dst, const char *name)
+{
+	int id = name_ref(dict, name);
+	if (id >= 0)
+	{
+		dst[0] = NAME_REF;
+		dst[1] = 0x80 | (id & 0x7f);
+		dst[2] = 0x80 | (id >> 7 & 0x7f);
+		dst[3] = 0x80 | (id >> 14 & 0x7f);
+		dst[4] = 0;
+		return;
+	}
+
+	if (dict && *name == NAME_REF)
+		*dst++ = NAME_REF;
+	strcpy(dst, name);
+}
+
+void release_name_dict(name_dict *dict)
+{
+	if (dict == 0 || __atomic_sub_fetch(&dict->refs, 1, __ATOMIC_ACQ_REL) != 0)
+		return;
+
+	free(dict->offs);
+	free(dict->pool);
+	free(dict->slots);
+	free(dict);
+}
+
+uint64_t name_dict_size(const name_dict *dict)
+{
+	if (dict == 0)
+		return 0;
+	return sizeof(name_dict) + (uint64_t)dict->count * sizeof(uint32_t) + dict->pool_size + (uint64_t)(dict->mask + 1) * sizeof(uint32_t);
+}
+
+static int put_name_count(fs_buf *fsbuf, name_count *counts, uint32_t mask, uint32_t off)
+{
+	const char *name = fs_ptr(fsbuf, off);
+	uint32_t i = hash_name(name) & mask;
+	while (counts[i].off && strcmp(fs_ptr(fsbuf, counts[i].off), name) != 0)
+		i = (i + 1) & mask;
+	if (counts[i].off == 0)
+		counts[i].off = off;
+	return counts[i].count++ == 0;
+}
+
+// copies of each name worth interning, 0 if out of memory
+static name_count *count_names(fs_buf *fsbuf, uint32_t *mask)
+{
+	uint32_t size = 1 << 16, used = 0;
+	name_count *counts = calloc(size, sizeof(name_count));
+	for (uint32_t off = fsbuf->first_name_off; counts && off < fsbuf->tail; off = next_name(fsbuf, off))
+	{
+		const char *name = fs_ptr(fsbuf, off);
+		if (*name == NAME_REF || strlen(name) <= NAME_REF_SIZE)
+			continue;
+
+		if ((used + 1) * 2 > size)
+		{
+			name_count *p = calloc(size * 2, sizeof(name_count));
+			for (uint32_t i = 0; p && i < size; i++)
+			{
+				if (counts[i].off == 0)
+					continue;
+				uint32_t j = hash_name(fs_ptr(fsbuf, counts[i].off)) & (size * 2 - 1);
+				while (p[j].off)
+					j = (j + 1) & (size * 2 - 1);
+				p[j] = counts[i];
+			}
+			free(counts);
+			counts = p;
+			size *= 2;
+			if (counts == 0)
+				break;
+		}
+		used += put_name_count(fsbuf, counts, size - 1, off);
+	}
+	*mask = size - 1;
+	return counts;
+}
+
+// dictionary of the names whose copies take more than the references & the dictionary would
+static name_dict *build_dict(fs_buf *fsbuf)
+{
+	uint32_t mask, count = 0, pool_size = 0;
+	name_count *counts = count_names(fsbuf, &mask);
+	if (counts == 0)
+		return 0;
+
+	for (uint32_t i = 0; i <= mask; i++)
+	{
+		if (counts[i].off == 0)
+			continue;
+
+		uint32_t len = strlen(fs_ptr(fsbuf, counts[i].off));
+		if (count < MAX_NAME_REFS && (uint64_t)counts[i].count * (len - NAME_REF_SIZE) > len + DICT_NAME_COST)
+		{
+			count++;
+			pool_size += len + 2;
+		}
+		else
+		{
+			counts[i].off = 0;
+		}
+	}
+
+	uint32_t size = 16;
+	while (size < count * 2)
+		size <<= 1;
+	name_dict *dict = calloc(1, sizeof(name_dict));
+	if (dict)
+	{
+		dict->refs = 1;
+		dict->mask = size - 1;
+		dict->pool_size = pool_size;
+		dict->offs = malloc(count ? count * sizeof(uint32_t) : 1);
+		dict->pool = malloc(pool_size ? pool_size : 1);
+		dict->slots = calloc(size, sizeof(uint32_t));
+	}
+	if (dict == 0 || dict->offs == 0 || dict->pool == 0 || dict->slots == 0)
+	{
+		release_name_dict(dict);
+		free(counts);
+		return 0;
+	}
+
+	for (uint32_t i = 0, used = 0; i <= mask; i++)
+	{
+		if (counts[i].off == 0)
+			continue;
+
+		const char *name = fs_ptr(fsbuf, counts[i].off);
+		dict->offs[dict->count] = used;
+		strcpy(dict->pool + used, name);
+		used += strlen(name) + 1;
+		dict->pool[used++] = FS_TAG_FILE;
+
+		uint32_t j = hash_name(name) & dict->mask;
+		while (dict->slots[j])
+			j = (j + 1) & dict->mask;
+		dict->slots[j] = ++dict->count;
+	}
+	free(counts);
+	return dict;
+}
+
+// new offset of the entry (or parent-tag) at off
+static uint32_t map_off(const name_shift *shifts, uint32_t count, uint32_t off)
+{
+	// shifts of the entries before off
+	uint32_t lo = 0, hi = count;
+	while (lo < hi)
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (shifts[mid].off < off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo ? off + shifts[lo - 1].total : off;
+}
+
+// map of the entries whose stored size differs with dict (0 for the plain layout), 0 if out of memory
+static name_shift *map_names(fs_buf *fsbuf, const name_dict *dict, uint32_t *count, int64_t *total)
+{
+	uint32_t capacity = 1024;
+	name_shift *shifts = malloc(capacity * sizeof(name_shift));
+	*count = 0;
+	*total = 0;
+	for (uint32_t off = fsbuf->first_name_off; shifts && off < fsbuf->tail; off = next_name(fsbuf, off))
+	{
+		const char *p = fs_ptr(fsbuf, off);
+		if (*p == 0)
+			continue;
+
+		int delta = (int)stored_name_len(dict, entry_name(fsbuf, p)) - (int)strlen(p);
+		if (delta == 0)
+			continue;
+
+		if (*count == capacity)
+		{
+			name_shift *q = realloc(shifts, capacity * 2 * sizeof(name_shift));
+			if (q == 0)
+			{
+				free(shifts);
+				return 0;
+			}
+			shifts = q;
+			capacity *= 2;
+		}
+		*total += delta;
+		shifts[*count].off = off;
+		shifts[*count].total = *total;
+		*count = *count + 1;
+	}
+	return shifts;
+}
+
+// the names of fsbuf stored with dict in a new flat head of *capacity bytes, the tags moved by shifts
+static char *recode_names(fs_buf *fsbuf, const name_dict *dict, const name_shift *shifts, uint32_t count,
+						  uint32_t tail, uint32_t *capacity)
+{
+	*capacity = (uint64_t)tail + FS_NEW_BLK_SIZE > max_fsbuf_size(fsbuf) ? tail : tail + FS_NEW_BLK_SIZE;
+	char *head = malloc(*capacity);
+	if (head == 0)
+		return 0;
+
+	memcpy(head, fsbuf->head, fsbuf->first_name_off);
+	for (uint32_t off = fsbuf->first_name_off, k = 0; off < fsbuf->tail; off = next_name(fsbuf, off))
+	{
+		const char *p = fs_ptr(fsbuf, off);
+		while (k < count && shifts[k].off < off)
+			k++;
+		uint32_t new_off = k ? off + shifts[k - 1].total : off, rel;
+		char *dst = head + new_off;
+		if (*p == 0)
+		{
+			// parent is ahead, 0 means root
+			*dst = 0;
+			rel = get_tag_reloff(fsbuf, p + 1);
+			set_dir_tag(fsbuf, dst + 1, rel ? new_off + 1 - map_off(shifts, count, off + 1 - rel) : 0);
+			continue;
+		}
+
+		uint32_t len = strlen(p);
+		store_name(dict, dst, entry_name(fsbuf, p));
+		dst += strlen(dst) + 1;
+		if (p[len + 1] == FS_TAG_FILE)
+		{
+			*dst = FS_TAG_FILE;
+			continue;
+		}
+		// kids are behind
+		rel = get_tag_reloff(fsbuf, p + len + 1);
+		set_dir_tag(fsbuf, dst, rel ? map_off(shifts, count, off + len + 1 + rel) - (dst - head) : 0);
+	}
+	return head;
+}
+
+int expand_names(fs_buf *fsbuf, fs_buf *flat)
+{
+	uint32_t count;
+	int64_t total;
+	name_shift *shifts = map_names(fsbuf, 0, &count, &total);
+	if (shifts == 0 || fsbuf->tail + total > max_fsbuf_size(fsbuf))
+	{
+		free(shifts);
+		return ERR_NO_MEM;
+	}
+
+	memset(flat, 0, sizeof(fs_buf));
+	flat->large = fsbuf->large;
+	flat->first_name_off = fsbuf->first_name_off;
+	flat->tail = fsbuf->tail + total;
+	flat->head = recode_names(fsbuf, 0, shifts, count, flat->tail, &flat->capacity);
+	free(shifts);
+	return flat->head ? 0 : ERR_NO_MEM;
+}
+
+static int intern_names(fs_buf *fsbuf)
+{
+	name_dict *dict = build_dict(fsbuf);
+	if (dict == 0)
+		return ERR_NO_MEM;
+
+	uint32_t count, capacity;
+	int64_t total;
+	name_shift *shifts = map_names(fsbuf, dict, &count, &total);
+	char *head = shifts && fsbuf->tail + total <= max_fsbuf_size(fsbuf) ? recode_names(fsbuf, dict, shifts, count, fsbuf->tail + total, &capacity) : 0;
+	if (head == 0)
+	{
+		free(shifts);
+		release_name_dict(dict);
+		return ERR_NO_MEM;
+	}
+
+	// snapshots taken from now on are of the new buffer, cursors of older generations can not follow it
+	fsbuf->generation++;
+	fsbuf->shift_floor = fsbuf->generation;
+	int folded = fsbuf->fold || fsbuf->seg_fold, segmented = fsbuf->segs || fsbuf->seg_pending;
+	free_segments(fsbuf);
+	fsbuf->seg_fold = fsbuf->seg_pending = 0;
+	free_head(fsbuf);
+	free(fsbuf->fold);
+	fsbuf->fold = 0;
+	fsbuf->head = head;
+	fsbuf->tail += total;
+	fsbuf->capacity = capacity;
+	fsbuf->mapped_size = 0;
+	fsbuf->huge_size = 0;
+	fsbuf->names = dict;
+	// a plain head if it can not be mapped
+	if (fsbuf->huge_pages)
+		map_huge_head(fsbuf, capacity);
+
+	// rows & postings keep their order
+	for (uint32_t i = 0; i < fsbuf->meta_count; i++)
+		fsbuf->meta_offs[i] = map_off(shifts, count, fsbuf->meta_offs[i]);
+	for (uint32_t i = 0; i < fsbuf->node_count; i++)
+		fsbuf->node_offs[i] = map_off(shifts, count, fsbuf->node_offs[i]);
+	remap_node_index(fsbuf);
+	for (uint32_t i = 0; i < fsbuf->ext_count; i++)
+		for (uint32_t j = 0; j < fsbuf->ext_lists[i].count; j++)
+			fsbuf->ext_lists[i].offs[j] = map_off(shifts, count, fsbuf->ext_lists[i].offs[j]);
+	free(shifts);
+
+	build_parent_index(fsbuf);
+	if (fsbuf->dir_hash_min_kids)
+		build_dir_hashes(fsbuf);
+	// the fold is a copy of the new bytes, references included
+	if (folded && (fsbuf->fold = malloc(fsbuf->capacity)) != 0)
+		fold_head(fsbuf);
+	if (segmented)
+		seg_convert(fsbuf);
+	return 0;
+}
+
+__attribute__((visibility("default"))) int enable_interned_names(fs_buf *fsbuf)
+{
+	pthread_rwlock_wrlock(&fsbuf->lock);
+	int r = fsbuf->names ? 0 : intern_names(fsbuf);
+	pthread_rwlock_unlock(&fsbuf->lock);
+	return r;
+}
+
+__attribute__((visibility("default"))) int has_interned_names(fs_buf *fsbuf)
+{
+	return fsbuf->names != 0;
+}
@@ -0,0 +1,298 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <stdio.h>
+
+#include "fs_buf.h"
+#include "fs_buf_base.h"
+#include "utils.h"
+
+// write-ahead journal: changes applied since a fs_buf was saved, appended to <lft file>.journal.
+// the header binds the journal to one saved base file, which is replaced (new inode or mtime)
+// by the next checkpoint, so a journal left behind by a crash in between is never replayed twice.
+// records: payload size, checksum of payload, then op type, is_dir, path\0 [dst_path\0].
+// the records of one call (e.g. of apply_changes, failed ops included) are replayed as that call was applied,
+// the last one is flagged in its type byte. names then come back at the same offsets as before the crash
+
+static const char journal_magic[] = "LFJ";
+
+typedef struct __journal_header__
+{
+	char magic[4];
+	uint32_t base_size;
+	uint64_t base_ino;
+	int64_t base_mtime_sec;
+	int64_t base_mtime_nsec;
+} journal_header;
+
+#define RECORD_HEAD_SIZE (sizeof(uint32_t) * 2)
+#define RECORD_MIN_SIZE 4
+// set in the type byte of the last record of a call
+#define RECORD_CALL_END 0x80
+
+static uint32_t checksum(const char *p, uint32_t size)
+{
+	uint32_t h = 2166136261u;
+	for (uint32_t i = 0; i < size; i++)
+		h = (h ^ (unsigned char)p[i]) * 16777619u;
+	return h;
+}
+
+static void journal_path(const char *filename, char *path)
+{
+	snprintf(path, PATH_MAX, "%s%s", filename, FS_JOURNAL_SUFFIX);
+}
+
+static int make_header(const char *filename, journal_header *header)
+{
+	struct stat st;
+	if (stat(filename, &st) != 0)
+		return 1;
+
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, journal_magic, sizeof(journal_magic));
+	header->base_size = st.st_size;
+	header->base_ino = st.st_ino;
+	header->base_mtime_sec = st.st_mtim.tv_sec;
+	header->base_mtime_nsec = st.st_mtim.tv_nsec;
+	return 0;
+}
+
+// read the records of filename's journal into *data, 0 if there is no journal for the current base
+static uint32_t read_journal(int fd, const char *filename, char **data)
+{
+	journal_header expected, header;
+	struct stat st;
+	*data = 0;
+	if (make_header(filename, &expected) != 0 || fstat(fd, &st) != 0 || st.st_size <= sizeof(header))
+		return 0;
+
+	if (read(fd, &header, sizeof(header)) != sizeof(header) || memcmp(&header, &expected, sizeof(header)) != 0)
+		return 0;
+
+	uint32_t size = st.st_size - sizeof(header);
+	*data = malloc(size);
+	if (*data == 0 || read_file(fd, *data, size) != 0)
+	{
+		free(*data);
+		*data = 0;
+		return 0;
+	}
+	return size;
+}
+
+// size of the leading whole & intact records, a crash may leave a torn one behind
+static uint32_t valid_records_size(const char *data, uint32_t size, uint32_t *count)
+{
+	uint32_t off = 0;
+	*count = 0;
+	while (size - off >= RECORD_HEAD_SIZE)
+	{
+		uint32_t payload_size = *(uint32_t *)(data + off), sum = *(uint32_t *)(data + off + sizeof(uint32_t));
+		const char *payload = data + off + RECORD_HEAD_SIZE;
+		if (payload_size < RECORD_MIN_SIZE || payload_size > size - off - RECORD_HEAD_SIZE || checksum(payload, payload_size) != sum)
+			break;
+		if (payload[payload_size - 1] != 0)
+			break;
+
+		off += RECORD_HEAD_SIZE + payload_size;
+		(*count)++;
+	}
+	return off;
+}
+
+int replay_journal(fs_buf *fsbuf, const char *filename)
+{
+	char path[PATH_MAX];
+	journal_path(filename, path);
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	char *data;
+	uint32_t size = read_journal(fd, filename, &data), count;
+	close(fd);
+	size = valid_records_size(data, size, &count);
+	if (count == 0)
+	{
+		free(data);
+		return 0;
+	}
+
+	fs_op *ops = malloc(count * sizeof(fs_op));
+	if (ops == 0)
+	{
+		free(data);
+		return ERR_NO_MEM;
+	}
+
+	// ops failing now failed the same way before (e.g. a removed file created again), nothing else to do.
+	// a call torn off by the crash is applied as far as it got
+	uint32_t start = 0;
+	for (uint32_t off = 0, i = 0; off < size; i++)
+	{
+		const char *payload = data + off + RECORD_HEAD_SIZE;
+		ops[i].type = (unsigned char)payload[0] & ~RECORD_CALL_END;
+		ops[i].is_dir = payload[1];
+		ops[i].path = payload + 2;
+		ops[i].dst_path = ops[i].type == FS_OP_RENAME ? ops[i].path + strlen(ops[i].path) + 1 : 0;
+		off += RECORD_HEAD_SIZE + *(uint32_t *)(data + off);
+		if ((payload[0] & RECORD_CALL_END) || off == size)
+		{
+			apply_changes(fsbuf, ops + start, i + 1 - start);
+			start = i + 1;
+		}
+	}
+	free(ops);
+	free(data);
+	return 0;
+}
+
+static void drop_journal(fs_buf *fsbuf)
+{
+	if (fsbuf->journal_fd >= 0)
+		close(fsbuf->journal_fd);
+	free(fsbuf->journal_base);
+	fsbuf->journal_fd = -1;
+	fsbuf->journal_size = 0;
+	fsbuf->journal_base = 0;
+}
+
+void journal_ops(fs_buf *fsbuf, const fs_op *ops, uint32_t count)
+{
+	if (fsbuf->journal_fd < 0)
+		return;
+
+	// a call changing nothing is left out, the failed ops of others are kept as they group the inserts around them
+	uint32_t size = 0, succeeded = 0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		succeeded += ops[i].result == 0;
+		size += RECORD_HEAD_SIZE + 2 + strlen(ops[i].path) + 1 + (ops[i].type == FS_OP_RENAME ? strlen(ops[i].dst_path) + 1 : 0);
+	}
+	if (succeeded == 0)
+		return;
+
+	// one write for all ops, so records of a call are never interleaved with others
+	char *data = malloc(size), *p = data;
+	if (data == 0)
+	{
+		drop_journal(fsbuf);
+		return;
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		char *payload = p + RECORD_HEAD_SIZE, *q = payload;
+		*q++ = ops[i].type | (i + 1 == count ? RECORD_CALL_END : 0);
+		*q++ = ops[i].is_dir;
+		strcpy(q, ops[i].path);
+		q += strlen(q) + 1;
+		if (ops[i].type == FS_OP_RENAME)
+		{
+			strcpy(q, ops[i].dst_path);
+			q += strlen(q) + 1;
+		}
+		*(uint32_t *)p = q - payload;
+		*(uint32_t *)(p + sizeof(uint32_t)) = checksum(payload, q - payload);
+		p = q;
+	}
+
+	// a journal missing changes must not be used, callers fall back to saving the whole buffer
+	if (write_file(fsbuf->journal_fd, data, size) != 0)
+		drop_journal(fsbuf);
+	else
+		fsbuf->journal_size += size;
+	free(data);
+}
+
+// start a new journal for the base just saved as filename, fd is opened with O_APPEND
+static int reset_journal(fs_buf *fsbuf, int fd, const char *filename)
+{
+	journal_header header;
+	if (make_header(filename, &header) != 0 || ftruncate(fd, 0) != 0 || write_file(fd, (char *)&header, sizeof(header)) != 0)
+		return 1;
+	fsbuf->journal_size = sizeof(header);
+	return 0;
+}
+
+__attribute__((visibility("default"))) int open_fs_journal(fs_buf *fsbuf, const char *filename)
+{
+	char path[PATH_MAX];
+	journal_path(filename, path);
+	char *base = strdup(filename);
+	int fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (base == 0 || fd < 0)
+	{
+		free(base);
+		if (fd >= 0)
+			close(fd);
+		return 1;
+	}
+
+	pthread_rwlock_wrlock(&fsbuf->lock);
+	drop_journal(fsbuf);
+
+	// keep the records of the current base (replayed by load), dropping a torn tail
+	char *data;
+	uint32_t size = read_journal(fd, filename, &data), count;
+	int r;
+	if (data)
+	{
+		size = valid_records_size(data, size, &count);
+		free(data);
+		r = ftruncate(fd, sizeof(journal_header) + size) != 0;
+		fsbuf->journal_size = sizeof(journal_header) + size;
+	}
+	else
+	{
+		r = reset_journal(fsbuf, fd, filename);
+	}
+
+	if (r != 0)
+	{
+		free(base);
+		close(fd);
+		pthread_rwlock_unlock(&fsbuf->lock);
+		return 2;
+	}
+	fsbuf->journal_fd = fd;
+	fsbuf->journal_base = base;
+	pthread_rwlock_unlock(&fsbuf->lock);
+	return 0;
+}
+
+__attribute__((visibility("default"))) void close_fs_journal(fs_buf *fsbuf)
+{
+	pthread_rwlock_wrlock(&fsbuf->lock);
+	drop_journal(fsbuf);
+	pthread_rwlock_unlock(&fsbuf->lock);
+}
+
+__attribute__((visibility("default"))) int has_fs_journal(fs_buf *fsbuf)
+{
+	return fsbuf->journal_fd >= 0;
+}
+
+__attribute__((visibility("default"))) uint32_t get_journal_size(fs_buf *fsbuf)
+{
+	return fsbuf->journal_size;
+}
+
+__attribute__((visibility("default"))) int checkpoint_fs_buf(fs_buf *fsbuf, const char *filename)
+{
+	// no change may slip in between saving the base and emptying the journal
+	pthread_rwlock_wrlock(&fsbuf->lock);
+	int r = do_save_fs_buf(fsbuf, filename, 1);
+	if (r == 0 && fsbuf->journal_fd >= 0 && reset_journal(fsbuf, fsbuf->journal_fd, filename) != 0)
+	{
+		drop_journal(fsbuf);
+		r = 3;
+	}
+	pthread_rwlock_unlock(&fsbuf->lock);
+	return r;
+}
@@ -0,0 +1,318 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "fs_buf.h"
+#include "fs_buf_base.h"
+#include "utils.h"
+
+#define META_ROWS_BLK_SIZE 4096
+
+// metadata index: size, mtime & mode of each name in columns, one row per name sorted by offset.
+// rows are kept in step with the names like the parent index, filters scan the columns instead of the names.
+// rows of names whose metadata is not known (e.g. stat failed) have mode 0
+
+// first row whose name offset >= off
+static uint32_t lower_bound(fs_buf *fsbuf, uint32_t off)
+{
+	uint32_t lo = 0, hi = fsbuf->meta_count;
+	while (lo < hi)
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (fsbuf->meta_offs[mid] < off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static int reserve_meta_rows(fs_buf *fsbuf, uint32_t count)
+{
+	if (count <= fsbuf->meta_capacity)
+		return 0;
+
+	uint32_t capacity = (count + META_ROWS_BLK_SIZE - 1) / META_ROWS_BLK_SIZE * META_ROWS_BLK_SIZE;
+	uint32_t *offs = realloc(fsbuf->meta_offs, capacity * sizeof(uint32_t));
+	if (offs == 0)
+		return 1;
+	fsbuf->meta_offs = offs;
+
+	uint64_t *sizes = realloc(fsbuf->meta_sizes, capacity * sizeof(uint64_t));
+	if (sizes == 0)
+		return 1;
+	fsbuf->meta_sizes = sizes;
+
+	int64_t *mtimes = realloc(fsbuf->meta_mtimes, capacity * sizeof(int64_t));
+	if (mtimes == 0)
+		return 1;
+	fsbuf->meta_mtimes = mtimes;
+
+	uint32_t *modes = realloc(fsbuf->meta_modes, capacity * sizeof(uint32_t));
+	if (modes == 0)
+		return 1;
+	fsbuf->meta_modes = modes;
+
+	fsbuf->meta_capacity = capacity;
+	return 0;
+}
+
+// names (not parent-tags) in [start_off, end_off), which must start with a name
+static uint32_t count_names(fs_buf *fsbuf, uint32_t start_off, uint32_t end_off, uint32_t *offs)
+{
+	uint32_t count = 0;
+	for (uint32_t off = start_off; off < end_off; off = next_name(fsbuf, off))
+	{
+		if (*fs_ptr(fsbuf, off) != 0)
+		{
+			if (offs)
+				offs[count] = off;
+			count++;
+		}
+	}
+	return count;
+}
+
+// unknown rows for the names in [start_off, end_off) at row i
+static int insert_meta_rows(fs_buf *fsbuf, uint32_t i, uint32_t start_off, uint32_t end_off)
+{
+	uint32_t count = count_names(fsbuf, start_off, end_off, 0);
+	if (count == 0)
+		return 0;
+
+	if (reserve_meta_rows(fsbuf, fsbuf->meta_count + count) != 0)
+		return ERR_NO_MEM;
+
+	uint32_t moved = fsbuf->meta_count - i;
+	memmove(fsbuf->meta_offs + i + count, fsbuf->meta_offs + i, moved * sizeof(uint32_t));
+	memmove(fsbuf->meta_sizes + i + count, fsbuf->meta_sizes + i, moved * sizeof(uint64_t));
+	memmove(fsbuf->meta_mtimes + i + count, fsbuf->meta_mtimes + i, moved * sizeof(int64_t));
+	memmove(fsbuf->meta_modes + i + count, fsbuf->meta_modes + i, moved * sizeof(uint32_t));
+	count_names(fsbuf, start_off, end_off, fsbuf->meta_offs + i);
+	memset(fsbuf->meta_sizes + i, 0, count * sizeof(uint64_t));
+	memset(fsbuf->meta_mtimes + i, 0, count * sizeof(int64_t));
+	memset(fsbuf->meta_modes + i, 0, count * sizeof(uint32_t));
+	fsbuf->meta_count += count;
+	return 0;
+}
+
+void free_meta_index(fs_buf *fsbuf)
+{
+	free(fsbuf->meta_offs);
+	free(fsbuf->meta_sizes);
+	free(fsbuf->meta_mtimes);
+	free(fsbuf->meta_modes);
+	fsbuf->meta_offs = 0;
+	fsbuf->meta_sizes = 0;
+	fsbuf->meta_mtimes = 0;
+	fsbuf->meta_modes = 0;
+	fsbuf->meta_count = fsbuf->meta_capacity = 0;
+}
+
+int copy_meta_index(fs_buf *dst, fs_buf *src)
+{
+	free_meta_index(dst);
+	if (src->meta_offs == 0)
+		return 0;
+
+	if (reserve_meta_rows(dst, src->meta_count ? src->meta_count : 1) != 0)
+	{
+		free_meta_index(dst);
+		return ERR_NO_MEM;
+	}
+	memcpy(dst->meta_offs, src->meta_offs, src->meta_count * sizeof(uint32_t));
+	memcpy(dst->meta_sizes, src->meta_sizes, src->meta_count * sizeof(uint64_t));
+	memcpy(dst->meta_mtimes, src->meta_mtimes, src->meta_count * sizeof(int64_t));
+	memcpy(dst->meta_modes, src->meta_modes, src->meta_count * sizeof(uint32_t));
+	dst->meta_count = src->meta_count;
+	return 0;
+}
+
+void sync_meta_index(fs_buf *fsbuf, uint32_t off, int delta)
+{
+	if (fsbuf->meta_offs == 0)
+		return;
+
+	uint32_t first = lower_bound(fsbuf, off);
+	if (delta < 0)
+	{
+		// drop rows of the removed names
+		uint32_t last = lower_bound(fsbuf, off - delta), moved = fsbuf->meta_count - last;
+		memmove(fsbuf->meta_offs + first, fsbuf->meta_offs + last, moved * sizeof(uint32_t));
+		memmove(fsbuf->meta_sizes + first, fsbuf->meta_sizes + last, moved * sizeof(uint64_t));
+		memmove(fsbuf->meta_mtimes + first, fsbuf->meta_mtimes + last, moved * sizeof(int64_t));
+		memmove(fsbuf->meta_modes + first, fsbuf->meta_modes + last, moved * sizeof(uint32_t));
+		fsbuf->meta_count -= last - first;
+	}
+
+	for (uint32_t i = first; i < fsbuf->meta_count; i++)
+		fsbuf->meta_offs[i] += delta;
+
+	// inserted names are unknown until set by the caller
+	if (delta > 0 && insert_meta_rows(fsbuf, first, off, off + delta) != 0)
+		free_meta_index(fsbuf);
+}
+
+void set_meta_row(fs_buf *fsbuf, uint32_t name_off, const fs_meta *meta)
+{
+	uint32_t i = fsbuf->meta_offs ? lower_bound(fsbuf, name_off) : 0;
+	if (fsbuf->meta_offs == 0 || i == fsbuf->meta_count || fsbuf->meta_offs[i] != name_off)
+		return;
+
+	fsbuf->meta_sizes[i] = meta->size;
+	fsbuf->meta_mtimes[i] = meta->mtime;
+	fsbuf->meta_modes[i] = meta->mode;
+}
+
+int get_meta_row(fs_buf *fsbuf, uint32_t name_off, fs_meta *meta)
+{
+	uint32_t i = fsbuf->meta_offs ? lower_bound(fsbuf, name_off) : 0;
+	if (fsbuf->meta_offs == 0 || i == fsbuf->meta_count || fsbuf->meta_offs[i] != name_off)
+		return 1;
+
+	meta->size = fsbuf->meta_sizes[i];
+	meta->mtime = fsbuf->meta_mtimes[i];
+	meta->mode = fsbuf->meta_modes[i];
+	return 0;
+}
+
+fs_meta *copy_meta_rows(fs_buf *fsbuf, uint32_t start_off, uint32_t end_off, uint32_t *count)
+{
+	*count = 0;
+	if (fsbuf->meta_offs == 0)
+		return 0;
+
+	uint32_t first = lower_bound(fsbuf, start_off), last = lower_bound(fsbuf, end_off);
+	fs_meta *rows = malloc((last - first + 1) * sizeof(fs_meta));
+	if (rows == 0)
+		return 0;
+
+	for (uint32_t i = first; i < last; i++)
+	{
+		rows[i - first].size = fsbuf->meta_sizes[i];
+		rows[i - first].mtime = fsbuf->meta_mtimes[i];
+		rows[i - first].mode = fsbuf->meta_modes[i];
+	}
+	*count = last - first;
+	return rows;
+}
+
+void put_meta_rows(fs_buf *fsbuf, uint32_t start_off, const fs_meta *rows, uint32_t count)
+{
+	if (fsbuf->meta_offs == 0)
+		return;
+
+	uint32_t first = lower_bound(fsbuf, start_off);
+	for (uint32_t i = 0; i < count && first + i < fsbuf->meta_count; i++)
+	{
+		fsbuf->meta_sizes[first + i] = rows[i].size;
+		fsbuf->meta_mtimes[first + i] = rows[i].mtime;
+		fsbuf->meta_modes[first + i] = rows[i].mode;
+	}
+}
+
+int stat_meta(const char *path, fs_meta *meta)
+{
+	struct stat st;
+	if (lstat(path, &st) != 0)
+		return 1;
+
+	meta->size = st.st_size;
+	meta->mtime = st.st_mtime;
+	meta->mode = st.st_mode;
+	return 0;
+}
+
+__attribute__((visibility("default"))) int enable_fs_meta(fs_buf *fsbuf)
+{
+	pthread_rwlock_wrlock(&fsbuf->lock);
+	if (fsbuf->meta_offs)
+	{
+		pthread_rwlock_unlock(&fsbuf->lock);
+		return 0;
+	}
+
+	// snapshots taken from now on carry the metadata
+	fsbuf->generation++;
+	// reserve at least one block, so that an empty index is told from a missing one
+	if (reserve_meta_rows(fsbuf, 1) != 0 || insert_meta_rows(fsbuf, 0, fsbuf->first_name_off, fsbuf->tail) != 0)
+	{
+		free_meta_index(fsbuf);
+		pthread_rwlock_unlock(&fsbuf->lock);
+		return ERR_NO_MEM;
+	}
+
+	char path[PATH_MAX];
+	for (uint32_t i = 0; i < fsbuf->meta_count; i++)
+	{
+		fs_meta meta;
+		if (stat_meta(do_get_path_by_name_off(fsbuf, fsbuf->meta_offs[i], path, sizeof(path)), &meta) == 0)
+		{
+			fsbuf->meta_sizes[i] = meta.size;
+			fsbuf->meta_mtimes[i] = meta.mtime;
+			fsbuf->meta_modes[i] = meta.mode;
+		}
+	}
+	pthread_rwlock_unlock(&fsbuf->lock);
+	return 0;
+}
+
+__attribute__((visibility("default"))) int has_fs_meta(fs_buf *fsbuf)
+{
+	return fsbuf->meta_offs != 0;
+}
+
+__attribute__((visibility("default"))) int get_fs_meta(fs_buf *fsbuf, uint32_t name_off, fs_meta *meta)
+{
+	pthread_rwlock_rdlock(&fsbuf->lock);
+	int r = get_meta_row(fsbuf, name_off, meta) != 0 || meta->mode == 0;
+	pthread_rwlock_unlock(&fsbuf->lock);
+	return r;
+}
+
+void set_fs_meta(fs_buf *fsbuf, uint32_t name_off, const fs_meta *meta)
+{
+	pthread_rwlock_wrlock(&fsbuf->lock);
+	fsbuf->generation++;
+	set_meta_row(fsbuf, name_off, meta);
+	pthread_rwlock_unlock(&fsbuf->lock);
+}
+
+static int match_meta(fs_buf *fsbuf, uint32_t i, const fs_meta_filter *filter)
+{
+	return fsbuf->meta_modes[i] != 0 &&
+		   (fsbuf->meta_modes[i] & filter->mode_mask) == filter->mode_value &&
+		   fsbuf->meta_sizes[i] >= filter->min_size && (filter->max_size == 0 || fsbuf->meta_sizes[i] <= filter->max_size) &&
+		   fsbuf->meta_mtimes[i] >= filter->min_mtime && (filter->max_mtime == 0 || fsbuf->meta_mtimes[i] <= filter->max_mtime);
+}
+
+__attribute__((visibility("default"))) void search_files_meta(fs_buf *fsbuf, uint32_t *start_off, uint32_t end_off, uint32_t *results, uint32_t *count,
+							const fs_meta_filter *filter)
+{
+	uint32_t size = *count;
+	*count = 0;
+	pthread_rwlock_rdlock(&fsbuf->lock);
+	uint32_t min_off = fsbuf->tail > end_off ? end_off : fsbuf->tail;
+	if (fsbuf->meta_offs == 0 || *start_off >= min_off || size == 0)
+	{
+		// nothing matches without metadata
+		if (fsbuf->meta_offs == 0 && size > 0 && *start_off < min_off)
+			*start_off = min_off;
+		pthread_rwlock_unlock(&fsbuf->lock);
+		return;
+	}
+
+	uint32_t i = lower_bound(fsbuf, *start_off);
+	for (; i < fsbuf->meta_count && fsbuf->meta_offs[i] < min_off && *count < size; i++)
+	{
+		if (match_meta(fsbuf, i, filter))
+		{
+			results[*count] = fsbuf->meta_offs[i];
+			*count = *count + 1;
+		}
+	}
+	// as search_files, a full page stops right behind its last result
+	*start_off = *count == size ? next_name(fsbuf, results[size - 1]) : min_off;
+	pthread_rwlock_unlock(&fsbuf->lock);
+}
@@ -0,0 +1,254 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs_buf.h"
+#include "fs_buf_base.h"
+
+#define NODE_ROWS_BLK_SIZE 4096
+
+// node ids: a number given to each name when it is inserted, which stays the same while other names are
+// inserted or removed around it. rows (offset & id of each name) are sorted by offset like the metadata rows,
+// id_offs translates an id back to the current offset of its name, 0 once the name is removed.
+// ids are never reused, so whatever still refers to a removed name can not be taken for a new one
+
+// first row whose name offset >= off
+static uint32_t lower_bound(fs_buf *fsbuf, uint32_t off)
+{
+	uint32_t lo = 0, hi = fsbuf->node_count;
+	while (lo < hi)
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (fsbuf->node_offs[mid] < off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static int reserve_node_rows(fs_buf *fsbuf, uint32_t count)
+{
+	if (count <= fsbuf->node_capacity)
+		return 0;
+
+	uint32_t capacity = (count + NODE_ROWS_BLK_SIZE - 1) / NODE_ROWS_BLK_SIZE * NODE_ROWS_BLK_SIZE;
+	uint32_t *offs = realloc(fsbuf->node_offs, capacity * sizeof(uint32_t));
+	if (offs == 0)
+		return 1;
+	fsbuf->node_offs = offs;
+
+	uint32_t *ids = realloc(fsbuf->node_ids, capacity * sizeof(uint32_t));
+	if (ids == 0)
+		return 1;
+	fsbuf->node_ids = ids;
+
+	fsbuf->node_capacity = capacity;
+	return 0;
+}
+
+// room for ids below next_node_id + count
+static int reserve_node_ids(fs_buf *fsbuf, uint32_t count)
+{
+	if (count > UINT32_MAX - fsbuf->next_node_id)
+		return 1;
+	if (fsbuf->next_node_id + count <= fsbuf->id_capacity)
+		return 0;
+
+	uint32_t capacity = fsbuf->id_capacity + fsbuf->id_capacity / 2;
+	if (capacity < fsbuf->next_node_id + count)
+		capacity = fsbuf->next_node_id + count;
+	uint32_t *offs = realloc(fsbuf->id_offs, (uint64_t)capacity * sizeof(uint32_t));
+	if (offs == 0)
+		return 1;
+	fsbuf->id_offs = offs;
+	fsbuf->id_capacity = capacity;
+	return 0;
+}
+
+// rows of new ids for the names in [start_off, end_off) at row i
+static int insert_node_rows(fs_buf *fsbuf, uint32_t i, uint32_t start_off, uint32_t end_off)
+{
+	uint32_t count = 0;
+	for (uint32_t off = start_off; off < end_off; off = next_name(fsbuf, off))
+		if (*fs_ptr(fsbuf, off) != 0)
+			count++;
+	if (count == 0)
+		return 0;
+
+	if (reserve_node_rows(fsbuf, fsbuf->node_count + count) != 0 || reserve_node_ids(fsbuf, count) != 0)
+		return ERR_NO_MEM;
+
+	uint32_t moved = fsbuf->node_count - i;
+	memmove(fsbuf->node_offs + i + count, fsbuf->node_offs + i, moved * sizeof(uint32_t));
+	memmove(fsbuf->node_ids + i + count, fsbuf->node_ids + i, moved * sizeof(uint32_t));
+	for (uint32_t off = start_off; off < end_off; off = next_name(fsbuf, off))
+	{
+		if (*fs_ptr(fsbuf, off) == 0)
+			continue;
+		uint32_t id = fsbuf->next_node_id++;
+		fsbuf->node_offs[i] = off;
+		fsbuf->node_ids[i++] = id;
+		fsbuf->id_offs[id] = off;
+	}
+	fsbuf->node_count += count;
+	return 0;
+}
+
+void free_node_index(fs_buf *fsbuf)
+{
+	free(fsbuf->node_offs);
+	free(fsbuf->node_ids);
+	free(fsbuf->id_offs);
+	fsbuf->node_offs = 0;
+	fsbuf->node_ids = 0;
+	fsbuf->id_offs = 0;
+	fsbuf->node_count = fsbuf->node_capacity = 0;
+	fsbuf->id_capacity = fsbuf->next_node_id = 0;
+}
+
+int copy_node_index(fs_buf *dst, fs_buf *src)
+{
+	free_node_index(dst);
+	if (src->node_offs == 0)
+		return 0;
+
+	dst->next_node_id = src->next_node_id;
+	if (reserve_node_rows(dst, src->node_count ? src->node_count : 1) != 0 || reserve_node_ids(dst, 0) != 0)
+	{
+		free_node_index(dst);
+		return ERR_NO_MEM;
+	}
+	memcpy(dst->node_offs, src->node_offs, src->node_count * sizeof(uint32_t));
+	memcpy(dst->node_ids, src->node_ids, src->node_count * sizeof(uint32_t));
+	memcpy(dst->id_offs, src->id_offs, src->next_node_id * sizeof(uint32_t));
+	dst->node_count = src->node_count;
+	return 0;
+}
+
+void sync_node_index(fs_buf *fsbuf, uint32_t off, int delta)
+{
+	if (fsbuf->node_offs == 0)
+		return;
+
+	uint32_t first = lower_bound(fsbuf, off);
+	if (delta < 0)
+	{
+		// ids of the removed names are gone for good
+		uint32_t last = lower_bound(fsbuf, off - delta), moved = fsbuf->node_count - last;
+		for (uint32_t i = first; i < last; i++)
+			fsbuf->id_offs[fsbuf->node_ids[i]] = 0;
+		memmove(fsbuf->node_offs + first, fsbuf->node_offs + last, moved * sizeof(uint32_t));
+		memmove(fsbuf->node_ids + first, fsbuf->node_ids + last, moved * sizeof(uint32_t));
+		fsbuf->node_count -= last - first;
+	}
+
+	for (uint32_t i = first; i < fsbuf->node_count; i++)
+	{
+		fsbuf->node_offs[i] += delta;
+		fsbuf->id_offs[fsbuf->node_ids[i]] += delta;
+	}
+
+	if (delta > 0 && insert_node_rows(fsbuf, first, off, off + delta) != 0)
+		free_node_index(fsbuf);
+}
+
+uint32_t get_node_row(fs_buf *fsbuf, uint32_t name_off)
+{
+	uint32_t i = fsbuf->node_offs ? lower_bound(fsbuf, name_off) : 0;
+	if (fsbuf->node_offs == 0 || i == fsbuf->node_count || fsbuf->node_offs[i] != name_off)
+		return 0;
+	return fsbuf->node_ids[i];
+}
+
+uint32_t *copy_node_ids(fs_buf *fsbuf, uint32_t start_off, uint32_t end_off, uint32_t *count)
+{
+	*count = 0;
+	if (fsbuf->node_offs == 0)
+		return 0;
+
+	uint32_t first = lower_bound(fsbuf, start_off), last = lower_bound(fsbuf, end_off);
+	uint32_t *ids = malloc((last - first + 1) * sizeof(uint32_t));
+	if (ids == 0)
+		return 0;
+
+	memcpy(ids, fsbuf->node_ids + first, (last - first) * sizeof(uint32_t));
+	*count = last - first;
+	return ids;
+}
+
+void put_node_ids(fs_buf *fsbuf, uint32_t start_off, const uint32_t *ids, uint32_t count)
+{
+	if (fsbuf->node_offs == 0)
+		return;
+
+	// the new ids the names were inserted with are dropped
+	uint32_t first = lower_bound(fsbuf, start_off);
+	for (uint32_t i = 0; i < count && first + i < fsbuf->node_count; i++)
+	{
+		fsbuf->id_offs[fsbuf->node_ids[first + i]] = 0;
+		fsbuf->node_ids[first + i] = ids[i];
+		fsbuf->id_offs[ids[i]] = fsbuf->node_offs[first + i];
+	}
+}
+
+void remap_node_index(fs_buf *fsbuf)
+{
+	for (uint32_t i = 0; i < fsbuf->node_count; i++)
+		fsbuf->id_offs[fsbuf->node_ids[i]] = fsbuf->node_offs[i];
+}
+
+__attribute__((visibility("default"))) int enable_node_ids(fs_buf *fsbuf)
+{
+	pthread_rwlock_wrlock(&fsbuf->lock);
+	if (fsbuf->node_offs)
+	{
+		pthread_rwlock_unlock(&fsbuf->lock);
+		return 0;
+	}
+
+	fsbuf->generation++;
+	// id 0 is never given, it tells a name without id
+	fsbuf->next_node_id = 1;
+	if (reserve_node_rows(fsbuf, 1) != 0 || insert_node_rows(fsbuf, 0, fsbuf->first_name_off, fsbuf->tail) != 0)
+	{
+		free_node_index(fsbuf);
+		pthread_rwlock_unlock(&fsbuf->lock);
+		return ERR_NO_MEM;
+	}
+	pthread_rwlock_unlock(&fsbuf->lock);
+	return 0;
+}
+
+__attribute__((visibility("default"))) int has_node_ids(fs_buf *fsbuf)
+{
+	return fsbuf->node_offs != 0;
+}
+
+__attribute__((visibility("default"))) uint32_t get_node_id(fs_buf *fsbuf, uint32_t name_off)
+{
+	pthread_rwlock_rdlock(&fsbuf->lock);
+	uint32_t id = get_node_row(fsbuf, name_off);
+	pthread_rwlock_unlock(&fsbuf->lock);
+	return id;
+}
+
+__attribute__((visibility("default"))) uint32_t get_node_offset(fs_buf *fsbuf, uint32_t id)
+{
+	pthread_rwlock_rdlock(&fsbuf->lock);
+	uint32_t off = fsbuf->id_offs && id < fsbuf->next_node_id ? fsbuf->id_offs[id] : 0;
+	pthread_rwlock_unlock(&fsbuf->lock);
+	return off;
+}
+
+__attribute__((visibility("default"))) uint32_t get_node_offsets(fs_buf *fsbuf, const uint32_t *ids, uint32_t count, uint32_t *offs)
+{
+	uint32_t n = 0;
+	pthread_rwlock_rdlock(&fsbuf->lock);
+	for (uint32_t i = 0; fsbuf->id_offs && i < count; i++)
+	{
+		if (ids[i] < fsbuf->next_node_id && fsbuf->id_offs[ids[i]] != 0)
+			offs[n++] = fsbuf->id_offs[ids[i]];
+	}
+	pthread_rwlock_unlock(&fsbuf->lock);
+	return n;
+}
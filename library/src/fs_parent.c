@@ -0,0 +1,268 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs_buf.h"
+#include "fs_buf_base.h"
+#include "utils.h"
+
+#define LIST_TAILS_BLK_SIZE 1024
+
+// parent index: sorted offsets of all parent-tags. kids lists are contiguous and never overlap,
+// so the tail of the list holding a name is the first parent-tag at or behind the name
+
+// first index whose tail >= off
+static uint32_t lower_bound(fs_buf *fsbuf, uint32_t off)
+{
+	uint32_t lo = 0, hi = fsbuf->list_tail_count;
+	while (lo < hi)
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (fsbuf->list_tails[mid] < off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static int reserve_list_tails(fs_buf *fsbuf, uint32_t count)
+{
+	if (count <= fsbuf->list_tail_capacity)
+		return 0;
+
+	uint32_t capacity = (count + LIST_TAILS_BLK_SIZE - 1) / LIST_TAILS_BLK_SIZE * LIST_TAILS_BLK_SIZE;
+	uint32_t *p = realloc(fsbuf->list_tails, capacity * sizeof(uint32_t));
+	if (p == 0)
+		return 1;
+
+	fsbuf->list_tails = p;
+	p = realloc(fsbuf->list_spans, capacity * sizeof(uint32_t));
+	if (p == 0)
+		return 1;
+
+	fsbuf->list_spans = p;
+	fsbuf->list_tail_capacity = capacity;
+	return 0;
+}
+
+// kids list of the name at name_off, 0 for a file or an empty folder
+static uint32_t kids_offset(fs_buf *fsbuf, uint32_t name_off)
+{
+	const char *name = fs_ptr(fsbuf, name_off);
+	uint32_t len = strlen(name);
+	if (name[len + 1] == FS_TAG_FILE)
+		return 0;
+
+	uint32_t rel_off = get_tag_reloff(fsbuf, name + len + 1);
+	return rel_off ? name_off + len + 1 + rel_off : 0;
+}
+
+// parent-tags in [start_off, end_off), which must start with a name
+static uint32_t count_list_tails(fs_buf *fsbuf, uint32_t start_off, uint32_t end_off, uint32_t *tails)
+{
+	uint32_t count = 0;
+	for (uint32_t off = start_off; off < end_off; off = next_name(fsbuf, off))
+	{
+		if (*fs_ptr(fsbuf, off) == 0)
+		{
+			if (tails)
+				tails[count] = off;
+			count++;
+		}
+	}
+	return count;
+}
+
+void free_parent_index(fs_buf *fsbuf)
+{
+	free(fsbuf->list_tails);
+	free(fsbuf->list_spans);
+	fsbuf->list_tails = fsbuf->list_spans = 0;
+	fsbuf->list_tail_count = fsbuf->list_tail_capacity = 0;
+	fsbuf->list_spans_known = 0;
+}
+
+// folder owning list i, 0 for the root list
+static uint32_t list_parent(fs_buf *fsbuf, uint32_t i)
+{
+	uint32_t tag_off = fsbuf->list_tails[i] + 1;
+	uint32_t rel_off = get_tag_reloff(fsbuf, fs_ptr(fsbuf, tag_off));
+	return rel_off ? tag_off - rel_off : 0;
+}
+
+// lists below a folder follow its own list (depth first), so a subtree is the run of lists from its top one,
+// ended by the subtree of the last folder with kids
+static void build_list_spans(fs_buf *fsbuf)
+{
+	for (uint32_t i = 0; i < fsbuf->list_tail_count; i++)
+		fsbuf->list_spans[i] = 1;
+
+	// the lists below a list all come after it, so each span is complete when added to its parent's
+	for (uint32_t i = fsbuf->list_tail_count; i-- > 0;)
+	{
+		uint32_t parent_off = list_parent(fsbuf, i);
+		if (parent_off >= fsbuf->first_name_off)
+			fsbuf->list_spans[lower_bound(fsbuf, parent_off)] += fsbuf->list_spans[i];
+	}
+	fsbuf->list_spans_known = fsbuf->list_tail_count > 0;
+}
+
+int build_parent_index(fs_buf *fsbuf)
+{
+	free_parent_index(fsbuf);
+	uint32_t count = count_list_tails(fsbuf, fsbuf->first_name_off, fsbuf->tail, 0);
+	// reserve at least one block, so that an empty index is told from a missing one
+	if (reserve_list_tails(fsbuf, count ? count : 1) != 0)
+	{
+		free_parent_index(fsbuf);
+		return ERR_NO_MEM;
+	}
+
+	fsbuf->list_tail_count = count_list_tails(fsbuf, fsbuf->first_name_off, fsbuf->tail, fsbuf->list_tails);
+	build_list_spans(fsbuf);
+	return 0;
+}
+
+int copy_parent_index(fs_buf *dst, fs_buf *src)
+{
+	free_parent_index(dst);
+	if (src->list_tails == 0)
+		return 0;
+
+	if (reserve_list_tails(dst, src->list_tail_count ? src->list_tail_count : 1) != 0)
+		return ERR_NO_MEM;
+	memcpy(dst->list_tails, src->list_tails, src->list_tail_count * sizeof(uint32_t));
+	memcpy(dst->list_spans, src->list_spans, src->list_tail_count * sizeof(uint32_t));
+	dst->list_tail_count = src->list_tail_count;
+	dst->list_spans_known = src->list_spans_known;
+	return 0;
+}
+
+// lists [first, first + count) were inserted (count > 0) or removed (count < 0), known spans of the lists
+// before them follow. a subtree ending right before inserted lists may or may not get them, its span is unknown then
+static void sync_list_spans(fs_buf *fsbuf, uint32_t first, int count)
+{
+	if (!fsbuf->list_spans_known)
+		return;
+
+	for (uint32_t i = 0; i < first; i++)
+	{
+		uint32_t span = fsbuf->list_spans[i];
+		if (span == 0 || i + span < first)
+			continue;
+
+		if (count > 0)
+			fsbuf->list_spans[i] = i + span > first ? span + count : 0;
+		else
+			fsbuf->list_spans[i] = i + span > first - count ? span + count : first - i;
+	}
+}
+
+void sync_parent_index(fs_buf *fsbuf, uint32_t off, int delta)
+{
+	if (fsbuf->list_tails == 0)
+		return;
+
+	uint32_t first = lower_bound(fsbuf, off);
+	if (delta < 0)
+	{
+		// drop tails inside the removed bytes
+		uint32_t last = lower_bound(fsbuf, off - delta);
+		if (last > first)
+		{
+			sync_list_spans(fsbuf, first, first - last);
+			memmove(fsbuf->list_tails + first, fsbuf->list_tails + last, (fsbuf->list_tail_count - last) * sizeof(uint32_t));
+			memmove(fsbuf->list_spans + first, fsbuf->list_spans + last, (fsbuf->list_tail_count - last) * sizeof(uint32_t));
+			fsbuf->list_tail_count -= last - first;
+		}
+	}
+
+	for (uint32_t i = first; i < fsbuf->list_tail_count; i++)
+		fsbuf->list_tails[i] += delta;
+
+	if (delta <= 0)
+		return;
+
+	// inserted bytes might hold new kids lists
+	uint32_t count = count_list_tails(fsbuf, off, off + delta, 0);
+	if (count == 0)
+		return;
+
+	if (reserve_list_tails(fsbuf, fsbuf->list_tail_count + count) != 0)
+	{
+		// fall back to walking names
+		free_parent_index(fsbuf);
+		return;
+	}
+
+	memmove(fsbuf->list_tails + first + count, fsbuf->list_tails + first, (fsbuf->list_tail_count - first) * sizeof(uint32_t));
+	memmove(fsbuf->list_spans + first + count, fsbuf->list_spans + first, (fsbuf->list_tail_count - first) * sizeof(uint32_t));
+	count_list_tails(fsbuf, off, off + delta, fsbuf->list_tails + first);
+	memset(fsbuf->list_spans + first, 0, count * sizeof(uint32_t));
+	fsbuf->list_tail_count += count;
+	sync_list_spans(fsbuf, first, count);
+}
+
+uint32_t lookup_list_tail(fs_buf *fsbuf, uint32_t off)
+{
+	uint32_t i = lower_bound(fsbuf, off);
+	return i < fsbuf->list_tail_count ? fsbuf->list_tails[i] : 0;
+}
+
+// kids list of the last folder with kids in list i, i.e. the last list right below it, 0 if none
+static uint32_t last_kids_offset(fs_buf *fsbuf, uint32_t i)
+{
+	uint32_t list_off = i ? fsbuf->list_tails[i - 1] + 1 + dir_tag_size(fsbuf) : fsbuf->first_name_off;
+	dir_hash *dh = find_dir_hash(fsbuf, list_off);
+	if (dh)
+	{
+		// folders of a big list are known without walking its files
+		for (uint32_t j = dh->dir_count; j-- > 0;)
+		{
+			uint32_t kids_off = kids_offset(fsbuf, dh->kids_off + dh->dirs[j] - 1);
+			if (kids_off)
+				return kids_off;
+		}
+		return 0;
+	}
+
+	uint32_t last_kids_off = 0;
+	for (uint32_t off = list_off; off < fsbuf->list_tails[i]; off = next_name(fsbuf, off))
+	{
+		uint32_t kids_off = kids_offset(fsbuf, off);
+		if (kids_off)
+			last_kids_off = kids_off;
+	}
+	return last_kids_off;
+}
+
+static uint32_t list_span(fs_buf *fsbuf, uint32_t i)
+{
+	// readers fill in unknown spans too, each with the same value
+	uint32_t span = __atomic_load_n(fsbuf->list_spans + i, __ATOMIC_RELAXED);
+	if (span)
+		return span;
+
+	span = 1;
+	uint32_t kids_off = last_kids_offset(fsbuf, i);
+	if (kids_off)
+	{
+		uint32_t j = lower_bound(fsbuf, kids_off);
+		if (j > i && j < fsbuf->list_tail_count)
+			span = j - i + list_span(fsbuf, j);
+	}
+	__atomic_store_n(fsbuf->list_spans + i, span, __ATOMIC_RELAXED);
+	__atomic_store_n(&fsbuf->list_spans_known, 1, __ATOMIC_RELAXED);
+	return span;
+}
+
+uint32_t lookup_tree_end(fs_buf *fsbuf, uint32_t kids_off)
+{
+	if (fsbuf->list_tails == 0)
+		return 0;
+
+	uint32_t i = lower_bound(fsbuf, kids_off);
+	if (i == fsbuf->list_tail_count)
+		return 0;
+	return fsbuf->list_tails[i + list_span(fsbuf, i) - 1] + 1 + dir_tag_size(fsbuf);
+}
@@ -0,0 +1,631 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#include "fs_buf.h"
+#include "fs_buf_base.h"
+#include "utils.h"
+
+// progress callback is invoked once per this many names (must be power of 2)
+#define SEARCH_PROGRESS_STEP 1024
+
+// simd kernels may read up to this many bytes (plus keyword length) past a name's head,
+// names closer than that to the buffer end are matched by the generic kernel
+#define SIMD_SAFE_SPAN (NAME_MAX + 1 + 64)
+#define NAME_NOT_TERMINATED ((uint32_t)-1)
+
+// ranges smaller than this are not worth splitting among threads (tests split small trees)
+#ifndef PARALLEL_MIN_RANGE
+#define PARALLEL_MIN_RANGE (1 << 22)
+#endif
+// chunks per thread, more chunks balance better between dense and sparse parts of the tree
+#define PARALLEL_CHUNKS_PER_THREAD 4
+#define PARALLEL_RESULTS_BLK 256
+
+typedef struct __literal_pattern__ {
+	const char *s;
+	uint32_t len;
+} literal_pattern;
+
+// a comparator callback if given, otherwise the built-in literal matcher
+typedef struct __search_matcher__ {
+	literal_pattern lp;
+	comparator_fn comparator;
+	void *comparator_param;
+	// match against the folded names
+	int folded;
+	// interned names are matched once per query, see match_name_ref
+	const name_dict *dict;
+	uint8_t *dict_matches;
+	// set by scan_range: the bytes from offset base on, names are matched in names while tags are read from tags.
+	// bytes before limit are readable
+	const char *names;
+	const char *tags;
+	uint32_t base;
+	uint32_t limit;
+} search_matcher;
+
+typedef void (*scan_fn)(fs_buf *fsbuf, uint32_t *start_off, uint32_t end_off, const search_matcher *sm,
+						uint32_t *results, uint32_t *count, uint32_t size, progress_fn pcf, void *pcf_param);
+
+// walk names in [*start_off, end_off), MATCH_NAME must set len (strlen of name) and matched for each name
+#define SCAN_NAMES(fsbuf, sm, start_off, end_off, results, count, size, pcf, pcf_param, MATCH_NAME)           \
+	do                                                                                                    \
+	{                                                                                                     \
+		uint32_t name_off = *start_off, scanned = 0;                                                      \
+		while (name_off < end_off && *count < size)                                                       \
+		{                                                                                                 \
+			const char *name = sm->names + (name_off - sm->base);                                         \
+			if (pcf && (scanned++ & (SEARCH_PROGRESS_STEP - 1)) == 0 &&                                   \
+				(*pcf)(*count, entry_name(fsbuf, sm->tags + (name_off - sm->base)), pcf_param) != 0)      \
+				break;                                                                                    \
+			int matched = 0;                                                                              \
+			uint32_t len = 0;                                                                             \
+			if (*name == NAME_REF && sm->dict)                                                            \
+				len = match_name_ref(sm, name, &matched);                                                 \
+			else                                                                                          \
+			{                                                                                             \
+				MATCH_NAME;                                                                               \
+			}                                                                                             \
+			if (matched)                                                                                  \
+			{                                                                                             \
+				results[*count] = name_off;                                                               \
+				*count = *count + 1;                                                                      \
+			}                                                                                             \
+			name_off += len + 1;                                                                          \
+			name_off += *(sm->tags + (name_off - sm->base)) == FS_TAG_FILE ? 1 : dir_tag_size(fsbuf);      \
+		}                                                                                                 \
+		*start_off = name_off;                                                                            \
+	} while (0)
+
+static uint32_t match_generic(const char *name, const literal_pattern *lp, int *matched)
+{
+	uint32_t len = strlen(name);
+	// parent-tags are empty names and never match, even for an empty keyword
+	*matched = len > 0 && len >= lp->len && memmem(name, len, lp->s, lp->len) != 0;
+	return len;
+}
+
+static int match_plain(const search_matcher *sm, const char *name)
+{
+	int matched;
+	if (sm->comparator)
+		return (*sm->comparator)(name, sm->comparator_param) == 0;
+	match_generic(name, &sm->lp, &matched);
+	return matched;
+}
+
+// a name stored with NAME_REF, returns its stored length. dict_matches[id] is 0 until the dictionary name
+// is matched by the first reference met, then 1 + matched. threads may match the same name, with the same result
+static uint32_t match_name_ref(const search_matcher *sm, const char *name, int *matched)
+{
+	if (name[1] == NAME_REF)
+	{
+		*matched = match_plain(sm, name + 1);
+		return strlen(name);
+	}
+
+	uint32_t id = name_ref_id(name);
+	uint8_t m = __atomic_load_n(sm->dict_matches + id, __ATOMIC_RELAXED);
+	if (m == 0)
+	{
+		const char *s = sm->dict->pool + sm->dict->offs[id];
+		char folded[NAME_MAX + 1];
+		if (sm->folded)
+		{
+			uint32_t len = strnlen(s, NAME_MAX);
+			fold_bytes(folded, s, len);
+			folded[len] = 0;
+			s = folded;
+		}
+		m = 1 + match_plain(sm, s);
+		__atomic_store_n(sm->dict_matches + id, m, __ATOMIC_RELAXED);
+	}
+	*matched = m == 2;
+	return NAME_REF_SIZE;
+}
+
+// case-insensitive matcher for buffers without folded names, param is the folded literal_pattern
+static int compare_folded(const char *file_name, void *param)
+{
+	const literal_pattern *lp = (const literal_pattern *)param;
+	char folded[NAME_MAX + 1];
+	uint32_t len = strnlen(file_name, NAME_MAX);
+	fold_bytes(folded, file_name, len);
+	return len < lp->len || memmem(folded, len, lp->s, lp->len) == 0;
+}
+
+static void scan_comparator(fs_buf *fsbuf, uint32_t *start_off, uint32_t end_off, const search_matcher *sm,
+							uint32_t *results, uint32_t *count, uint32_t size, progress_fn pcf, void *pcf_param)
+{
+	SCAN_NAMES(fsbuf, sm, start_off, end_off, results, count, size, pcf, pcf_param,
+			   len = strlen(name);
+			   matched = len > 0 && (*sm->comparator)(name, sm->comparator_param) == 0);
+}
+
+static void scan_generic(fs_buf *fsbuf, uint32_t *start_off, uint32_t end_off, const search_matcher *sm,
+						 uint32_t *results, uint32_t *count, uint32_t size, progress_fn pcf, void *pcf_param)
+{
+	SCAN_NAMES(fsbuf, sm, start_off, end_off, results, count, size, pcf, pcf_param,
+			   len = match_generic(name, &sm->lp, &matched));
+}
+
+#ifdef __x86_64__
+
+// cands holds bits of positions whose first & last bytes equal the keyword's, check the bytes in between
+static inline int verify_candidates(const char *block, uint32_t cands, const literal_pattern *lp)
+{
+	while (cands)
+	{
+		uint32_t pos = __builtin_ctz(cands);
+		if (lp->len < 3 || memcmp(block + pos + 1, lp->s + 1, lp->len - 2) == 0)
+			return 1;
+		cands &= cands - 1;
+	}
+	return 0;
+}
+
+// a candidate crossing the name's \0 always fails verification, since the keyword holds no \0,
+// so only candidates starting after the \0 (i.e. inside the tag or the next name) must be masked out
+static inline uint32_t match_sse2(const char *name, const literal_pattern *lp, __m128i first, __m128i last, int *matched)
+{
+	const __m128i zero = _mm_setzero_si128();
+	for (uint32_t i = 0; i <= NAME_MAX; i += sizeof(__m128i))
+	{
+		__m128i block = _mm_loadu_si128((const __m128i *)(name + i));
+		uint32_t zeros = _mm_movemask_epi8(_mm_cmpeq_epi8(block, zero));
+		if (!*matched)
+		{
+			__m128i block_last = _mm_loadu_si128((const __m128i *)(name + i + lp->len - 1));
+			uint32_t cands = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(block, first),
+															 _mm_cmpeq_epi8(block_last, last)));
+			if (zeros)
+				cands &= (zeros & -zeros) - 1;
+			*matched = verify_candidates(name + i, cands, lp);
+		}
+		if (zeros)
+			return i + __builtin_ctz(zeros);
+	}
+	return NAME_NOT_TERMINATED;
+}
+
+static void scan_sse2(fs_buf *fsbuf, uint32_t *start_off, uint32_t end_off, const search_matcher *sm,
+					  uint32_t *results, uint32_t *count, uint32_t size, progress_fn pcf, void *pcf_param)
+{
+	const literal_pattern *lp = &sm->lp;
+	const __m128i first = _mm_set1_epi8(lp->s[0]), last = _mm_set1_epi8(lp->s[lp->len - 1]);
+	SCAN_NAMES(fsbuf, sm, start_off, end_off, results, count, size, pcf, pcf_param,
+			   if (name_off + SIMD_SAFE_SPAN + lp->len > sm->limit ||
+				   (len = match_sse2(name, lp, first, last, &matched)) == NAME_NOT_TERMINATED)
+				   len = match_generic(name, lp, &matched));
+}
+
+__attribute__((target("avx2"))) static inline uint32_t match_avx2(const char *name, const literal_pattern *lp, __m256i first, __m256i last, int *matched)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	for (uint32_t i = 0; i <= NAME_MAX; i += sizeof(__m256i))
+	{
+		__m256i block = _mm256_loadu_si256((const __m256i *)(name + i));
+		uint32_t zeros = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, zero));
+		if (!*matched)
+		{
+			__m256i block_last = _mm256_loadu_si256((const __m256i *)(name + i + lp->len - 1));
+			uint32_t cands = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(block, first),
+																   _mm256_cmpeq_epi8(block_last, last)));
+			if (zeros)
+				cands &= (zeros & -zeros) - 1;
+			*matched = verify_candidates(name + i, cands, lp);
+		}
+		if (zeros)
+			return i + __builtin_ctz(zeros);
+	}
+	return NAME_NOT_TERMINATED;
+}
+
+__attribute__((target("avx2"))) static void scan_avx2(fs_buf *fsbuf, uint32_t *start_off, uint32_t end_off, const search_matcher *sm,
+													  uint32_t *results, uint32_t *count, uint32_t size, progress_fn pcf, void *pcf_param)
+{
+	const literal_pattern *lp = &sm->lp;
+	const __m256i first = _mm256_set1_epi8(lp->s[0]), last = _mm256_set1_epi8(lp->s[lp->len - 1]);
+	SCAN_NAMES(fsbuf, sm, start_off, end_off, results, count, size, pcf, pcf_param,
+			   if (name_off + SIMD_SAFE_SPAN + lp->len > sm->limit ||
+				   (len = match_avx2(name, lp, first, last, &matched)) == NAME_NOT_TERMINATED)
+				   len = match_generic(name, lp, &matched));
+}
+
+#endif
+
+// scan [*start_off, end_off) of the flat buffer, or segment by segment
+static void scan_range(fs_buf *fsbuf, scan_fn scan, const search_matcher *sm, uint32_t *start_off, uint32_t end_off,
+					   uint32_t *results, uint32_t *count, uint32_t size, progress_fn pcf, void *pcf_param)
+{
+	search_matcher local = *sm;
+	if (fsbuf->segs == 0)
+	{
+		local.names = local.folded ? fsbuf->fold : fsbuf->head;
+		local.tags = fsbuf->head;
+		local.base = 0;
+		local.limit = fsbuf->capacity;
+		(*scan)(fsbuf, start_off, end_off, &local, results, count, size, pcf, pcf_param);
+		return;
+	}
+
+	for (uint32_t i = seg_index(fsbuf, *start_off); i < fsbuf->seg_count && *start_off < end_off && *count < size; i++)
+	{
+		fs_segment *seg = fsbuf->segs + i;
+		uint32_t seg_end = fsbuf->seg_starts[i] + seg->used;
+		local.names = local.folded ? seg->fold : seg->data;
+		local.tags = seg->data;
+		local.base = fsbuf->seg_starts[i];
+		local.limit = seg_readable_end(fsbuf, i);
+		(*scan)(fsbuf, start_off, seg_end < end_off ? seg_end : end_off, &local, results, count, size, pcf, pcf_param);
+		// stopped by pcf or for room
+		if (*start_off < seg_end && *start_off < end_off)
+			break;
+	}
+}
+
+static scan_fn select_scan_kernel(const search_matcher *sm)
+{
+	if (sm->comparator)
+		return scan_comparator;
+
+	// an empty keyword has no first/last byte to filter on
+	if (sm->lp.len == 0)
+		return scan_generic;
+
+#ifdef __x86_64__
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return scan_avx2;
+	return scan_sse2;
+#else
+	return scan_generic;
+#endif
+}
+
+// id of the dictionary name at pool offset off
+static uint32_t dict_name_id(const name_dict *dict, uint32_t off)
+{
+	uint32_t lo = 0, hi = dict->count;
+	while (lo < hi)
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (dict->offs[mid] < off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+// match all dictionary names by scanning the pool with the kernel of the query
+static int match_dict(fs_buf *fsbuf, scan_fn scan, search_matcher *sm)
+{
+	const name_dict *dict = sm->dict;
+	char *folded = sm->folded ? malloc(dict->pool_size) : 0;
+	if (sm->folded && folded == 0)
+		return ERR_NO_MEM;
+	if (folded)
+		fold_entries(fsbuf, folded, dict->pool, dict->pool_size);
+
+	search_matcher local = *sm;
+	local.dict = 0;
+	local.names = folded ? folded : dict->pool;
+	local.tags = dict->pool;
+	local.base = 0;
+	local.limit = dict->pool_size;
+	memset(sm->dict_matches, 1, dict->count);
+	uint32_t results[PARALLEL_RESULTS_BLK], off = 0;
+	while (off < dict->pool_size)
+	{
+		uint32_t count = 0;
+		(*scan)(fsbuf, &off, dict->pool_size, &local, results, &count, PARALLEL_RESULTS_BLK, 0, 0);
+		for (uint32_t i = 0; i < count; i++)
+			sm->dict_matches[dict_name_id(dict, results[i])] = 2;
+	}
+	free(folded);
+	return 0;
+}
+
+// the memo of dictionary matches of this query, ERR_NO_MEM if out of memory. a range bigger than the dictionary
+// is likely to refer to many of its names, which are then matched up front at the speed of the kernel
+static int set_dict_matcher(fs_buf *fsbuf, scan_fn scan, search_matcher *sm, uint32_t range)
+{
+	if (fsbuf->names == 0 || fsbuf->names->count == 0)
+		return 0;
+
+	sm->dict = fsbuf->names;
+	sm->dict_matches = calloc(sm->dict->count, sizeof(uint8_t));
+	if (sm->dict_matches == 0)
+		return ERR_NO_MEM;
+	return sm->comparator == 0 && range >= sm->dict->pool_size ? match_dict(fsbuf, scan, sm) : 0;
+}
+
+__attribute__((visibility("default"))) void search_files_literal(fs_buf *fsbuf, uint32_t *start_off, uint32_t end_off, uint32_t *results, uint32_t *count,
+																 const char *keyword, progress_fn pcf, void *pcf_param)
+{
+	search_matcher sm = {.lp = {.s = keyword, .len = strlen(keyword)}};
+	uint32_t size = *count;
+	*count = 0;
+	pthread_rwlock_rdlock(&fsbuf->lock);
+	uint32_t min_off = fsbuf->tail > end_off ? end_off : fsbuf->tail;
+	scan_fn scan = select_scan_kernel(&sm);
+	if (set_dict_matcher(fsbuf, scan, &sm, *start_off < min_off ? min_off - *start_off : 0) == 0)
+		scan_range(fsbuf, scan, &sm, start_off, min_off, results, count, size, pcf, pcf_param);
+	pthread_rwlock_unlock(&fsbuf->lock);
+	free(sm.dict_matches);
+}
+
+typedef struct __search_chunk__ {
+	uint32_t start_off;
+	uint32_t end_off;
+	// where the scan stopped, end_off if the whole chunk is done
+	uint32_t stop_off;
+	uint32_t *results;
+	uint32_t count;
+	int done;
+} search_chunk;
+
+typedef struct __parallel_search__ {
+	fs_buf *fsbuf;
+	scan_fn scan;
+	const search_matcher *sm;
+	progress_fn pcf;
+	void *pcf_param;
+	uint32_t size;
+	search_chunk *chunks;
+	uint32_t chunk_count;
+	pthread_mutex_t mutex;
+	// next chunk to be claimed, and the first chunk whose predecessors already hold enough results
+	uint32_t next_chunk;
+	uint32_t satisfied_chunk;
+	int aborted;
+} parallel_search;
+
+typedef struct __chunk_progress__ {
+	parallel_search *ps;
+	uint32_t chunk;
+} chunk_progress;
+
+static int chunk_progress_fn(uint32_t count, const char *cur_file, void *param)
+{
+	chunk_progress *cp = (chunk_progress *)param;
+	parallel_search *ps = cp->ps;
+	// results of chunks behind a satisfied prefix would be dropped by the merge anyway
+	if (__atomic_load_n(&ps->aborted, __ATOMIC_RELAXED) || cp->chunk > __atomic_load_n(&ps->satisfied_chunk, __ATOMIC_RELAXED))
+		return 1;
+
+	if (ps->pcf && (*ps->pcf)(count, cur_file, ps->pcf_param) != 0)
+	{
+		__atomic_store_n(&ps->aborted, 1, __ATOMIC_RELAXED);
+		return 1;
+	}
+	return 0;
+}
+
+static void scan_chunk(parallel_search *ps, uint32_t index)
+{
+	search_chunk *chunk = ps->chunks + index;
+	chunk_progress cp = {.ps = ps, .chunk = index};
+	uint32_t capacity = 0, off = chunk->start_off;
+
+	while (1)
+	{
+		if (chunk->count == capacity)
+		{
+			uint32_t new_capacity = capacity + PARALLEL_RESULTS_BLK > ps->size ? ps->size : capacity + PARALLEL_RESULTS_BLK;
+			uint32_t *p = realloc(chunk->results, new_capacity * sizeof(uint32_t));
+			if (p == 0)
+			{
+				// out of memory ends the search like a cancel, the caller gets *start_off at this chunk's stop_off
+				__atomic_store_n(&ps->aborted, 1, __ATOMIC_RELAXED);
+				break;
+			}
+			chunk->results = p;
+			capacity = new_capacity;
+		}
+
+		uint32_t count = 0;
+		scan_range(ps->fsbuf, ps->scan, ps->sm, &off, chunk->end_off, chunk->results + chunk->count, &count, capacity - chunk->count,
+					chunk_progress_fn, &cp);
+		chunk->count += count;
+		// stopped for room only, grow the results and go on
+		if (off >= chunk->end_off || chunk->count < capacity || capacity == ps->size)
+			break;
+	}
+	chunk->stop_off = off;
+
+	pthread_mutex_lock(&ps->mutex);
+	chunk->done = 1;
+	uint32_t total = 0;
+	for (uint32_t i = 0; i < ps->chunk_count && ps->chunks[i].done; i++)
+	{
+		total += ps->chunks[i].count;
+		if (total >= ps->size || ps->chunks[i].stop_off < ps->chunks[i].end_off)
+		{
+			__atomic_store_n(&ps->satisfied_chunk, i, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&ps->mutex);
+}
+
+static void *search_worker(void *arg)
+{
+	parallel_search *ps = (parallel_search *)arg;
+	while (1)
+	{
+		pthread_mutex_lock(&ps->mutex);
+		uint32_t index = ps->next_chunk;
+		int stop = index >= ps->chunk_count || index > ps->satisfied_chunk || ps->aborted;
+		if (!stop)
+			ps->next_chunk++;
+		pthread_mutex_unlock(&ps->mutex);
+		if (stop)
+			break;
+		scan_chunk(ps, index);
+	}
+	return 0;
+}
+
+static void merge_chunks(parallel_search *ps, uint32_t *start_off, uint32_t *results, uint32_t *count)
+{
+	*count = 0;
+	for (uint32_t i = 0; i < ps->chunk_count; i++)
+	{
+		search_chunk *chunk = ps->chunks + i;
+		// chunks never claimed hold nothing, the scan resumes from them
+		if (!chunk->done)
+		{
+			*start_off = chunk->start_off;
+			return;
+		}
+
+		uint32_t n = chunk->count > ps->size - *count ? ps->size - *count : chunk->count;
+		memcpy(results + *count, chunk->results, n * sizeof(uint32_t));
+		*count += n;
+		// search_files stops right behind its last result, even if the chunk was scanned further
+		if (*count == ps->size)
+		{
+			*start_off = next_name(ps->fsbuf, results[*count - 1]);
+			return;
+		}
+		*start_off = chunk->stop_off;
+		if (chunk->stop_off < chunk->end_off)
+			return;
+	}
+}
+
+// nocase means sm holds a folded keyword to be matched against folded names
+static void do_search_parallel(fs_buf *fsbuf, uint32_t *start_off, uint32_t end_off, uint32_t *results, uint32_t *count,
+							   search_matcher sm, int nocase, progress_fn pcf, void *pcf_param, int threads)
+{
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	uint32_t size = *count;
+	*count = 0;
+	pthread_rwlock_rdlock(&fsbuf->lock);
+	uint32_t min_off = fsbuf->tail > end_off ? end_off : fsbuf->tail;
+	if (nocase && has_fold_names(fsbuf))
+	{
+		sm.folded = 1;
+	}
+	else if (nocase)
+	{
+		sm.comparator = compare_folded;
+		sm.comparator_param = &sm.lp;
+	}
+	scan_fn scan = select_scan_kernel(&sm);
+	if (set_dict_matcher(fsbuf, scan, &sm, *start_off < min_off ? min_off - *start_off : 0) != 0)
+	{
+		pthread_rwlock_unlock(&fsbuf->lock);
+		return;
+	}
+
+	if (threads <= 1 || size == 0 || *start_off >= min_off || min_off - *start_off < PARALLEL_MIN_RANGE)
+	{
+		scan_range(fsbuf, scan, &sm, start_off, min_off, results, count, size, pcf, pcf_param);
+		pthread_rwlock_unlock(&fsbuf->lock);
+		free(sm.dict_matches);
+		return;
+	}
+
+	parallel_search ps = {
+		.fsbuf = fsbuf,
+		.scan = scan,
+		.sm = &sm,
+		.pcf = pcf,
+		.pcf_param = pcf_param,
+		.size = size,
+		.chunk_count = threads * PARALLEL_CHUNKS_PER_THREAD,
+	};
+	ps.satisfied_chunk = ps.chunk_count;
+	ps.chunks = calloc(ps.chunk_count, sizeof(search_chunk));
+	if (ps.chunks == 0)
+	{
+		scan_range(fsbuf, scan, &sm, start_off, min_off, results, count, size, pcf, pcf_param);
+		pthread_rwlock_unlock(&fsbuf->lock);
+		free(sm.dict_matches);
+		return;
+	}
+	pthread_mutex_init(&ps.mutex, 0);
+
+	// chunk borders must be name-aligned so that every name is scanned by exactly one chunk
+	uint64_t range = min_off - *start_off;
+	uint32_t chunk_start = *start_off;
+	for (uint32_t i = 0; i < ps.chunk_count; i++)
+	{
+		uint32_t chunk_end = min_off;
+		if (i + 1 < ps.chunk_count)
+		{
+			chunk_end = *start_off + range * (i + 1) / ps.chunk_count;
+			// segments start with a name
+			chunk_end = fsbuf->segs ? fsbuf->seg_starts[seg_index(fsbuf, chunk_end)] : get_aligned_offset(fsbuf, chunk_end);
+			if (chunk_end > min_off)
+				chunk_end = min_off;
+			if (chunk_end < chunk_start)
+				chunk_end = chunk_start;
+		}
+		ps.chunks[i].start_off = ps.chunks[i].stop_off = chunk_start;
+		ps.chunks[i].end_off = chunk_end;
+		chunk_start = chunk_end;
+	}
+
+	pthread_t workers[threads - 1];
+	int started = 0;
+	for (; started < threads - 1; started++)
+		if (pthread_create(&workers[started], 0, search_worker, &ps) != 0)
+			break;
+	search_worker(&ps);
+	for (int i = 0; i < started; i++)
+		pthread_join(workers[i], 0);
+
+	merge_chunks(&ps, start_off, results, count);
+	pthread_rwlock_unlock(&fsbuf->lock);
+
+	for (uint32_t i = 0; i < ps.chunk_count; i++)
+		free(ps.chunks[i].results);
+	free(ps.chunks);
+	free(sm.dict_matches);
+	pthread_mutex_destroy(&ps.mutex);
+}
+
+__attribute__((visibility("default"))) void search_files_parallel(fs_buf *fsbuf, uint32_t *start_off, uint32_t end_off, uint32_t *results, uint32_t *count,
+																  comparator_fn comparator, void *comparator_param, const char *keyword,
+																  progress_fn pcf, void *pcf_param, int threads)
+{
+	search_matcher sm = {.comparator = comparator, .comparator_param = comparator_param};
+	if (comparator == 0)
+	{
+		sm.lp.s = keyword;
+		sm.lp.len = strlen(keyword);
+	}
+	do_search_parallel(fsbuf, start_off, end_off, results, count, sm, 0, pcf, pcf_param, threads);
+}
+
+__attribute__((visibility("default"))) void search_files_nocase(fs_buf *fsbuf, uint32_t *start_off, uint32_t end_off, uint32_t *results, uint32_t *count,
+																const char *keyword, progress_fn pcf, void *pcf_param, int threads)
+{
+	uint32_t len = strlen(keyword);
+	char *folded = malloc(len + 1);
+	if (folded == 0)
+	{
+		*count = 0;
+		return;
+	}
+	fold_bytes(folded, keyword, len + 1);
+
+	search_matcher sm = {.lp = {.s = folded, .len = len}};
+	do_search_parallel(fsbuf, start_off, end_off, results, count, sm, 1, pcf, pcf_param, threads);
+	free(folded);
+}
@@ -0,0 +1,544 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "fs_buf.h"
+#include "fs_buf_base.h"
+#include "utils.h"
+
+// segmented storage: names behind the header live in fixed-size segments, each holding whole entries
+// and some slack, so an insertion only moves bytes inside one segment. offsets stay the same as in
+// the flat layout (i.e. the serialized LFT), a segment's start is the sum of used bytes before it.
+
+#define SEG_SIZE (1 << 16)
+// segments are filled up to this when built, the rest is slack for insertions
+#define SEG_FILL (SEG_SIZE / 4 * 3)
+// neighbours are merged when one of them drops below this
+#define SEG_LOW (SEG_SIZE / 4)
+// readable bytes behind SEG_SIZE, simd kernels may read past the last name
+#define SEG_PAD 1024
+
+// segment bytes are shared by the snapshots taken (see fs_snapshot.c), a shared segment is copied before
+// being changed. the fold of a segment goes with its bytes, so it is shared & freed along with them
+typedef struct __seg_block__
+{
+	uint32_t refs;
+	char data[] __attribute__((aligned(16)));
+} seg_block;
+
+static seg_block *block_of(const char *data)
+{
+	return (seg_block *)(data - offsetof(seg_block, data));
+}
+
+static uint32_t entry_size(fs_buf *fsbuf, const char *p)
+{
+	uint32_t len = strlen(p);
+	return len + 1 + (p[len + 1] == FS_TAG_FILE ? 1 : dir_tag_size(fsbuf));
+}
+
+// size of the whole entries in p[0, size) up to limit bytes
+static uint32_t entries_size(fs_buf *fsbuf, const char *p, uint32_t size, uint32_t limit)
+{
+	uint32_t off = 0;
+	while (off < size)
+	{
+		uint32_t n = entry_size(fsbuf, p + off);
+		if (off > 0 && off + n > limit)
+			break;
+		off += n;
+	}
+	return off;
+}
+
+static int alloc_segment(fs_buf *fsbuf, fs_segment *seg)
+{
+	seg->used = 0;
+	seg->fold = 0;
+	seg_block *block = malloc(sizeof(seg_block) + SEG_SIZE + SEG_PAD);
+	if (block == 0)
+		return ERR_NO_MEM;
+	block->refs = 1;
+	seg->data = block->data;
+
+	if (fsbuf->seg_fold)
+	{
+		seg->fold = malloc(SEG_SIZE + SEG_PAD);
+		if (seg->fold == 0)
+		{
+			free(block);
+			return ERR_NO_MEM;
+		}
+	}
+	return 0;
+}
+
+// drop a reference, the last one frees the segment
+static void free_segment(fs_segment *seg)
+{
+	seg_block *block = block_of(seg->data);
+	if (__atomic_sub_fetch(&block->refs, 1, __ATOMIC_ACQ_REL) == 0)
+	{
+		free(block);
+		free(seg->fold);
+	}
+}
+
+// copy segment i if it is shared, so that it can be changed
+static int own_segment(fs_buf *fsbuf, uint32_t i)
+{
+	fs_segment *seg = fsbuf->segs + i;
+	// references are only added under the read lock, which writers exclude
+	if (__atomic_load_n(&block_of(seg->data)->refs, __ATOMIC_ACQUIRE) == 1)
+		return 0;
+
+	seg_block *block = malloc(sizeof(seg_block) + SEG_SIZE + SEG_PAD);
+	char *fold = seg->fold ? malloc(SEG_SIZE + SEG_PAD) : 0;
+	if (block == 0 || (seg->fold && fold == 0))
+	{
+		free(block);
+		free(fold);
+		return ERR_NO_MEM;
+	}
+
+	block->refs = 1;
+	memcpy(block->data, seg->data, seg->used);
+	if (fold)
+		memcpy(fold, seg->fold, seg->used);
+	fs_segment shared = *seg;
+	seg->data = block->data;
+	seg->fold = fold;
+	free_segment(&shared);
+	return 0;
+}
+
+// for changes which can not fail half-way, e.g. tags of a removal already under way
+static void must_own_segment(fs_buf *fsbuf, uint32_t i)
+{
+	if (own_segment(fsbuf, i) != 0)
+	{
+		fprintf(stderr, "Out of memory to copy a segment shared with snapshots\n");
+		abort();
+	}
+}
+
+// make room for count segments at i, they are not allocated here
+static int open_segments(fs_buf *fsbuf, uint32_t i, uint32_t count)
+{
+	if (fsbuf->seg_count + count > fsbuf->seg_capacity)
+	{
+		uint32_t capacity = fsbuf->seg_capacity * 2;
+		while (capacity < fsbuf->seg_count + count)
+			capacity *= 2;
+
+		fs_segment *segs = realloc(fsbuf->segs, capacity * sizeof(fs_segment));
+		if (segs == 0)
+			return ERR_NO_MEM;
+		fsbuf->segs = segs;
+
+		uint32_t *starts = realloc(fsbuf->seg_starts, capacity * sizeof(uint32_t));
+		if (starts == 0)
+			return ERR_NO_MEM;
+		fsbuf->seg_starts = starts;
+		fsbuf->seg_capacity = capacity;
+	}
+
+	memmove(fsbuf->segs + i + count, fsbuf->segs + i, (fsbuf->seg_count - i) * sizeof(fs_segment));
+	memmove(fsbuf->seg_starts + i + count, fsbuf->seg_starts + i, (fsbuf->seg_count - i) * sizeof(uint32_t));
+	fsbuf->seg_count += count;
+	return 0;
+}
+
+static void close_segments(fs_buf *fsbuf, uint32_t i, uint32_t count)
+{
+	memmove(fsbuf->segs + i, fsbuf->segs + i + count, (fsbuf->seg_count - i - count) * sizeof(fs_segment));
+	memmove(fsbuf->seg_starts + i, fsbuf->seg_starts + i + count, (fsbuf->seg_count - i - count) * sizeof(uint32_t));
+	fsbuf->seg_count -= count;
+}
+
+static void update_seg_starts(fs_buf *fsbuf, uint32_t i)
+{
+	if (i == 0)
+	{
+		fsbuf->seg_starts[0] = fsbuf->first_name_off;
+		i = 1;
+	}
+	for (; i < fsbuf->seg_count; i++)
+		fsbuf->seg_starts[i] = fsbuf->seg_starts[i - 1] + fsbuf->segs[i - 1].used;
+}
+
+uint32_t seg_index(fs_buf *fsbuf, uint32_t off)
+{
+	uint32_t lo = 0, hi = fsbuf->seg_count;
+	while (lo < hi)
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (fsbuf->seg_starts[mid] <= off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo > 0 ? lo - 1 : 0;
+}
+
+char *seg_ptr(fs_buf *fsbuf, uint32_t off)
+{
+	uint32_t i = seg_index(fsbuf, off);
+	return fsbuf->segs[i].data + (off - fsbuf->seg_starts[i]);
+}
+
+char *seg_wptr(fs_buf *fsbuf, uint32_t off)
+{
+	uint32_t i = seg_index(fsbuf, off);
+	must_own_segment(fsbuf, i);
+	return fsbuf->segs[i].data + (off - fsbuf->seg_starts[i]);
+}
+
+// move the bytes of segment i from local offset split on to a new segment behind it
+static int split_segment(fs_buf *fsbuf, uint32_t i, uint32_t split)
+{
+	fs_segment seg;
+	if (alloc_segment(fsbuf, &seg) != 0)
+		return ERR_NO_MEM;
+
+	if (open_segments(fsbuf, i + 1, 1) != 0)
+	{
+		free_segment(&seg);
+		return ERR_NO_MEM;
+	}
+
+	fs_segment *old = fsbuf->segs + i;
+	seg.used = old->used - split;
+	memcpy(seg.data, old->data + split, seg.used);
+	if (seg.fold)
+		memcpy(seg.fold, old->fold + split, seg.used);
+	old->used = split;
+	fsbuf->segs[i + 1] = seg;
+	fsbuf->seg_starts[i + 1] = fsbuf->seg_starts[i] + split;
+	return 0;
+}
+
+// merge segment i + 1 into i if both are small
+static void merge_segments(fs_buf *fsbuf, uint32_t i)
+{
+	if (i + 1 >= fsbuf->seg_count)
+		return;
+
+	fs_segment *seg = fsbuf->segs + i, *next = seg + 1;
+	if ((seg->used >= SEG_LOW && next->used >= SEG_LOW) || seg->used + next->used > SEG_FILL)
+		return;
+	// merging is optional, a shared segment which can not be copied is left as it is
+	if (own_segment(fsbuf, i) != 0)
+		return;
+
+	memcpy(seg->data + seg->used, next->data, next->used);
+	if (seg->fold)
+		memcpy(seg->fold + seg->used, next->fold, next->used);
+	seg->used += next->used;
+	free_segment(next);
+	close_segments(fsbuf, i + 1, 1);
+}
+
+static void seg_copy_in(fs_buf *fsbuf, uint32_t off, const char *src, uint32_t size)
+{
+	uint32_t i = seg_index(fsbuf, off);
+	while (size > 0)
+	{
+		uint32_t local = off - fsbuf->seg_starts[i];
+		uint32_t n = fsbuf->segs[i].used - local < size ? fsbuf->segs[i].used - local : size;
+		memcpy(fsbuf->segs[i].data + local, src, n);
+		src += n;
+		off += n;
+		size -= n;
+		i++;
+	}
+}
+
+int seg_make_room(fs_buf *fsbuf, uint32_t off, uint32_t size)
+{
+	uint32_t i = seg_index(fsbuf, off);
+	// the head of a segment is also the end of the previous one
+	if (i > 0 && off == fsbuf->seg_starts[i] && fsbuf->segs[i - 1].used + size <= SEG_SIZE)
+		i--;
+
+	if (fsbuf->segs[i].used + size > SEG_SIZE)
+	{
+		fs_segment *seg = fsbuf->segs + i;
+		if (split_segment(fsbuf, i, entries_size(fsbuf, seg->data, seg->used, seg->used / 2)) != 0)
+			return ERR_NO_MEM;
+		if (off > fsbuf->seg_starts[i + 1] || (off == fsbuf->seg_starts[i + 1] && fsbuf->segs[i].used + size > SEG_SIZE))
+			i++;
+	}
+
+	if (own_segment(fsbuf, i) != 0)
+		return ERR_NO_MEM;
+
+	fs_segment *seg = fsbuf->segs + i;
+	uint32_t local = off - fsbuf->seg_starts[i];
+	memmove(seg->data + local + size, seg->data + local, seg->used - local);
+	if (seg->fold)
+		memmove(seg->fold + local + size, seg->fold + local, seg->used - local);
+	seg->used += size;
+	for (uint32_t j = i + 1; j < fsbuf->seg_count; j++)
+		fsbuf->seg_starts[j] += size;
+	return 0;
+}
+
+int seg_insert_block(fs_buf *fsbuf, uint32_t off, const char *block, uint32_t size)
+{
+	if (size <= SEG_LOW)
+	{
+		if (seg_make_room(fsbuf, off, size) != 0)
+			return ERR_NO_MEM;
+		seg_copy_in(fsbuf, off, block, size);
+		return 0;
+	}
+
+	uint32_t count = 0;
+	for (uint32_t n = 0; n < size; count++)
+		n += entries_size(fsbuf, block + n, size - n, SEG_FILL);
+
+	// big blocks get segments of their own
+	fs_segment *segs = calloc(count, sizeof(fs_segment));
+	if (segs == 0)
+		return ERR_NO_MEM;
+
+	for (uint32_t k = 0, n = 0; k < count; k++)
+	{
+		if (alloc_segment(fsbuf, segs + k) != 0)
+		{
+			for (uint32_t j = 0; j < k; j++)
+				free_segment(segs + j);
+			free(segs);
+			return ERR_NO_MEM;
+		}
+		segs[k].used = entries_size(fsbuf, block + n, size - n, SEG_FILL);
+		memcpy(segs[k].data, block + n, segs[k].used);
+		n += segs[k].used;
+	}
+
+	uint32_t i = seg_index(fsbuf, off), local = off - fsbuf->seg_starts[i];
+	int r = 0;
+	if (local > 0 && local < fsbuf->segs[i].used)
+		r = split_segment(fsbuf, i++, local);
+	else if (local > 0 || fsbuf->segs[i].used == 0)
+		i++; // the end of the last segment
+	if (r == 0)
+		r = open_segments(fsbuf, i, count);
+
+	if (r != 0)
+	{
+		for (uint32_t k = 0; k < count; k++)
+			free_segment(segs + k);
+		free(segs);
+		return ERR_NO_MEM;
+	}
+
+	memcpy(fsbuf->segs + i, segs, count * sizeof(fs_segment));
+	free(segs);
+	update_seg_starts(fsbuf, i);
+	return 0;
+}
+
+void seg_remove(fs_buf *fsbuf, uint32_t off, uint32_t size)
+{
+	uint32_t i = seg_index(fsbuf, off), first = i, local = off - fsbuf->seg_starts[i];
+	while (size > 0 && i < fsbuf->seg_count)
+	{
+		fs_segment *seg = fsbuf->segs + i;
+		uint32_t n = seg->used - local < size ? seg->used - local : size;
+		// a segment removed as a whole is only dropped
+		if (n < seg->used)
+			must_own_segment(fsbuf, i);
+		memmove(seg->data + local, seg->data + local + n, seg->used - local - n);
+		if (seg->fold)
+			memmove(seg->fold + local, seg->fold + local + n, seg->used - local - n);
+		seg->used -= n;
+		size -= n;
+		local = 0;
+
+		if (seg->used == 0 && fsbuf->seg_count > 1)
+		{
+			free_segment(seg);
+			close_segments(fsbuf, i, 1);
+			continue;
+		}
+		i++;
+	}
+
+	if (first > 0)
+		first--;
+	if (first < fsbuf->seg_count)
+		merge_segments(fsbuf, first);
+	if (first + 1 < fsbuf->seg_count)
+		merge_segments(fsbuf, first + 1);
+	update_seg_starts(fsbuf, first);
+}
+
+void seg_copy_out(fs_buf *fsbuf, uint32_t off, uint32_t size, char *dst)
+{
+	uint32_t i = seg_index(fsbuf, off);
+	while (size > 0)
+	{
+		uint32_t local = off - fsbuf->seg_starts[i];
+		uint32_t n = fsbuf->segs[i].used - local < size ? fsbuf->segs[i].used - local : size;
+		memcpy(dst, fsbuf->segs[i].data + local, n);
+		dst += n;
+		off += n;
+		size -= n;
+		i++;
+	}
+}
+
+void seg_fold_range(fs_buf *fsbuf, uint32_t off, uint32_t size)
+{
+	uint32_t i = seg_index(fsbuf, off);
+	while (size > 0)
+	{
+		uint32_t local = off - fsbuf->seg_starts[i];
+		uint32_t n = fsbuf->segs[i].used - local < size ? fsbuf->segs[i].used - local : size;
+		must_own_segment(fsbuf, i);
+		fold_entries(fsbuf, fsbuf->segs[i].fold + local, fsbuf->segs[i].data + local, n);
+		off += n;
+		size -= n;
+		i++;
+	}
+}
+
+static void seg_disable_fold(fs_buf *fsbuf)
+{
+	for (uint32_t i = 0; i < fsbuf->seg_count; i++)
+	{
+		free(fsbuf->segs[i].fold);
+		fsbuf->segs[i].fold = 0;
+	}
+	fsbuf->seg_fold = 0;
+}
+
+int seg_enable_fold(fs_buf *fsbuf)
+{
+	for (uint32_t i = 0; i < fsbuf->seg_count; i++)
+	{
+		fs_segment *seg = fsbuf->segs + i;
+		if (seg->fold)
+			continue;
+
+		if (own_segment(fsbuf, i) != 0 || (seg->fold = malloc(SEG_SIZE + SEG_PAD)) == 0)
+		{
+			seg_disable_fold(fsbuf);
+			return ERR_NO_MEM;
+		}
+		fold_entries(fsbuf, seg->fold, seg->data, seg->used);
+	}
+	fsbuf->seg_fold = 1;
+	return 0;
+}
+
+uint32_t seg_readable_end(fs_buf *fsbuf, uint32_t i)
+{
+	return fsbuf->seg_starts[i] + SEG_SIZE + SEG_PAD;
+}
+
+uint64_t seg_allocated(fs_buf *fsbuf)
+{
+	return (uint64_t)fsbuf->seg_count * (SEG_SIZE + SEG_PAD) * (fsbuf->seg_fold ? 2 : 1);
+}
+
+void free_segments(fs_buf *fsbuf)
+{
+	for (uint32_t i = 0; i < fsbuf->seg_count; i++)
+		free_segment(fsbuf->segs + i);
+	free(fsbuf->segs);
+	free(fsbuf->seg_starts);
+	fsbuf->segs = 0;
+	fsbuf->seg_starts = 0;
+	fsbuf->seg_count = fsbuf->seg_capacity = 0;
+}
+
+int share_segments(fs_buf *dst, fs_buf *src)
+{
+	dst->segs = malloc(src->seg_count * sizeof(fs_segment));
+	dst->seg_starts = malloc(src->seg_count * sizeof(uint32_t));
+	if (dst->segs == 0 || dst->seg_starts == 0)
+	{
+		free(dst->segs);
+		free(dst->seg_starts);
+		dst->segs = 0;
+		dst->seg_starts = 0;
+		return ERR_NO_MEM;
+	}
+
+	memcpy(dst->segs, src->segs, src->seg_count * sizeof(fs_segment));
+	memcpy(dst->seg_starts, src->seg_starts, src->seg_count * sizeof(uint32_t));
+	for (uint32_t i = 0; i < src->seg_count; i++)
+		__atomic_add_fetch(&block_of(src->segs[i].data)->refs, 1, __ATOMIC_RELAXED);
+	dst->seg_count = dst->seg_capacity = src->seg_count;
+	dst->seg_fold = src->seg_fold;
+	return 0;
+}
+
+// build segments from the flat head & fold
+static int build_segments(fs_buf *fsbuf)
+{
+	uint32_t size = fsbuf->tail - fsbuf->first_name_off, count = 0;
+	const char *names = fsbuf->head + fsbuf->first_name_off;
+	for (uint32_t n = 0; n < size; count++)
+		n += entries_size(fsbuf, names + n, size - n, SEG_FILL);
+	if (count == 0)
+		count = 1;
+
+	fsbuf->seg_fold = fsbuf->fold != 0;
+	fsbuf->segs = calloc(count, sizeof(fs_segment));
+	fsbuf->seg_starts = malloc(count * sizeof(uint32_t));
+	fsbuf->seg_count = fsbuf->seg_capacity = count;
+	if (fsbuf->segs == 0 || fsbuf->seg_starts == 0)
+	{
+		free_segments(fsbuf);
+		return ERR_NO_MEM;
+	}
+
+	for (uint32_t i = 0, n = 0; i < count; i++)
+	{
+		fs_segment *seg = fsbuf->segs + i;
+		if (alloc_segment(fsbuf, seg) != 0)
+		{
+			free_segments(fsbuf);
+			return ERR_NO_MEM;
+		}
+		seg->used = entries_size(fsbuf, names + n, size - n, SEG_FILL);
+		memcpy(seg->data, names + n, seg->used);
+		if (seg->fold)
+			memcpy(seg->fold, fsbuf->fold + fsbuf->first_name_off + n, seg->used);
+		n += seg->used;
+	}
+	update_seg_starts(fsbuf, 0);
+	return 0;
+}
+
+int seg_convert(fs_buf *fsbuf)
+{
+	fsbuf->seg_pending = 0;
+	if (build_segments(fsbuf) != 0)
+		return ERR_NO_MEM;
+
+	// head keeps the header only, names and folded names now live in segments
+	free(fsbuf->fold);
+	fsbuf->fold = 0;
+	resize_head(fsbuf, fsbuf->first_name_off);
+	fsbuf->capacity = fsbuf->first_name_off;
+	return 0;
+}
+
+__attribute__((visibility("default"))) int enable_segments(fs_buf *fsbuf)
+{
+	pthread_rwlock_wrlock(&fsbuf->lock);
+	int r = 0;
+	// a mapped buffer is kept as it is until changed, copying it now would page it all in
+	if (fsbuf->mapped_size)
+		fsbuf->seg_pending = fsbuf->segs == 0;
+	else if (fsbuf->segs == 0)
+		r = seg_convert(fsbuf);
+	pthread_rwlock_unlock(&fsbuf->lock);
+	return r;
+}
@@ -0,0 +1,95 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs_buf.h"
+#include "fs_buf_base.h"
+#include "utils.h"
+
+// snapshots: read-only fs_bufs of the version of a fs_buf when taken. segments are shared with the
+// fs_buf and copied by its writer before being changed (see fs_segment.c), a flat buffer is copied as a whole.
+// the latest snapshot is kept by the fs_buf, so readers coming while a writer holds the lock search it
+// instead of waiting. a snapshot replaced by a newer one is freed by the release of its last reader.
+
+static fs_buf *take_snapshot(fs_buf *fsbuf)
+{
+	fs_buf *snap = calloc(1, sizeof(fs_buf));
+	if (snap == 0)
+		return 0;
+
+	if (pthread_rwlock_init(&snap->lock, 0) != 0)
+	{
+		free(snap);
+		return 0;
+	}
+	pthread_mutex_init(&snap->snapshot_lock, 0);
+	snap->journal_fd = -1;
+
+	// names of a segmented buffer are behind its header
+	uint32_t size = fsbuf->segs ? fsbuf->first_name_off : fsbuf->tail;
+	snap->head = malloc(size);
+	snap->fold = fsbuf->fold ? malloc(size) : 0;
+	if (snap->head == 0 || (fsbuf->fold && snap->fold == 0))
+	{
+		free_fs_buf(snap);
+		return 0;
+	}
+	memcpy(snap->head, fsbuf->head, size);
+	if (snap->fold)
+		memcpy(snap->fold, fsbuf->fold, size);
+
+	snap->capacity = size;
+	snap->tail = fsbuf->tail;
+	snap->first_name_off = fsbuf->first_name_off;
+	snap->save_format = fsbuf->save_format;
+	snap->large = fsbuf->large;
+	snap->sorted = fsbuf->sorted;
+	snap->generation = fsbuf->generation;
+	// the dictionary never changes, references of the names copied stay valid
+	if ((snap->names = fsbuf->names) != 0)
+		__atomic_add_fetch(&snap->names->refs, 1, __ATOMIC_RELAXED);
+	// the reference held by fsbuf
+	snap->refs = 1;
+	// paths of results are built from the parent index too, dir hashes only speed up changes
+	// cursors of fsbuf are moved on to the snapshot through the shifts before it
+	if (copy_parent_index(snap, fsbuf) != 0 || copy_shift_log(snap, fsbuf) != 0 || copy_meta_index(snap, fsbuf) != 0 ||
+		copy_node_index(snap, fsbuf) != 0 || copy_ext_index(snap, fsbuf) != 0 || (fsbuf->segs && share_segments(snap, fsbuf) != 0))
+	{
+		free_fs_buf(snap);
+		return 0;
+	}
+	return snap;
+}
+
+__attribute__((visibility("default"))) fs_buf *acquire_fs_snapshot(fs_buf *fsbuf)
+{
+	pthread_mutex_lock(&fsbuf->snapshot_lock);
+	fs_buf *snap = fsbuf->snapshot, *replaced = 0;
+	// a writer holding the lock leaves readers with the latest snapshot taken
+	if ((snap ? pthread_rwlock_tryrdlock(&fsbuf->lock) : pthread_rwlock_rdlock(&fsbuf->lock)) == 0)
+	{
+		if (snap == 0 || snap->generation != fsbuf->generation)
+		{
+			fs_buf *taken = take_snapshot(fsbuf);
+			if (taken)
+			{
+				replaced = snap;
+				fsbuf->snapshot = snap = taken;
+			}
+		}
+		pthread_rwlock_unlock(&fsbuf->lock);
+	}
+
+	if (snap)
+		__atomic_add_fetch(&snap->refs, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&fsbuf->snapshot_lock);
+
+	if (replaced)
+		release_fs_snapshot(replaced);
+	return snap;
+}
+
+__attribute__((visibility("default"))) void release_fs_snapshot(fs_buf *snapshot)
+{
+	if (snapshot && __atomic_sub_fetch(&snapshot->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		free_fs_buf(snapshot);
+}
@@ -0,0 +1,95 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "fs_buf.h"
+#include "fs_buf_base.h"
+#include "utils.h"
+
+// sorted mode: the names of each kids list are kept in strcmp order. build_fstree sorts each folder once,
+// inserts go to their places instead of the list tail, so lookups stop at the first greater name
+// and hashed lists find places by binary search over dir_hash::kids
+
+int kids_sorted(fs_buf *fsbuf)
+{
+	const char *prev = 0;
+	for (uint32_t off = fsbuf->first_name_off; off < fsbuf->tail; off = next_name(fsbuf, off))
+	{
+		const char *name = entry_name(fsbuf, fs_ptr(fsbuf, off));
+		// a parent-tag starts the next list
+		if (*name == 0)
+			prev = 0;
+		else if (prev && strcmp(prev, name) >= 0)
+			return 0;
+		else
+			prev = name;
+	}
+	return 1;
+}
+
+uint32_t find_sorted_kid(fs_buf *fsbuf, uint32_t list_off, const char *name, uint32_t len, int *found, uint32_t *count)
+{
+	dir_hash *dh = find_dir_hash(fsbuf, list_off);
+	if (dh)
+	{
+		uint32_t lo = 0, hi = dh->kid_count;
+		while (lo < hi)
+		{
+			uint32_t mid = lo + (hi - lo) / 2;
+			if (compare_kid_name(entry_name(fsbuf, fs_ptr(fsbuf, dh->kids_off + dh->kids[mid] - 1)), name, len) < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		uint32_t off = lo < dh->kid_count ? dh->kids_off + dh->kids[lo] - 1 : dh->tail_off;
+		*found = lo < dh->kid_count && compare_kid_name(entry_name(fsbuf, fs_ptr(fsbuf, off)), name, len) == 0;
+		return off;
+	}
+
+	uint32_t off = list_off, place = 0, n = 0;
+	*found = 0;
+	for (; off < fsbuf->tail && *fs_ptr(fsbuf, off); off = next_name(fsbuf, off), n++)
+	{
+		if (place)
+			continue;
+
+		int r = compare_kid_name(entry_name(fsbuf, fs_ptr(fsbuf, off)), name, len);
+		if (r >= 0)
+		{
+			*found = r == 0;
+			place = off;
+			// the rest is only walked to be counted
+			if (count == 0)
+				return place;
+		}
+	}
+	if (count)
+		*count = n;
+	return place ? place : off;
+}
+
+__attribute__((visibility("default"))) int enable_sorted_kids(fs_buf *fsbuf)
+{
+	pthread_rwlock_wrlock(&fsbuf->lock);
+	int r = 0;
+	if (!fsbuf->sorted)
+	{
+		if (!kids_sorted(fsbuf))
+		{
+			r = ERR_NOT_SORTED;
+		}
+		else
+		{
+			fsbuf->sorted = 1;
+			// hashed lists need their kids in order
+			if (fsbuf->dir_hash_min_kids)
+				r = build_dir_hashes(fsbuf);
+		}
+	}
+	pthread_rwlock_unlock(&fsbuf->lock);
+	return r;
+}
+
+__attribute__((visibility("default"))) int is_sorted_kids(fs_buf *fsbuf)
+{
+	return fsbuf->sorted;
+}
@@ -7,12 +7,12 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
-#include <wchar.h>
 
 #include "index.h"
 #include "index_base.h"
 #include "index_allfile.h"
 #include "index_allmem.h"
+#include "posting.h"
 #include "utils.h"
 
 // File System Indice
@@ -98,9 +98,14 @@ __attribute__((visibility("default"))) void get_stats(fs_index* fsi, uint64_t *m
 	return fsi->get_statistics(fsi, memory, keywords, fsbuf_offsets);
 }
 
+__attribute__((visibility("default"))) int get_table_stats(fs_index* fsi, index_table_stats* stats)
+{
+	return fsi->get_table_stats ? fsi->get_table_stats(fsi, stats) : 1;
+}
+
 __attribute__((visibility("default"))) int get_load_policy(fs_index* fsi)
 {
-	return fsi->get_load_policy();
+	return fsi->get_load_policy(fsi);
 }
 
 __attribute__((visibility("default"))) index_keyword* get_index_keyword(fs_index* fsi, const char* query_utf8)
@@ -108,62 +113,164 @@ __attribute__((visibility("default"))) index_keyword* get_index_keyword(fs_index
 	return fsi->get_index_keyword(fsi, query_utf8);
 }
 
+index_keyword* new_query_keyword(const char* queries[], uint32_t count, uint32_t* offsets, uint32_t len)
+{
+	uint32_t size = 0;
+	for (uint32_t i = 0; i < count; i++)
+		size += strlen(queries[i]) + 1;
+
+	// queries joined by spaces
+	char s[size + 1];
+	s[0] = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		if (i > 0)
+			strcat(s, " ");
+		strcat(s, queries[i]);
+	}
+
+	index_keyword* inkw = malloc(sizeof(index_keyword));
+	if (inkw == 0 || set_cs_string(&inkw->keyword, s) == CS_SET_STR_FAIL) {
+		free(inkw);
+		free(offsets);
+		return 0;
+	}
+	inkw->fsbuf_offsets = offsets;
+	inkw->len = len;
+	inkw->empty = 0;
+	return inkw;
+}
+
+// the first limit characters of query_utf8
+static void cut_query(const char* query_utf8, uint32_t limit, char* cut)
+{
+	uint32_t len = limit > 0 ? utf8_prefix(query_utf8, limit) : strlen(query_utf8);
+	if (len > NAME_MAX)
+		len = NAME_MAX;
+	memcpy(cut, query_utf8, len);
+	cut[len] = 0;
+}
+
+__attribute__((visibility("default"))) index_keyword* get_index_keywords(fs_index* fsi, const char* queries_utf8[], uint32_t count)
+{
+	if (fsi->get_index_keywords)
+		return fsi->get_index_keywords(fsi, queries_utf8, count);
+
+	uint32_t* offsets = 0;
+	uint32_t len = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		char cut[NAME_MAX + 1];
+		cut_query(queries_utf8[i], fsi->query_limit, cut);
+		index_keyword* inkw = get_index_keyword(fsi, cut);
+		if (inkw == 0) {
+			len = 0;
+			break;
+		}
+
+		if (i == 0) {
+			offsets = malloc(sizeof(uint32_t) * inkw->len);
+			if (offsets) {
+				memcpy(offsets, inkw->fsbuf_offsets, sizeof(uint32_t) * inkw->len);
+				len = inkw->len;
+			}
+		} else
+			len = intersect_offsets(offsets, len, inkw->fsbuf_offsets, inkw->len);
+
+		if (get_load_policy(fsi) != LOAD_ALL)
+			free_index_keyword(inkw, 1);
+		if (len == 0)
+			break;
+	}
+
+	if (len == 0) {
+		free(offsets);
+		return 0;
+	}
+	return new_query_keyword(queries_utf8, count, offsets, len);
+}
+
 __attribute__((visibility("default"))) void free_fs_index(fs_index* fsi)
 {
 	fsi->free_fs_index(fsi);
 }
 
-__attribute__((visibility("default"))) int load_fs_index(fs_index** pfsi, const char* filename, int load_policy)
+int open_index_file(const char* filename, const char* magic, uint32_t* count)
 {
 	int fd = open(filename, O_RDWR);
 	if (fd < 0)
-		return 1;
+		return -1;
 
-	char magic[4];
-	if (read(fd, magic, sizeof(magic)) != sizeof(magic) || strcmp(magic, index_magic) != 0) {
+	char read_magic[4];
+	if (read(fd, read_magic, sizeof(read_magic)) != sizeof(read_magic) || strcmp(read_magic, magic) != 0) {
 		close(fd);
-		return 2;
+		return -2;
 	}
 
 	// we won't verify len here
-	uint32_t len;
-	if (read(fd, &len, sizeof(len)) != sizeof(len)) {
+	if (read(fd, count, sizeof(uint32_t)) != sizeof(uint32_t)) {
 		close(fd);
-		return 3;
+		return -3;
 	}
+	return fd;
+}
 
+int load_index_file(fs_index** pfsi, int fd, uint32_t count, int load_policy)
+{
 	switch (load_policy) {
 	case LOAD_ALL:
-		return load_allmem_index(pfsi, fd, len);
+		return load_allmem_index(pfsi, fd, count);
 	case LOAD_NONE:
-		return load_allfile_index(pfsi, fd, len);
+		return load_allfile_index(pfsi, fd, count);
 	default:
 		close(fd);
 		return -1;
 	}
 }
 
+__attribute__((visibility("default"))) int load_fs_index(fs_index** pfsi, const char* filename, int load_policy)
+{
+	uint32_t len;
+	int fd = open_index_file(filename, index_magic, &len);
+	if (fd < 0)
+		return -fd;
+
+	return load_index_file(pfsi, fd, len, load_policy);
+}
+
+__attribute__((visibility("default"))) uint32_t get_query_limit(fs_index* fsi)
+{
+	return fsi->query_limit;
+}
+
 __attribute__((visibility("default"))) void add_index(fs_index* fsi, char* name, uint32_t fsbuf_offset)
 {
-	// from utf8 to wchar_t
-	wchar_t converted[NAME_MAX];
-	if (utf8_to_wchar_t(name, converted, sizeof(converted) - sizeof(wchar_t)) != 0)
+	// indexes splitting names their own way take them whole
+	if (fsi->add_name) {
+		fsi->add_name(fsi, name, fsbuf_offset);
 		return;
+	}
 
-	wchar_t index[NAME_MAX];
-	for (int i = 0; i < wcslen(converted); i++)
-		for (int j = i+1; j <= wcslen(converted) && j <= i+MAX_KW_LEN; j++) {
-			wcsncpy(index, converted+i, j-i);
-			index[j-i] = 0;
-			char index_utf8[NAME_MAX];
-			if (wchar_t_to_utf8(index, index_utf8, sizeof(index_utf8) - sizeof(char)) != 0)
-				continue;
-
+	// starts of the characters, keywords are the bytes between them
+	uint32_t starts[NAME_MAX + 1], chars = 0, len = strlen(name), i = 0;
+	while (i < len) {
+		uint32_t cp, size = utf8_decode(name + i, len - i, &cp);
+		if (size == 0 || chars == NAME_MAX)
+			return;
+		starts[chars++] = i;
+		i += size;
+	}
+	starts[chars] = len;
+
+	char index_utf8[NAME_MAX + 1];
+	for (i = 0; i < chars; i++)
+		for (uint32_t j = i+1; j <= chars && j <= i+MAX_KW_LEN; j++) {
+			uint32_t size = starts[j] - starts[i];
+			memcpy(index_utf8, name + starts[i], size);
+			index_utf8[size] = 0;
 			fsi->add_index(fsi, index_utf8, fsbuf_offset);
 		}
 }
 
-void add_fsbuf_offsets(fs_index* fsi, uint32_t start_off, int delta)
+__attribute__((visibility("default"))) void add_fsbuf_offsets(fs_index* fsi, uint32_t start_off, int delta)
 {
 	return fsi->add_fsbuf_offsets(fsi, start_off, delta);
 }
@@ -49,7 +49,7 @@ static index_keyword* get_index_keyword_allfile(fs_index* fsi, const char* query
 	if (lseek(afi->fd, ico.off, SEEK_SET) == -1)
 		return 0;
 
-	index_keyword* inkw = malloc(sizeof(index_keyword));
+	index_keyword* inkw = calloc(1, sizeof(index_keyword));
 	if (inkw == 0)
 		return 0;
 
@@ -62,6 +62,7 @@ static index_keyword* get_index_keyword_allfile(fs_index* fsi, const char* query
 			return 0;
 		}
 	}
+	free(inkw);
 	return 0;
 }
 
@@ -89,6 +90,10 @@ int load_allfile_index(fs_index** pfsi, int fd, uint32_t count)
 	afi->base.add_index = add_index_allfile;
 	afi->base.add_fsbuf_offsets = add_fsbuf_offsets_allfile;
 	afi->base.free_fs_index = free_fs_index_allfile;
+	afi->base.query_limit = MAX_KW_LEN;
+	afi->base.add_name = 0;
+	afi->base.get_index_keywords = 0;
+	afi->base.get_table_stats = 0;
 	afi->fd = fd;
 
 	*pfsi = &afi->base;
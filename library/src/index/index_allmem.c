@@ -14,14 +14,35 @@
 #include "index_utils.h"
 #include "utils.h"
 
-#define IDX_KW_BLK	4
 #define FSBUF_BLK	4
+#define SLOTS_INIT	1024
+#define KW_INIT		256
+// keywords of 7 bytes or more are kept in blocks of the arena, which are never moved
+#define ARENA_BLK	(1 << 16)
 
 extern const char index_magic[];
 
+// a slot of the keyword table. the table is open-addressing with robin hood insertion: a keyword takes the slot
+// of one closer to its home slot, so probe lengths stay short & even, and a lookup stops at the first slot
+// whose keyword is closer to home than the probe
+typedef struct __kw_slot__ {
+	// hash_keyword of the keyword, 0 for a free slot
+	uint32_t hash;
+	// position in keywords
+	uint32_t pos;
+} kw_slot;
+
 struct __fs_allmem_index__ {
 	fs_index base;
-	index_hash* indice;
+	kw_slot* slots;
+	uint32_t slot_count;
+	index_keyword* keywords;
+	uint32_t keyword_count;
+	uint32_t keyword_capacity;
+	char** arena;
+	uint32_t arena_count;
+	// bytes used of the last arena block
+	uint32_t arena_used;
 };
 
 static int get_load_policy_allmem()
@@ -33,101 +54,189 @@ static void get_stats_allmem(fs_index* fsi, uint64_t *memory, uint32_t* keywords
 {
 	fs_allmem_index* ami = (fs_allmem_index*)fsi;
 
-	*memory = sizeof(index_hash)*fsi->count;
-	*keywords = 0;
+	*memory = sizeof(fs_allmem_index) + sizeof(kw_slot)*ami->slot_count + sizeof(index_keyword)*ami->keyword_capacity +
+		(uint64_t)ARENA_BLK*ami->arena_count;
+	*keywords = ami->keyword_count;
 	*fsbuf_offsets = 0;
-	for (int i = 0; i < fsi->count; i++) {
-		if (ami->indice[i].len == 0)
+	for (uint32_t i = 0; i < ami->keyword_count; i++) {
+		index_keyword* inkw = &ami->keywords[i];
+		*fsbuf_offsets = *fsbuf_offsets + inkw->len;
+		*memory = *memory + sizeof(uint32_t)*(inkw->len + inkw->empty);
+	}
+}
+
+static uint32_t probe_length(fs_allmem_index* ami, uint32_t i)
+{
+	return (i - ami->slots[i].hash) & (ami->slot_count - 1);
+}
+
+static int get_table_stats_allmem(fs_index* fsi, index_table_stats* stats)
+{
+	fs_allmem_index* ami = (fs_allmem_index*)fsi;
+	stats->slots = ami->slot_count;
+	stats->keywords = ami->keyword_count;
+	stats->max_probe = 0;
+	stats->total_probe = 0;
+	for (uint32_t i = 0; i < ami->slot_count; i++) {
+		if (ami->slots[i].hash == 0)
 			continue;
 
-		*keywords = *keywords + ami->indice[i].len;
-		*memory = *memory + sizeof(index_keyword)*(ami->indice[i].len + ami->indice[i].empty);
-		for (int j = 0; j < ami->indice[i].len; j++) {
-			index_keyword* inkw = &ami->indice[i].keywords[j];
-			*fsbuf_offsets = *fsbuf_offsets + inkw->len;
-			*memory = *memory + sizeof(uint32_t)*(inkw->len + inkw->empty);
-			char *s = get_cs_string(&inkw->keyword);
-			if (strlen(s) >= 7)
-				*memory = *memory + strlen(s) + 1;
-		}
+		uint32_t n = probe_length(ami, i);
+		stats->total_probe += n;
+		if (n > stats->max_probe)
+			stats->max_probe = n;
+	}
+	return 0;
+}
+
+static uint32_t keyword_hash(const char* s)
+{
+	uint32_t h = hash_keyword(s, strlen(s));
+	// 0 tells a free slot
+	return h ? h : 1;
+}
+
+// the slot holding s (of hash h), 0 if none
+static kw_slot* find_slot(fs_allmem_index* ami, const char* s, uint32_t h)
+{
+	uint32_t mask = ami->slot_count - 1;
+	for (uint32_t i = h & mask, n = 0; ; i = (i + 1) & mask, n++) {
+		kw_slot* slot = &ami->slots[i];
+		if (slot->hash == 0 || probe_length(ami, i) < n)
+			return 0;
+		if (slot->hash == h && strcmp(get_cs_string(&ami->keywords[slot->pos].keyword), s) == 0)
+			return slot;
 	}
 }
 
 static index_keyword* get_index_keyword_allmem(fs_index* fsi, const char* query_utf8)
 {
 	fs_allmem_index* ami = (fs_allmem_index*)fsi;
-	uint32_t ih = hash(query_utf8) % fsi->count;
-
-	uint32_t inkw_pos = ami->indice[ih].len;
-	for (uint32_t i = 0; i < ami->indice[ih].len; i++) {
-		index_keyword* inkw = &ami->indice[ih].keywords[i];
-		if (strcmp(get_cs_string(&inkw->keyword), query_utf8) == 0) {
-			inkw_pos = i;
-			break;
+	kw_slot* slot = find_slot(ami, query_utf8, keyword_hash(query_utf8));
+	return slot ? &ami->keywords[slot->pos] : 0;
+}
+
+// robin hood insertion of a keyword not in the table
+static void put_slot(fs_allmem_index* ami, kw_slot slot)
+{
+	uint32_t mask = ami->slot_count - 1;
+	for (uint32_t i = slot.hash & mask, n = 0; ; i = (i + 1) & mask, n++) {
+		if (ami->slots[i].hash == 0) {
+			ami->slots[i] = slot;
+			return;
+		}
+
+		// the richer keyword gives its slot up & goes on probing
+		uint32_t len = probe_length(ami, i);
+		if (len < n) {
+			kw_slot t = ami->slots[i];
+			ami->slots[i] = slot;
+			slot = t;
+			n = len;
 		}
 	}
+}
 
-	return inkw_pos == ami->indice[ih].len ? 0 : &ami->indice[ih].keywords[inkw_pos];
+static int grow_slots(fs_allmem_index* ami)
+{
+	kw_slot* old = ami->slots;
+	uint32_t old_count = ami->slot_count;
+	kw_slot* slots = calloc(sizeof(kw_slot), old_count * 2);
+	if (slots == 0)
+		return 1;
+
+	ami->slots = slots;
+	ami->slot_count = old_count * 2;
+	for (uint32_t i = 0; i < old_count; i++)
+		if (old[i].hash)
+			put_slot(ami, old[i]);
+	free(old);
+	return 0;
 }
 
 static void free_fs_index_allmem(fs_index* fsi)
 {
 	fs_allmem_index* ami = (fs_allmem_index*)fsi;
-	for (uint32_t i = 0; i < fsi->count; i++) {
-		if (ami->indice[i].keywords == 0)
-			continue;
-
-		for (uint32_t j = 0; j < ami->indice[i].len; j++)
-			free_index_keyword(&ami->indice[i].keywords[j], 0);
-		free(ami->indice[i].keywords);
-	}
-	
-	free(ami->indice);
+	// keywords point into the arena, only the offsets are theirs
+	for (uint32_t i = 0; i < ami->keyword_count; i++)
+		free(ami->keywords[i].fsbuf_offsets);
+	for (uint32_t i = 0; i < ami->arena_count; i++)
+		free(ami->arena[i]);
+
+	free(ami->arena);
+	free(ami->keywords);
+	free(ami->slots);
 	free(ami);
 }
 
-static index_keyword* init_index_keyword(index_keyword* inkw, const char* index_utf8)
+// room for size bytes in the arena
+static char* arena_alloc(fs_allmem_index* ami, uint32_t size)
 {
-	int ret = set_cs_string(&inkw->keyword, index_utf8);
-	if (ret == CS_SET_STR_FAIL)
-		return 0;
-	int long_str = CS_LONG_STR == ret;
+	if (ami->arena_count == 0 || ami->arena_used + size > ARENA_BLK) {
+		char** arena = realloc(ami->arena, sizeof(char*) * (ami->arena_count + 1));
+		if (arena == 0)
+			return 0;
+		ami->arena = arena;
 
-	inkw->fsbuf_offsets = malloc(FSBUF_BLK * sizeof(uint32_t));
-	if (inkw->fsbuf_offsets == 0) {
-		if (long_str)
-			free(inkw->keyword.p);
-		return 0;
+		if ((arena[ami->arena_count] = malloc(ARENA_BLK)) == 0)
+			return 0;
+		ami->arena_count++;
+		ami->arena_used = 0;
 	}
 
-	inkw->empty = FSBUF_BLK;
-	inkw->len = 0;
-	return inkw;
+	char* p = ami->arena[ami->arena_count - 1] + ami->arena_used;
+	ami->arena_used += size;
+	return p;
 }
 
-static index_keyword* get_index_keyword_for_append(fs_allmem_index* ami, const char* query_utf8)
+// a new keyword of s (of hash h) taking offsets (0 for none yet)
+static index_keyword* new_keyword(fs_allmem_index* ami, const char* s, uint32_t h, uint32_t* offsets, uint32_t len)
 {
-	index_keyword* inkw = get_index_keyword_allmem(&ami->base, query_utf8);
-	if (inkw != 0)
-		return inkw;
+	if ((ami->keyword_count + 1)*8 > ami->slot_count*7 && grow_slots(ami) != 0)
+		return 0;
 
-	uint32_t ih = hash(query_utf8) % ami->base.count;
-	if (ami->indice[ih].empty == 0) {
-		void* p = realloc(ami->indice[ih].keywords, sizeof(index_keyword) * (ami->indice[ih].len + IDX_KW_BLK));
-		if (p == 0)
+	if (ami->keyword_count == ami->keyword_capacity) {
+		uint32_t capacity = ami->keyword_capacity ? ami->keyword_capacity * 2 : KW_INIT;
+		index_keyword* keywords = realloc(ami->keywords, sizeof(index_keyword) * capacity);
+		if (keywords == 0)
 			return 0;
-		ami->indice[ih].keywords = p;
-		ami->indice[ih].empty = IDX_KW_BLK;
+		ami->keywords = keywords;
+		ami->keyword_capacity = capacity;
 	}
 
-	inkw = init_index_keyword(&ami->indice[ih].keywords[ami->indice[ih].len], query_utf8);
-	if (inkw) {
-		ami->indice[ih].len++;
-		ami->indice[ih].empty--;
+	index_keyword* inkw = &ami->keywords[ami->keyword_count];
+	uint32_t size = strlen(s) + 1;
+	if (size <= sizeof(inkw->keyword.short_str.s)) {
+		set_cs_string(&inkw->keyword, s);
+	} else {
+		char* p = arena_alloc(ami, size);
+		if (p == 0)
+			return 0;
+		memcpy(p, s, size);
+		inkw->keyword.p = p;
 	}
+
+	if (offsets == 0) {
+		if ((offsets = malloc(FSBUF_BLK * sizeof(uint32_t))) == 0)
+			return 0;
+		inkw->empty = FSBUF_BLK;
+	} else
+		inkw->empty = 0;
+	inkw->fsbuf_offsets = offsets;
+	inkw->len = len;
+
+	kw_slot slot = {h, ami->keyword_count++};
+	put_slot(ami, slot);
 	return inkw;
 }
 
+static index_keyword* get_index_keyword_for_append(fs_allmem_index* ami, const char* query_utf8)
+{
+	uint32_t h = keyword_hash(query_utf8);
+	kw_slot* slot = find_slot(ami, query_utf8, h);
+	return slot ? &ami->keywords[slot->pos] : new_keyword(ami, query_utf8, h, 0, 0);
+}
+
 static void add_index_allmem(fs_index* fsi, const char* index_utf8, uint32_t fsbuf_offset)
 {
 	fs_allmem_index* ami = (fs_allmem_index*)fsi;
@@ -159,16 +268,24 @@ static void add_index_allmem(fs_index* fsi, const char* index_utf8, uint32_t fsb
 static void add_fsbuf_offsets_allmem(fs_index* fsi, uint32_t start_off, int delta)
 {
 	fs_allmem_index* ami = (fs_allmem_index*)fsi;
-	for (uint32_t i = 0; i < fsi->count; i++) {
-		for (uint32_t j = 0; j < ami->indice[i].len; j++) {
-			index_keyword* inkw = &ami->indice[i].keywords[j];
-			add_inkw_fsbuf_offsets(inkw, start_off, delta);
-		}
-	}
+	for (uint32_t i = 0; i < ami->keyword_count; i++)
+		add_inkw_fsbuf_offsets(&ami->keywords[i], start_off, delta);
 }
 
-static void init_allmem_base(fs_index* fsi, uint32_t count)
+static fs_allmem_index* create_allmem_index(uint32_t count)
 {
+	fs_allmem_index* ami = calloc(1, sizeof(fs_allmem_index));
+	if (0 == ami)
+		return 0;
+
+	ami->slot_count = SLOTS_INIT;
+	ami->slots = calloc(sizeof(kw_slot), ami->slot_count);
+	if (0 == ami->slots) {
+		free(ami);
+		return 0;
+	}
+
+	fs_index* fsi = &ami->base;
 	fsi->count = count;
 	fsi->get_statistics = get_stats_allmem;
 	fsi->get_load_policy = get_load_policy_allmem;
@@ -176,26 +293,23 @@ static void init_allmem_base(fs_index* fsi, uint32_t count)
 	fsi->add_index = add_index_allmem;
 	fsi->add_fsbuf_offsets = add_fsbuf_offsets_allmem;
 	fsi->free_fs_index = free_fs_index_allmem;
+	fsi->query_limit = MAX_KW_LEN;
+	fsi->add_name = 0;
+	fsi->get_index_keywords = 0;
+	fsi->get_table_stats = get_table_stats_allmem;
+	return ami;
 }
 
 int load_allmem_index(fs_index** pfsi, int fd, uint32_t count)
 {
-	fs_allmem_index* ami = malloc(sizeof(fs_allmem_index));
+	fs_allmem_index* ami = create_allmem_index(count);
 	if (0 == ami) {
 		close(fd);
 		return 10;
 	}
-	init_allmem_base(&ami->base, count);
 
 	posix_fadvise(fd, sizeof(uint32_t)*2, 0, POSIX_FADV_SEQUENTIAL);
 
-	ami->indice = calloc(sizeof(index_hash), count);
-	if (ami->indice == 0) {
-		free(ami);
-		close(fd);
-		return 11; 
-	}
-
 	inkw_count_off* icos = load_inkw_count_offs(fd, count);
 	if (icos == 0) {
 		free_fs_index_allmem(&ami->base);
@@ -203,24 +317,28 @@ int load_allmem_index(fs_index** pfsi, int fd, uint32_t count)
 		return 12;
 	}
 
+	uint32_t total = 0;
 	for (uint32_t i = 0; i < count; i++)
-		ami->indice[i].len = icos[i].len;
+		total += icos[i].len;
 	free(icos);
 
-	for (uint32_t i = 0; i < count; i++) {
-		ami->indice[i].keywords = calloc(sizeof(index_keyword), ami->indice[i].len);
-		if (ami->indice[i].keywords == 0) {
+	// keywords of the file are all different, their offsets are taken over as they are
+	for (uint32_t i = 0; i < total; i++) {
+		index_keyword inkw;
+		if (load_index_keyword(fd, &inkw, LOAD_ALL, 0) != 0) {
 			free_fs_index_allmem(&ami->base);
 			close(fd);
-			return 13;
+			return 14;
 		}
-		for (uint32_t j = 0; j < ami->indice[i].len; j++) {
-			if (load_index_keyword(fd, &ami->indice[i].keywords[j], LOAD_ALL, 0) != 0) {
-				free_fs_index_allmem(&ami->base);
-				close(fd);
-				return 14;
-			}
+
+		char* s = get_cs_string(&inkw.keyword);
+		if (new_keyword(ami, s, keyword_hash(s), inkw.fsbuf_offsets, inkw.len) == 0) {
+			free_index_keyword(&inkw, 0);
+			free_fs_index_allmem(&ami->base);
+			close(fd);
+			return 13;
 		}
+		free_composite_str(&inkw.keyword);
 	}
 
 	*pfsi = &ami->base;
@@ -230,71 +348,64 @@ int load_allmem_index(fs_index** pfsi, int fd, uint32_t count)
 
 __attribute__((visibility("default"))) fs_allmem_index* new_allmem_index(uint32_t count)
 {
-	fs_allmem_index* ami = malloc(sizeof(fs_allmem_index));
-	if (0 == ami)
-		return 0;
-
-	ami->indice = calloc(sizeof(index_hash), count);
-	if (0 == ami->indice) {
-		free(ami);
-		return 0;
-	}
-	init_allmem_base(&ami->base, count);
-
-	return ami;
+	return create_allmem_index(count);
 }
 
+// keywords are written in count buckets by hash, which the file is looked up with when loaded with LOAD_NONE
 __attribute__((visibility("default"))) int save_allmem_index(fs_allmem_index* ami, const char* filename)
 {
-	int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-	if (fd < 0)
-		return 1;
-
-	if (write(fd, index_magic, strlen(index_magic)+1) != strlen(index_magic)+1) {
-		close(fd);
-		return 2;
-	}
-
-	if (write(fd, &ami->base.count, sizeof(ami->base.count)) != sizeof(ami->base.count)) {
-		close(fd);
-		return 3;
+	uint32_t count = ami->base.count;
+	inkw_count_off* icos = calloc(sizeof(inkw_count_off), count);
+	uint32_t* starts = malloc(sizeof(uint32_t) * count);
+	uint32_t* order = malloc(sizeof(uint32_t) * (ami->keyword_count + 1));
+	if (icos == 0 || starts == 0 || order == 0) {
+		free(icos);
+		free(starts);
+		free(order);
+		return 4;
 	}
 
-	inkw_count_off* icos = malloc(sizeof(inkw_count_off) * ami->base.count);
-	if (icos == 0) {
-		close(fd);
-		return 4;
+	// sizes of the buckets first, then where they start
+	for (uint32_t i = 0; i < ami->keyword_count; i++) {
+		index_keyword* inkw = &ami->keywords[i];
+		char* s = get_cs_string(&inkw->keyword);
+		uint32_t ih = hash(s) % count;
+		icos[ih].len++;
+		icos[ih].off += sizeof(uint32_t)*2 + strlen(s) + 1 + sizeof(uint32_t)*inkw->len;
 	}
 
-	uint64_t offset = strlen(index_magic) + 1 + sizeof(uint32_t) + sizeof(inkw_count_off)*ami->base.count;
-	for (uint32_t i = 0; i < ami->base.count; i++) {
-		icos[i].len = ami->indice[i].len;
+	uint64_t offset = strlen(index_magic) + 1 + sizeof(uint32_t) + sizeof(inkw_count_off)*count;
+	uint32_t start = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		uint64_t size = icos[i].off;
 		icos[i].off = offset;
-		uint64_t inkw_size = 0;
-		for (uint32_t j = 0; j < ami->indice[i].len; j++) {
-			index_keyword* inkw = &ami->indice[i].keywords[j];
-			char* s = get_cs_string(&inkw->keyword);
-			inkw_size += sizeof(uint32_t)*2 + strlen(s) + 1 + sizeof(uint32_t)*inkw->len;
-		}
-		offset += inkw_size;
+		offset += size;
+		starts[i] = start;
+		start += icos[i].len;
 	}
 
-	if (write_file(fd, (char *)icos, sizeof(inkw_count_off) * ami->base.count) != 0) {
-		free(icos);
+	for (uint32_t i = 0; i < ami->keyword_count; i++)
+		order[starts[hash(get_cs_string(&ami->keywords[i].keyword)) % count]++] = i;
+	free(starts);
+
+	int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	int r = 0;
+	if (fd < 0)
+		r = 1;
+	else if (write(fd, index_magic, strlen(index_magic)+1) != strlen(index_magic)+1)
+		r = 2;
+	else if (write(fd, &count, sizeof(count)) != sizeof(count))
+		r = 3;
+	else if (write_file(fd, (char *)icos, sizeof(inkw_count_off) * count) != 0)
+		r = 5;
+
+	for (uint32_t i = 0; r == 0 && i < ami->keyword_count; i++)
+		if (save_index_keyword(fd, &ami->keywords[order[i]]) == 0)
+			r = 6;
+
+	if (fd >= 0)
 		close(fd);
-		return 5;
-	}
+	free(order);
 	free(icos);
-
-	for (uint32_t i = 0; i < ami->base.count; i++) {
-		for (uint32_t j = 0; j < ami->indice[i].len; j++) {
-			index_keyword* inkw = &ami->indice[i].keywords[j];
-			if (save_index_keyword(fd, inkw) == 0) {
-				close(fd);
-				return 6;
-			}
-		}
-	}
-	close(fd);
-	return 0;
+	return r;
 }
@@ -0,0 +1,576 @@
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "fs_buf.h"
+#include "index.h"
+#include "index_base.h"
+#include "index_allfile.h"
+#include "index_trigram.h"
+#include "index_utils.h"
+#include "posting.h"
+#include "utils.h"
+
+// trigram index: posting lists of the 3-byte sequences of utf8 names. a query of 3 bytes or more is answered by
+// intersecting the lists of its trigrams, and the candidates are checked against their names. shorter queries
+// check every name of the fs_buf. the lists are compressed in memory, the file keeps them as the keywords of an
+// allmem index (with a magic of its own), which are looked up there when loaded with LOAD_NONE.
+// the lists keep node ids instead of offsets if fsbuf has them, which changes of fsbuf leave as they are:
+// only the names inserted are added, the ids of removed names no longer give an offset
+
+#define GRAM_LEN	3
+#define SLOTS_INIT	1024
+
+// Fs Index of 3-grams
+const char trigram_magic[] = "FS3";
+
+#pragma pack(push, 4)
+
+typedef struct __gram_slot__ {
+	// the 3 bytes of the gram, 0 for a free slot
+	uint32_t gram;
+	posting_list* list;
+} gram_slot;
+
+#pragma pack(pop)
+
+struct __fs_trigram_index__ {
+	fs_index base;
+	gram_slot* slots;
+	uint32_t slot_count;
+	uint32_t gram_count;
+	// grams left in the index file when loaded with LOAD_NONE
+	fs_index* grams;
+	fs_buf* fsbuf;
+	// the lists hold node ids of fsbuf
+	int by_id;
+	// result of the last query when loaded all in memory, whose results are not freed by callers
+	index_keyword* last;
+};
+
+// posting list of a gram, compressed in memory or loaded from the file
+typedef struct __gram_postings__ {
+	posting_list* pl;
+	index_keyword* inkw;
+	uint32_t len;
+} gram_postings;
+
+static uint32_t gram_key(const char* s)
+{
+	return (uint8_t)s[0] << 16 | (uint8_t)s[1] << 8 | (uint8_t)s[2];
+}
+
+// the slot of gram, or the free one it would take
+static gram_slot* find_slot(fs_trigram_index* tgi, uint32_t gram)
+{
+	uint32_t h = gram * 2654435761u;
+	h ^= h >> 16;
+	for (uint32_t i = h & (tgi->slot_count - 1); ; i = (i + 1) & (tgi->slot_count - 1))
+		if (tgi->slots[i].gram == gram || tgi->slots[i].gram == 0)
+			return &tgi->slots[i];
+}
+
+static int grow_slots(fs_trigram_index* tgi)
+{
+	gram_slot* old = tgi->slots;
+	uint32_t old_count = tgi->slot_count;
+	gram_slot* slots = calloc(sizeof(gram_slot), old_count * 2);
+	if (slots == 0)
+		return 1;
+
+	tgi->slots = slots;
+	tgi->slot_count = old_count * 2;
+	for (uint32_t i = 0; i < old_count; i++)
+		if (old[i].gram)
+			*find_slot(tgi, old[i].gram) = old[i];
+	free(old);
+	return 0;
+}
+
+static void add_gram(fs_trigram_index* tgi, uint32_t gram, uint32_t fsbuf_offset)
+{
+	gram_slot* slot = find_slot(tgi, gram);
+	if (slot->gram == 0 && (tgi->gram_count + 1)*4 > tgi->slot_count*3) {
+		if (grow_slots(tgi) != 0)
+			return;
+		slot = find_slot(tgi, gram);
+	}
+
+	posting_list* pl = posting_add(slot->list, fsbuf_offset);
+	if (pl == 0)
+		return;
+
+	if (slot->gram == 0) {
+		slot->gram = gram;
+		tgi->gram_count++;
+	}
+	slot->list = pl;
+}
+
+static int get_load_policy_trigram(fs_index* fsi)
+{
+	fs_trigram_index* tgi = (fs_trigram_index*)fsi;
+	return tgi->grams ? get_load_policy(tgi->grams) : LOAD_ALL;
+}
+
+static void get_stats_trigram(fs_index* fsi, uint64_t *memory, uint32_t* keywords, uint32_t* fsbuf_offsets)
+{
+	fs_trigram_index* tgi = (fs_trigram_index*)fsi;
+	if (tgi->grams) {
+		get_stats(tgi->grams, memory, keywords, fsbuf_offsets);
+	} else {
+		*memory = sizeof(gram_slot)*tgi->slot_count;
+		*keywords = tgi->gram_count;
+		*fsbuf_offsets = 0;
+		for (uint32_t i = 0; i < tgi->slot_count; i++) {
+			*memory = *memory + posting_memory(tgi->slots[i].list);
+			*fsbuf_offsets = *fsbuf_offsets + posting_count(tgi->slots[i].list);
+		}
+	}
+
+	*memory = *memory + sizeof(fs_trigram_index);
+	if (tgi->last)
+		*memory = *memory + sizeof(index_keyword) + sizeof(uint32_t)*tgi->last->len;
+}
+
+static void free_fs_index_trigram(fs_index* fsi)
+{
+	fs_trigram_index* tgi = (fs_trigram_index*)fsi;
+	free_index_keyword(tgi->last, 1);
+	if (tgi->grams)
+		free_fs_index(tgi->grams);
+	for (uint32_t i = 0; i < tgi->slot_count; i++)
+		free(tgi->slots[i].list);
+	free(tgi->slots);
+	free(tgi);
+}
+
+// adds the trigrams of s not in grams[0..n) yet, returns their count then
+static uint32_t get_grams(const char* s, char grams[][GRAM_LEN+1], uint32_t n)
+{
+	uint32_t len = strlen(s);
+	for (uint32_t i = 0; i + GRAM_LEN <= len; i++) {
+		uint32_t j = 0;
+		while (j < n && memcmp(grams[j], s + i, GRAM_LEN) != 0)
+			j++;
+		if (j < n)
+			continue;
+
+		memcpy(grams[n], s + i, GRAM_LEN);
+		grams[n][GRAM_LEN] = 0;
+		n++;
+	}
+	return n;
+}
+
+static void add_name_trigram(fs_index* fsi, const char* name, uint32_t fsbuf_offset)
+{
+	fs_trigram_index* tgi = (fs_trigram_index*)fsi;
+	uint32_t len = strlen(name);
+	if (len < GRAM_LEN)
+		return;
+	if (tgi->by_id && (fsbuf_offset = get_node_id(tgi->fsbuf, fsbuf_offset)) == 0)
+		return;
+
+	char grams[len][GRAM_LEN+1];
+	uint32_t n = get_grams(name, grams, 0);
+	for (uint32_t i = 0; i < n; i++) {
+		if (tgi->grams)
+			tgi->grams->add_index(tgi->grams, grams[i], fsbuf_offset);
+		else
+			add_gram(tgi, gram_key(grams[i]), fsbuf_offset);
+	}
+}
+
+// names are added whole by add_name_trigram, a keyword given here is taken as a name too
+static void add_index_trigram(fs_index* fsi, const char* index_utf8, uint32_t fsbuf_offset)
+{
+	add_name_trigram(fsi, index_utf8, fsbuf_offset);
+}
+
+static void add_fsbuf_offsets_trigram(fs_index* fsi, uint32_t start_off, int delta)
+{
+	fs_trigram_index* tgi = (fs_trigram_index*)fsi;
+	if (tgi->by_id)
+		return;
+	if (tgi->grams) {
+		add_fsbuf_offsets(tgi->grams, start_off, delta);
+		return;
+	}
+
+	for (uint32_t i = 0; i < tgi->slot_count; i++) {
+		posting_list* pl = posting_shift(tgi->slots[i].list, start_off, delta);
+		if (pl)
+			tgi->slots[i].list = pl;
+	}
+}
+
+static int match_name(fs_trigram_index* tgi, uint32_t name_off, const char* queries[], uint32_t count)
+{
+	if (tgi->fsbuf == 0)
+		return 1;
+
+	char* name = get_name(tgi->fsbuf, name_off);
+	for (uint32_t i = 0; i < count; i++)
+		if (strstr(name, queries[i]) == 0)
+			return 0;
+	return 1;
+}
+
+static int compare_offset(const void* a, const void* b)
+{
+	uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+// offsets of the names of ids still there, in place and sorted, as names inserted later may be anywhere
+static uint32_t ids_to_offsets(fs_trigram_index* tgi, uint32_t* ids, uint32_t len)
+{
+	len = get_node_offsets(tgi->fsbuf, ids, len, ids);
+	qsort(ids, len, sizeof(uint32_t), compare_offset);
+	return len;
+}
+
+static uint32_t lookup_gram(fs_trigram_index* tgi, const char* gram, gram_postings* gp)
+{
+	gp->pl = 0;
+	gp->inkw = 0;
+	if (tgi->grams) {
+		gp->inkw = get_index_keyword(tgi->grams, gram);
+		gp->len = gp->inkw ? gp->inkw->len : 0;
+	} else {
+		gp->pl = find_slot(tgi, gram_key(gram))->list;
+		gp->len = posting_count(gp->pl);
+	}
+	return gp->len;
+}
+
+// offsets of the names containing all queries: the shortest posting list of their trigrams narrowed by the
+// others, from short to long
+static uint32_t query_grams(fs_trigram_index* tgi, const char* queries[], uint32_t count, char grams[][GRAM_LEN+1], uint32_t n, uint32_t** offsets)
+{
+	gram_postings gps[n];
+	uint32_t found = 0;
+	for (; found < n; found++)
+		if (lookup_gram(tgi, grams[found], &gps[found]) == 0)
+			break;
+
+	uint32_t len = 0;
+	if (found == n) {
+		for (uint32_t i = 1; i < n; i++)
+			for (uint32_t j = i; j > 0 && gps[j].len < gps[j-1].len; j--) {
+				gram_postings t = gps[j];
+				gps[j] = gps[j-1];
+				gps[j-1] = t;
+			}
+
+		*offsets = malloc(sizeof(uint32_t) * gps[0].len);
+		if (*offsets) {
+			if (gps[0].pl)
+				len = posting_decode(gps[0].pl, *offsets);
+			else {
+				memcpy(*offsets, gps[0].inkw->fsbuf_offsets, sizeof(uint32_t) * gps[0].len);
+				len = gps[0].len;
+			}
+		}
+		for (uint32_t i = 1; i < n && len > 0; i++)
+			len = gps[i].pl ? posting_intersect(gps[i].pl, *offsets, len) : intersect_offsets(*offsets, len, gps[i].inkw->fsbuf_offsets, gps[i].len);
+		if (tgi->by_id)
+			len = ids_to_offsets(tgi, *offsets, len);
+	}
+
+	if (tgi->grams && get_load_policy(tgi->grams) != LOAD_ALL)
+		for (uint32_t i = 0; i < found + (found < n); i++)
+			free_index_keyword(gps[i].inkw, 1);
+
+	uint32_t kept = 0;
+	for (uint32_t i = 0; i < len; i++)
+		if (match_name(tgi, (*offsets)[i], queries, count))
+			(*offsets)[kept++] = (*offsets)[i];
+	return kept;
+}
+
+// queries shorter than a trigram can appear in any name
+static uint32_t query_names(fs_trigram_index* tgi, const char* queries[], uint32_t count, uint32_t** offsets)
+{
+	if (tgi->fsbuf == 0)
+		return 0;
+
+	uint32_t len = 0, capacity = 0;
+	for (uint32_t name_off = first_name(tgi->fsbuf); name_off < get_tail(tgi->fsbuf); name_off = next_name(tgi->fsbuf, name_off)) {
+		if (!match_name(tgi, name_off, queries, count))
+			continue;
+
+		if (len == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			void* p = realloc(*offsets, sizeof(uint32_t) * capacity);
+			if (p == 0)
+				break;
+			*offsets = p;
+		}
+		(*offsets)[len++] = name_off;
+	}
+	return len;
+}
+
+static index_keyword* query_trigram(fs_trigram_index* tgi, const char* queries[], uint32_t count)
+{
+	uint32_t size = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		if (*queries[i] == 0)
+			return 0;
+		size += strlen(queries[i]);
+	}
+
+	char grams[size][GRAM_LEN+1];
+	uint32_t n = 0;
+	for (uint32_t i = 0; i < count; i++)
+		n = get_grams(queries[i], grams, n);
+
+	// ids are gone if fsbuf ran out of memory for them
+	if (tgi->by_id && !has_node_ids(tgi->fsbuf))
+		n = 0;
+
+	uint32_t* offsets = 0;
+	uint32_t len = n == 0 ? query_names(tgi, queries, count, &offsets) : query_grams(tgi, queries, count, grams, n, &offsets);
+	if (len == 0) {
+		free(offsets);
+		return 0;
+	}
+	return new_query_keyword(queries, count, offsets, len);
+}
+
+static index_keyword* get_index_keyword_trigram(fs_index* fsi, const char* query_utf8)
+{
+	fs_trigram_index* tgi = (fs_trigram_index*)fsi;
+	index_keyword* inkw = query_trigram(tgi, &query_utf8, 1);
+	if (inkw && get_load_policy_trigram(fsi) == LOAD_ALL) {
+		free_index_keyword(tgi->last, 1);
+		tgi->last = inkw;
+	}
+	return inkw;
+}
+
+static index_keyword* get_index_keywords_trigram(fs_index* fsi, const char* queries[], uint32_t count)
+{
+	return query_trigram((fs_trigram_index*)fsi, queries, count);
+}
+
+static fs_trigram_index* create_trigram_index(uint32_t count, fs_index* grams, fs_buf* fsbuf)
+{
+	fs_trigram_index* tgi = malloc(sizeof(fs_trigram_index));
+	if (tgi == 0)
+		return 0;
+
+	tgi->slot_count = grams ? 1 : SLOTS_INIT;
+	tgi->slots = calloc(sizeof(gram_slot), tgi->slot_count);
+	if (tgi->slots == 0) {
+		free(tgi);
+		return 0;
+	}
+
+	tgi->base.count = count;
+	tgi->base.query_limit = 0;
+	tgi->base.get_statistics = get_stats_trigram;
+	tgi->base.get_load_policy = get_load_policy_trigram;
+	tgi->base.get_index_keyword = get_index_keyword_trigram;
+	tgi->base.add_index = add_index_trigram;
+	tgi->base.add_fsbuf_offsets = add_fsbuf_offsets_trigram;
+	tgi->base.free_fs_index = free_fs_index_trigram;
+	tgi->base.add_name = add_name_trigram;
+	tgi->base.get_index_keywords = get_index_keywords_trigram;
+	tgi->base.get_table_stats = 0;
+	tgi->gram_count = 0;
+	tgi->grams = grams;
+	tgi->fsbuf = fsbuf;
+	tgi->by_id = grams == 0 && fsbuf && has_node_ids(fsbuf);
+	tgi->last = 0;
+	return tgi;
+}
+
+__attribute__((visibility("default"))) fs_trigram_index* new_trigram_index(uint32_t count, fs_buf* fsbuf)
+{
+	return create_trigram_index(count, 0, fsbuf);
+}
+
+__attribute__((visibility("default"))) void shrink_trigram_index(fs_trigram_index* tgi)
+{
+	for (uint32_t i = 0; i < tgi->slot_count; i++)
+		tgi->slots[i].list = posting_shrink(tgi->slots[i].list);
+}
+
+// the file keeps offsets, ids are not saved with fsbuf
+static uint32_t decode_offsets(fs_trigram_index* tgi, posting_list* pl, uint32_t* offsets)
+{
+	uint32_t len = posting_decode(pl, offsets);
+	return tgi->by_id ? ids_to_offsets(tgi, offsets, len) : len;
+}
+
+static void gram_string(uint32_t gram, char* s)
+{
+	s[0] = gram >> 16;
+	s[1] = gram >> 8;
+	s[2] = gram;
+	s[GRAM_LEN] = 0;
+}
+
+// the layout of save_allmem_index, with grams put in count buckets by their hash
+__attribute__((visibility("default"))) int save_trigram_index(fs_trigram_index* tgi, const char* filename)
+{
+	if (tgi->grams)
+		return -1;
+
+	uint32_t count = tgi->base.count, max_len = 0;
+	for (uint32_t i = 0; i < tgi->slot_count; i++)
+		if (posting_count(tgi->slots[i].list) > max_len)
+			max_len = posting_count(tgi->slots[i].list);
+
+	inkw_count_off* icos = calloc(sizeof(inkw_count_off), count);
+	uint32_t* starts = malloc(sizeof(uint32_t) * count);
+	uint32_t* order = malloc(sizeof(uint32_t) * (tgi->gram_count + 1));
+	uint32_t* offsets = malloc(sizeof(uint32_t) * (max_len + 1));
+	if (icos == 0 || starts == 0 || order == 0 || offsets == 0) {
+		free(icos);
+		free(starts);
+		free(order);
+		free(offsets);
+		return 4;
+	}
+
+	// sizes of the buckets first, then where they start. ids of removed names are left out
+	char gram[GRAM_LEN+1];
+	for (uint32_t i = 0; i < tgi->slot_count; i++) {
+		if (tgi->slots[i].gram == 0)
+			continue;
+
+		gram_string(tgi->slots[i].gram, gram);
+		uint32_t ih = hash(gram) % count, len = tgi->by_id ? decode_offsets(tgi, tgi->slots[i].list, offsets) : posting_count(tgi->slots[i].list);
+		icos[ih].len++;
+		icos[ih].off += sizeof(uint32_t)*2 + GRAM_LEN + 1 + sizeof(uint32_t)*len;
+	}
+
+	uint64_t offset = strlen(trigram_magic) + 1 + sizeof(uint32_t) + sizeof(inkw_count_off)*count;
+	uint32_t start = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		uint64_t size = icos[i].off;
+		icos[i].off = offset;
+		offset += size;
+		starts[i] = start;
+		start += icos[i].len;
+	}
+
+	for (uint32_t i = 0; i < tgi->slot_count; i++) {
+		if (tgi->slots[i].gram == 0)
+			continue;
+
+		gram_string(tgi->slots[i].gram, gram);
+		order[starts[hash(gram) % count]++] = i;
+	}
+	free(starts);
+
+	int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	int r = 0;
+	if (fd < 0)
+		r = 1;
+	else if (write(fd, trigram_magic, strlen(trigram_magic)+1) != strlen(trigram_magic)+1)
+		r = 2;
+	else if (write(fd, &count, sizeof(count)) != sizeof(count))
+		r = 3;
+	else if (write_file(fd, (char *)icos, sizeof(inkw_count_off) * count) != 0)
+		r = 5;
+
+	for (uint32_t i = 0; r == 0 && i < tgi->gram_count; i++) {
+		gram_slot* slot = &tgi->slots[order[i]];
+		index_keyword inkw;
+		gram_string(slot->gram, gram);
+		set_cs_string(&inkw.keyword, gram);
+		inkw.fsbuf_offsets = offsets;
+		inkw.len = decode_offsets(tgi, slot->list, offsets);
+		if (save_index_keyword(fd, &inkw) == 0)
+			r = 6;
+	}
+
+	if (fd >= 0)
+		close(fd);
+	free(offsets);
+	free(order);
+	free(icos);
+	return r;
+}
+
+__attribute__((visibility("default"))) int load_trigram_index(fs_index** pfsi, const char* filename, int load_policy, fs_buf* fsbuf)
+{
+	uint32_t count;
+	int fd = open_index_file(filename, trigram_magic, &count);
+	if (fd < 0)
+		return -fd;
+
+	fs_trigram_index* tgi = 0;
+	if (load_policy == LOAD_NONE) {
+		fs_index* grams = 0;
+		int r = load_allfile_index(&grams, fd, count);
+		if (r != 0)
+			return r;
+
+		tgi = create_trigram_index(count, grams, fsbuf);
+		if (tgi == 0) {
+			free_fs_index(grams);
+			return 10;
+		}
+		*pfsi = &tgi->base;
+		return 0;
+	}
+
+	if (load_policy != LOAD_ALL) {
+		close(fd);
+		return -1;
+	}
+
+	tgi = create_trigram_index(count, 0, fsbuf);
+	if (tgi == 0) {
+		close(fd);
+		return 10;
+	}
+
+	posix_fadvise(fd, sizeof(uint32_t)*2, 0, POSIX_FADV_SEQUENTIAL);
+
+	inkw_count_off* icos = load_inkw_count_offs(fd, count);
+	if (icos == 0) {
+		free_fs_index_trigram(&tgi->base);
+		close(fd);
+		return 12;
+	}
+
+	uint32_t total = 0;
+	for (uint32_t i = 0; i < count; i++)
+		total += icos[i].len;
+	free(icos);
+
+	for (uint32_t i = 0; i < total; i++) {
+		index_keyword inkw;
+		if (load_index_keyword(fd, &inkw, LOAD_ALL, 0) != 0) {
+			free_fs_index_trigram(&tgi->base);
+			close(fd);
+			return 14;
+		}
+
+		char* gram = get_cs_string(&inkw.keyword);
+		if (strlen(gram) == GRAM_LEN)
+			for (uint32_t j = 0; j < inkw.len; j++) {
+				uint32_t value = tgi->by_id ? get_node_id(fsbuf, inkw.fsbuf_offsets[j]) : inkw.fsbuf_offsets[j];
+				if (value)
+					add_gram(tgi, gram_key(gram), value);
+			}
+		free_index_keyword(&inkw, 0);
+	}
+	shrink_trigram_index(tgi);
+
+	*pfsi = &tgi->base;
+	close(fd);
+	return 0;
+}
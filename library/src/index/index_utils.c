@@ -15,6 +15,33 @@ uint32_t hash(const char* name)
 	return result;
 }
 
+static uint64_t fmix64(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+uint32_t hash_keyword(const char* s, uint32_t len)
+{
+	// 8 bytes mixed in at a time, then all bits of the result are made to depend on them
+	uint64_t h = len * 0x9e3779b97f4a7c15ULL;
+	uint32_t i = 0;
+	for (; i + 8 <= len; i += 8) {
+		uint64_t v;
+		memcpy(&v, s + i, 8);
+		h = (h ^ v) * 0x87c37b91114253d5ULL;
+		h ^= h >> 31;
+	}
+
+	uint64_t v = 0;
+	memcpy(&v, s + i, len - i);
+	return fmix64(h ^ v);
+}
+
 uint32_t get_insert_pos(uint32_t value, uint32_t* sorted, uint32_t size, int favor_big)
 {
 	if (size == 0 || sorted[0] >= value)
@@ -26,16 +53,18 @@ uint32_t get_insert_pos(uint32_t value, uint32_t* sorted, uint32_t size, int fav
 	if (sorted[size-1] < value)
 		return favor_big ? size : size-1;
 
-	for (uint32_t i = 0; i < size-1; i++) {
-		if (sorted[i] == value)
-			return i;
-
-		if (sorted[i] < value && value < sorted[i+1])
-			return favor_big ? i+1 : i;
+	// sorted[lo] < value < sorted[hi]
+	uint32_t lo = 0, hi = size-1;
+	while (hi - lo > 1) {
+		uint32_t mid = lo + (hi - lo)/2;
+		if (sorted[mid] == value)
+			return mid;
+		if (sorted[mid] < value)
+			lo = mid;
+		else
+			hi = mid;
 	}
-
-	// this should never happen
-	return favor_big ? size : size-1;
+	return favor_big ? hi : lo;
 }
 
 inkw_count_off* load_inkw_count_offs(int fd, uint32_t count)
@@ -61,11 +90,22 @@ uint32_t add_inkw_fsbuf_offsets(index_keyword* inkw, uint32_t start_off, int del
 	if (inkw->fsbuf_offsets[inkw->len-1] < start_off)
 		return 0;
 
-	uint32_t total = 0;
-	for (uint32_t n = 0; n < inkw->len; n++)
-		if (inkw->fsbuf_offsets[n] >= start_off) {
-			inkw->fsbuf_offsets[n] += delta;
+	// offsets of the removed names are dropped, the others would be out of order
+	uint32_t total = 0, kept = 0, end_off = delta < 0 ? start_off - delta : start_off;
+	for (uint32_t n = 0; n < inkw->len; n++) {
+		uint32_t off = inkw->fsbuf_offsets[n];
+		if (off >= start_off && off < end_off)
+			continue;
+		if (off >= start_off) {
+			off += delta;
 			total++;
 		}
+		inkw->fsbuf_offsets[kept++] = off;
+	}
+
+	// the room of the dropped ones is kept as far as empty can tell it
+	uint32_t empty = inkw->empty + inkw->len - kept;
+	inkw->empty = empty > 15 ? 15 : empty;
+	inkw->len = kept;
 	return total;
 }
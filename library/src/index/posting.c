@@ -0,0 +1,449 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#include "posting.h"
+
+// offsets per block, a block inserted into when full is split in halves
+#define POSTING_BLOCK	128
+#define MAX_VARINT		5
+#define POSTING_INIT	16
+
+typedef struct __attribute__((__packed__)) __block_header__ {
+	uint32_t first;
+	uint16_t len;
+	// bytes of the deltas following the header
+	uint16_t size;
+} block_header;
+
+struct __posting_list__ {
+	uint32_t count;
+	uint32_t max;
+	// position of the last block, which appends go to
+	uint32_t last;
+	uint32_t size;
+	uint32_t capacity;
+	uint8_t data[];
+};
+
+static block_header read_header(posting_list* pl, uint32_t pos)
+{
+	block_header h;
+	memcpy(&h, pl->data + pos, sizeof(h));
+	return h;
+}
+
+static void write_header(posting_list* pl, uint32_t pos, block_header h)
+{
+	memcpy(pl->data + pos, &h, sizeof(h));
+}
+
+static uint32_t next_block(posting_list* pl, uint32_t pos)
+{
+	return pos + sizeof(block_header) + read_header(pl, pos).size;
+}
+
+static uint32_t encode_varint(uint32_t v, uint8_t* p)
+{
+	uint32_t n = 0;
+	while (v >= 0x80) {
+		p[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+	return n;
+}
+
+// bytes of the block of n offsets written to out
+static uint32_t encode_block(const uint32_t* values, uint32_t n, uint8_t* out)
+{
+	uint32_t size = 0;
+	for (uint32_t i = 1; i < n; i++)
+		size += encode_varint(values[i] - values[i-1], out + sizeof(block_header) + size);
+
+	block_header h = {values[0], n, size};
+	memcpy(out, &h, sizeof(h));
+	return sizeof(h) + size;
+}
+
+static uint32_t decode_block(const uint8_t* p, uint32_t* out)
+{
+	block_header h;
+	memcpy(&h, p, sizeof(h));
+	p += sizeof(h);
+
+	out[0] = h.first;
+	for (uint32_t i = 1; i < h.len; i++) {
+		uint32_t d = 0, shift = 0;
+		while (*p & 0x80) {
+			d |= (*p++ & 0x7f) << shift;
+			shift += 7;
+		}
+		d |= *p++ << shift;
+		out[i] = out[i-1] + d;
+	}
+	return h.len;
+}
+
+static posting_list* reserve_posting(posting_list* pl, uint32_t extra)
+{
+	if (pl->size + extra <= pl->capacity)
+		return pl;
+
+	uint32_t capacity = pl->capacity + pl->capacity/2;
+	if (capacity < pl->size + extra)
+		capacity = pl->size + extra;
+	posting_list* p = realloc(pl, sizeof(posting_list) + capacity);
+	if (p)
+		p->capacity = capacity;
+	return p;
+}
+
+// puts size bytes of enc in place of the old_size bytes of the block at pos
+static posting_list* replace_block(posting_list* pl, uint32_t pos, uint32_t old_size, const uint8_t* enc, uint32_t size)
+{
+	if (size > old_size) {
+		posting_list* p = reserve_posting(pl, size - old_size);
+		if (p == 0)
+			return 0;
+		pl = p;
+	}
+
+	memmove(pl->data + pos + size, pl->data + pos + old_size, pl->size - pos - old_size);
+	memcpy(pl->data + pos, enc, size);
+	pl->size += size - old_size;
+	if (pos < pl->last)
+		pl->last += size - old_size;
+	return pl;
+}
+
+posting_list* posting_add(posting_list* pl, uint32_t value)
+{
+	if (pl == 0) {
+		pl = malloc(sizeof(posting_list) + POSTING_INIT);
+		if (pl == 0)
+			return 0;
+		pl->capacity = POSTING_INIT;
+		pl->count = 0;
+		pl->size = 0;
+	}
+
+	// a new list, or one emptied by removals
+	if (pl->count == 0) {
+		posting_list* p = reserve_posting(pl, sizeof(block_header));
+		if (p == 0)
+			return 0;
+		pl = p;
+
+		pl->count = 1;
+		pl->max = value;
+		pl->last = 0;
+		pl->size = encode_block(&value, 1, pl->data);
+		return pl;
+	}
+
+	if (value == pl->max)
+		return pl;
+
+	// names are mostly added in the order of their offsets
+	if (value > pl->max) {
+		posting_list* p = reserve_posting(pl, sizeof(block_header) + MAX_VARINT);
+		if (p == 0)
+			return 0;
+		pl = p;
+
+		block_header h = read_header(pl, pl->last);
+		if (h.len < POSTING_BLOCK) {
+			uint32_t n = encode_varint(value - pl->max, pl->data + pl->size);
+			h.len++;
+			h.size += n;
+			write_header(pl, pl->last, h);
+			pl->size += n;
+		} else {
+			pl->last = pl->size;
+			pl->size += encode_block(&value, 1, pl->data + pl->size);
+		}
+		pl->max = value;
+		pl->count++;
+		return pl;
+	}
+
+	// the block value falls in, the first one if it's below them all
+	uint32_t pos = 0;
+	while (pos != pl->last) {
+		uint32_t next = next_block(pl, pos);
+		if (read_header(pl, next).first > value)
+			break;
+		pos = next;
+	}
+
+	uint32_t values[POSTING_BLOCK + 1];
+	uint32_t len = decode_block(pl->data + pos, values), i = 0;
+	while (i < len && values[i] < value)
+		i++;
+	if (i < len && values[i] == value)
+		return pl;
+
+	memmove(values + i + 1, values + i, sizeof(uint32_t)*(len - i));
+	values[i] = value;
+	len++;
+
+	uint8_t enc[2*(sizeof(block_header) + POSTING_BLOCK*MAX_VARINT)];
+	uint32_t size, first_size = 0;
+	if (len > POSTING_BLOCK) {
+		first_size = encode_block(values, len/2, enc);
+		size = first_size + encode_block(values + len/2, len - len/2, enc + first_size);
+	} else
+		size = encode_block(values, len, enc);
+
+	int split_last = first_size && pos == pl->last;
+	posting_list* p = replace_block(pl, pos, next_block(pl, pos) - pos, enc, size);
+	if (p == 0)
+		return 0;
+	pl = p;
+	if (split_last)
+		pl->last = pos + first_size;
+	pl->count++;
+	return pl;
+}
+
+// drops the offsets in [start, end) and moves the ones behind down to start. values only get closer, so the
+// blocks are encoded again in no more bytes
+static posting_list* posting_remove(posting_list* pl, uint32_t start, uint32_t end)
+{
+	uint32_t pos = 0, prev = 0;
+	while (pos < pl->size) {
+		block_header h = read_header(pl, pos);
+		int is_last = pos == pl->last;
+		uint32_t next = next_block(pl, pos);
+		if (h.first >= end) {
+			h.first -= end - start;
+			write_header(pl, pos, h);
+		} else if (h.first >= start || is_last || read_header(pl, next).first >= start) {
+			uint32_t values[POSTING_BLOCK];
+			uint32_t len = decode_block(pl->data + pos, values), n = 0;
+			for (uint32_t i = 0; i < len; i++) {
+				if (values[i] >= end)
+					values[n++] = values[i] - (end - start);
+				else if (values[i] < start)
+					values[n++] = values[i];
+			}
+			pl->count -= len - n;
+
+			uint8_t enc[sizeof(block_header) + POSTING_BLOCK*MAX_VARINT];
+			uint32_t size = n ? encode_block(values, n, enc) : 0;
+			replace_block(pl, pos, next - pos, enc, size);
+			// an emptied last block leaves the one before it last
+			if (n == 0 && is_last)
+				pl->last = prev;
+			if (n == 0) {
+				if (is_last)
+					break;
+				continue;
+			}
+			next = pos + size;
+		}
+
+		if (is_last)
+			break;
+		prev = pos;
+		pos = next;
+	}
+
+	if (pl->count == 0) {
+		pl->size = pl->last = pl->max = 0;
+		return pl;
+	}
+	uint32_t values[POSTING_BLOCK];
+	pl->max = values[decode_block(pl->data + pl->last, values) - 1];
+	return pl;
+}
+
+posting_list* posting_shift(posting_list* pl, uint32_t start, int delta)
+{
+	if (pl == 0 || pl->count == 0 || pl->max < start)
+		return pl;
+	// the offsets of removed names are dropped, the others would be out of order
+	if (delta < 0)
+		return posting_remove(pl, start, start - delta);
+
+	// only the delta crossing start is encoded again, a varint at most longer
+	posting_list* p = reserve_posting(pl, MAX_VARINT);
+	if (p == 0)
+		return 0;
+	pl = p;
+
+	uint32_t pos = 0;
+	while (1) {
+		block_header h = read_header(pl, pos);
+		int is_last = pos == pl->last;
+		uint32_t next = next_block(pl, pos);
+		if (h.first >= start) {
+			h.first += delta;
+			write_header(pl, pos, h);
+		} else if (is_last || read_header(pl, next).first >= start) {
+			uint32_t values[POSTING_BLOCK];
+			uint32_t len = decode_block(pl->data + pos, values);
+			for (uint32_t i = 0; i < len; i++)
+				if (values[i] >= start)
+					values[i] += delta;
+
+			uint8_t enc[sizeof(block_header) + POSTING_BLOCK*MAX_VARINT];
+			uint32_t size = encode_block(values, len, enc);
+			replace_block(pl, pos, next - pos, enc, size);
+			next = pos + size;
+		}
+
+		if (is_last)
+			break;
+		pos = next;
+	}
+	pl->max += delta;
+	return pl;
+}
+
+posting_list* posting_shrink(posting_list* pl)
+{
+	if (pl == 0 || pl->size == pl->capacity)
+		return pl;
+
+	posting_list* p = realloc(pl, sizeof(posting_list) + pl->size);
+	if (p == 0)
+		return pl;
+	p->capacity = p->size;
+	return p;
+}
+
+uint32_t posting_count(posting_list* pl)
+{
+	return pl ? pl->count : 0;
+}
+
+uint64_t posting_memory(posting_list* pl)
+{
+	return pl ? sizeof(posting_list) + pl->capacity : 0;
+}
+
+uint32_t posting_decode(posting_list* pl, uint32_t* out)
+{
+	if (pl == 0)
+		return 0;
+
+	uint32_t n = 0;
+	for (uint32_t pos = 0; pos < pl->size; pos = next_block(pl, pos))
+		n += decode_block(pl->data + pos, out + n);
+	return n;
+}
+
+// offsets in both sorted a & b to out, 4 of a against 4 of b at a time
+static uint32_t intersect_block(const uint32_t* a, uint32_t na, const uint32_t* b, uint32_t nb, uint32_t* out)
+{
+	uint32_t i = 0, j = 0, n = 0;
+#ifdef __x86_64__
+	while (i + 4 <= na && j + 4 <= nb) {
+		__m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i*)(b + j));
+		__m128i m = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi32(va, vb), _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1)))),
+			_mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2))),
+				_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3)))));
+		int mask = _mm_movemask_ps(_mm_castsi128_ps(m));
+		while (mask) {
+			out[n++] = a[i + __builtin_ctz(mask)];
+			mask &= mask - 1;
+		}
+
+		uint32_t amax = a[i+3], bmax = b[j+3];
+		if (amax <= bmax)
+			i += 4;
+		if (bmax <= amax)
+			j += 4;
+	}
+#endif
+	while (i < na && j < nb) {
+		if (a[i] < b[j])
+			i++;
+		else if (a[i] > b[j])
+			j++;
+		else {
+			out[n++] = a[i];
+			i++;
+			j++;
+		}
+	}
+	return n;
+}
+
+uint32_t posting_intersect(posting_list* pl, uint32_t* a, uint32_t na)
+{
+	if (pl == 0 || pl->count == 0)
+		return 0;
+
+	uint32_t values[POSTING_BLOCK], found[POSTING_BLOCK];
+	uint32_t kept = 0, ia = 0, pos = 0;
+	while (ia < na) {
+		block_header h = read_header(pl, pos);
+		int is_last = pos == pl->last;
+		uint32_t next = next_block(pl, pos);
+
+		while (ia < na && a[ia] < h.first)
+			ia++;
+		uint32_t ie = ia;
+		if (is_last)
+			while (ie < na && a[ie] <= pl->max)
+				ie++;
+		else {
+			uint32_t next_first = read_header(pl, next).first;
+			while (ie < na && a[ie] < next_first)
+				ie++;
+		}
+
+		// blocks none of a falls in are skipped without decoding
+		if (ie > ia) {
+			uint32_t len = decode_block(pl->data + pos, values);
+			uint32_t n = intersect_block(a + ia, ie - ia, values, len, found);
+			memcpy(a + kept, found, sizeof(uint32_t)*n);
+			kept += n;
+		}
+
+		ia = ie;
+		if (is_last)
+			break;
+		pos = next;
+	}
+	return kept;
+}
+
+// first position in b[from..nb) whose offset is no less than value
+static uint32_t lower_bound(const uint32_t* b, uint32_t from, uint32_t nb, uint32_t value)
+{
+	while (from < nb) {
+		uint32_t mid = from + (nb - from)/2;
+		if (b[mid] < value)
+			from = mid + 1;
+		else
+			nb = mid;
+	}
+	return from;
+}
+
+uint32_t intersect_offsets(uint32_t* a, uint32_t na, const uint32_t* b, uint32_t nb)
+{
+	uint32_t found[POSTING_BLOCK];
+	uint32_t kept = 0, j = 0;
+	for (uint32_t i = 0; i < na && j < nb; i += POSTING_BLOCK) {
+		uint32_t c = na - i < POSTING_BLOCK ? na - i : POSTING_BLOCK;
+		j = lower_bound(b, j, nb, a[i]);
+		uint32_t e = lower_bound(b, j, nb, a[i+c-1]);
+		if (e < nb && b[e] == a[i+c-1])
+			e++;
+		uint32_t n = intersect_block(a + i, c, b + j, e - j, found);
+		memcpy(a + kept, found, sizeof(uint32_t)*n);
+		kept += n;
+		j = e;
+	}
+	return kept;
+}
@@ -0,0 +1,214 @@
+#include <string.h>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#include "utils.h"
+
+// utf8 codec & case folding of names, without the setup of iconv for each call. names are mostly ascii,
+// which is checked & folded 16 bytes at a time
+
+__attribute__((visibility("default"))) uint32_t utf8_decode(const char* s, uint32_t size, uint32_t* cp)
+{
+	const uint8_t* p = (const uint8_t*)s;
+	if (size == 0)
+		return 0;
+	if (p[0] < 0x80) {
+		*cp = p[0];
+		return 1;
+	}
+
+	uint32_t n, min;
+	if ((p[0] & 0xe0) == 0xc0) {
+		n = 2;
+		min = 0x80;
+		*cp = p[0] & 0x1f;
+	} else if ((p[0] & 0xf0) == 0xe0) {
+		n = 3;
+		min = 0x800;
+		*cp = p[0] & 0x0f;
+	} else if ((p[0] & 0xf8) == 0xf0) {
+		n = 4;
+		min = 0x10000;
+		*cp = p[0] & 0x07;
+	} else
+		return 0;
+
+	if (size < n)
+		return 0;
+	for (uint32_t i = 1; i < n; i++) {
+		if ((p[i] & 0xc0) != 0x80)
+			return 0;
+		*cp = *cp << 6 | (p[i] & 0x3f);
+	}
+
+	// overlong forms, surrogates & beyond unicode
+	if (*cp < min || (*cp >= 0xd800 && *cp <= 0xdfff) || *cp > 0x10ffff)
+		return 0;
+	return n;
+}
+
+__attribute__((visibility("default"))) uint32_t utf8_encode(uint32_t cp, char* out)
+{
+	uint8_t* p = (uint8_t*)out;
+	if (cp < 0x80) {
+		p[0] = cp;
+		return 1;
+	}
+	if (cp < 0x800) {
+		p[0] = 0xc0 | cp >> 6;
+		p[1] = 0x80 | (cp & 0x3f);
+		return 2;
+	}
+	if ((cp >= 0xd800 && cp <= 0xdfff) || cp > 0x10ffff)
+		return 0;
+	if (cp < 0x10000) {
+		p[0] = 0xe0 | cp >> 12;
+		p[1] = 0x80 | (cp >> 6 & 0x3f);
+		p[2] = 0x80 | (cp & 0x3f);
+		return 3;
+	}
+	p[0] = 0xf0 | cp >> 18;
+	p[1] = 0x80 | (cp >> 12 & 0x3f);
+	p[2] = 0x80 | (cp >> 6 & 0x3f);
+	p[3] = 0x80 | (cp & 0x3f);
+	return 4;
+}
+
+__attribute__((visibility("default"))) uint32_t utf8_count(const char* s, uint32_t size)
+{
+	uint32_t i = 0, count = 0;
+#ifdef __x86_64__
+	// continuation bytes are 0x80-0xbf, below -64 as signed chars
+	for (; i + 16 <= size; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+		count += 16 - __builtin_popcount(_mm_movemask_epi8(_mm_cmplt_epi8(v, _mm_set1_epi8(-64))));
+	}
+#endif
+	for (; i < size; i++)
+		count += ((uint8_t)s[i] & 0xc0) != 0x80;
+	return count;
+}
+
+__attribute__((visibility("default"))) uint32_t utf8_prefix(const char* s, uint32_t chars)
+{
+	uint32_t i = 0;
+	for (; s[i]; i++)
+		if (((uint8_t)s[i] & 0xc0) != 0x80 && chars-- == 0)
+			break;
+	return i;
+}
+
+// upper case letters of latin, greek, cyrillic, armenian, coptic & fullwidth latin folded to lower case of the same
+// utf8 length. letters whose folding changes the length (e.g. U+0130, U+1E9E, the kelvin sign) are kept
+__attribute__((visibility("default"))) uint32_t fold_char(uint32_t cp)
+{
+	if (cp < 0x80)
+		return cp >= 'A' && cp <= 'Z' ? cp + 0x20 : cp;
+	if (cp < 0x100)
+		return cp >= 0xc0 && cp <= 0xde && cp != 0xd7 ? cp + 0x20 : cp;
+	if (cp < 0x180) {
+		// pairs of upper & lower case, odd ones upper in 0x139-0x148 & 0x179-0x17e
+		if (cp == 0x130 || cp == 0x131 || cp == 0x138 || cp == 0x149 || cp == 0x17f)
+			return cp;
+		if (cp == 0x178)
+			return 0xff;
+		if ((cp >= 0x139 && cp <= 0x148) || (cp >= 0x179 && cp <= 0x17e))
+			return cp & 1 ? cp + 1 : cp;
+		return cp & 1 ? cp : cp + 1;
+	}
+	if (cp >= 0x386 && cp <= 0x3ab) {
+		if (cp == 0x386)
+			return 0x3ac;
+		if (cp >= 0x388 && cp <= 0x38a)
+			return cp + 37;
+		if (cp == 0x38c)
+			return 0x3cc;
+		if (cp == 0x38e || cp == 0x38f)
+			return cp + 63;
+		return cp >= 0x391 && cp != 0x3a2 ? cp + 0x20 : cp;
+	}
+	if (cp == 0x3c2)
+		return 0x3c3;
+	if (cp >= 0x400 && cp <= 0x52f) {
+		if (cp < 0x410)
+			return cp + 0x50;
+		if (cp < 0x430)
+			return cp + 0x20;
+		if (cp == 0x4c0)
+			return 0x4cf;
+		if (cp >= 0x4c1 && cp <= 0x4ce)
+			return cp & 1 ? cp + 1 : cp;
+		if ((cp >= 0x460 && cp <= 0x481) || (cp >= 0x48a && cp <= 0x4bf) || cp >= 0x4d0)
+			return cp & 1 ? cp : cp + 1;
+		return cp;
+	}
+	if (cp >= 0x531 && cp <= 0x556)
+		return cp + 0x30;
+	if ((cp >= 0x1e00 && cp <= 0x1e95) || (cp >= 0x1ea0 && cp <= 0x1eff))
+		return cp & 1 ? cp : cp + 1;
+	// greek with diacritics, upper case 8 after lower case
+	if (cp >= 0x1f08 && cp <= 0x1f6f && (cp & 0xf) >= 8) {
+		uint32_t row = cp >> 4 & 0xf;
+		if (row == 0x0 || row == 0x2 || row == 0x3 || row == 0x6 || ((row == 0x1 || row == 0x4) && cp % 16 <= 0xd) ||
+				(row == 0x5 && cp & 1))
+			return cp - 8;
+		return cp;
+	}
+	if ((cp >= 0x2c80 && cp <= 0x2ce3) || (cp >= 0xa640 && cp <= 0xa66d) || (cp >= 0xa680 && cp <= 0xa69b))
+		return cp & 1 ? cp : cp + 1;
+	if (cp >= 0xff21 && cp <= 0xff3a)
+		return cp + 0x20;
+	return cp;
+}
+
+static void fold_ascii(char *dst, const char *src, uint32_t size)
+{
+	for (uint32_t i = 0; i < size; i++)
+		dst[i] = src[i] >= 'A' && src[i] <= 'Z' ? src[i] + ('a' - 'A') : src[i];
+}
+
+// the character at src (of size bytes at most) folded to dst, returns its bytes. bytes of invalid sequences
+// (e.g. tags) are copied as they are
+static uint32_t fold_utf8(char *dst, const char *src, uint32_t size)
+{
+	uint32_t cp, n = utf8_decode(src, size, &cp);
+	if (n == 0) {
+		*dst = *src;
+		return 1;
+	}
+	// the folded character has as many bytes
+	utf8_encode(fold_char(cp), dst);
+	return n;
+}
+
+void fold_bytes(char *dst, const char *src, uint32_t size)
+{
+	uint32_t i = 0;
+#ifdef __x86_64__
+	// 16 bytes are folded as ascii at a time, then the other characters among them one by one
+	while (i + 16 <= size) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_add_epi8(v, _mm_and_si128(upper, _mm_set1_epi8('a' - 'A'))));
+
+		uint32_t mask = _mm_movemask_epi8(v), end = i + 16;
+		while (mask) {
+			uint32_t p = i + __builtin_ctz(mask), n = fold_utf8(dst + p, src + p, size - p);
+			// a character running over the 16 bytes is done already
+			if (p + n > end)
+				end = p + n;
+			mask &= ~((1u << (p - i + n)) - 1);
+		}
+		i = end;
+	}
+#endif
+	while (i < size) {
+		if ((uint8_t)src[i] < 0x80) {
+			fold_ascii(dst + i, src + i, 1);
+			i++;
+		} else
+			i += fold_utf8(dst + i, src + i, size - i);
+	}
+}
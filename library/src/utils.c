@@ -1,6 +1,5 @@
 #include <unistd.h>
 #include <string.h>
-#include <iconv.h>
 #include <wchar.h>
 
 #include "utils.h"
@@ -9,36 +8,32 @@
 
 __attribute__((visibility("default"))) int utf8_to_wchar_t(char* input, wchar_t* output, size_t output_bytes)
 {
-	char *pinput = input;
-	char *poutput = (char *)output;
-	size_t inbytes = strlen(input), outbytes = output_bytes;
-
-	iconv_t icd = iconv_open("WCHAR_T", "UTF-8");
-	size_t chars = iconv(icd, &pinput, &inbytes, &poutput, &outbytes);
-	iconv_close(icd);
-
-	if (chars == -1)
-		return 1;
-
-	wchar_t *p = (wchar_t*)poutput;
-	*p = 0;
+	uint32_t len = strlen(input), i = 0;
+	size_t n = 0;
+	while (i < len) {
+		uint32_t cp, size = utf8_decode(input + i, len - i, &cp);
+		// room for the character & the terminating 0
+		if (size == 0 || (n + 2) * sizeof(wchar_t) > output_bytes)
+			return 1;
+		output[n++] = cp;
+		i += size;
+	}
+	output[n] = 0;
 	return 0;
 }
 
 __attribute__((visibility("default"))) int wchar_t_to_utf8(const wchar_t* input, char* output, size_t output_bytes)
 {
-	char *pinput = (char *)input;
-	char *poutput = output;
-	size_t inbytes = wcslen(input)*sizeof(wchar_t), outbytes = output_bytes;
-
-	iconv_t icd = iconv_open("UTF-8", "WCHAR_T");
-	size_t chars = iconv(icd, &pinput, &inbytes, &poutput, &outbytes);
-	iconv_close(icd);
-
-	if (chars == -1)
-		return 1;
-
-	*poutput = 0;
+	size_t n = 0;
+	for (; *input; input++) {
+		char c[4];
+		uint32_t size = utf8_encode(*input, c);
+		if (size == 0 || n + size + 1 > output_bytes)
+			return 1;
+		memcpy(output + n, c, size);
+		n += size;
+	}
+	output[n] = 0;
 	return 0;
 }
 
@@ -8,6 +8,7 @@
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <limits.h>
 
 #include "fs_buf.h"
@@ -103,6 +104,68 @@ static int should_skip_path(const char* path, partition_filter *pf)
 	return 0;
 }
 
+// names of a folder, each behind its is_dir byte, appended by strcmp order for fs_bufs in sorted mode
+typedef struct __name_list__ {
+	char* pool;
+	uint32_t size;
+	uint32_t capacity;
+	uint32_t count;
+} name_list;
+
+// without memory the name is dropped, as append_new_name does
+static void add_name(name_list* nl, const char* name, int is_dir)
+{
+	uint32_t len = strlen(name) + 2;
+	if (nl->size + len > nl->capacity) {
+		uint32_t capacity = nl->capacity ? nl->capacity * 2 : 4096;
+		while (capacity < nl->size + len)
+			capacity *= 2;
+		char* p = realloc(nl->pool, capacity);
+		if (p == 0)
+			return;
+		nl->pool = p;
+		nl->capacity = capacity;
+	}
+	nl->pool[nl->size] = is_dir;
+	strcpy(nl->pool + nl->size + 1, name);
+	nl->size += len;
+	nl->count++;
+}
+
+static int compare_names(const void* p1, const void* p2)
+{
+	return strcmp(*(const char**)p1 + 1, *(const char**)p2 + 1);
+}
+
+// append a name of the folder dir, with its metadata if kept
+static void append_name(fs_buf* fsbuf, DIR* dir, const char* name, int is_dir)
+{
+	uint32_t name_off = get_tail(fsbuf);
+	if (append_new_name(fsbuf, (char*)name, is_dir) != 0 || !has_fs_meta(fsbuf))
+		return;
+
+	struct stat st;
+	if (fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+		fs_meta meta = {st.st_size, st.st_mtime, st.st_mode};
+		set_fs_meta(fsbuf, name_off, &meta);
+	}
+}
+
+static void append_sorted_names(fs_buf* fsbuf, DIR* dir, name_list* nl)
+{
+	const char** names = malloc(nl->count * sizeof(char*));
+	if (names == 0)
+		return;
+
+	uint32_t i = 0;
+	for (uint32_t off = 0; off < nl->size; off += strlen(nl->pool + off + 1) + 2)
+		names[i++] = nl->pool + off;
+	qsort(names, nl->count, sizeof(char*), compare_names);
+	for (i = 0; i < nl->count; i++)
+		append_name(fsbuf, dir, names[i] + 1, names[i][0]);
+	free(names);
+}
+
 // name should be absolute path, i.e., it should start with / so that we can compare path with special path
 static int walkdir(const char* name, fs_buf* fsbuf, uint32_t parent_off, progress_report *pr, partition_filter *pf)
 {
@@ -117,6 +180,8 @@ static int walkdir(const char* name, fs_buf* fsbuf, uint32_t parent_off, progres
 		return EMPTY_DIR;
 
 	uint32_t start = get_tail(fsbuf);
+	name_list nl = {0};
+	int sorted = is_sorted_kids(fsbuf);
 
 	struct dirent* de = 0;
 	while ((de = readdir(dir)) != 0) {
@@ -128,15 +193,24 @@ static int walkdir(const char* name, fs_buf* fsbuf, uint32_t parent_off, progres
 		if (de->d_type != DT_DIR && de->d_type != DT_REG && de->d_type != DT_LNK)
 			continue;
 
-		append_new_name(fsbuf, de->d_name, de->d_type == DT_DIR);
+		if (!sorted)
+			append_name(fsbuf, dir, de->d_name, de->d_type == DT_DIR);
+		else
+			add_name(&nl, de->d_name, de->d_type == DT_DIR);
 		if (de->d_type == DT_DIR)
 			pr->dir_count++;
 		else
 			pr->file_count++;
 
-		if (pr->pcf && pr->pcf(pr->file_count, pr->dir_count, name, de->d_name, pr->param))
+		if (pr->pcf && pr->pcf(pr->file_count, pr->dir_count, name, de->d_name, pr->param)) {
+			free(nl.pool);
 			return CANCELLED;
+		}
 	}
+	// sorted once here, so that no insert has to find places
+	if (nl.count > 0)
+		append_sorted_names(fsbuf, dir, &nl);
+	free(nl.pool);
 	closedir(dir);
 
 	// empty folder
@@ -200,6 +274,8 @@ __attribute__((visibility("default"))) int build_fstree(fs_buf* fsbuf, int merge
 	pf.selected_partition = get_path_partition(root, pf.partition_count, parts);
 
 	int ret = walkdir(root, fsbuf, 0, &pr, &pf) == CANCELLED;
+	// the room left of the initial capacity (and of the last growth) is given back
+	shrink_fs_buf(fsbuf);
 
 	free(root);
 
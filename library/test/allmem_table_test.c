@@ -0,0 +1,185 @@
+#define _GNU_SOURCE
+
+#include "test_tree.h"
+#include "index.h"
+#include "index_allmem.h"
+#include "utils.h"
+
+// the keyword table of the allmem index, grown from its first slots to a hundred thousand keywords, holds each
+// keyword once at a short probe, and its keywords find the names a scan finds, through shifts of names removed
+// & inserted, saved & loaded back whole or looked up in the file
+
+#define NAMES		4000
+#define GAP			64
+#define BASE_OFF	100
+#define MAX_SUBS	(NAMES * 24 * MAX_KW_LEN)
+#define SUB_SIZE	(MAX_KW_LEN * 4 + 1)
+
+static char names[NAMES][NAME_MAX];
+static uint32_t offs[NAMES];
+static int removed[NAMES];
+
+static const char* absent[] = {"zzz", "Q", "日日", "__init__.c", "_d", "index9999"};
+
+// keywords are the substrings of up to MAX_KW_LEN characters
+static int compare_sub(const void* a, const void* b)
+{
+	return strcmp(a, b);
+}
+
+static uint32_t count_keywords()
+{
+	char (*subs)[SUB_SIZE] = malloc(sizeof(*subs) * MAX_SUBS);
+	uint32_t count = 0;
+	for (uint32_t i = 0; subs && i < NAMES; i++) {
+		const char* name = names[i];
+		for (uint32_t start = 0; name[start]; start += utf8_prefix(name + start, 1))
+			for (uint32_t chars = 1; chars <= MAX_KW_LEN && count < MAX_SUBS; chars++) {
+				uint32_t size = utf8_prefix(name + start, chars);
+				memcpy(subs[count], name + start, size);
+				subs[count++][size] = 0;
+				if (name[start + size] == 0)
+					break;
+			}
+	}
+	qsort(subs, count, SUB_SIZE, compare_sub);
+	uint32_t distinct = 0;
+	for (uint32_t i = 0; i < count; i++)
+		distinct += i == 0 || strcmp(subs[i - 1], subs[i]) != 0;
+	free(subs);
+	return distinct;
+}
+
+static void check_query(fs_index* fsi, const char* query, const char* what)
+{
+	static uint32_t expected[NAMES];
+	uint32_t n = 0;
+	for (uint32_t i = 0; i < NAMES; i++)
+		if (!removed[i] && strstr(names[i], query))
+			expected[n++] = offs[i];
+	index_keyword* inkw = get_index_keyword(fsi, query);
+	uint32_t len = inkw ? inkw->len : 0;
+	CHECK(len == n && (n == 0 || memcmp(inkw->fsbuf_offsets, expected, n * sizeof(uint32_t)) == 0),
+		  "%s: %s found %u names instead of %u", what, query, len, n);
+	if (inkw && get_load_policy(fsi) != LOAD_ALL)
+		free_index_keyword(inkw, 1);
+}
+
+static void check_queries(fs_index* fsi, const char* what)
+{
+	// the substrings of some names, all of the short names & those absent
+	char query[SUB_SIZE];
+	for (uint32_t i = 0; i < NAMES; i += 97) {
+		for (uint32_t start = 0, chars = 1; names[i][start]; start += utf8_prefix(names[i] + start, 1), chars = chars % MAX_KW_LEN + 1) {
+			uint32_t size = utf8_prefix(names[i] + start, chars);
+			memcpy(query, names[i] + start, size);
+			query[size] = 0;
+			check_query(fsi, query, what);
+		}
+	}
+	for (uint32_t i = 0; i < sizeof(absent) / sizeof(absent[0]); i++)
+		check_query(fsi, absent[i], what);
+
+	// and pairs of them
+	const char* pairs[][2] = {{"dat", "1"}, {"Écho", "7"}, {"日本", "2_"}, {".py", "main"}};
+	for (uint32_t p = 0; p < sizeof(pairs) / sizeof(pairs[0]); p++) {
+		uint32_t n = 0;
+		for (uint32_t i = 0; i < NAMES; i++)
+			n += !removed[i] && strstr(names[i], pairs[p][0]) && strstr(names[i], pairs[p][1]);
+		index_keyword* inkw = get_index_keywords(fsi, pairs[p], 2);
+		CHECK((inkw ? inkw->len : 0) == n, "%s: %s %s found %u names instead of %u", what, pairs[p][0], pairs[p][1], inkw ? inkw->len : 0, n);
+		free_index_keyword(inkw, 1);
+	}
+}
+
+static void check_table(fs_index* fsi, uint32_t keywords, const char* what)
+{
+	index_table_stats stats;
+	CHECK(get_table_stats(fsi, &stats) == 0, "%s: no table", what);
+	CHECK(stats.keywords == keywords, "%s: %u keywords in the table instead of %u", what, stats.keywords, keywords);
+	CHECK((stats.slots & (stats.slots - 1)) == 0 && (uint64_t)stats.keywords * 8 <= (uint64_t)stats.slots * 7,
+		  "%s: %u keywords in %u slots", what, stats.keywords, stats.slots);
+	// robin hood keeps probes short & even
+	CHECK(stats.max_probe < 64 && stats.total_probe < (uint64_t)stats.keywords * 4, "%s: probes of %u at most, %lu in all",
+		  what, stats.max_probe, (unsigned long)stats.total_probe);
+}
+
+// names in [first, last] removed, the rest moved down, as remove_path does
+static void remove_names(fs_index* fsi, uint32_t first, uint32_t last)
+{
+	uint32_t start = offs[first], end = offs[last] + GAP;
+	add_fsbuf_offsets(fsi, start, start - end);
+	for (uint32_t i = 0; i < NAMES; i++) {
+		if (i >= first && i <= last)
+			removed[i] = 1;
+		else if (offs[i] >= end)
+			offs[i] -= end - start;
+	}
+}
+
+// room made at the offset of name i, as insert_path does
+static void make_room(fs_index* fsi, uint32_t i, uint32_t size)
+{
+	uint32_t start = offs[i];
+	add_fsbuf_offsets(fsi, start, size);
+	for (uint32_t k = 0; k < NAMES; k++)
+		if (!removed[k] && offs[k] >= start)
+			offs[k] += size;
+}
+
+int main()
+{
+	for (uint32_t i = 0; i < NAMES; i++) {
+		sprintf(names[i], "%s_%u%s", test_stems[i % TEST_STEMS], i * 7919 % 100000, test_exts[i / TEST_STEMS % TEST_EXTS]);
+		offs[i] = BASE_OFF + i * GAP;
+	}
+	uint32_t keywords = count_keywords();
+
+	fs_index* fsi = (fs_index*)new_allmem_index(1024);
+	CHECK(fsi != 0, "no index");
+	if (fsi == 0)
+		return 1;
+	index_table_stats stats;
+	get_table_stats(fsi, &stats);
+	uint32_t first_slots = stats.slots;
+	for (uint32_t i = 0; i < NAMES; i++)
+		add_index(fsi, names[i], offs[i]);
+	// names added again are kept once
+	for (uint32_t i = 0; i < NAMES; i += 10)
+		add_index(fsi, names[i], offs[i]);
+	get_table_stats(fsi, &stats);
+	CHECK(stats.slots >= first_slots * 64, "grown from %u to %u slots only", first_slots, stats.slots);
+	check_table(fsi, keywords, "added");
+	check_queries(fsi, "added");
+
+	remove_names(fsi, 0, 0);
+	remove_names(fsi, 100, 350);
+	remove_names(fsi, NAMES - 1, NAMES - 1);
+	check_queries(fsi, "removed");
+	make_room(fsi, 50, 40);
+	make_room(fsi, 2000, GAP * 3);
+	check_queries(fsi, "inserted");
+	check_table(fsi, keywords, "shifted");
+
+	char filename[] = "/tmp/allmem_table_XXXXXX";
+	int fd = mkstemp(filename);
+	CHECK(fd >= 0 && save_allmem_index((fs_allmem_index*)fsi, filename) == 0, "saving failed");
+	if (fd >= 0)
+		close(fd);
+	for (int policy = LOAD_ALL; policy <= LOAD_NONE; policy++) {
+		const char* what = policy == LOAD_ALL ? "loaded" : "looked up in the file";
+		fs_index* loaded = 0;
+		CHECK(load_fs_index(&loaded, filename, policy) == 0 && loaded, "%s: loading failed", what);
+		if (loaded == 0)
+			continue;
+		check_queries(loaded, what);
+		if (policy == LOAD_ALL)
+			check_table(loaded, keywords, what);
+		free_fs_index(loaded);
+	}
+	unlink(filename);
+	free_fs_index(fsi);
+
+	printf("%s\n", test_failures ? "FAILED" : "OK");
+	return test_failures != 0;
+}
@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+
+#include "test_tree.h"
+
+// a batch of apply_changes ends with the paths & results the ops give one by one through insert/remove/rename_path:
+// inserts out of order and into folders inserted earlier in the same batch, names already there or twice in the batch,
+// parents missing, removes of kids & their folder, and renames between runs
+
+#define MAX_OPS	256
+
+static char paths[MAX_OPS][PATH_MAX], dsts[MAX_OPS][PATH_MAX];
+static fs_op ops[MAX_OPS];
+static uint32_t op_count;
+
+static void add_op(int type, int is_dir, const char* path, const char* dst)
+{
+	strcpy(paths[op_count], path);
+	ops[op_count] = (fs_op){type, is_dir, paths[op_count], 0, -1};
+	if (dst) {
+		strcpy(dsts[op_count], dst);
+		ops[op_count].dst_path = dsts[op_count];
+	}
+	op_count++;
+}
+
+static void make_ops()
+{
+	char dir[NAME_MAX], name[NAME_MAX], path[PATH_MAX], dst[PATH_MAX];
+	test_dir_name(dir, 0);
+	for (int i = 0; i < 40; i++) {
+		sprintf(path, "%s%s/batch%d.c", test_root, dir, (i * 17) % 40);
+		add_op(FS_OP_INSERT, 0, path, 0);
+	}
+	// a new folder and its kids out of order, nested
+	sprintf(path, "%snew_dir", test_root);
+	add_op(FS_OP_INSERT, 1, path, 0);
+	for (int i = 0; i < 5; i++) {
+		sprintf(path, "%snew_dir/kid%d", test_root, 4 - i);
+		add_op(FS_OP_INSERT, i % 2, path, 0);
+	}
+	sprintf(path, "%snew_dir/sub", test_root);
+	add_op(FS_OP_INSERT, 1, path, 0);
+	sprintf(path, "%snew_dir/sub/deep.txt", test_root);
+	add_op(FS_OP_INSERT, 0, path, 0);
+	// there already, twice in the batch, no parent
+	test_name(name, 0);
+	sprintf(path, "%s%s/%s", test_root, dir, name);
+	add_op(FS_OP_INSERT, 0, path, 0);
+	sprintf(path, "%s%s/batch3.c", test_root, dir);
+	add_op(FS_OP_INSERT, 0, path, 0);
+	sprintf(path, "%snowhere/x.c", test_root);
+	add_op(FS_OP_INSERT, 0, path, 0);
+
+	// a kid of a folder, then the folder, and a name not there
+	test_dir_name(dir, 1);
+	test_name(name, 2);
+	sprintf(path, "%s%s/%s", test_root, dir, name);
+	add_op(FS_OP_REMOVE, 0, path, 0);
+	sprintf(path, "%s%s", test_root, dir);
+	add_op(FS_OP_REMOVE, 0, path, 0);
+	sprintf(path, "%s%s/gone.c", test_root, dir);
+	add_op(FS_OP_REMOVE, 0, path, 0);
+	test_dir_name(dir, 2);
+	for (int i = 1; i < 6; i++) {
+		test_name(name, i);
+		sprintf(path, "%s%s/%s", test_root, dir, name);
+		add_op(FS_OP_REMOVE, 0, path, 0);
+	}
+
+	test_dir_name(dir, 0);
+	sprintf(path, "%s%s/batch7.c", test_root, dir);
+	sprintf(dst, "%snew_dir/sub/batch7.c", test_root);
+	add_op(FS_OP_RENAME, 0, path, dst);
+	sprintf(path, "%snew_dir", test_root);
+	sprintf(dst, "%s%s/new_dir", test_root, dir);
+	add_op(FS_OP_RENAME, 0, path, dst);
+	sprintf(path, "%s%s/new_dir/kid9", test_root, dir);
+	add_op(FS_OP_INSERT, 0, path, 0);
+	sprintf(path, "%s%s/new_dir/kid1", test_root, dir);
+	add_op(FS_OP_REMOVE, 0, path, 0);
+}
+
+static void test_batch(int sorted, uint32_t dir_hash)
+{
+	char what[64];
+	sprintf(what, "%s%s", sorted ? "sorted" : "plain", dir_hash ? " hashed" : "");
+	fs_buf* batched = sorted ? new_fs_buf(1 << 21, test_root) : build_test_buf(0);
+	fs_buf* single = build_test_buf(0);
+	if (sorted && batched && (enable_sorted_kids(batched) != 0 || build_fstree(batched, 0, 0, 0) != 0)) {
+		free_fs_buf(batched);
+		batched = 0;
+	}
+	CHECK(batched && single, "%s: no fs_buf", what);
+	if (batched && single) {
+		if (dir_hash)
+			CHECK(enable_dir_hash(batched, dir_hash) == 0, "%s: no hashes", what);
+
+		uint32_t succeeded = 0;
+		int results[MAX_OPS];
+		for (uint32_t i = 0; i < op_count; i++) {
+			fs_change changes[64];
+			uint32_t change_count;
+			if (ops[i].type == FS_OP_INSERT)
+				results[i] = insert_test_path(single, ops[i].path, ops[i].is_dir, changes);
+			else if (ops[i].type == FS_OP_REMOVE)
+				results[i] = remove_path(single, ops[i].path, changes, &change_count);
+			else
+				results[i] = rename_path(single, ops[i].path, ops[i].dst_path, changes, &change_count);
+			succeeded += results[i] == 0;
+		}
+
+		CHECK(apply_changes(batched, ops, op_count) == succeeded, "%s: not %u ops succeeded", what, succeeded);
+		for (uint32_t i = 0; i < op_count; i++)
+			CHECK(ops[i].result == results[i], "%s: op %u on %s gave %d instead of %d", what, i, ops[i].path, ops[i].result, results[i]);
+		CHECK(differ_paths(batched, single) == 0, "%s: paths differ", what);
+		CHECK(!sorted || is_sorted_kids(batched), "%s: kids out of order", what);
+	}
+	free_fs_buf(batched);
+	free_fs_buf(single);
+}
+
+int main()
+{
+	if (make_test_root("apply_changes", 2, 4, 20) != 0) {
+		remove_test_root();
+		return 1;
+	}
+
+	make_ops();
+	test_batch(0, 0);
+	test_batch(0, 1);
+	test_batch(1, 0);
+	test_batch(1, 1);
+
+	remove_test_root();
+	printf("%s\n", test_failures ? "FAILED" : "OK");
+	return test_failures != 0;
+}
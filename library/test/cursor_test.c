@@ -0,0 +1,124 @@
+#define _GNU_SOURCE
+
+#include "test_tree.h"
+#include "fs_buf_base.h"
+
+// pages of results fetched through a cursor moved on across changes between them give each name matching
+// from the start once, but those removed meanwhile, also for the range of a folder; a cursor older than
+// the changes kept is refused and left as it is
+
+#define MAX_NAMES	(1 << 14)
+#define PAGE		5
+
+static char* expected[MAX_NAMES];
+static uint32_t expected_count;
+static int seen[MAX_NAMES], removed[MAX_NAMES];
+static uint32_t inserted;
+
+static int find_expected(const char* path)
+{
+	for (uint32_t i = 0; i < expected_count; i++)
+		if (strcmp(expected[i], path) == 0)
+			return i;
+	return -1;
+}
+
+static void test_pages(fs_buf* fsbuf, const char* folder, const char* what)
+{
+	char buf[PATH_MAX], path[PATH_MAX], dir[NAME_MAX], prefix[PATH_MAX];
+	uint32_t offs[MAX_NAMES], path_off = 0, start_off = first_name(fsbuf), end_off = get_tail(fsbuf);
+	if (folder) {
+		sprintf(path, "%s%s", test_root, folder);
+		get_path_range(fsbuf, path, &path_off, &start_off, &end_off);
+	}
+	sprintf(prefix, "%s%s", test_root, folder ? folder : "");
+	expected_count = 0;
+	for (uint32_t i = 0, n = scan_names(fsbuf, "data", offs, MAX_NAMES); i < n; i++)
+		if (offs[i] >= start_off && offs[i] < end_off)
+			expected[expected_count++] = strdup(get_path_by_name_off(fsbuf, offs[i], buf, sizeof(buf)));
+	memset(seen, 0, sizeof(seen));
+	memset(removed, 0, sizeof(removed));
+	CHECK(expected_count > PAGE * 4, "%s: only %u names", what, expected_count);
+
+	fs_cursor cursor;
+	init_fs_cursor(fsbuf, &cursor, start_off, end_off);
+	fs_change changes[64];
+	uint32_t change_count, pages = 0, late = 0;
+	while (cursor.start_off < cursor.end_off) {
+		uint32_t results[PAGE], n = PAGE;
+		search_files_literal(fsbuf, &cursor.start_off, cursor.end_off, results, &n, "data", 0, 0);
+		for (uint32_t i = 0; i < n; i++) {
+			const char* p = get_path_by_name_off(fsbuf, results[i], buf, sizeof(buf));
+			int k = find_expected(p);
+			CHECK(strncmp(p, prefix, strlen(prefix)) == 0, "%s: %s is out of the range", what, p);
+			if (k < 0) {
+				late++;
+				CHECK(strstr(p, "late_data"), "%s: %s was never there", what, p);
+				continue;
+			}
+			CHECK(!seen[k] && !removed[k], "%s: %s found %s", what, p, seen[k] ? "twice" : "once removed");
+			seen[k] = 1;
+		}
+
+		// names in front of and behind the cursor, inside and outside its range, then a name not found yet
+		test_dir_name(dir, pages % 4);
+		sprintf(path, "%s%s/late_data%u.txt", test_root, dir, inserted++);
+		CHECK(insert_test_path(fsbuf, path, 0, changes) == 0, "%s: inserting %s failed", what, path);
+		if (pages % 2 == 0)
+			for (uint32_t k = expected_count; k-- > 0;)
+				if (!seen[k] && !removed[k]) {
+					CHECK(remove_path(fsbuf, expected[k], changes, &change_count) == 0, "%s: removing %s failed", what, expected[k]);
+					removed[k] = 1;
+					break;
+				}
+		CHECK(seek_fs_cursor(fsbuf, &cursor) == 0 && cursor.generation == get_fs_generation(fsbuf), "%s: the cursor was lost", what);
+		CHECK(++pages < MAX_NAMES, "%s: no end of pages", what);
+		if (pages >= MAX_NAMES)
+			break;
+	}
+
+	for (uint32_t k = 0; k < expected_count; k++)
+		CHECK(seen[k] || removed[k], "%s: %s not found", what, expected[k]);
+	for (uint32_t k = 0; k < expected_count; k++)
+		free(expected[k]);
+	CHECK(pages > 4, "%s: only %u pages (%u names inserted found)", what, pages, late);
+}
+
+int main()
+{
+	if (make_test_root("cursor", 2, 5, 40) != 0) {
+		remove_test_root();
+		return 1;
+	}
+
+	for (int segments = 0; segments < 2; segments++) {
+		fs_buf* fsbuf = build_test_buf(0);
+		CHECK(fsbuf != 0, "no fs_buf");
+		if (fsbuf == 0)
+			continue;
+		if (segments)
+			CHECK(enable_segments(fsbuf) == 0, "no segments");
+		char dir[NAME_MAX];
+		test_dir_name(dir, 2);
+		test_pages(fsbuf, 0, segments ? "all segments" : "all");
+		test_pages(fsbuf, dir, segments ? "folder segments" : "folder");
+
+		// a cursor behind all the changes kept can not follow
+		fs_cursor cursor;
+		init_fs_cursor(fsbuf, &cursor, first_name(fsbuf), get_tail(fsbuf));
+		char path[PATH_MAX];
+		fs_change change;
+		uint32_t change_count;
+		sprintf(path, "%s%s/churn.txt", test_root, dir);
+		for (int i = 0; i <= FS_SHIFT_LOG_SIZE / 2; i++)
+			CHECK(insert_test_path(fsbuf, path, 0, &change) == 0 && remove_path(fsbuf, path, &change, &change_count) == 0,
+				  "churning %s failed", path);
+		fs_cursor old = cursor;
+		CHECK(seek_fs_cursor(fsbuf, &cursor) == 1 && memcmp(&old, &cursor, sizeof(cursor)) == 0, "an old cursor moved on");
+		free_fs_buf(fsbuf);
+	}
+
+	remove_test_root();
+	printf("%s\n", test_failures ? "FAILED" : "OK");
+	return test_failures != 0;
+}
@@ -0,0 +1,83 @@
+#define _GNU_SOURCE
+
+#include "test_tree.h"
+
+// path lookups through the folder hashes give the ranges a walk of the kids gives, for every name and for
+// names not there, in a big folder and in small ones, also after the hashes are kept in step with changes
+
+static void check_ranges(fs_buf* hashed, fs_buf* plain, const char* what)
+{
+	char buf[PATH_MAX], missing[PATH_MAX + 8];
+	uint32_t names = 0;
+	for (uint32_t off = first_name(plain); off < get_tail(plain); off = next_name(plain, off)) {
+		if (*get_name(plain, off) == 0)
+			continue;
+		const char* path = get_path_by_name_off(plain, off, buf, sizeof(buf));
+		uint32_t expected[3] = {0}, got[3] = {0};
+		get_path_range(plain, path, expected, expected + 1, expected + 2);
+		get_path_range(hashed, path, got, got + 1, got + 2);
+		CHECK(expected[0] == off && memcmp(expected, got, sizeof(got)) == 0, "%s: %s is at %u (%u, %u) instead of %u (%u, %u)",
+			  what, path, got[0], got[1], got[2], expected[0], expected[1], expected[2]);
+
+		// a name of the same folder which is not there
+		if (names++ % 7 == 0) {
+			sprintf(missing, "%s~", path);
+			got[0] = 0;
+			get_path_range(hashed, missing, got, got + 1, got + 2);
+			CHECK(got[0] == 0, "%s: %s found at %u", what, missing, got[0]);
+		}
+	}
+}
+
+int main()
+{
+	// a folder of 1500 names, hashed at the default of 1024 kids
+	char path[PATH_MAX];
+	int failed = make_test_root("dir_hash", 2, 4, 20);
+	sprintf(path, "%sbig", test_root);
+	failed = failed || mkdir(path, 0755) != 0;
+	for (int i = 0; !failed && i < 1500; i++) {
+		sprintf(path, "%sbig/name%d.txt", test_root, i);
+		failed = touch_file(path) != 0;
+	}
+	if (failed) {
+		remove_test_root();
+		return 1;
+	}
+
+	for (uint32_t min_kids = 0; min_kids <= 1; min_kids++) {
+		const char* what = min_kids ? "all folders" : "big folder";
+		fs_buf* hashed = build_test_buf(0);
+		fs_buf* plain = build_test_buf(0);
+		CHECK(hashed && plain, "%s: no fs_buf", what);
+		if (hashed && plain) {
+			CHECK(enable_dir_hash(hashed, min_kids) == 0, "%s: no hashes", what);
+			check_ranges(hashed, plain, what);
+			CHECK(change_test_buf(hashed) == 0 && change_test_buf(plain) == 0, "%s: changes failed", what);
+
+			// the big folder grows, shrinks and is renamed
+			fs_change changes[64];
+			uint32_t change_count;
+			for (int i = 0; i < 40; i++) {
+				sprintf(path, "%sbig/late%d.c", test_root, i);
+				CHECK(insert_test_path(hashed, path, 0, changes) == 0 && insert_test_path(plain, path, 0, changes) == 0,
+					  "%s: inserting %s failed", what, path);
+				sprintf(path, "%sbig/name%d.txt", test_root, i * 3);
+				CHECK(remove_path(hashed, path, changes, &change_count) == 0 && remove_path(plain, path, changes, &change_count) == 0,
+					  "%s: removing %s failed", what, path);
+			}
+			char src[PATH_MAX], dst[PATH_MAX];
+			sprintf(src, "%sbig", test_root);
+			sprintf(dst, "%sbigger", test_root);
+			CHECK(rename_path(hashed, src, dst, changes, &change_count) == 0 && rename_path(plain, src, dst, changes, &change_count) == 0,
+				  "%s: renaming %s failed", what, src);
+			check_ranges(hashed, plain, what);
+		}
+		free_fs_buf(hashed);
+		free_fs_buf(plain);
+	}
+
+	remove_test_root();
+	printf("%s\n", test_failures ? "FAILED" : "OK");
+	return test_failures != 0;
+}
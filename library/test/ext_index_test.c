@@ -0,0 +1,90 @@
+#define _GNU_SOURCE
+
+#include "test_tree.h"
+
+// search_files_ext finds what search_files finds with an extension comparator (behind the last '.', any case),
+// whole and in pages, with the index built after build_fstree or kept during it, through changes, and without it
+
+#define MAX_RESULTS	(1 << 16)
+
+static const char* exts[] = {"c", "C", "txt", "pdf", "gz", "jpg", "h", "py", "bashrc", "none", "", "averyveryverylongextensionname"};
+
+// 0 if name has the extension param, as comparators of search_files return
+static int match_ext(const char* name, void* param)
+{
+	const char* dot = strrchr(name, '.');
+	return dot == 0 || *(const char*)param == 0 || strcasecmp(dot + 1, param) != 0;
+}
+
+static void check_exts(fs_buf* fsbuf, const char* what)
+{
+	static uint32_t expected[MAX_RESULTS], results[MAX_RESULTS];
+	for (uint32_t e = 0; e < sizeof(exts) / sizeof(exts[0]); e++) {
+		uint32_t page_sizes[] = {MAX_RESULTS, 3, 0};
+		for (uint32_t p = 0; p < sizeof(page_sizes) / sizeof(page_sizes[0]); p++) {
+			uint32_t count = page_sizes[p], start = first_name(fsbuf);
+			search_files(fsbuf, &start, get_tail(fsbuf), expected, &count, match_ext, (void*)exts[e], 0, 0);
+			uint32_t n = page_sizes[p], stop = first_name(fsbuf);
+			search_files_ext(fsbuf, &stop, get_tail(fsbuf), results, &n, exts[e]);
+			CHECK(n == count && memcmp(expected, results, n * sizeof(uint32_t)) == 0 && stop == start,
+				  "%s: *.%s in pages of %u found %u names up to %u instead of %u up to %u", what, exts[e], page_sizes[p], n, stop, count, start);
+		}
+	}
+}
+
+int main()
+{
+	if (make_test_root("ext_index", 2, 4, 30) != 0) {
+		remove_test_root();
+		return 1;
+	}
+	char path[PATH_MAX];
+	sprintf(path, "%s.bashrc", test_root);
+	if (touch_file(path) != 0) {
+		remove_test_root();
+		return 1;
+	}
+
+	for (int mode = 0; mode < 3; mode++) {
+		const char* what = mode == 0 ? "scanned" : mode == 1 ? "indexed" : "indexed while built";
+		fs_buf* fsbuf = 0;
+		if (mode == 2) {
+			fsbuf = new_fs_buf(1 << 21, test_root);
+			if (fsbuf && (enable_ext_index(fsbuf) != 0 || build_fstree(fsbuf, 0, 0, 0) != 0)) {
+				free_fs_buf(fsbuf);
+				fsbuf = 0;
+			}
+		} else {
+			fsbuf = build_test_buf(0);
+			if (fsbuf && mode == 1)
+				CHECK(enable_ext_index(fsbuf) == 0, "%s: no index", what);
+		}
+		CHECK(fsbuf != 0, "%s: no fs_buf", what);
+		if (fsbuf == 0)
+			continue;
+		CHECK(has_ext_index(fsbuf) == (mode != 0), "%s: index %s", what, mode ? "missing" : "made");
+		check_exts(fsbuf, what);
+		CHECK(change_test_buf(fsbuf) == 0, "%s: changes failed", what);
+		check_exts(fsbuf, what);
+
+		// names of an extension moved between segments
+		CHECK(enable_segments(fsbuf) == 0, "%s: no segments", what);
+		char dir[NAME_MAX], dst[PATH_MAX];
+		fs_change changes[64];
+		uint32_t change_count;
+		test_dir_name(dir, 3);
+		for (int i = 0; i < 20; i++) {
+			sprintf(path, "%s%s/seg%d.%s", test_root, dir, i, i % 2 ? "C" : "pdf");
+			CHECK(insert_test_path(fsbuf, path, 0, changes) == 0, "%s: inserting %s failed", what, path);
+		}
+		sprintf(path, "%s%s/seg4.pdf", test_root, dir);
+		sprintf(dst, "%sseg4.txt", test_root);
+		CHECK(rename_path(fsbuf, path, dst, changes, &change_count) == 0, "%s: renaming %s failed", what, path);
+		check_exts(fsbuf, what);
+		free_fs_buf(fsbuf);
+	}
+
+	remove_test_root();
+	printf("%s\n", test_failures ? "FAILED" : "OK");
+	return test_failures != 0;
+}
@@ -0,0 +1,162 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "fs_buf.h"
+#include "walkdir.h"
+
+// case-insensitive search over a fold of interned names: the id bytes of a reference (e.g. 0xc3 0x80 of id 67)
+// look like utf8 capitals and must be kept as they are by the fold
+
+#define DIR_COUNT	8
+#define NAME_COUNT	300
+#define MAX_RESULTS	(DIR_COUNT * NAME_COUNT * 2)
+// names left out of the first folder, inserted once interned
+#define LATE_NAME	67
+
+static char root[] = "/tmp/fold_intern_XXXXXX/";
+
+static void file_name(char *path, int i, int j)
+{
+	sprintf(path, "%sD%d/%sName%03d.TXT", root, i, j % 2 ? "Écho" : "", j);
+}
+
+static int make_tree()
+{
+	char path[256];
+	for (int i = 0; i < DIR_COUNT; i++) {
+		sprintf(path, "%sD%d", root, i);
+		if (mkdir(path, 0755) != 0)
+			return 1;
+		for (int j = 0; j < NAME_COUNT; j++) {
+			if (i == 0 && (j == LATE_NAME || j == LATE_NAME + 1))
+				continue;
+			file_name(path, i, j);
+			int fd = open(path, O_WRONLY | O_CREAT, 0644);
+			if (fd < 0)
+				return 1;
+			close(fd);
+		}
+	}
+	return 0;
+}
+
+static void remove_tree()
+{
+	char path[256];
+	for (int i = 0; i < DIR_COUNT; i++) {
+		for (int j = 0; j < NAME_COUNT; j++) {
+			file_name(path, i, j);
+			unlink(path);
+		}
+		sprintf(path, "%sD%d", root, i);
+		rmdir(path);
+	}
+	root[strlen(root) - 1] = 0;
+	rmdir(root);
+}
+
+static int insert(fs_buf *fsbuf, int j)
+{
+	// insert_path changes its path
+	char path[256];
+	fs_change change;
+	file_name(path, 0, j);
+	return insert_path(fsbuf, path, 0, &change);
+}
+
+static uint32_t count_names(fs_buf *fsbuf, const char *query)
+{
+	uint32_t count = 0;
+	for (uint32_t off = first_name(fsbuf); off < get_tail(fsbuf); off = next_name(fsbuf, off))
+		if (strcasestr(get_name(fsbuf, off), query))
+			count++;
+	return count;
+}
+
+// 0 if the nocase results of query are the names holding it
+static int check(fs_buf *fsbuf, const char *query, const char *lower, const char *what)
+{
+	static uint32_t results[MAX_RESULTS];
+	uint32_t count = MAX_RESULTS, start = first_name(fsbuf), expected = count_names(fsbuf, lower);
+	search_files_nocase(fsbuf, &start, get_tail(fsbuf), results, &count, query, 0, 0, 1);
+	for (uint32_t i = 0; i < count; i++) {
+		if (strcasestr(get_name(fsbuf, results[i]), lower) == 0) {
+			printf("%s: %s matched %s\n", what, query, get_name(fsbuf, results[i]));
+			return 1;
+		}
+	}
+	if (count != expected) {
+		printf("%s: %s found %u names instead of %u\n", what, query, count, expected);
+		return 1;
+	}
+	return 0;
+}
+
+static int check_all(fs_buf *fsbuf, const char *what)
+{
+	return check(fsbuf, "NAME06", "name06", what) || check(fsbuf, ".txt", ".txt", what) ||
+		check(fsbuf, "ÉCHONAME1", "Échoname1", what) || check(fsbuf, "échoname2", "Échoname2", what);
+}
+
+static int test(int fold_first, int segments)
+{
+	char what[64];
+	sprintf(what, "fold %s, segments %d", fold_first ? "first" : "last", segments);
+	fs_buf *fsbuf = new_fs_buf(1 << 21, root);
+	int r = build_fstree(fsbuf, 0, 0, 0);
+	if (r == 0 && segments)
+		r = enable_segments(fsbuf);
+	if (r == 0 && fold_first)
+		r = enable_fold_names(fsbuf);
+	if (r == 0)
+		r = enable_interned_names(fsbuf);
+	if (r == 0 && !fold_first)
+		r = enable_fold_names(fsbuf);
+	if (r != 0 || !has_interned_names(fsbuf) || !has_fold_names(fsbuf)) {
+		printf("%s: enabling failed\n", what);
+		free_fs_buf(fsbuf);
+		return 1;
+	}
+
+	r = check_all(fsbuf, what);
+	// names of the dictionary inserted later are folded as references too
+	if (r == 0 && (insert(fsbuf, LATE_NAME) != 0 || insert(fsbuf, LATE_NAME + 1) != 0)) {
+		printf("%s: insert failed\n", what);
+		r = 1;
+	}
+	if (r == 0)
+		r = check_all(fsbuf, what);
+	free_fs_buf(fsbuf);
+	return r;
+}
+
+int main()
+{
+	// the root path ends with a '/'
+	root[strlen(root) - 1] = 0;
+	if (mkdtemp(root) == 0) {
+		printf("no temp dir\n");
+		return 1;
+	}
+	root[strlen(root)] = '/';
+
+	if (make_tree() != 0) {
+		printf("no tree in %s\n", root);
+		remove_tree();
+		return 1;
+	}
+
+	int failed = 0;
+	for (int fold_first = 0; fold_first < 2; fold_first++)
+		for (int segments = 0; segments < 2; segments++)
+			failed += test(fold_first, segments);
+	remove_tree();
+	printf("%s\n", failed ? "FAILED" : "OK");
+	return failed != 0;
+}
@@ -0,0 +1,78 @@
+#define _GNU_SOURCE
+
+#include "test_tree.h"
+
+// the buffer grows by an eighth at least (in blocks of 1 MB), shrink_fs_buf gives back the room behind the names,
+// and the case-folded copy grows along with it
+
+#define INSERTS		5000
+#define MAX_RESULTS	(1 << 16)
+
+static void check_nocase(fs_buf* fsbuf, const char* query, const char* lower, const char* what)
+{
+	static uint32_t results[MAX_RESULTS];
+	uint32_t expected = 0;
+	for (uint32_t off = first_name(fsbuf); off < get_tail(fsbuf); off = next_name(fsbuf, off))
+		if (strcasestr(get_name(fsbuf, off), lower))
+			expected++;
+
+	uint32_t count = MAX_RESULTS, start = first_name(fsbuf);
+	search_files_nocase(fsbuf, &start, get_tail(fsbuf), results, &count, query, 0, 0, 1);
+	CHECK(count == expected, "%s: %s found %u names instead of %u", what, query, count, expected);
+}
+
+// inserts names of i in [from, to) into the first folder, which keeps names already
+static void insert_names(fs_buf* fsbuf, int from, int to)
+{
+	char dir[NAME_MAX], path[PATH_MAX];
+	test_dir_name(dir, 0);
+	for (int i = from; i < to; i++) {
+		fs_change change;
+		uint32_t capacity = get_capacity(fsbuf);
+		sprintf(path, "%s%s/Inserted_%05d_%0230d.TXT", test_root, dir, i, i);
+		int r = insert_test_path(fsbuf, path, 0, &change);
+		CHECK(r == 0, "inserting %s failed: %d", path, r);
+		if (get_capacity(fsbuf) != capacity) {
+			uint32_t added = get_capacity(fsbuf) - capacity;
+			CHECK(added >= capacity / 8 && added % (1 << 20) == 0, "capacity %u grew by %u", capacity, added);
+		}
+	}
+}
+
+int main()
+{
+	if (make_test_root("growth", 1, 4, 60) != 0) {
+		remove_test_root();
+		return 1;
+	}
+
+	fs_buf* fsbuf = build_test_buf(0);
+	CHECK(fsbuf != 0, "no fs_buf");
+	if (fsbuf) {
+		// build_fstree gives back the room left
+		CHECK(get_capacity(fsbuf) == get_tail(fsbuf), "capacity %u after build, tail %u", get_capacity(fsbuf), get_tail(fsbuf));
+		CHECK(enable_fold_names(fsbuf) == 0, "no fold");
+
+		insert_names(fsbuf, 0, INSERTS);
+		CHECK(get_capacity(fsbuf) > get_tail(fsbuf), "capacity %u, tail %u", get_capacity(fsbuf), get_tail(fsbuf));
+		check_nocase(fsbuf, "INSERTED_0", "inserted_0", "grown");
+		check_nocase(fsbuf, "écho", "Écho", "grown");
+
+		fs_buf_usage usage;
+		get_fs_buf_usage(fsbuf, &usage);
+		CHECK(usage.used <= usage.reserved, "%lu bytes used of %lu", usage.used, usage.reserved);
+
+		shrink_fs_buf(fsbuf);
+		CHECK(get_capacity(fsbuf) == get_tail(fsbuf), "capacity %u after shrink, tail %u", get_capacity(fsbuf), get_tail(fsbuf));
+		check_nocase(fsbuf, "INSERTED_0", "inserted_0", "shrunk");
+
+		// and grows again
+		insert_names(fsbuf, INSERTS, INSERTS + 100);
+		check_nocase(fsbuf, "INSERTED_0", "inserted_0", "grown again");
+		free_fs_buf(fsbuf);
+	}
+
+	remove_test_root();
+	printf("%s\n", test_failures ? "FAILED" : "OK");
+	return test_failures != 0;
+}
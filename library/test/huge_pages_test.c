@@ -0,0 +1,120 @@
+#define _GNU_SOURCE
+
+#include "test_tree.h"
+#include "fs_buf_base.h"
+
+// a buffer kept in huge pages (where the kernel has them) holds the names of a plain one: built from the smallest
+// capacity, grown by changes past a few huge pages, shrunk, loaded, mapped, interned & snapshotted. segmented
+// buffers are left as they are
+
+#define GROWN		40000
+#define HUGE_PAGE	(2 << 20)
+
+static void check_huge(fs_buf* fsbuf, int expected, const char* what)
+{
+	fs_buf_usage usage;
+	get_fs_buf_usage(fsbuf, &usage);
+	CHECK(has_huge_pages(fsbuf) == expected, "%s: huge pages %s", what, expected ? "lost" : "taken");
+	if (has_huge_pages(fsbuf))
+		CHECK(usage.huge <= usage.reserved && usage.huge % HUGE_PAGE == 0 && usage.huge >= get_tail(fsbuf) &&
+			  (uintptr_t)fsbuf->head % HUGE_PAGE == 0, "%s: %lu bytes of huge pages for %u", what, (unsigned long)usage.huge, get_tail(fsbuf));
+	else
+		CHECK(usage.huge == 0, "%s: huge pages counted", what);
+}
+
+static void check_same(fs_buf* huge, fs_buf* plain, int expected, const char* what)
+{
+	check_huge(huge, expected, what);
+	CHECK(differ_layout(huge, plain) == 0 && differ_paths(huge, plain) == 0, "%s: names differ", what);
+}
+
+// many long names in a batch, which grows the buffer a few times
+static int grow(fs_buf* fsbuf)
+{
+	static fs_op ops[GROWN];
+	static char paths[GROWN][128];
+	char dir[NAME_MAX];
+	test_dir_name(dir, 3);
+	for (int i = 0; i < GROWN; i++) {
+		sprintf(paths[i], "%s%s/grown_%05d_%s", test_root, dir, i, "a_long_name_to_fill_huge_pages_with.txt");
+		ops[i] = (fs_op){FS_OP_INSERT, 0, paths[i], 0, 0};
+	}
+	return apply_changes(fsbuf, ops, GROWN) != GROWN;
+}
+
+int main()
+{
+	if (make_test_root("huge_pages", 2, 4, 30) != 0) {
+		remove_test_root();
+		return 1;
+	}
+
+	fs_buf* huge = new_fs_buf((1 << 20) + 256, test_root);
+	fs_buf* plain = new_fs_buf((1 << 20) + 256, test_root);
+	CHECK(huge && plain, "no fs_buf");
+	if (huge && plain) {
+		CHECK(enable_huge_pages(huge) == 0, "enable_huge_pages failed");
+		// the kernel may have them turned off, which keeps the buffer as it is
+		int available = has_huge_pages(huge);
+		printf("huge pages %savailable\n", available ? "" : "not ");
+		CHECK(build_fstree(huge, 0, 0, 0) == 0 && build_fstree(plain, 0, 0, 0) == 0, "build_fstree failed");
+		check_same(huge, plain, available, "built");
+
+		CHECK(change_test_buf(huge) == 0 && change_test_buf(plain) == 0, "changes failed");
+		check_same(huge, plain, available, "changed");
+		CHECK(grow(huge) == 0 && grow(plain) == 0, "growing failed");
+		check_same(huge, plain, available, "grown");
+		fs_buf_usage usage;
+		get_fs_buf_usage(huge, &usage);
+		CHECK(!available || usage.huge > HUGE_PAGE, "grown: only %lu bytes of huge pages", (unsigned long)usage.huge);
+		shrink_fs_buf(huge);
+		shrink_fs_buf(plain);
+		check_same(huge, plain, available, "shrunk");
+
+		fs_buf* snap = acquire_fs_snapshot(huge);
+		CHECK(snap && differ_layout(snap, plain) == 0, "snapshot: names differ");
+		if (snap)
+			release_fs_snapshot(snap);
+
+		// enabled after load & after mapping a saved file
+		char path[PATH_MAX];
+		sprintf(path, "%shuge.lft", test_root);
+		CHECK(save_fs_buf(huge, path) == 0, "saving failed");
+		fs_buf* loaded = 0;
+		CHECK(load_fs_buf(&loaded, path) == 0 && enable_huge_pages(loaded) == 0, "loading failed");
+		if (loaded) {
+			check_same(loaded, plain, available, "loaded");
+			free_fs_buf(loaded);
+		}
+		loaded = 0;
+		CHECK(load_fs_buf_mmap(&loaded, path) == 0 && enable_huge_pages(loaded) == 0, "mapping failed");
+		if (loaded) {
+			check_same(loaded, plain, available, "mapped");
+			fs_change change;
+			sprintf(path, "%sLate_Dir/mapped.txt", test_root);
+			CHECK(insert_test_path(loaded, path, 0, &change) == 0 && insert_test_path(plain, path, 0, &change) == 0 &&
+				  insert_test_path(huge, path, 0, &change) == 0, "inserting %s failed", path);
+			check_same(loaded, plain, available, "mapped & changed");
+			free_fs_buf(loaded);
+		}
+		sprintf(path, "%shuge.lft", test_root);
+		unlink(path);
+
+		// interning recodes the names into a new head, mapped the same way
+		CHECK(enable_interned_names(huge) == 0 && enable_interned_names(plain) == 0, "interning failed");
+		check_same(huge, plain, available, "interned");
+	}
+	free_fs_buf(huge);
+	free_fs_buf(plain);
+
+	fs_buf* segmented = build_test_buf(0);
+	if (segmented) {
+		CHECK(enable_segments(segmented) == 0 && enable_huge_pages(segmented) == 0, "segments: enabling failed");
+		check_huge(segmented, 0, "segments");
+		free_fs_buf(segmented);
+	}
+
+	remove_test_root();
+	printf("%s\n", test_failures ? "FAILED" : "OK");
+	return test_failures != 0;
+}
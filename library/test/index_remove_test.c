@@ -0,0 +1,212 @@
+#define _GNU_SOURCE
+
+#include "test_tree.h"
+#include "index.h"
+#include "index_allmem.h"
+#include "index_trigram.h"
+#include "posting.h"
+
+// offsets of removed names are dropped by the shift of a negative delta: posting lists & allmem keywords
+// stay sorted, so intersections (AND queries) after removals find what a scan finds
+
+#define VALUES		1000
+#define MAX_RESULTS	(1 << 16)
+
+static uint32_t model[VALUES], model_count;
+
+static void model_shift(uint32_t start, int delta)
+{
+	uint32_t n = 0;
+	for (uint32_t i = 0; i < model_count; i++) {
+		if (model[i] < start)
+			model[n++] = model[i];
+		else if (delta >= 0 || model[i] >= start - delta)
+			model[n++] = model[i] + delta;
+	}
+	model_count = n;
+}
+
+static void check_list(posting_list* pl, const char* what)
+{
+	static uint32_t out[VALUES];
+	uint32_t count = posting_count(pl);
+	CHECK(count == model_count, "%s: %u offsets instead of %u", what, count, model_count);
+	if (count != model_count)
+		return;
+	posting_decode(pl, out);
+	for (uint32_t i = 0; i < count; i++) {
+		if (out[i] != model[i]) {
+			CHECK(0, "%s: offset %u is %u instead of %u", what, i, out[i], model[i]);
+			return;
+		}
+	}
+
+	// all of the model and none between are kept by an intersection
+	uint32_t a[VALUES * 2], na = 0;
+	for (uint32_t i = 0; i < model_count; i++) {
+		a[na++] = model[i];
+		if (i + 1 == model_count || model[i + 1] > model[i] + 1)
+			a[na++] = model[i] + 1;
+	}
+	count = posting_intersect(pl, a, na);
+	CHECK(count == model_count, "%s: intersection of %u instead of %u", what, count, model_count);
+}
+
+static void test_posting()
+{
+	posting_list* pl = 0;
+	model_count = 0;
+	for (uint32_t i = 0; i < VALUES; i++) {
+		// blocks of 128 offsets of gaps up to 300
+		model[model_count] = (model_count ? model[model_count - 1] : 100) + 1 + i * 7 % 300;
+		pl = posting_add(pl, model[model_count++]);
+	}
+	check_list(pl, "added");
+
+	struct { int index, span; } removes[] = {
+		{0, 1}, {10, 5}, {120, 20}, {256, 128}, {model_count / 2, 300},
+	};
+	for (uint32_t i = 0; i < sizeof(removes) / sizeof(removes[0]) && test_failures == 0; i++) {
+		// a range starting at an offset, or in the gap in front of it
+		uint32_t start = model[removes[i].index] - i % 2;
+		uint32_t end = model[removes[i].index + removes[i].span - 1] + 1;
+		char what[64];
+		sprintf(what, "removed [%u, %u)", start, end);
+		model_shift(start, start - end);
+		pl = posting_shift(pl, start, start - end);
+		check_list(pl, what);
+	}
+
+	// the last offset, then everything
+	uint32_t last = model[model_count - 1];
+	model_shift(last, -1);
+	pl = posting_shift(pl, last, -1);
+	check_list(pl, "removed last");
+	uint32_t end = model[model_count - 1] + 1;
+	model_shift(0, -(int)end);
+	pl = posting_shift(pl, 0, -(int)end);
+	check_list(pl, "removed all");
+
+	// added after, and shifted by inserts
+	model[model_count++] = 50;
+	pl = posting_add(pl, 50);
+	model_shift(40, 10);
+	pl = posting_shift(pl, 40, 10);
+	check_list(pl, "added after all removed");
+	free(pl);
+}
+
+static int compare_offset(const void* a, const void* b)
+{
+	uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+static void check_query(fs_index* fsi, fs_buf* fsbuf, const char* q1, const char* q2, const char* what)
+{
+	static uint32_t expected[MAX_RESULTS];
+	uint32_t n = 0;
+	for (uint32_t off = first_name(fsbuf); off < get_tail(fsbuf); off = next_name(fsbuf, off)) {
+		char* name = get_name(fsbuf, off);
+		if (strstr(name, q1) && strstr(name, q2))
+			expected[n++] = off;
+	}
+
+	const char* queries[] = {q1, q2};
+	index_keyword* inkw = get_index_keywords(fsi, queries, 2);
+	uint32_t len = inkw ? inkw->len : 0;
+	CHECK(len == n, "%s: %s %s found %u names instead of %u", what, q1, q2, len, n);
+	if (inkw && len == n) {
+		qsort(inkw->fsbuf_offsets, len, sizeof(uint32_t), compare_offset);
+		for (uint32_t i = 0; i < len; i++) {
+			if (inkw->fsbuf_offsets[i] != expected[i]) {
+				CHECK(0, "%s: %s %s found %u instead of %u", what, q1, q2, inkw->fsbuf_offsets[i], expected[i]);
+				break;
+			}
+		}
+	}
+	free_index_keyword(inkw, 1);
+}
+
+static void check_queries(fs_index* fsi, fs_buf* fsbuf, const char* what)
+{
+	check_query(fsi, fsbuf, "dat", "a1", what);
+	check_query(fsi, fsbuf, "ind", "ex", what);
+	check_query(fsi, fsbuf, "Écho", "txt", what);
+	check_query(fsi, fsbuf, "mai", ".py", what);
+	check_query(fsi, fsbuf, "ME", "dir", what);
+}
+
+static void remove_and_shift(fs_index* fsi, fs_buf* fsbuf, const char* path)
+{
+	fs_change changes[64];
+	uint32_t count = 0;
+	int r = remove_path(fsbuf, path, changes, &count);
+	CHECK(r == 0, "removing %s failed: %d", path, r);
+	for (uint32_t i = 0; i < count; i++)
+		add_fsbuf_offsets(fsi, changes[i].start_off, changes[i].delta);
+}
+
+static void test_index(int trigram)
+{
+	const char* what = trigram ? "trigram" : "allmem";
+	fs_buf* fsbuf = build_test_buf(0);
+	if (fsbuf == 0) {
+		CHECK(0, "%s: no fs_buf", what);
+		return;
+	}
+	fs_index* fsi = trigram ? (fs_index*)new_trigram_index(MAX_RESULTS, fsbuf) : (fs_index*)new_allmem_index(MAX_RESULTS);
+	for (uint32_t off = first_name(fsbuf); off < get_tail(fsbuf); off = next_name(fsbuf, off))
+		if (*get_name(fsbuf, off))
+			add_index(fsi, get_name(fsbuf, off), off);
+	check_queries(fsi, fsbuf, what);
+
+	// a folder of many names in the middle, a few names around it, and the last name
+	char path[PATH_MAX], name[NAME_MAX], dir[NAME_MAX];
+	test_dir_name(dir, 2);
+	sprintf(path, "%s%s", test_root, dir);
+	remove_and_shift(fsi, fsbuf, path);
+	for (int i = 1; i < 30; i += 7) {
+		test_name(name, i);
+		test_dir_name(dir, 1);
+		sprintf(path, "%s%s/%s", test_root, dir, name);
+		remove_and_shift(fsi, fsbuf, path);
+	}
+	test_dir_name(dir, 5);
+	sprintf(path, "%s%s/%s", test_root, dir, dir);
+	remove_and_shift(fsi, fsbuf, path);
+	check_queries(fsi, fsbuf, what);
+
+	// inserts after, into a folder keeping names
+	for (int i = 1; i < 30; i += 7) {
+		fs_change change;
+		test_name(name, i);
+		test_dir_name(dir, 1);
+		sprintf(path, "%s%s/%s", test_root, dir, name);
+		if (insert_test_path(fsbuf, path, 0, &change) != 0) {
+			CHECK(0, "%s: inserting %s failed", what, path);
+			continue;
+		}
+		add_fsbuf_offsets(fsi, change.start_off, change.delta);
+		uint32_t path_off, start_off, end_off;
+		get_path_range(fsbuf, path, &path_off, &start_off, &end_off);
+		add_index(fsi, get_name(fsbuf, path_off), path_off);
+	}
+	check_queries(fsi, fsbuf, what);
+
+	free_fs_index(fsi);
+	free_fs_buf(fsbuf);
+}
+
+int main()
+{
+	test_posting();
+	if (make_test_root("index_remove", 2, 6, 60) == 0) {
+		test_index(1);
+		test_index(0);
+	} else
+		test_failures++;
+	remove_test_root();
+	printf("%s\n", test_failures ? "FAILED" : "OK");
+	return test_failures != 0;
+}
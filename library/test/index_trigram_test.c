@@ -0,0 +1,178 @@
+#define _GNU_SOURCE
+
+#include "test_tree.h"
+#include "index.h"
+#include "index_trigram.h"
+
+// results of the trigram index kept in step with inserts, removes & renames, as offsets shifted by each change
+// or as node ids, found the same as search_files does. then saved and loaded again
+
+#define MAX_RESULTS	(1 << 16)
+
+typedef struct __query__ {
+	const char* words[2];
+	uint32_t count;
+} query;
+
+static const query queries[] = {
+	{{"dat"}, 1}, {{"index", ".c"}, 2}, {{"Écho"}, 1}, {{"late", "txt"}, 2}, {{"_dir"}, 1},
+	{{"Ma"}, 1}, {{"renamed"}, 1}, {{"日本語", "JPG"}, 2},
+};
+
+// 0 if name holds all words, as comparators of search_files return
+static int match_words(const char* name, void* param)
+{
+	const query* q = param;
+	for (uint32_t i = 0; i < q->count; i++)
+		if (strstr(name, q->words[i]) == 0)
+			return 1;
+	return 0;
+}
+
+static int compare_offset(const void* a, const void* b)
+{
+	uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+static void check_queries(fs_index* fsi, fs_buf* fsbuf, const char* what)
+{
+	static uint32_t results[MAX_RESULTS];
+	for (uint32_t q = 0; q < sizeof(queries) / sizeof(queries[0]); q++) {
+		uint32_t count = MAX_RESULTS, start = first_name(fsbuf);
+		search_files(fsbuf, &start, get_tail(fsbuf), results, &count, match_words, (void*)&queries[q], 0, 0);
+
+		index_keyword* inkw = get_index_keywords(fsi, (const char**)queries[q].words, queries[q].count);
+		uint32_t len = inkw ? inkw->len : 0;
+		CHECK(len == count, "%s: %s found %u names instead of %u", what, queries[q].words[0], len, count);
+		if (inkw && len == count) {
+			qsort(inkw->fsbuf_offsets, len, sizeof(uint32_t), compare_offset);
+			for (uint32_t i = 0; i < len; i++) {
+				if (inkw->fsbuf_offsets[i] != results[i]) {
+					CHECK(0, "%s: %s found %u instead of %u", what, queries[q].words[0], inkw->fsbuf_offsets[i], results[i]);
+					break;
+				}
+			}
+		}
+		free_index_keyword(inkw, 1);
+	}
+}
+
+// as the cli does: shift offsets by the changes (a no-op for ids), then add the name got at path
+// and the names of a folder renamed, which were removed & inserted again
+static void update_index(fs_index* fsi, fs_buf* fsbuf, fs_change* changes, uint32_t change_count, const char* path)
+{
+	for (uint32_t i = 0; i < change_count; i++)
+		add_fsbuf_offsets(fsi, changes[i].start_off, changes[i].delta);
+
+	uint32_t path_off = 0, start_off, end_off;
+	if (path)
+		get_path_range(fsbuf, path, &path_off, &start_off, &end_off);
+	if (path_off == 0)
+		return;
+	add_index(fsi, get_name(fsbuf, path_off), path_off);
+	for (uint32_t off = start_off; off && off < end_off; off = next_name(fsbuf, off))
+		if (*get_name(fsbuf, off))
+			add_index(fsi, get_name(fsbuf, off), off);
+}
+
+static void change_names(fs_index* fsi, fs_buf* fsbuf, const char* what)
+{
+	char dir[NAME_MAX], path[PATH_MAX], dst[PATH_MAX];
+	fs_change changes[64];
+	uint32_t change_count;
+
+	// inserts into folders keeping names
+	for (int i = 0; i < 3; i++) {
+		test_dir_name(dir, i);
+		for (int j = 0; j < 5; j++) {
+			sprintf(path, "%s%s/late%d_data.txt", test_root, dir, j);
+			CHECK(insert_test_path(fsbuf, path, 0, changes) == 0, "%s: inserting %s failed", what, path);
+			update_index(fsi, fsbuf, changes, 1, path);
+		}
+	}
+	sprintf(path, "%slate_dir", test_root);
+	CHECK(insert_test_path(fsbuf, path, 1, changes) == 0, "%s: inserting %s failed", what, path);
+	update_index(fsi, fsbuf, changes, 1, path);
+	check_queries(fsi, fsbuf, what);
+
+	// a folder, and names of another
+	test_dir_name(dir, 1);
+	sprintf(path, "%s%s", test_root, dir);
+	CHECK(remove_path(fsbuf, path, changes, &change_count) == 0, "%s: removing %s failed", what, path);
+	update_index(fsi, fsbuf, changes, change_count, 0);
+	test_dir_name(dir, 2);
+	for (int j = 0; j < 5; j += 2) {
+		sprintf(path, "%s%s/late%d_data.txt", test_root, dir, j);
+		CHECK(remove_path(fsbuf, path, changes, &change_count) == 0, "%s: removing %s failed", what, path);
+		update_index(fsi, fsbuf, changes, change_count, 0);
+	}
+	check_queries(fsi, fsbuf, what);
+
+	// a name in its folder, a name into another folder, and a folder with its names
+	test_dir_name(dir, 2);
+	sprintf(path, "%s%s/late1_data.txt", test_root, dir);
+	sprintf(dst, "%s%s/renamed_data.txt", test_root, dir);
+	CHECK(rename_path(fsbuf, path, dst, changes, &change_count) == 0, "%s: renaming %s failed", what, path);
+	update_index(fsi, fsbuf, changes, change_count, dst);
+	sprintf(path, "%s%s/late3_data.txt", test_root, dir);
+	test_dir_name(dir, 0);
+	sprintf(dst, "%s%s/renamed_late3.txt", test_root, dir);
+	CHECK(rename_path(fsbuf, path, dst, changes, &change_count) == 0, "%s: renaming %s failed", what, path);
+	update_index(fsi, fsbuf, changes, change_count, dst);
+	sprintf(path, "%s%s", test_root, dir);
+	sprintf(dst, "%srenamed_dir", test_root);
+	CHECK(rename_path(fsbuf, path, dst, changes, &change_count) == 0, "%s: renaming %s failed", what, path);
+	update_index(fsi, fsbuf, changes, change_count, dst);
+	check_queries(fsi, fsbuf, what);
+}
+
+static void test_mode(int ids)
+{
+	const char* what = ids ? "ids" : "offsets";
+	fs_buf* fsbuf = build_test_buf(0);
+	if (fsbuf == 0) {
+		CHECK(0, "%s: no fs_buf", what);
+		return;
+	}
+	if (ids)
+		CHECK(enable_node_ids(fsbuf) == 0 && has_node_ids(fsbuf), "%s: no node ids", what);
+
+	fs_trigram_index* tgi = new_trigram_index(MAX_RESULTS, fsbuf);
+	fs_index* fsi = (fs_index*)tgi;
+	for (uint32_t off = first_name(fsbuf); off < get_tail(fsbuf); off = next_name(fsbuf, off))
+		if (*get_name(fsbuf, off))
+			add_index(fsi, get_name(fsbuf, off), off);
+	shrink_trigram_index(tgi);
+	check_queries(fsi, fsbuf, what);
+
+	change_names(fsi, fsbuf, what);
+
+	// the file keeps offsets, which are turned to ids again when loaded for a buffer of ids
+	char filename[PATH_MAX];
+	sprintf(filename, "%sindex.fs3", test_root);
+	CHECK(save_trigram_index(tgi, filename) == 0, "%s: saving failed", what);
+	free_fs_index(fsi);
+	for (int policy = LOAD_ALL; policy <= LOAD_NONE; policy++) {
+		fsi = 0;
+		CHECK(load_trigram_index(&fsi, filename, policy, fsbuf) == 0, "%s: loading failed", what);
+		if (fsi) {
+			check_queries(fsi, fsbuf, policy == LOAD_ALL ? "loaded all" : "loaded none");
+			free_fs_index(fsi);
+		}
+	}
+	unlink(filename);
+	free_fs_buf(fsbuf);
+}
+
+int main()
+{
+	if (make_test_root("index_trigram", 2, 4, 40) == 0) {
+		test_mode(0);
+		test_mode(1);
+	} else
+		test_failures++;
+	remove_test_root();
+	printf("%s\n", test_failures ? "FAILED" : "OK");
+	return test_failures != 0;
+}
@@ -0,0 +1,125 @@
+#define _GNU_SOURCE
+
+#include "test_tree.h"
+
+// interned names take fewer bytes and give the paths & results of a plain buffer, through changes (names of
+// the dictionary inserted again are kept as references), segments, indexes & ids made before, and snapshots.
+// save_fs_buf writes the plain layout
+
+#define MAX_RESULTS	(1 << 16)
+
+static const char* keywords[] = {"index", "Écho", "日本", "_dir", "late", "Renamed", ".c", "zzz"};
+
+// 1 if a search of a & b gives different paths
+static int differ_results(fs_buf* a, fs_buf* b, const char* keyword, const char* ext)
+{
+	static uint32_t ra[MAX_RESULTS], rb[MAX_RESULTS];
+	uint32_t na = MAX_RESULTS, nb = MAX_RESULTS, sa = first_name(a), sb = first_name(b);
+	if (ext) {
+		search_files_ext(a, &sa, get_tail(a), ra, &na, ext);
+		search_files_ext(b, &sb, get_tail(b), rb, &nb, ext);
+	} else {
+		search_files_literal(a, &sa, get_tail(a), ra, &na, keyword, 0, 0);
+		search_files_literal(b, &sb, get_tail(b), rb, &nb, keyword, 0, 0);
+	}
+	if (na != nb)
+		return 1;
+	// results come in the order of the names, which interning keeps
+	char pa[PATH_MAX], pb[PATH_MAX];
+	for (uint32_t i = 0; i < na; i++)
+		if (strcmp(get_path_by_name_off(a, ra[i], pa, sizeof(pa)), get_path_by_name_off(b, rb[i], pb, sizeof(pb))) != 0)
+			return 1;
+	return 0;
+}
+
+static void check_same(fs_buf* interned, fs_buf* plain, const char* what)
+{
+	CHECK(has_interned_names(interned) && !has_interned_names(plain), "%s: interning mixed up", what);
+	CHECK(get_tail(interned) < get_tail(plain), "%s: %u bytes interned, %u plain", what, get_tail(interned), get_tail(plain));
+	CHECK(differ_paths(interned, plain) == 0, "%s: paths differ", what);
+	for (uint32_t k = 0; k < sizeof(keywords) / sizeof(keywords[0]); k++)
+		CHECK(differ_results(interned, plain, keywords[k], 0) == 0, "%s: results of %s differ", what, keywords[k]);
+	CHECK(differ_results(interned, plain, 0, "py") == 0 && differ_results(interned, plain, 0, "jpg") == 0, "%s: extensions differ", what);
+}
+
+int main()
+{
+	if (make_test_root("intern", 2, 5, 30) != 0) {
+		remove_test_root();
+		return 1;
+	}
+
+	fs_buf* interned = build_test_buf(0);
+	fs_buf* plain = build_test_buf(0);
+	CHECK(interned && plain, "no fs_buf");
+	if (interned && plain) {
+		// indexes & ids made before are moved along
+		CHECK(enable_ext_index(interned) == 0 && enable_node_ids(interned) == 0, "no indexes");
+		CHECK(enable_ext_index(plain) == 0, "no index");
+		char buf[PATH_MAX], path[PATH_MAX], name[NAME_MAX], dir[NAME_MAX];
+		uint32_t off = first_name(interned);
+		for (int i = 0; i < 40; i++)
+			off = next_name(interned, off);
+		uint32_t id = get_node_id(interned, off);
+		strcpy(path, get_path_by_name_off(interned, off, buf, sizeof(buf)));
+		uint32_t generation = get_fs_generation(interned);
+
+		CHECK(enable_interned_names(interned) == 0 && enable_interned_names(interned) == 0, "interning failed");
+		CHECK(get_fs_generation(interned) != generation, "offsets changed in the same generation");
+		off = get_node_offset(interned, id);
+		CHECK(off && strcmp(get_path_by_name_off(interned, off, buf, sizeof(buf)), path) == 0, "id %u moved off %s", id, path);
+		check_same(interned, plain, "interned");
+
+		CHECK(change_test_buf(interned) == 0 && change_test_buf(plain) == 0, "changes failed");
+		check_same(interned, plain, "changed");
+
+		// a name of the dictionary inserted again takes less than it does in plain
+		fs_change change;
+		test_name(name, 3);
+		sprintf(path, "%sLate_Dir/%s", test_root, name);
+		uint32_t tail_interned = get_tail(interned), tail_plain = get_tail(plain);
+		CHECK(insert_test_path(interned, path, 0, &change) == 0 && insert_test_path(plain, path, 0, &change) == 0, "inserting %s failed", path);
+		CHECK(get_tail(interned) - tail_interned < get_tail(plain) - tail_plain, "%s not interned", name);
+		test_dir_name(dir, 3);
+		sprintf(path, "%s%s/%s_new.txt", test_root, dir, name);
+		CHECK(insert_test_path(interned, path, 0, &change) == 0 && insert_test_path(plain, path, 0, &change) == 0, "inserting %s failed", path);
+		check_same(interned, plain, "inserted");
+
+		fs_buf* snap = acquire_fs_snapshot(interned);
+		CHECK(snap != 0, "no snapshot");
+		if (snap) {
+			check_same(snap, plain, "snapshot");
+			release_fs_snapshot(snap);
+		}
+
+		// the plain layout is saved, and loaded without interning
+		char interned_file[PATH_MAX], plain_file[PATH_MAX];
+		sprintf(interned_file, "%sinterned.lft", test_root);
+		sprintf(plain_file, "%splain.lft", test_root);
+		CHECK(save_fs_buf(interned, interned_file) == 0 && save_fs_buf(plain, plain_file) == 0, "saving failed");
+		uint32_t interned_size = 0, plain_size = 0;
+		char* interned_data = read_whole(interned_file, &interned_size);
+		char* plain_data = read_whole(plain_file, &plain_size);
+		CHECK(interned_data && plain_data && interned_size == plain_size && memcmp(interned_data, plain_data, plain_size) == 0,
+			  "saved files differ");
+		free(interned_data);
+		free(plain_data);
+		fs_buf* loaded = 0;
+		CHECK(load_fs_buf(&loaded, interned_file) == 0 && !has_interned_names(loaded) && differ_layout(loaded, plain) == 0,
+			  "loaded names differ");
+		free_fs_buf(loaded);
+		unlink(interned_file);
+		unlink(plain_file);
+
+		CHECK(enable_segments(interned) == 0 && enable_segments(plain) == 0, "no segments");
+		sprintf(path, "%s%s/%s", test_root, dir, "segmented.c");
+		CHECK(insert_test_path(interned, path, 0, &change) == 0 && insert_test_path(plain, path, 0, &change) == 0, "inserting %s failed", path);
+		check_same(interned, plain, "segments");
+	}
+	free_fs_buf(interned);
+	free_fs_buf(plain);
+
+	remove_test_root();
+	printf("%s\n", test_failures ? "FAILED" : "OK");
+	return test_failures != 0;
+}
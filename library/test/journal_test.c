@@ -0,0 +1,118 @@
+#define _GNU_SOURCE
+
+#include "test_tree.h"
+
+// changes journaled since a save are replayed by load after a crash (the buffer is dropped unsaved): names come
+// back at the same offsets, also for calls of apply_changes whose inserts were grouped around failed ops
+
+static void change_names(fs_buf* fsbuf)
+{
+	char dir[NAME_MAX], path[PATH_MAX], dst[PATH_MAX];
+	fs_change changes[64];
+	uint32_t change_count;
+
+	// single calls, names out of order
+	test_dir_name(dir, 0);
+	const char* names[] = {"zeta.txt", "alpha.txt", "mid.txt"};
+	for (int i = 0; i < 3; i++) {
+		sprintf(path, "%s%s/%s", test_root, dir, names[i]);
+		CHECK(insert_test_path(fsbuf, path, 0, changes) == 0, "inserting %s failed", path);
+	}
+	sprintf(path, "%s%s/alpha.txt", test_root, dir);
+	sprintf(dst, "%s%s/omega.txt", test_root, dir);
+	CHECK(rename_path(fsbuf, path, dst, changes, &change_count) == 0, "renaming %s failed", path);
+
+	// a call of inserts into two folders, split by a failed remove, and a folder removed
+	char paths[8][PATH_MAX];
+	fs_op ops[8];
+	uint32_t n = 0;
+	test_dir_name(dir, 1);
+	const char* batch[] = {"yak.c", "bee.c", 0, "cat.c", "ant.c"};
+	for (int i = 0; i < 5; i++) {
+		if (batch[i])
+			sprintf(paths[n], "%s%s/%s", test_root, dir, batch[i]);
+		else
+			sprintf(paths[n], "%s%s/missing.c", test_root, dir);
+		ops[n] = (fs_op){batch[i] ? FS_OP_INSERT : FS_OP_REMOVE, 0, paths[n], 0, 0};
+		n++;
+	}
+	test_dir_name(dir, 2);
+	sprintf(paths[n], "%s%s/dog.c", test_root, dir);
+	ops[n] = (fs_op){FS_OP_INSERT, 0, paths[n], 0, 0};
+	n++;
+	sprintf(paths[n], "%s%s", test_root, dir);
+	ops[n] = (fs_op){FS_OP_REMOVE, 0, paths[n], 0, 0};
+	n++;
+	CHECK(apply_changes(fsbuf, ops, n) == n - 1, "apply_changes failed");
+
+	// a call failing does not change anything
+	sprintf(path, "%snowhere/x.c", test_root);
+	CHECK(remove_path(fsbuf, path, changes, &change_count) != 0, "removing %s succeeded", path);
+	test_dir_name(dir, 1);
+	sprintf(path, "%s%s/late.h", test_root, dir);
+	CHECK(insert_test_path(fsbuf, path, 0, changes) == 0, "inserting %s failed", path);
+}
+
+static void check_loaded(fs_buf* expected, const char* filename, const char* what)
+{
+	fs_buf* loaded = 0;
+	CHECK(load_fs_buf(&loaded, filename) == 0, "%s: loading failed", what);
+	if (loaded) {
+		CHECK(differ_layout(expected, loaded) == 0, "%s: names moved", what);
+		free_fs_buf(loaded);
+	}
+}
+
+int main()
+{
+	if (make_test_root("journal", 1, 4, 20) != 0) {
+		remove_test_root();
+		return 1;
+	}
+
+	char filename[PATH_MAX], journal[PATH_MAX + sizeof(FS_JOURNAL_SUFFIX)];
+	sprintf(filename, "%sfsbuf.lft", test_root);
+	sprintf(journal, "%s%s", filename, FS_JOURNAL_SUFFIX);
+	fs_buf* fsbuf = build_test_buf(0);
+	CHECK(fsbuf != 0, "no fs_buf");
+	if (fsbuf) {
+		CHECK(save_fs_buf(fsbuf, filename) == 0, "saving failed");
+		CHECK(open_fs_journal(fsbuf, filename) == 0 && has_fs_journal(fsbuf), "no journal");
+		uint32_t empty = get_journal_size(fsbuf);
+		change_names(fsbuf);
+		CHECK(get_journal_size(fsbuf) > empty, "nothing journaled");
+
+		// the crash: fsbuf is not saved, its journal is replayed by load
+		check_loaded(fsbuf, filename, "replayed");
+
+		// a record torn by the crash is dropped
+		int fd = open(journal, O_WRONLY | O_APPEND);
+		CHECK(fd >= 0 && write(fd, "\x20\0\0\0torn", 8) == 8, "no journal to tear");
+		if (fd >= 0)
+			close(fd);
+		check_loaded(fsbuf, filename, "torn");
+
+		// and reopened journals go on after the records kept
+		fs_buf* loaded = 0;
+		CHECK(load_fs_buf(&loaded, filename) == 0, "loading failed");
+		if (loaded) {
+			CHECK(open_fs_journal(loaded, filename) == 0, "no journal reopened");
+			char path[PATH_MAX], dir[NAME_MAX];
+			fs_change change;
+			test_dir_name(dir, 3);
+			sprintf(path, "%s%s/reopened.txt", test_root, dir);
+			CHECK(insert_test_path(loaded, path, 0, &change) == 0, "inserting %s failed", path);
+			check_loaded(loaded, filename, "reopened");
+
+			// a checkpoint empties the journal
+			CHECK(checkpoint_fs_buf(loaded, filename) == 0 && get_journal_size(loaded) == empty, "no checkpoint");
+			check_loaded(loaded, filename, "checkpoint");
+			free_fs_buf(loaded);
+		}
+		free_fs_buf(fsbuf);
+	}
+
+	remove_test_root();
+	printf("%s\n", test_failures ? "FAILED" : "OK");
+	return test_failures != 0;
+}
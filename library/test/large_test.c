@@ -0,0 +1,67 @@
+#define _GNU_SOURCE
+
+#include "test_tree.h"
+#include "fs_buf_base.h"
+
+// a large buffer (8-byte dir tags) holds the paths a plain one holds, finds the same names and paths,
+// and keeps them through the same changes; sizes over the plain limit are only taken by large buffers
+
+#define MAX_RESULTS	(1 << 16)
+
+static const char* keywords[] = {"dat", "_dir", "日本語", "late", "Renamed"};
+
+static void check_same(fs_buf* plain, fs_buf* large, const char* what)
+{
+	static uint32_t a[MAX_RESULTS], b[MAX_RESULTS];
+	CHECK(differ_paths(plain, large) == 0, "%s: paths differ", what);
+	for (uint32_t k = 0; k < sizeof(keywords) / sizeof(keywords[0]); k++) {
+		uint32_t na = MAX_RESULTS, nb = MAX_RESULTS, sa = first_name(plain), sb = first_name(large);
+		search_files_literal(plain, &sa, get_tail(plain), a, &na, keywords[k], 0, 0);
+		search_files_literal(large, &sb, get_tail(large), b, &nb, keywords[k], 0, 0);
+		CHECK(na == nb, "%s: %s found %u names instead of %u", what, keywords[k], nb, na);
+		for (uint32_t i = 0; i < na && i < nb; i++) {
+			char x[PATH_MAX], y[PATH_MAX];
+			const char* px = get_path_by_name_off(plain, a[i], x, sizeof(x));
+			const char* py = get_path_by_name_off(large, b[i], y, sizeof(y));
+			CHECK(strcmp(px, py) == 0, "%s: %s found %s instead of %s", what, keywords[k], py, px);
+
+			// and the path leads back to the name
+			uint32_t path_off = 0, start_off, end_off;
+			get_path_range(large, py, &path_off, &start_off, &end_off);
+			CHECK(path_off == b[i], "%s: %s is at %u instead of %u", what, py, path_off, b[i]);
+		}
+	}
+}
+
+int main()
+{
+	if (make_test_root("large", 2, 4, 30) != 0) {
+		remove_test_root();
+		return 1;
+	}
+
+	CHECK(new_fs_buf(MAX_FSBUF_SIZE + 1u, test_root) == 0, "a plain fs_buf over %u bytes", MAX_FSBUF_SIZE);
+	CHECK(new_large_fs_buf(MAX_LARGE_FSBUF_SIZE + 1u, test_root) == 0, "a large fs_buf over %u bytes", MAX_LARGE_FSBUF_SIZE);
+
+	fs_buf* plain = build_test_buf(0);
+	fs_buf* large = build_test_buf(1);
+	CHECK(plain && large, "no fs_buf");
+	if (plain && large) {
+		CHECK(!is_large_fs_buf(plain) && is_large_fs_buf(large), "modes mixed up");
+		// the 4 more bytes of each folder
+		uint32_t dirs = 0;
+		for (uint32_t off = first_name(plain); off < get_tail(plain); off = next_name(plain, off))
+			dirs += !is_file(plain, off);
+		CHECK(get_tail(large) - get_tail(plain) == dirs * 4, "%u bytes more for %u folders", get_tail(large) - get_tail(plain), dirs);
+
+		check_same(plain, large, "built");
+		CHECK(change_test_buf(plain) == 0 && change_test_buf(large) == 0, "changes failed");
+		check_same(plain, large, "changed");
+	}
+	free_fs_buf(plain);
+	free_fs_buf(large);
+
+	remove_test_root();
+	printf("%s\n", test_failures ? "FAILED" : "OK");
+	return test_failures != 0;
+}
@@ -0,0 +1,132 @@
+#define _GNU_SOURCE
+
+#include "test_tree.h"
+
+// buffers saved as LFT2 (and as legacy LFT) load back to the same names at the same offsets, whole or mapped;
+// truncated LFT2 files are refused and corrupted ones are refused or loaded without reading out of bounds
+
+static void check_loaded(fs_buf* expected, const char* filename, int format, int mapped, const char* what)
+{
+	fs_buf* loaded = 0;
+	int r = mapped ? load_fs_buf_mmap(&loaded, filename) : load_fs_buf(&loaded, filename);
+	CHECK(r == 0, "%s: loading failed (%d)", what, r);
+	if (loaded) {
+		CHECK(differ_layout(expected, loaded) == 0, "%s: names differ", what);
+		CHECK(get_save_format(loaded) == format, "%s: format %d instead of %d", what, get_save_format(loaded), format);
+		CHECK(is_large_fs_buf(loaded) == is_large_fs_buf(expected), "%s: large mode lost", what);
+		free_fs_buf(loaded);
+	}
+}
+
+static void write_whole(const char* filename, const char* data, uint32_t size)
+{
+	int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	CHECK(fd >= 0 && write(fd, data, size) == size, "writing %s failed", filename);
+	if (fd >= 0)
+		close(fd);
+}
+
+// load of data as the file broken, 0 if it was loaded
+static int load_broken(const char* broken, const char* data, uint32_t size)
+{
+	write_whole(broken, data, size);
+	fs_buf* loaded = 0;
+	int r = load_fs_buf(&loaded, broken);
+	if (loaded) {
+		// a loaded buffer still walks within its tail
+		uint32_t off = first_name(loaded);
+		while (off < get_tail(loaded))
+			off = next_name(loaded, off);
+		free_fs_buf(loaded);
+	}
+	return r;
+}
+
+static void check_broken(const char* filename)
+{
+	char broken[PATH_MAX];
+	sprintf(broken, "%s.broken", filename);
+	uint32_t size = 0;
+	char* data = read_whole(filename, &size);
+	CHECK(data != 0, "no %s", filename);
+	if (data == 0)
+		return;
+
+	// cut in the header, in the root path and through the blocks
+	for (uint32_t cut = 0; cut < size; cut += cut < 64 ? 3 : size / 61 + 1)
+		CHECK(load_broken(broken, data, cut) != 0, "a file cut at %u of %u bytes loaded", cut, size);
+
+	// sizes of block headers and compressed bytes changed
+	char* copy = malloc(size);
+	for (uint32_t pos = 8; pos < size; pos += size / 97 + 1) {
+		for (int bit = 0; bit < 8; bit += 3) {
+			memcpy(copy, data, size);
+			copy[pos] ^= 1 << bit;
+			load_broken(broken, copy, size);
+		}
+	}
+	memcpy(copy, data, size);
+	memset(copy + size / 2, 0xff, size / 4);
+	load_broken(broken, copy, size);
+	free(copy);
+	free(data);
+	unlink(broken);
+}
+
+static void test_formats(int large)
+{
+	const char* what = large ? "large" : "plain";
+	fs_buf* fsbuf = build_test_buf(large);
+	if (fsbuf == 0) {
+		CHECK(0, "%s: no fs_buf", what);
+		return;
+	}
+
+	char lft[PATH_MAX], lft2[PATH_MAX];
+	sprintf(lft, "%s%s.lft", test_root, what);
+	sprintf(lft2, "%s%s.lft2", test_root, what);
+	set_save_format(fsbuf, FS_FORMAT_LFT);
+	CHECK(save_fs_buf(fsbuf, lft) == 0, "%s: saving LFT failed", what);
+	set_save_format(fsbuf, FS_FORMAT_LFT2);
+	CHECK(save_fs_buf(fsbuf, lft2) == 0, "%s: saving LFT2 failed", what);
+
+	check_loaded(fsbuf, lft2, FS_FORMAT_LFT2, 0, "LFT2");
+	// which can not be mapped, and is read instead
+	check_loaded(fsbuf, lft2, FS_FORMAT_LFT2, 1, "LFT2 mapped");
+	check_loaded(fsbuf, lft, FS_FORMAT_LFT, 0, "LFT");
+	check_loaded(fsbuf, lft, FS_FORMAT_LFT, 1, "LFT mapped");
+
+	uint32_t lft_size = 0, lft2_size = 0;
+	free(read_whole(lft, &lft_size));
+	free(read_whole(lft2, &lft2_size));
+	CHECK(lft2_size < lft_size, "%s: LFT2 of %u bytes, LFT of %u", what, lft2_size, lft_size);
+
+	// a loaded buffer saves as it was loaded
+	fs_buf* loaded = 0;
+	CHECK(load_fs_buf(&loaded, lft2) == 0, "%s: loading LFT2 failed", what);
+	if (loaded) {
+		char again[PATH_MAX];
+		sprintf(again, "%s%s.again", test_root, what);
+		CHECK(save_fs_buf(loaded, again) == 0, "%s: saving again failed", what);
+		check_loaded(fsbuf, again, FS_FORMAT_LFT2, 0, "LFT2 saved again");
+		unlink(again);
+		free_fs_buf(loaded);
+	}
+
+	check_broken(lft2);
+	unlink(lft);
+	unlink(lft2);
+	free_fs_buf(fsbuf);
+}
+
+int main()
+{
+	if (make_test_root("lft_format", 2, 5, 40) == 0) {
+		test_formats(0);
+		test_formats(1);
+	} else
+		test_failures++;
+	remove_test_root();
+	printf("%s\n", test_failures ? "FAILED" : "OK");
+	return test_failures != 0;
+}
@@ -0,0 +1,112 @@
+#define _GNU_SOURCE
+
+#include "test_tree.h"
+
+// search_files_literal finds what search_files finds with a substring comparator: names of any length up to NAME_MAX,
+// keywords across the blocks of the simd kernels or at the end of names, names near the end of the buffer
+// (shrunk to its tail by build_fstree), and on segmented and interned buffers
+
+#define MAX_RESULTS	(1 << 16)
+
+static const char* keywords[] = {"", "a", "ab", "abd", "dab", "abcabd", "c.t", "txt", ".tar.gz", "Écho", "日本語", "_dir1",
+	"abcabdabcabdabc", "abdabcabdabcabdabcabdabcabdabcabdab", "zz", "\xe6"};
+
+// 0 if name holds keyword, as comparators of search_files return
+static int match_keyword(const char* name, void* param)
+{
+	return strstr(name, param) == 0;
+}
+
+// names of each length up to NAME_MAX, repeating "abcabd" behind a number, and one filling NAME_MAX with a match at its end
+static int make_long_names()
+{
+	char path[PATH_MAX], name[NAME_MAX + 1];
+	for (int len = 4; len <= NAME_MAX; len += len < 80 ? 1 : 7) {
+		int n = sprintf(name, "%03d", len);
+		for (; n < len; n++)
+			name[n] = "abcabd"[n % 6];
+		name[len] = 0;
+		sprintf(path, "%s%s", test_root, name);
+		if (touch_file(path) != 0)
+			return 1;
+	}
+	memset(name, 'z', NAME_MAX);
+	memcpy(name + NAME_MAX - 3, "dab", 3);
+	name[NAME_MAX] = 0;
+	sprintf(path, "%s%s", test_root, name);
+	return touch_file(path);
+}
+
+static int count_progress(uint32_t count, const char* cur_file, void* param)
+{
+	(*(uint32_t*)param)++;
+	return 0;
+}
+
+static void check_keywords(fs_buf* fsbuf, const char* what)
+{
+	static uint32_t expected[MAX_RESULTS], results[MAX_RESULTS];
+	for (uint32_t k = 0; k < sizeof(keywords) / sizeof(keywords[0]); k++) {
+		uint32_t count = MAX_RESULTS, start = first_name(fsbuf);
+		search_files(fsbuf, &start, get_tail(fsbuf), expected, &count, match_keyword, (void*)keywords[k], 0, 0);
+
+		uint32_t n = MAX_RESULTS, progress = 0;
+		start = first_name(fsbuf);
+		search_files_literal(fsbuf, &start, get_tail(fsbuf), results, &n, keywords[k], count_progress, &progress);
+		CHECK(n == count && memcmp(expected, results, n * sizeof(uint32_t)) == 0,
+			  "%s: \"%s\" found %u names instead of %u", what, keywords[k], n, count);
+		CHECK(start == get_tail(fsbuf) && progress > 0, "%s: \"%s\" stopped at %u", what, keywords[k], start);
+
+		// pages of 3 resume right behind their last result
+		uint32_t done = 0, prev = first_name(fsbuf);
+		start = prev;
+		while (start < get_tail(fsbuf) && done <= count) {
+			n = 3;
+			search_files_literal(fsbuf, &start, get_tail(fsbuf), results, &n, keywords[k], 0, 0);
+			for (uint32_t i = 0; i < n && done + i < count; i++)
+				CHECK(results[i] == expected[done + i], "%s: \"%s\" page from %u differs", what, keywords[k], prev);
+			if (n == 3)
+				CHECK(start == next_name(fsbuf, results[2]), "%s: \"%s\" page from %u stopped at %u", what, keywords[k], prev, start);
+			done += n;
+			prev = start;
+		}
+		CHECK(done == count, "%s: \"%s\" found %u names in pages instead of %u", what, keywords[k], done, count);
+	}
+}
+
+int main()
+{
+	if (make_test_root("literal_search", 2, 3, 30) != 0 || make_long_names() != 0) {
+		remove_test_root();
+		return 1;
+	}
+
+	fs_buf* fsbuf = build_test_buf(0);
+	CHECK(fsbuf != 0, "no fs_buf");
+	if (fsbuf) {
+		check_keywords(fsbuf, "flat");
+		// names close to the tail, which is the end of the buffer once inserted
+		char path[PATH_MAX], dir[NAME_MAX];
+		fs_change change;
+		test_dir_name(dir, 2);
+		sprintf(path, "%s%s/zzabd", test_root, dir);
+		CHECK(insert_test_path(fsbuf, path, 0, &change) == 0, "inserting %s failed", path);
+		shrink_fs_buf(fsbuf);
+		check_keywords(fsbuf, "shrunk");
+		CHECK(enable_interned_names(fsbuf) == 0, "no interned names");
+		check_keywords(fsbuf, "interned");
+		free_fs_buf(fsbuf);
+	}
+
+	fsbuf = build_test_buf(1);
+	CHECK(fsbuf != 0, "no large fs_buf");
+	if (fsbuf) {
+		CHECK(enable_segments(fsbuf) == 0, "no segments");
+		check_keywords(fsbuf, "segments");
+		free_fs_buf(fsbuf);
+	}
+
+	remove_test_root();
+	printf("%s\n", test_failures ? "FAILED" : "OK");
+	return test_failures != 0;
+}
@@ -0,0 +1,155 @@
+#define _GNU_SOURCE
+
+#include <sys/time.h>
+
+#include "test_tree.h"
+
+// sizes, mtimes & modes kept for each name are those lstat gives, when built, inserted or renamed,
+// and search_files_meta finds the names a scan of them finds
+
+#define MAX_RESULTS	(1 << 16)
+#define BASE_TIME	1600000000
+
+static uint32_t files;
+
+// sizes & mtimes spread over the files of the tree
+static int spread_meta(const char* path, const struct stat* st, int type, struct FTW* ftw)
+{
+	if (type != FTW_F)
+		return 0;
+	files++;
+	struct timeval times[2] = {{BASE_TIME, 0}, {BASE_TIME + (files % 50) * 86400, 0}};
+	return truncate(path, (files * 7919) % 20000) != 0 || utimes(path, times) != 0;
+}
+
+static int meta_differs(fs_buf* fsbuf, uint32_t off, const char* what)
+{
+	char buf[PATH_MAX];
+	const char* path = get_path_by_name_off(fsbuf, off, buf, sizeof(buf));
+	struct stat st;
+	fs_meta meta;
+	if (lstat(path, &st) != 0 || get_fs_meta(fsbuf, off, &meta) != 0) {
+		printf("%s: no metadata of %s\n", what, path);
+		return 1;
+	}
+	if (meta.mode != st.st_mode || meta.mtime != st.st_mtime || (S_ISREG(st.st_mode) && meta.size != (uint64_t)st.st_size)) {
+		printf("%s: metadata of %s differs\n", what, path);
+		return 1;
+	}
+	return 0;
+}
+
+static int filter_matches(const fs_meta* meta, const fs_meta_filter* filter)
+{
+	return meta->size >= filter->min_size && (filter->max_size == 0 || meta->size <= filter->max_size) &&
+		   meta->mtime >= filter->min_mtime && (filter->max_mtime == 0 || meta->mtime <= filter->max_mtime) &&
+		   (meta->mode & filter->mode_mask) == filter->mode_value;
+}
+
+static void check_filters(fs_buf* fsbuf, const char* what)
+{
+	static uint32_t expected[MAX_RESULTS], results[MAX_RESULTS];
+	const fs_meta_filter filters[] = {
+		{0, 0, 0, 0, 0, 0},
+		{10000, 0, 0, 0, S_IFMT, S_IFREG},
+		{100, 5000, 0, 0, 0, 0},
+		{0, 0, BASE_TIME + 10 * 86400, BASE_TIME + 20 * 86400, S_IFMT, S_IFREG},
+		{0, 0, 0, 0, S_IFMT, S_IFDIR},
+	};
+	for (uint32_t f = 0; f < sizeof(filters) / sizeof(filters[0]); f++) {
+		uint32_t count = 0;
+		for (uint32_t off = first_name(fsbuf); off < get_tail(fsbuf); off = next_name(fsbuf, off)) {
+			fs_meta meta;
+			if (*get_name(fsbuf, off) && get_fs_meta(fsbuf, off, &meta) == 0 && filter_matches(&meta, filters + f))
+				expected[count++] = off;
+		}
+		uint32_t n = MAX_RESULTS, start = first_name(fsbuf);
+		search_files_meta(fsbuf, &start, get_tail(fsbuf), results, &n, filters + f);
+		CHECK(n == count && memcmp(expected, results, n * sizeof(uint32_t)) == 0, "%s: filter %u found %u names instead of %u", what, f, n, count);
+		// an empty page does not move, pages of 4 stop behind their last result
+		n = 0;
+		start = first_name(fsbuf);
+		search_files_meta(fsbuf, &start, get_tail(fsbuf), results, &n, filters + f);
+		CHECK(n == 0 && start == first_name(fsbuf), "%s: filter %u moved to %u for no results", what, f, start);
+		if (count > 4) {
+			n = 4;
+			start = first_name(fsbuf);
+			search_files_meta(fsbuf, &start, get_tail(fsbuf), results, &n, filters + f);
+			CHECK(n == 4 && start == next_name(fsbuf, results[3]), "%s: filter %u stopped at %u", what, f, start);
+		}
+	}
+}
+
+static void check_all(fs_buf* fsbuf, const char* what)
+{
+	uint32_t differ = 0;
+	for (uint32_t off = first_name(fsbuf); off < get_tail(fsbuf); off = next_name(fsbuf, off))
+		if (*get_name(fsbuf, off))
+			differ += meta_differs(fsbuf, off, what);
+	CHECK(differ == 0, "%s: metadata of %u names differs", what, differ);
+	check_filters(fsbuf, what);
+}
+
+int main()
+{
+	if (make_test_root("meta", 2, 4, 30) != 0 || nftw(test_root, spread_meta, 16, FTW_PHYS) != 0) {
+		remove_test_root();
+		return 1;
+	}
+
+	fs_buf* fsbuf = new_fs_buf(1 << 21, test_root);
+	CHECK(fsbuf && enable_fs_meta(fsbuf) == 0 && has_fs_meta(fsbuf), "no metadata");
+	if (fsbuf && build_fstree(fsbuf, 0, 0, 0) == 0) {
+		check_all(fsbuf, "built");
+
+		// a file written before it is inserted, names renamed on disk & in fsbuf, a file removed
+		char dir[NAME_MAX], name[NAME_MAX], path[PATH_MAX], dst[PATH_MAX];
+		fs_change changes[64];
+		uint32_t change_count;
+		test_dir_name(dir, 0);
+		sprintf(path, "%s%s/written.bin", test_root, dir);
+		CHECK(touch_file(path) == 0 && truncate(path, 123456) == 0, "writing %s failed", path);
+		CHECK(insert_test_path(fsbuf, path, 0, changes) == 0, "inserting %s failed", path);
+		test_name(name, 4);
+		sprintf(path, "%s%s/%s", test_root, dir, name);
+		sprintf(dst, "%s%s/renamed_%s", test_root, dir, name);
+		CHECK(rename(path, dst) == 0 && rename_path(fsbuf, path, dst, changes, &change_count) == 0, "renaming %s failed", path);
+		test_dir_name(dir, 1);
+		sprintf(path, "%s%s", test_root, dir);
+		sprintf(dst, "%srenamed_dir", test_root);
+		CHECK(rename(path, dst) == 0 && rename_path(fsbuf, path, dst, changes, &change_count) == 0, "renaming %s failed", path);
+		test_dir_name(dir, 2);
+		test_name(name, 5);
+		sprintf(path, "%s%s/%s", test_root, dir, name);
+		CHECK(unlink(path) == 0 && remove_path(fsbuf, path, changes, &change_count) == 0, "removing %s failed", path);
+		CHECK(has_fs_meta(fsbuf), "metadata dropped");
+		check_all(fsbuf, "changed");
+
+		// and names inserted by a batch
+		fs_op ops[3];
+		char paths[3][PATH_MAX];
+		for (int i = 0; i < 3; i++) {
+			sprintf(paths[i], "%s%s/batch%d.dat", test_root, dir, i);
+			CHECK(touch_file(paths[i]) == 0 && truncate(paths[i], 1000 * i) == 0, "writing %s failed", paths[i]);
+			ops[i] = (fs_op){FS_OP_INSERT, 0, paths[i], 0, 0};
+		}
+		CHECK(apply_changes(fsbuf, ops, 3) == 3, "apply_changes failed");
+		check_all(fsbuf, "batch");
+	} else
+		CHECK(0, "no fs_buf built");
+	free_fs_buf(fsbuf);
+
+	// without metadata nothing matches
+	fsbuf = build_test_buf(0);
+	if (fsbuf) {
+		uint32_t results[4], n = 4, start = first_name(fsbuf);
+		fs_meta_filter all = {0};
+		search_files_meta(fsbuf, &start, get_tail(fsbuf), results, &n, &all);
+		CHECK(!has_fs_meta(fsbuf) && n == 0 && start == get_tail(fsbuf), "found %u names without metadata", n);
+		free_fs_buf(fsbuf);
+	}
+
+	remove_test_root();
+	printf("%s\n", test_failures ? "FAILED" : "OK");
+	return test_failures != 0;
+}
@@ -0,0 +1,75 @@
+#define _GNU_SOURCE
+
+#include "test_tree.h"
+
+// a mapped file loads the names load_fs_buf reads, takes changes without writing them to the file,
+// stays valid while the file is replaced by a save, and refuses a truncated file
+
+static void test_mapped(int large)
+{
+	const char* what = large ? "large" : "plain";
+	char filename[PATH_MAX];
+	sprintf(filename, "%s%s.lft", test_root, what);
+	fs_buf* fsbuf = build_test_buf(large);
+	CHECK(fsbuf && save_fs_buf(fsbuf, filename) == 0, "%s: saving failed", what);
+	free_fs_buf(fsbuf);
+
+	uint32_t size = 0;
+	char* saved = read_whole(filename, &size);
+	fs_buf *read = 0, *mapped = 0;
+	CHECK(load_fs_buf(&read, filename) == 0, "%s: loading failed", what);
+	CHECK(load_fs_buf_mmap(&mapped, filename) == 0, "%s: mapping failed", what);
+	if (saved && read && mapped) {
+		CHECK(differ_layout(read, mapped) == 0, "%s: mapped names differ", what);
+		CHECK(is_large_fs_buf(mapped) == large && get_save_format(mapped) == FS_FORMAT_LFT, "%s: mapped mode differs", what);
+
+		// changes are copied out of the mapping, the file keeps the names saved
+		CHECK(change_test_buf(read) == 0 && change_test_buf(mapped) == 0, "%s: changes failed", what);
+		CHECK(differ_layout(read, mapped) == 0, "%s: changed names differ", what);
+		uint32_t now = 0;
+		char* data = read_whole(filename, &now);
+		CHECK(data && now == size && memcmp(data, saved, size) == 0, "%s: the file changed", what);
+		free(data);
+
+		// saved over its own file, which is replaced while still mapped
+		CHECK(save_fs_buf(mapped, filename) == 0, "%s: saving the mapped buffer failed", what);
+		CHECK(differ_layout(read, mapped) == 0, "%s: saving changed the names", what);
+		fs_buf* again = 0;
+		CHECK(load_fs_buf_mmap(&again, filename) == 0, "%s: mapping again failed", what);
+		if (again) {
+			CHECK(differ_layout(read, again) == 0, "%s: names mapped again differ", what);
+			free_fs_buf(again);
+		}
+
+		// cut behind its header, in its root path and in its names
+		char cut[PATH_MAX + 8];
+		sprintf(cut, "%s.cut", filename);
+		uint32_t sizes[] = {4, 12, size / 2, size - 1};
+		for (uint32_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+			int fd = open(cut, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			CHECK(fd >= 0 && write(fd, saved, sizes[i]) == sizes[i], "%s: writing %s failed", what, cut);
+			if (fd >= 0)
+				close(fd);
+			fs_buf* broken = 0;
+			CHECK(load_fs_buf_mmap(&broken, cut) != 0, "%s: a file cut at %u of %u bytes mapped", what, sizes[i], size);
+			free_fs_buf(broken);
+		}
+		unlink(cut);
+	}
+	free(saved);
+	free_fs_buf(read);
+	free_fs_buf(mapped);
+	unlink(filename);
+}
+
+int main()
+{
+	if (make_test_root("mmap_load", 2, 4, 30) == 0) {
+		test_mapped(0);
+		test_mapped(1);
+	} else
+		test_failures++;
+	remove_test_root();
+	printf("%s\n", test_failures ? "FAILED" : "OK");
+	return test_failures != 0;
+}
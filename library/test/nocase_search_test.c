@@ -0,0 +1,88 @@
+#define _GNU_SOURCE
+
+#include <locale.h>
+#include <wchar.h>
+#include <wctype.h>
+
+#include "test_tree.h"
+
+// search_files_nocase finds the names holding the keyword whatever the case (compared here as towlower of wide
+// strings), on the case-folded copy kept in step with inserts, removes & renames, and name by name without it
+
+#define MAX_RESULTS	(1 << 16)
+
+static const char* keywords[] = {"écho", "ÉCHO", "readme", "MAKEFILE", ".jpg", ".PY", "日本", "late", "DATA.txt", "Renamed_é", "_DIR1", "x"};
+
+static void lower(const char* s, wchar_t* out)
+{
+	uint32_t n = mbstowcs(out, s, NAME_MAX);
+	for (uint32_t i = 0; i < n; i++)
+		out[i] = towlower(out[i]);
+	out[n] = 0;
+}
+
+// names holding keyword in any case, in buffer order
+static uint32_t scan_nocase(fs_buf* fsbuf, const char* keyword, uint32_t* offs)
+{
+	wchar_t name[NAME_MAX + 1], key[NAME_MAX + 1];
+	uint32_t count = 0;
+	lower(keyword, key);
+	for (uint32_t off = first_name(fsbuf); off < get_tail(fsbuf); off = next_name(fsbuf, off)) {
+		lower(get_name(fsbuf, off), name);
+		if (name[0] && wcsstr(name, key))
+			offs[count++] = off;
+	}
+	return count;
+}
+
+static void check_keywords(fs_buf* fsbuf, const char* what)
+{
+	static uint32_t expected[MAX_RESULTS], results[MAX_RESULTS];
+	for (uint32_t k = 0; k < sizeof(keywords) / sizeof(keywords[0]); k++) {
+		uint32_t count = scan_nocase(fsbuf, keywords[k], expected);
+		for (int threads = 1; threads <= 4; threads += 3) {
+			uint32_t n = MAX_RESULTS, start = first_name(fsbuf);
+			search_files_nocase(fsbuf, &start, get_tail(fsbuf), results, &n, keywords[k], 0, 0, threads);
+			CHECK(n == count && memcmp(expected, results, n * sizeof(uint32_t)) == 0,
+				  "%s: %s on %d threads found %u names instead of %u", what, keywords[k], threads, n, count);
+		}
+	}
+}
+
+static void test_nocase(int fold, int segments)
+{
+	char what[64];
+	sprintf(what, "%s%s", fold ? "folded" : "plain", segments ? " segments" : "");
+	fs_buf* fsbuf = build_test_buf(0);
+	if (fsbuf == 0) {
+		CHECK(0, "%s: no fs_buf", what);
+		return;
+	}
+	if (segments)
+		CHECK(enable_segments(fsbuf) == 0, "%s: no segments", what);
+	if (fold)
+		CHECK(enable_fold_names(fsbuf) == 0 && has_fold_names(fsbuf), "%s: no folded names", what);
+
+	check_keywords(fsbuf, what);
+	CHECK(change_test_buf(fsbuf) == 0, "%s: changes failed", what);
+	check_keywords(fsbuf, what);
+	CHECK(has_fold_names(fsbuf) == fold, "%s: folded names %s", what, fold ? "dropped" : "made");
+	free_fs_buf(fsbuf);
+}
+
+int main()
+{
+	if (setlocale(LC_CTYPE, "C.UTF-8") == 0) {
+		printf("no C.UTF-8 locale\n");
+		return 1;
+	}
+	if (make_test_root("nocase_search", 2, 4, 30) == 0) {
+		for (int fold = 0; fold < 2; fold++)
+			for (int segments = 0; segments < 2; segments++)
+				test_nocase(fold, segments);
+	} else
+		test_failures++;
+	remove_test_root();
+	printf("%s\n", test_failures ? "FAILED" : "OK");
+	return test_failures != 0;
+}
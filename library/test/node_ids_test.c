@@ -0,0 +1,190 @@
+#define _GNU_SOURCE
+
+#include "test_tree.h"
+
+// each name keeps its node id while others are inserted, removed & renamed around it, names moved by a rename
+// keep theirs and the renamed name gets a new one, ids of removed names give 0 and are never reused.
+// flat, segmented & large buffers, one change at a time & in batches
+
+#define MAX_NODES	(1 << 15)
+
+typedef struct __node__ {
+	uint32_t id;
+	// 0 once removed or renamed
+	char* path;
+} node;
+
+static node nodes[MAX_NODES];
+static uint32_t node_count, max_id;
+
+static void forget_nodes()
+{
+	for (uint32_t i = 0; i < node_count; i++)
+		free(nodes[i].path);
+	node_count = max_id = 0;
+}
+
+// ids & paths of the names not known yet, which must be new ids
+static void learn_nodes(fs_buf* fsbuf, const char* what)
+{
+	char buf[PATH_MAX];
+	uint32_t known = node_count, seen_max = max_id, off;
+	for (off = first_name(fsbuf); off < get_tail(fsbuf) && node_count < MAX_NODES; off = next_name(fsbuf, off)) {
+		uint32_t id = get_node_id(fsbuf, off);
+		if (*get_name(fsbuf, off) == 0) {
+			CHECK(id == 0, "%s: a parent-tag got id %u", what, id);
+			continue;
+		}
+		uint32_t i = 0;
+		while (i < known && nodes[i].id != id)
+			i++;
+		if (i < known)
+			continue;
+		CHECK(id > seen_max, "%s: %s got id %u of %u", what, get_path_by_name_off(fsbuf, off, buf, sizeof(buf)), id, seen_max);
+		nodes[node_count++] = (node){id, strdup(get_path_by_name_off(fsbuf, off, buf, sizeof(buf)))};
+		if (id > max_id)
+			max_id = id;
+	}
+	CHECK(off >= get_tail(fsbuf), "%s: too many names", what);
+}
+
+// names removed, or renamed from path to dst (moving their kids along)
+static void forget_path(const char* path, const char* dst)
+{
+	uint32_t len = strlen(path);
+	char moved[PATH_MAX];
+	for (uint32_t i = 0; i < node_count; i++) {
+		if (nodes[i].path == 0 || strncmp(nodes[i].path, path, len) != 0 || (nodes[i].path[len] && nodes[i].path[len] != '/'))
+			continue;
+		if (dst && nodes[i].path[len]) {
+			sprintf(moved, "%s%s", dst, nodes[i].path + len);
+			free(nodes[i].path);
+			nodes[i].path = strdup(moved);
+		} else {
+			free(nodes[i].path);
+			nodes[i].path = 0;
+		}
+	}
+}
+
+static void check_nodes(fs_buf* fsbuf, const char* mode, const char* step)
+{
+	static uint32_t ids[MAX_NODES], offs[MAX_NODES];
+	char buf[PATH_MAX], what[64];
+	sprintf(what, "%s, %s", mode, step);
+	uint32_t wrong = 0, alive = 0;
+	CHECK(has_node_ids(fsbuf), "%s: ids dropped", what);
+	for (uint32_t i = 0; i < node_count; i++) {
+		uint32_t off = get_node_offset(fsbuf, nodes[i].id);
+		ids[i] = nodes[i].id;
+		if (nodes[i].path == 0) {
+			wrong += off != 0;
+			continue;
+		}
+		alive++;
+		if (off == 0 || get_node_id(fsbuf, off) != nodes[i].id || strcmp(get_path_by_name_off(fsbuf, off, buf, sizeof(buf)), nodes[i].path) != 0) {
+			printf("%s: id %u of %s is at %u\n", what, nodes[i].id, nodes[i].path, off);
+			wrong++;
+		}
+	}
+	CHECK(wrong == 0, "%s: %u ids lost their names", what, wrong);
+
+	// the offsets of many at once, gone ones left out
+	uint32_t count = get_node_offsets(fsbuf, ids, node_count, offs), k = 0;
+	CHECK(count == alive, "%s: %u offsets of %u names", what, count, alive);
+	for (uint32_t i = 0; i < node_count && k < count; i++)
+		if (nodes[i].path && offs[k++] != get_node_offset(fsbuf, nodes[i].id))
+			wrong++;
+	CHECK(wrong == 0, "%s: offsets out of order", what);
+	CHECK(get_node_offset(fsbuf, max_id + 1000) == 0, "%s: an id not given has a name", what);
+	learn_nodes(fsbuf, what);
+}
+
+static void test_ids(fs_buf* fsbuf, const char* what)
+{
+	char a[NAME_MAX], b[NAME_MAX], name[NAME_MAX], path[PATH_MAX], dst[PATH_MAX];
+	fs_change changes[64];
+	uint32_t change_count;
+	CHECK(enable_node_ids(fsbuf) == 0, "%s: no ids", what);
+	learn_nodes(fsbuf, what);
+	check_nodes(fsbuf, what, "built");
+
+	test_dir_name(a, 0);
+	test_dir_name(b, 1);
+	for (int i = 0; i < 5; i++) {
+		sprintf(path, "%s%s/new%d.txt", test_root, a, i);
+		CHECK(insert_test_path(fsbuf, path, 0, changes) == 0, "%s: inserting %s failed", what, path);
+	}
+	sprintf(path, "%s%s/new_dir", test_root, b);
+	CHECK(insert_test_path(fsbuf, path, 1, changes) == 0, "%s: inserting %s failed", what, path);
+	check_nodes(fsbuf, what, "inserted");
+
+	test_name(name, 2);
+	sprintf(path, "%s%s/%s", test_root, a, name);
+	CHECK(remove_path(fsbuf, path, changes, &change_count) == 0, "%s: removing %s failed", what, path);
+	forget_path(path, 0);
+	test_dir_name(a, 2);
+	sprintf(path, "%s%s", test_root, a);
+	CHECK(remove_path(fsbuf, path, changes, &change_count) == 0, "%s: removing %s failed", what, path);
+	forget_path(path, 0);
+	check_nodes(fsbuf, what, "removed");
+
+	// a file renamed in place & into another folder, a folder renamed & moved under another one
+	test_dir_name(a, 0);
+	sprintf(path, "%s%s/new1.txt", test_root, a);
+	sprintf(dst, "%s%s/Renamed.txt", test_root, a);
+	CHECK(rename_path(fsbuf, path, dst, changes, &change_count) == 0, "%s: renaming %s failed", what, path);
+	forget_path(path, dst);
+	sprintf(path, "%s%s/new2.txt", test_root, a);
+	sprintf(dst, "%s%s/moved.txt", test_root, b);
+	CHECK(rename_path(fsbuf, path, dst, changes, &change_count) == 0, "%s: renaming %s failed", what, path);
+	forget_path(path, dst);
+	sprintf(path, "%s%s", test_root, b);
+	sprintf(dst, "%s%s/renamed_dir", test_root, a);
+	CHECK(rename_path(fsbuf, path, dst, changes, &change_count) == 0, "%s: renaming %s failed", what, path);
+	forget_path(path, dst);
+	check_nodes(fsbuf, what, "renamed");
+
+	// a batch of each
+	fs_op ops[6];
+	char paths[6][PATH_MAX], dsts[6][PATH_MAX];
+	test_dir_name(b, 3);
+	for (int i = 0; i < 6; i++) {
+		sprintf(paths[i], "%s%s/batch%d.c", test_root, b, i);
+		ops[i] = (fs_op){FS_OP_INSERT, 0, paths[i], 0, 0};
+	}
+	CHECK(apply_changes(fsbuf, ops, 6) == 6, "%s: inserting a batch failed", what);
+	check_nodes(fsbuf, what, "batch inserted");
+	for (int i = 0; i < 6; i++) {
+		sprintf(dsts[i], "%s%s/batch%d.h", test_root, b, i);
+		ops[i] = i % 2 ? (fs_op){FS_OP_REMOVE, 0, paths[i], 0, 0} : (fs_op){FS_OP_RENAME, 0, paths[i], dsts[i], 0};
+		forget_path(paths[i], i % 2 ? 0 : dsts[i]);
+	}
+	CHECK(apply_changes(fsbuf, ops, 6) == 6, "%s: a batch of removes & renames failed", what);
+	check_nodes(fsbuf, what, "batch changed");
+	forget_nodes();
+}
+
+int main()
+{
+	if (make_test_root("node_ids", 2, 5, 30) != 0) {
+		remove_test_root();
+		return 1;
+	}
+
+	const char* modes[] = {"flat", "segments", "large"};
+	for (int mode = 0; mode < 3; mode++) {
+		fs_buf* fsbuf = build_test_buf(mode == 2);
+		CHECK(fsbuf != 0, "%s: no fs_buf", modes[mode]);
+		if (fsbuf == 0)
+			continue;
+		if (mode == 1)
+			CHECK(enable_segments(fsbuf) == 0, "%s: no segments", modes[mode]);
+		test_ids(fsbuf, modes[mode]);
+		free_fs_buf(fsbuf);
+	}
+
+	remove_test_root();
+	printf("%s\n", test_failures ? "FAILED" : "OK");
+	return test_failures != 0;
+}
@@ -0,0 +1,84 @@
+#define _GNU_SOURCE
+
+#include "test_tree.h"
+#include "fs_buf_base.h"
+
+// search_files_parallel, by keyword or by comparator, on any number of threads and in pages of any size,
+// gives the same results and the same *start_off as search_files, also on a segmented buffer
+
+#define MAX_RESULTS	(1 << 16)
+
+static const char* queries[] = {"a", "dat", "index.c", "Écho", "日本", "_dir", ".tar.gz", "missing"};
+static const int thread_counts[] = {1, 2, 3, 8, 0};
+static const uint32_t page_sizes[] = {MAX_RESULTS, 1, 7, 100};
+
+// 0 if name holds keyword, as comparators of search_files return
+static int match_keyword(const char* name, void* param)
+{
+	return strstr(name, param) == 0;
+}
+
+// offsets of all pages, each page followed by the *start_off it left
+static uint32_t search_pages(fs_buf* fsbuf, uint32_t start, const char* keyword, int comparator, int threads, uint32_t page, uint32_t* out)
+{
+	static uint32_t results[MAX_RESULTS];
+	uint32_t total = 0;
+	while (start < get_tail(fsbuf)) {
+		uint32_t count = page;
+		if (threads < 0)
+			search_files(fsbuf, &start, get_tail(fsbuf), results, &count, match_keyword, (void*)keyword, 0, 0);
+		else
+			search_files_parallel(fsbuf, &start, get_tail(fsbuf), results, &count, comparator ? match_keyword : 0,
+								  (void*)keyword, keyword, 0, 0, threads);
+		if (total + count + 1 > MAX_RESULTS * 2)
+			break;
+		memcpy(out + total, results, count * sizeof(uint32_t));
+		total += count;
+		out[total++] = start;
+	}
+	return total;
+}
+
+static void check_searches(fs_buf* fsbuf, const char* what)
+{
+	static uint32_t serial[MAX_RESULTS * 2], parallel[MAX_RESULTS * 2];
+	// from the first name, and from a name in the middle
+	uint32_t starts[] = {first_name(fsbuf), get_aligned_offset(fsbuf, (first_name(fsbuf) + get_tail(fsbuf)) / 2)};
+	for (uint32_t s = 0; s < 2; s++) {
+		for (uint32_t q = 0; q < sizeof(queries) / sizeof(queries[0]); q++) {
+			for (uint32_t p = 0; p < sizeof(page_sizes) / sizeof(page_sizes[0]); p++) {
+				uint32_t expected = search_pages(fsbuf, starts[s], queries[q], 1, -1, page_sizes[p], serial);
+				for (uint32_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++) {
+					for (int comparator = 0; comparator < 2; comparator++) {
+						uint32_t n = search_pages(fsbuf, starts[s], queries[q], comparator, thread_counts[t], page_sizes[p], parallel);
+						CHECK(n == expected && memcmp(serial, parallel, n * sizeof(uint32_t)) == 0,
+							  "%s: %s from %u in pages of %u on %d threads (%s) differs", what, queries[q], starts[s],
+							  page_sizes[p], thread_counts[t], comparator ? "comparator" : "keyword");
+					}
+				}
+			}
+		}
+	}
+}
+
+int main()
+{
+	if (make_test_root("parallel_search", 2, 6, 60) != 0) {
+		remove_test_root();
+		return 1;
+	}
+
+	fs_buf* fsbuf = build_test_buf(0);
+	CHECK(fsbuf != 0, "no fs_buf");
+	if (fsbuf) {
+		CHECK(get_tail(fsbuf) - first_name(fsbuf) > 4096 * 8, "a tree of %u bytes is too small to split", get_tail(fsbuf));
+		check_searches(fsbuf, "flat");
+		CHECK(enable_segments(fsbuf) == 0, "no segments");
+		check_searches(fsbuf, "segments");
+		free_fs_buf(fsbuf);
+	}
+
+	remove_test_root();
+	printf("%s\n", test_failures ? "FAILED" : "OK");
+	return test_failures != 0;
+}
@@ -0,0 +1,102 @@
+#define _GNU_SOURCE
+
+#include "test_tree.h"
+
+// paths of names got one by one (through the parent index) and in pages by get_paths_by_name_offs,
+// which stops at a buffer too small for the next path
+
+#define MAX_NAMES	(1 << 14)
+
+static uint32_t offs[MAX_NAMES];
+static char* expected[MAX_NAMES];
+
+static void check_page(fs_buf* fsbuf, uint32_t count, uint32_t buf_size, const char* what)
+{
+	static char* paths[MAX_NAMES];
+	char* buf = malloc(buf_size ? buf_size : 1);
+	uint32_t done = 0;
+	while (done < count) {
+		uint32_t n = get_paths_by_name_offs(fsbuf, offs + done, count - done, buf, buf_size, paths);
+		if (n == 0) {
+			CHECK(0, "%s: no path of %u fits in %u bytes", what, offs[done], buf_size);
+			break;
+		}
+		for (uint32_t i = 0; i < n; i++)
+			CHECK(strcmp(paths[i], expected[done + i]) == 0, "%s: %s instead of %s", what, paths[i], expected[done + i]);
+		done += n;
+	}
+	free(buf);
+}
+
+static void test_paths(fs_buf* fsbuf, const char* query, const char* what)
+{
+	char path[PATH_MAX];
+	uint32_t count = scan_names(fsbuf, query, offs, MAX_NAMES), longest = 0, total = 0;
+	CHECK(count > 0, "%s: no names", what);
+	for (uint32_t i = 0; i < count; i++) {
+		expected[i] = strdup(get_path_by_name_off(fsbuf, offs[i], path, sizeof(path)));
+		uint32_t len = strlen(expected[i]) + 1;
+		longest = len > longest ? len : longest;
+		total += len;
+
+		// the path leads back to the name
+		uint32_t path_off = 0, start_off, end_off;
+		get_path_range(fsbuf, expected[i], &path_off, &start_off, &end_off);
+		CHECK(path_off == offs[i], "%s: %s is at %u instead of %u", what, expected[i], path_off, offs[i]);
+	}
+
+	check_page(fsbuf, count, total, what);
+	// one path at least per call, then only a few
+	check_page(fsbuf, count, longest, what);
+	check_page(fsbuf, count, longest * 3, what);
+
+	// a buffer too small for the first path (its \0 does not fit) gets nothing
+	static char* paths[MAX_NAMES];
+	uint32_t first = strlen(expected[0]) + 1;
+	char* buf = malloc(first);
+	for (uint32_t size = 0; size < first; size += first / 4 + 1)
+		CHECK(get_paths_by_name_offs(fsbuf, offs, count, buf, size, paths) == 0, "%s: a path stored in %u bytes", what, size);
+	CHECK(get_paths_by_name_offs(fsbuf, offs, count, buf, first - 1, paths) == 0, "%s: a path stored without its \\0", what);
+	CHECK(get_paths_by_name_offs(fsbuf, offs, count, buf, first, paths) == 1, "%s: the first path not stored", what);
+	free(buf);
+
+	for (uint32_t i = 0; i < count; i++)
+		free(expected[i]);
+}
+
+int main()
+{
+	if (make_test_root("paths", 3, 3, 20) != 0) {
+		remove_test_root();
+		return 1;
+	}
+
+	fs_buf* fsbuf = build_test_buf(0);
+	CHECK(fsbuf != 0, "no fs_buf");
+	if (fsbuf) {
+		test_paths(fsbuf, 0, "all");
+		test_paths(fsbuf, "main", "main");
+
+		// paths of names changed since
+		char dir[NAME_MAX], path[PATH_MAX], dst[PATH_MAX];
+		fs_change changes[64];
+		uint32_t change_count;
+		test_dir_name(dir, 1);
+		sprintf(path, "%s%s/late.txt", test_root, dir);
+		CHECK(insert_test_path(fsbuf, path, 0, changes) == 0, "inserting %s failed", path);
+		test_dir_name(dir, 0);
+		sprintf(path, "%s%s", test_root, dir);
+		CHECK(remove_path(fsbuf, path, changes, &change_count) == 0, "removing %s failed", path);
+		test_dir_name(dir, 2);
+		sprintf(path, "%s%s", test_root, dir);
+		sprintf(dst, "%srenamed", test_root);
+		CHECK(rename_path(fsbuf, path, dst, changes, &change_count) == 0, "renaming %s failed", path);
+		test_paths(fsbuf, 0, "changed");
+		test_paths(fsbuf, "late", "late");
+		free_fs_buf(fsbuf);
+	}
+
+	remove_test_root();
+	printf("%s\n", test_failures ? "FAILED" : "OK");
+	return test_failures != 0;
+}
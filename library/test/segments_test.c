@@ -0,0 +1,106 @@
+#define _GNU_SOURCE
+
+#include "test_tree.h"
+
+// a segmented buffer keeps the offsets of a flat one through the same changes: inserts splitting segments,
+// removes merging them and renames moving names between them, and saves the same file
+
+static fs_buf* flat;
+static fs_buf* segmented;
+
+static void check_same(const char* what)
+{
+	CHECK(differ_layout(flat, segmented) == 0, "%s: names differ", what);
+	uint32_t a = 0, b = 0, n = 0;
+	for (uint32_t off = first_name(flat); off < get_tail(flat); off = next_name(flat, off), n++)
+		if (n % 5 == 0) {
+			char x[PATH_MAX], y[PATH_MAX];
+			a += strcmp(get_path_by_name_off(flat, off, x, sizeof(x)), get_path_by_name_off(segmented, off, y, sizeof(y))) != 0;
+			b++;
+		}
+	CHECK(a == 0, "%s: %u paths of %u differ", what, a, b);
+}
+
+static void insert_both(const char* path, int is_dir)
+{
+	fs_change x = {0}, y = {0};
+	int r = insert_test_path(flat, path, is_dir, &x);
+	CHECK(r == insert_test_path(segmented, path, is_dir, &y), "inserting %s differs", path);
+	CHECK(x.start_off == y.start_off && x.delta == y.delta, "inserting %s changed %u by %d instead of %u by %d",
+		  path, y.start_off, y.delta, x.start_off, x.delta);
+}
+
+static void remove_both(const char* path)
+{
+	fs_change x[64], y[64];
+	uint32_t nx = 0, ny = 0;
+	int r = remove_path(flat, path, x, &nx);
+	CHECK(r == remove_path(segmented, path, y, &ny), "removing %s differs", path);
+	CHECK(nx == ny && memcmp(x, y, nx * sizeof(fs_change)) == 0, "removing %s changed other ranges", path);
+}
+
+static void rename_both(const char* path, const char* dst)
+{
+	fs_change x[64], y[64];
+	uint32_t nx = 0, ny = 0;
+	int r = rename_path(flat, path, dst, x, &nx);
+	CHECK(r == rename_path(segmented, path, dst, y, &ny), "renaming %s differs", path);
+	CHECK(nx == ny && memcmp(x, y, nx * sizeof(fs_change)) == 0, "renaming %s changed other ranges", path);
+}
+
+int main()
+{
+	if (make_test_root("segments", 2, 6, 50) != 0) {
+		remove_test_root();
+		return 1;
+	}
+
+	flat = build_test_buf(0);
+	segmented = build_test_buf(0);
+	CHECK(flat && segmented, "no fs_buf");
+	if (flat && segmented) {
+		CHECK(enable_segments(segmented) == 0, "no segments");
+		check_same("enabled");
+		CHECK(change_test_buf(flat) == 0 && change_test_buf(segmented) == 0, "changes failed");
+		check_same("changed");
+
+		// a folder grown over several segments, then emptied again, and moved
+		char dir[NAME_MAX], path[PATH_MAX], dst[PATH_MAX];
+		test_dir_name(dir, 3);
+		for (int i = 0; i < 4000; i++) {
+			sprintf(path, "%s%s/grown_%05d_with_a_longer_name.txt", test_root, dir, i);
+			insert_both(path, 0);
+		}
+		check_same("grown");
+		for (int i = 0; i < 4000; i += i % 100 == 0 ? 1 : 2) {
+			sprintf(path, "%s%s/grown_%05d_with_a_longer_name.txt", test_root, dir, i);
+			remove_both(path);
+		}
+		check_same("emptied");
+		sprintf(path, "%s%s", test_root, dir);
+		sprintf(dst, "%smoved", test_root);
+		rename_both(path, dst);
+		test_dir_name(dir, 4);
+		sprintf(path, "%s%s", test_root, dir);
+		remove_both(path);
+		check_same("moved");
+
+		// nor does the file tell them apart
+		char a[PATH_MAX], b[PATH_MAX];
+		sprintf(a, "%sflat.lft", test_root);
+		sprintf(b, "%ssegmented.lft", test_root);
+		CHECK(save_fs_buf(flat, a) == 0 && save_fs_buf(segmented, b) == 0, "saving failed");
+		uint32_t na = 0, nb = 0;
+		char* da = read_whole(a, &na);
+		char* db = read_whole(b, &nb);
+		CHECK(da && db && na == nb && memcmp(da, db, na) == 0, "saved files differ");
+		free(da);
+		free(db);
+	}
+	free_fs_buf(flat);
+	free_fs_buf(segmented);
+
+	remove_test_root();
+	printf("%s\n", test_failures ? "FAILED" : "OK");
+	return test_failures != 0;
+}
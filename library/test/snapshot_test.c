@@ -0,0 +1,166 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+
+#include "test_tree.h"
+
+// a snapshot keeps the names, paths, generation & indexes of the version it was taken of while the fs_buf changes,
+// flat or segmented, and readers searching snapshots while a writer changes the fs_buf see whole versions only
+
+#define MAX_RESULTS	(1 << 16)
+#define WRITES		300
+
+static void check_search(fs_buf* snap, const char* keyword, const uint32_t* expected, uint32_t count, const char* what)
+{
+	static uint32_t results[MAX_RESULTS];
+	uint32_t n = MAX_RESULTS, start = first_name(snap);
+	search_files_literal(snap, &start, get_tail(snap), results, &n, keyword, 0, 0);
+	CHECK(n == count && memcmp(results, expected, n * sizeof(uint32_t)) == 0, "%s: %s found %u names instead of %u", what, keyword, n, count);
+	n = MAX_RESULTS;
+	start = first_name(snap);
+	search_files_ext(snap, &start, get_tail(snap), results, &n, "c");
+	uint32_t c = 0;
+	for (uint32_t off = first_name(snap); off < get_tail(snap); off = next_name(snap, off)) {
+		const char* dot = strrchr(get_name(snap, off), '.');
+		c += dot && strcasecmp(dot, ".c") == 0;
+	}
+	CHECK(n == c, "%s: *.c found %u names instead of %u", what, n, c);
+}
+
+static void test_versions(int segments)
+{
+	const char* what = segments ? "segments" : "flat";
+	static uint32_t expected[MAX_RESULTS];
+	fs_buf* fsbuf = build_test_buf(0);
+	if (fsbuf == 0) {
+		CHECK(0, "%s: no fs_buf", what);
+		return;
+	}
+	if (segments)
+		CHECK(enable_segments(fsbuf) == 0, "%s: no segments", what);
+	CHECK(enable_ext_index(fsbuf) == 0 && enable_node_ids(fsbuf) == 0, "%s: no indexes", what);
+
+	fs_buf* before = acquire_fs_snapshot(fsbuf);
+	CHECK(before != 0, "%s: no snapshot", what);
+	if (before) {
+		fs_buf* same = acquire_fs_snapshot(fsbuf);
+		CHECK(same == before, "%s: a snapshot taken again without changes", what);
+		release_fs_snapshot(same);
+
+		uint32_t generation = get_fs_generation(fsbuf), count = scan_names(fsbuf, "dat", expected, MAX_RESULTS);
+		uint32_t path_count;
+		char** paths = list_paths(fsbuf, &path_count);
+		uint32_t first_id = get_node_id(before, first_name(before));
+
+		CHECK(change_test_buf(fsbuf) == 0, "%s: changes failed", what);
+		CHECK(get_fs_generation(fsbuf) != generation && get_fs_generation(before) == generation, "%s: generations mixed up", what);
+
+		// the snapshot still holds the names it was taken of, and their ids
+		uint32_t n;
+		char** now = list_paths(before, &n);
+		int differ = n != path_count;
+		for (uint32_t i = 0; !differ && i < n; i++)
+			differ = strcmp(paths[i], now[i]) != 0;
+		CHECK(!differ, "%s: the snapshot changed", what);
+		free_paths(now, n);
+		free_paths(paths, path_count);
+		check_search(before, "dat", expected, count, what);
+		CHECK(get_node_id(before, first_name(before)) == first_id && get_node_offset(before, first_id) == first_name(before),
+			  "%s: ids of the snapshot changed", what);
+
+		fs_buf* after = acquire_fs_snapshot(fsbuf);
+		CHECK(after && after != before && differ_layout(after, fsbuf) == 0 && differ_paths(after, fsbuf) == 0,
+			  "%s: the new snapshot differs", what);
+		if (after) {
+			count = scan_names(fsbuf, "Renamed", expected, MAX_RESULTS);
+			check_search(after, "Renamed", expected, count, what);
+			release_fs_snapshot(after);
+		}
+		release_fs_snapshot(before);
+	}
+	free_fs_buf(fsbuf);
+}
+
+typedef struct __reader__ {
+	fs_buf* fsbuf;
+	int* done;
+	uint32_t reads;
+	uint32_t broken;
+} reader;
+
+// every snapshot walks from its first name to its tail, and its results have paths under the root
+static void* read_snapshots(void* arg)
+{
+	reader* r = arg;
+	static __thread uint32_t results[MAX_RESULTS];
+	while (!__atomic_load_n(r->done, __ATOMIC_ACQUIRE) || r->reads == 0) {
+		fs_buf* snap = acquire_fs_snapshot(r->fsbuf);
+		if (snap == 0)
+			continue;
+		uint32_t off = first_name(snap);
+		while (off < get_tail(snap))
+			off = next_name(snap, off);
+		uint32_t n = MAX_RESULTS, start = first_name(snap);
+		search_files_literal(snap, &start, get_tail(snap), results, &n, "late", 0, 0);
+		char path[PATH_MAX];
+		for (uint32_t i = 0; i < n; i++)
+			r->broken += strncmp(get_path_by_name_off(snap, results[i], path, sizeof(path)), test_root, strlen(test_root)) != 0;
+		r->broken += off != get_tail(snap);
+		release_fs_snapshot(snap);
+		r->reads++;
+	}
+	return 0;
+}
+
+static void test_readers(int segments)
+{
+	const char* what = segments ? "segments" : "flat";
+	fs_buf* fsbuf = build_test_buf(0);
+	if (fsbuf == 0) {
+		CHECK(0, "%s: no fs_buf", what);
+		return;
+	}
+	if (segments)
+		CHECK(enable_segments(fsbuf) == 0, "%s: no segments", what);
+
+	int done = 0;
+	reader readers[3];
+	pthread_t threads[3];
+	for (int i = 0; i < 3; i++) {
+		readers[i] = (reader){fsbuf, &done, 0, 0};
+		pthread_create(&threads[i], 0, read_snapshots, &readers[i]);
+	}
+
+	char dir[NAME_MAX], path[PATH_MAX];
+	fs_change changes[64];
+	uint32_t change_count;
+	test_dir_name(dir, 3);
+	for (int i = 0; i < WRITES; i++) {
+		sprintf(path, "%s%s/late%d.txt", test_root, dir, i);
+		CHECK(insert_test_path(fsbuf, path, 0, changes) == 0, "%s: inserting %s failed", what, path);
+		if (i % 3 == 0) {
+			sprintf(path, "%s%s/late%d.txt", test_root, dir, i / 2);
+			remove_path(fsbuf, path, changes, &change_count);
+		}
+	}
+	__atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+	for (int i = 0; i < 3; i++) {
+		pthread_join(threads[i], 0);
+		CHECK(readers[i].broken == 0, "%s: reader %d saw %u broken snapshots of %u", what, i, readers[i].broken, readers[i].reads);
+	}
+	free_fs_buf(fsbuf);
+}
+
+int main()
+{
+	if (make_test_root("snapshot", 2, 5, 30) == 0) {
+		for (int segments = 0; segments < 2; segments++) {
+			test_versions(segments);
+			test_readers(segments);
+		}
+	} else
+		test_failures++;
+	remove_test_root();
+	printf("%s\n", test_failures ? "FAILED" : "OK");
+	return test_failures != 0;
+}
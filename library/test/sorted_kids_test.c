@@ -0,0 +1,96 @@
+#define _GNU_SOURCE
+
+#include "test_tree.h"
+
+// kids of each folder stay in strcmp order after build_fstree, changes and apply_changes, with or without folder
+// hashes, hold the paths of an unsorted buffer, and keep the mode through save & load. unsorted buffers are refused
+
+// 1 if the kids of a folder are out of order
+static int unsorted_kids(fs_buf* fsbuf)
+{
+	char buf[PATH_MAX];
+	uint32_t ranges = 0;
+	for (uint32_t off = first_name(fsbuf); off < get_tail(fsbuf); off = next_name(fsbuf, off)) {
+		if (*get_name(fsbuf, off) == 0 || is_file(fsbuf, off))
+			continue;
+		uint32_t path_off = 0, start_off = 0, end_off = 0;
+		get_path_range(fsbuf, get_path_by_name_off(fsbuf, off, buf, sizeof(buf)), &path_off, &start_off, &end_off);
+		// the kids run up to the parent-tag of the next list, the range goes on to the end of the subtree
+		const char* prev = 0;
+		for (uint32_t kid = start_off; kid && kid < end_off && *get_name(fsbuf, kid); kid = next_name(fsbuf, kid)) {
+			const char* name = get_name(fsbuf, kid);
+			if (prev && strcmp(prev, name) >= 0) {
+				printf("%s before %s\n", prev, name);
+				return 1;
+			}
+			prev = name;
+		}
+		ranges++;
+	}
+	return ranges == 0;
+}
+
+static fs_buf* build_sorted()
+{
+	fs_buf* fsbuf = new_fs_buf(1 << 21, test_root);
+	if (fsbuf && (enable_sorted_kids(fsbuf) != 0 || build_fstree(fsbuf, 0, 0, 0) != 0)) {
+		free_fs_buf(fsbuf);
+		return 0;
+	}
+	return fsbuf;
+}
+
+static void test_sorted(uint32_t dir_hash)
+{
+	const char* what = dir_hash ? "hashed" : "plain";
+	fs_buf* sorted = build_sorted();
+	fs_buf* unsorted = build_test_buf(0);
+	CHECK(sorted && unsorted, "%s: no fs_buf", what);
+	if (sorted && unsorted) {
+		if (dir_hash) {
+			CHECK(enable_dir_hash(sorted, dir_hash) == 0, "%s: no hashes", what);
+			CHECK(enable_dir_hash(unsorted, dir_hash) == 0, "%s: no hashes", what);
+		}
+		CHECK(is_sorted_kids(sorted) && !is_sorted_kids(unsorted), "%s: modes mixed up", what);
+		CHECK(unsorted_kids(sorted) == 0, "%s: built out of order", what);
+		CHECK(differ_paths(sorted, unsorted) == 0, "%s: built paths differ", what);
+
+		CHECK(change_test_buf(sorted) == 0 && change_test_buf(unsorted) == 0, "%s: changes failed", what);
+		char path[PATH_MAX];
+		fs_op ops[6];
+		char paths[6][PATH_MAX];
+		for (int i = 0; i < 6; i++) {
+			sprintf(paths[i], "%sLate_Dir/%c%d", test_root, "zaMm_Z"[i], i);
+			ops[i] = (fs_op){FS_OP_INSERT, i % 2, paths[i], 0, 0};
+		}
+		CHECK(apply_changes(sorted, ops, 6) == 6 && apply_changes(unsorted, ops, 6) == 6, "%s: apply_changes failed", what);
+		CHECK(unsorted_kids(sorted) == 0, "%s: changed out of order", what);
+		CHECK(differ_paths(sorted, unsorted) == 0, "%s: changed paths differ", what);
+
+		// the mode is saved, and a buffer out of order is refused
+		sprintf(path, "%s%s.lft", test_root, what);
+		CHECK(save_fs_buf(sorted, path) == 0, "%s: saving failed", what);
+		fs_buf* loaded = 0;
+		CHECK(load_fs_buf(&loaded, path) == 0 && is_sorted_kids(loaded), "%s: loaded unsorted", what);
+		if (loaded) {
+			CHECK(differ_layout(sorted, loaded) == 0, "%s: loaded names differ", what);
+			free_fs_buf(loaded);
+		}
+		unlink(path);
+		CHECK(enable_sorted_kids(unsorted) == ERR_NOT_SORTED && !is_sorted_kids(unsorted), "%s: unsorted kids taken", what);
+	}
+	free_fs_buf(sorted);
+	free_fs_buf(unsorted);
+}
+
+int main()
+{
+	if (make_test_root("sorted_kids", 2, 5, 30) == 0) {
+		test_sorted(0);
+		test_sorted(1);
+	} else
+		test_failures++;
+	remove_test_root();
+	printf("%s\n", test_failures ? "FAILED" : "OK");
+	return test_failures != 0;
+}
@@ -0,0 +1,250 @@
+#pragma once
+
+// helpers of the tests: a tree of names on disk under a temp root, and brute-force scans to check results against.
+// include it after defining _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+#include "fs_buf.h"
+#include "walkdir.h"
+
+static int test_failures;
+
+#define CHECK(cond, ...) do {\
+	if (!(cond)) {\
+		printf("%s:%d: ", __FILE__, __LINE__);\
+		printf(__VA_ARGS__);\
+		printf("\n");\
+		test_failures++;\
+	}\
+} while(0)
+
+// ends with a '/' as root paths of fs_buf do
+static char test_root[256];
+
+static const char* test_stems[] = {"index", "Makefile", "README", "main", "Écho", "data", "__init__", "日本語", "photo"};
+static const char* test_exts[] = {".c", ".h", ".txt", ".PDF", ".py", ".tar.gz", "", ".JPG"};
+
+#define TEST_STEMS	(sizeof(test_stems) / sizeof(test_stems[0]))
+#define TEST_EXTS	(sizeof(test_exts) / sizeof(test_exts[0]))
+
+// i-th name of a folder (i < 72), every third one is the same in all folders
+static inline void test_name(char* name, int i)
+{
+	if (i % 3 == 0)
+		sprintf(name, "%s%s", test_stems[i % TEST_STEMS], test_exts[i % TEST_EXTS]);
+	else
+		sprintf(name, "%s%d%s", test_stems[i % TEST_STEMS], i, test_exts[i % TEST_EXTS]);
+}
+
+static inline void test_dir_name(char* name, int i)
+{
+	sprintf(name, "%s_dir%d", test_stems[i % TEST_STEMS], i);
+}
+
+static inline int touch_file(const char* path)
+{
+	int fd = open(path, O_WRONLY | O_CREAT, 0644);
+	if (fd < 0)
+		return 1;
+	close(fd);
+	return 0;
+}
+
+// files files and dirs folders in dir (ending with a '/'), the folders filled the same way depth - 1 levels down
+static inline int make_test_tree(const char* dir, int depth, int dirs, int files)
+{
+	char path[PATH_MAX], name[NAME_MAX];
+	for (int i = 0; i < files; i++) {
+		test_name(name, i);
+		sprintf(path, "%s%s", dir, name);
+		if (touch_file(path) != 0)
+			return 1;
+	}
+	for (int i = 0; depth > 0 && i < dirs; i++) {
+		test_dir_name(name, i);
+		sprintf(path, "%s%s", dir, name);
+		if (mkdir(path, 0755) != 0)
+			return 1;
+		strcat(path, "/");
+		if (make_test_tree(path, depth - 1, dirs, files) != 0)
+			return 1;
+	}
+	return 0;
+}
+
+// a temp folder /tmp/<prefix>_XXXXXX/ in test_root holding make_test_tree(depth, dirs, files)
+static inline int make_test_root(const char* prefix, int depth, int dirs, int files)
+{
+	sprintf(test_root, "/tmp/%s_XXXXXX", prefix);
+	if (mkdtemp(test_root) == 0) {
+		printf("no temp dir\n");
+		return 1;
+	}
+	strcat(test_root, "/");
+	if (make_test_tree(test_root, depth, dirs, files) != 0) {
+		printf("no tree in %s\n", test_root);
+		return 1;
+	}
+	return 0;
+}
+
+static inline int remove_entry(const char* path, const struct stat* st, int type, struct FTW* ftw)
+{
+	remove(path);
+	return 0;
+}
+
+static inline void remove_test_root()
+{
+	if (test_root[0])
+		nftw(test_root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static inline fs_buf* build_test_buf(int large)
+{
+	fs_buf* fsbuf = large ? new_large_fs_buf(1 << 21, test_root) : new_fs_buf(1 << 21, test_root);
+	if (fsbuf && build_fstree(fsbuf, 0, 0, 0) != 0) {
+		free_fs_buf(fsbuf);
+		return 0;
+	}
+	return fsbuf;
+}
+
+// insert_path changes its path
+static inline int insert_test_path(fs_buf* fsbuf, const char* path, int is_dir, fs_change* change)
+{
+	char copy[PATH_MAX];
+	strcpy(copy, path);
+	return insert_path(fsbuf, copy, is_dir, change);
+}
+
+// offsets of the names holding query (all names if 0), at most max of them
+static inline uint32_t scan_names(fs_buf* fsbuf, const char* query, uint32_t* offs, uint32_t max)
+{
+	uint32_t count = 0;
+	for (uint32_t off = first_name(fsbuf); off < get_tail(fsbuf) && count < max; off = next_name(fsbuf, off)) {
+		char* name = get_name(fsbuf, off);
+		if (*name && (query == 0 || strstr(name, query)))
+			offs[count++] = off;
+	}
+	return count;
+}
+
+static inline int compare_path(const void* a, const void* b)
+{
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// sorted paths of all names, freed by free_paths
+static inline char** list_paths(fs_buf* fsbuf, uint32_t* count)
+{
+	uint32_t max = 0;
+	for (uint32_t off = first_name(fsbuf); off < get_tail(fsbuf); off = next_name(fsbuf, off))
+		max++;
+	char** paths = malloc(sizeof(char*) * (max + 1));
+	char path[PATH_MAX];
+	*count = 0;
+	for (uint32_t off = first_name(fsbuf); off < get_tail(fsbuf); off = next_name(fsbuf, off))
+		if (*get_name(fsbuf, off))
+			paths[(*count)++] = strdup(get_path_by_name_off(fsbuf, off, path, sizeof(path)));
+	qsort(paths, *count, sizeof(char*), compare_path);
+	return paths;
+}
+
+static inline void free_paths(char** paths, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++)
+		free(paths[i]);
+	free(paths);
+}
+
+// 1 if a and b hold different paths
+static inline int differ_paths(fs_buf* a, fs_buf* b)
+{
+	uint32_t na, nb;
+	char** pa = list_paths(a, &na);
+	char** pb = list_paths(b, &nb);
+	int differ = na != nb;
+	for (uint32_t i = 0; !differ && i < na; i++)
+		differ = strcmp(pa[i], pb[i]) != 0;
+	free_paths(pa, na);
+	free_paths(pb, nb);
+	return differ;
+}
+
+// 1 if a and b differ in a name, its offset or its kind
+static inline int differ_layout(fs_buf* a, fs_buf* b)
+{
+	if (first_name(a) != first_name(b) || get_tail(a) != get_tail(b))
+		return 1;
+	for (uint32_t off = first_name(a); off < get_tail(a); off = next_name(a, off))
+		if (strcmp(get_name(a, off), get_name(b, off)) != 0 || is_file(a, off) != is_file(b, off))
+			return 1;
+	return 0;
+}
+
+// contents of filename, freed by the caller (0 if not read)
+static inline char* read_whole(const char* filename, uint32_t* size)
+{
+	int fd = open(filename, O_RDONLY);
+	struct stat st;
+	char* data = 0;
+	if (fd >= 0 && fstat(fd, &st) == 0) {
+		data = malloc(st.st_size);
+		if (data && read(fd, data, st.st_size) != st.st_size) {
+			free(data);
+			data = 0;
+		}
+		*size = st.st_size;
+	}
+	if (fd >= 0)
+		close(fd);
+	return data;
+}
+
+// the usual changes of a tree of at least 3 folders of 2 files: names inserted into a folder and a new folder,
+// a file and a folder removed, and renames in a folder, into another one and of a folder. 1 if one failed
+static inline int change_test_buf(fs_buf* fsbuf)
+{
+	char dir[NAME_MAX], name[NAME_MAX], path[PATH_MAX], dst[PATH_MAX];
+	fs_change changes[64];
+	uint32_t change_count;
+	int failed = 0;
+
+	test_dir_name(dir, 0);
+	for (int i = 0; i < 5; i++) {
+		sprintf(path, "%s%s/late%d_Data.TXT", test_root, dir, i);
+		failed |= insert_test_path(fsbuf, path, 0, changes) != 0;
+	}
+	sprintf(path, "%sLate_Dir", test_root);
+	failed |= insert_test_path(fsbuf, path, 1, changes) != 0;
+
+	test_dir_name(dir, 1);
+	test_name(name, 1);
+	sprintf(path, "%s%s/%s", test_root, dir, name);
+	failed |= remove_path(fsbuf, path, changes, &change_count) != 0;
+	test_dir_name(dir, 2);
+	sprintf(path, "%s%s", test_root, dir);
+	failed |= remove_path(fsbuf, path, changes, &change_count) != 0;
+
+	test_dir_name(dir, 0);
+	sprintf(path, "%s%s/late1_Data.TXT", test_root, dir);
+	sprintf(dst, "%s%s/Renamed_ÉCHO.txt", test_root, dir);
+	failed |= rename_path(fsbuf, path, dst, changes, &change_count) != 0;
+	sprintf(path, "%s%s/late2_Data.TXT", test_root, dir);
+	test_dir_name(dir, 1);
+	sprintf(dst, "%s%s/moved_late2.txt", test_root, dir);
+	failed |= rename_path(fsbuf, path, dst, changes, &change_count) != 0;
+	sprintf(path, "%s%s", test_root, dir);
+	sprintf(dst, "%srenamed_dir", test_root);
+	failed |= rename_path(fsbuf, path, dst, changes, &change_count) != 0;
+	return failed;
+}
@@ -0,0 +1,132 @@
+#define _GNU_SOURCE
+
+#include "test_tree.h"
+
+// the range get_path_range gives of each folder holds exactly the names under it, and ends right behind
+// the parent-tag of its last kids list, after each change of names inserted, removed & renamed at the ends
+// of subtrees, with spans known or not, flat or segmented, plain, large or with folder hashes
+
+#define MAX_NAMES	(1 << 14)
+
+static char* paths[MAX_NAMES];
+static uint32_t offs[MAX_NAMES];
+
+static void check_ranges(fs_buf* fsbuf, const char* what)
+{
+	char buf[PATH_MAX], prefix[PATH_MAX];
+	uint32_t count = scan_names(fsbuf, 0, offs, MAX_NAMES);
+	for (uint32_t i = 0; i < count; i++)
+		paths[i] = strdup(get_path_by_name_off(fsbuf, offs[i], buf, sizeof(buf)));
+
+	for (uint32_t d = 0; d < count; d++) {
+		if (is_file(fsbuf, offs[d]))
+			continue;
+		uint32_t path_off = 0, start_off = 0, end_off = 0;
+		get_path_range(fsbuf, paths[d], &path_off, &start_off, &end_off);
+		if (start_off == 0)
+			continue;
+		// names under the folder, and the first parent-tag behind the last of them
+		sprintf(prefix, "%s/", paths[d]);
+		uint32_t len = strlen(prefix), last = 0, inside = 0, outside = 0;
+		for (uint32_t i = 0; i < count; i++) {
+			int under = strncmp(paths[i], prefix, len) == 0;
+			int in_range = offs[i] >= start_off && offs[i] < end_off;
+			inside += under && in_range;
+			outside += under != in_range;
+			if (under && offs[i] > last)
+				last = offs[i];
+		}
+		uint32_t tag = last;
+		while (tag < get_tail(fsbuf) && *get_name(fsbuf, tag))
+			tag = next_name(fsbuf, tag);
+		uint32_t expected_end = tag < get_tail(fsbuf) ? next_name(fsbuf, tag) : get_tail(fsbuf);
+		CHECK(inside > 0 && outside == 0 && end_off == expected_end, "%s: %s ends at %u instead of %u, %u names out of place",
+			  what, paths[d], end_off, expected_end, outside);
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+		free(paths[i]);
+}
+
+// a change, checked at once, and again once spans of all folders are known
+static void changed(fs_buf* fsbuf, int failed, const char* change, const char* what)
+{
+	CHECK(!failed, "%s: %s failed", what, change);
+	check_ranges(fsbuf, what);
+	check_ranges(fsbuf, what);
+}
+
+static void test_changes(fs_buf* fsbuf, const char* what)
+{
+	char a[NAME_MAX], b[NAME_MAX], path[PATH_MAX], dst[PATH_MAX];
+	fs_change changes[64];
+	uint32_t change_count;
+	check_ranges(fsbuf, what);
+
+	// folders behind the last list of a subtree, nested, then filled
+	test_dir_name(a, 3);
+	test_dir_name(b, 3);
+	sprintf(path, "%s%s/%s/deep", test_root, a, b);
+	changed(fsbuf, insert_test_path(fsbuf, path, 1, changes), "inserting the deep folder", what);
+	strcat(path, "/deeper");
+	changed(fsbuf, insert_test_path(fsbuf, path, 1, changes), "inserting the deeper folder", what);
+	strcat(path, "/last.txt");
+	changed(fsbuf, insert_test_path(fsbuf, path, 0, changes), "inserting a file", what);
+	sprintf(path, "%s%s/%s/deep/side", test_root, a, b);
+	changed(fsbuf, insert_test_path(fsbuf, path, 1, changes), "inserting a side folder", what);
+	sprintf(path, "%s%s/side.c", test_root, a);
+	changed(fsbuf, insert_test_path(fsbuf, path, 0, changes), "inserting a file into the middle", what);
+	sprintf(path, "%snew_root_dir", test_root);
+	changed(fsbuf, insert_test_path(fsbuf, path, 1, changes), "inserting a root folder", what);
+
+	// the last folder of a subtree removed, a middle one, then moved across subtrees
+	sprintf(path, "%s%s/%s/deep/side", test_root, a, b);
+	changed(fsbuf, remove_path(fsbuf, path, changes, &change_count), "removing the side folder", what);
+	test_dir_name(b, 1);
+	sprintf(path, "%s%s/%s", test_root, a, b);
+	changed(fsbuf, remove_path(fsbuf, path, changes, &change_count), "removing a middle folder", what);
+	test_dir_name(b, 3);
+	sprintf(path, "%s%s/%s/deep", test_root, a, b);
+	test_dir_name(b, 0);
+	sprintf(dst, "%s%s/moved_deep", test_root, b);
+	changed(fsbuf, rename_path(fsbuf, path, dst, changes, &change_count), "moving the deep folder", what);
+	sprintf(path, "%s%s", test_root, b);
+	sprintf(dst, "%snew_root_dir/%s", test_root, b);
+	changed(fsbuf, rename_path(fsbuf, path, dst, changes, &change_count), "moving a root folder", what);
+
+	// a batch into the moved folder and its new parent
+	sprintf(path, "%snew_root_dir", test_root);
+	fs_op ops[6];
+	char op_paths[6][PATH_MAX];
+	for (int i = 0; i < 6; i++) {
+		sprintf(op_paths[i], "%s%s", i < 3 ? dst : path, i % 3 == 0 ? "/batch_dir" : i % 3 == 1 ? "/batch_dir/batch.txt" : "/batch.c");
+		ops[i] = (fs_op){FS_OP_INSERT, i % 3 == 0, op_paths[i], 0, 0};
+	}
+	changed(fsbuf, apply_changes(fsbuf, ops, 6) != 6, "apply_changes", what);
+}
+
+int main()
+{
+	if (make_test_root("tree_end", 3, 4, 10) != 0) {
+		remove_test_root();
+		return 1;
+	}
+
+	const char* modes[] = {"plain", "large", "hashed", "segments"};
+	for (int mode = 0; mode < 4; mode++) {
+		fs_buf* fsbuf = build_test_buf(mode == 1);
+		CHECK(fsbuf != 0, "%s: no fs_buf", modes[mode]);
+		if (fsbuf == 0)
+			continue;
+		if (mode == 2)
+			CHECK(enable_dir_hash(fsbuf, 1) == 0, "%s: no hashes", modes[mode]);
+		if (mode == 3)
+			CHECK(enable_segments(fsbuf) == 0, "%s: no segments", modes[mode]);
+		test_changes(fsbuf, modes[mode]);
+		free_fs_buf(fsbuf);
+	}
+
+	remove_test_root();
+	printf("%s\n", test_failures ? "FAILED" : "OK");
+	return test_failures != 0;
+}
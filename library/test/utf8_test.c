@@ -0,0 +1,227 @@
+#define _GNU_SOURCE
+
+#include <locale.h>
+#include <wchar.h>
+#include <wctype.h>
+
+#include "test_tree.h"
+#include "utils.h"
+
+// the utf8 codec & case folding of utils.h agree with glibc (mbrtowc, wcrtomb & towlower under C.UTF-8)
+// for every code point, refuse what glibc refuses, and fold_bytes folds any mix of ascii, utf8 & stray
+// bytes at any alignment as folding character by character does
+
+// bytes of the character at s as mbrtowc takes it, 0 if invalid or cut
+static uint32_t glibc_decode(const char* s, uint32_t size, uint32_t* cp)
+{
+	mbstate_t state;
+	wchar_t wc;
+	memset(&state, 0, sizeof(state));
+	size_t n = mbrtowc(&wc, s, size, &state);
+	if (n == (size_t)-1 || n == (size_t)-2)
+		return 0;
+	*cp = wc;
+	// a \0 is a character of one byte
+	return n ? n : 1;
+}
+
+static void check_code_points()
+{
+	uint32_t wrong = 0;
+	for (uint32_t cp = 0; cp <= 0x10ffff + 16; cp++) {
+		char out[4], ref[MB_LEN_MAX];
+		mbstate_t state;
+		memset(&state, 0, sizeof(state));
+		size_t ref_n = wcrtomb(ref, cp, &state);
+		uint32_t n = utf8_encode(cp, out), back = 0, decoded = 0;
+		// glibc goes on up to 0x7fffffff, utf8 stops at U+10FFFF
+		if (ref_n == (size_t)-1 || cp > 0x10ffff) {
+			wrong += n != 0;
+			continue;
+		}
+		back = utf8_decode(out, n, &decoded);
+		if (n != ref_n || memcmp(out, ref, n) != 0 || back != n || decoded != cp) {
+			if (wrong++ < 10)
+				printf("U+%04X: %u bytes, %u decoded to U+%04X\n", cp, n, back, decoded);
+		}
+	}
+	CHECK(wrong == 0, "%u code points coded otherwise than by glibc", wrong);
+}
+
+static void check_invalid()
+{
+	static const char* invalid[] = {
+		"\x80", "\xbf", "\xc0\x80", "\xc1\xbf", "\xe0\x80\x80", "\xe0\x9f\xbf", "\xf0\x80\x80\x80", "\xf0\x8f\xbf\xbf",
+		"\xed\xa0\x80", "\xed\xbf\xbf", "\xf8\x88\x80\x80", "\xfe", "\xff", "\xe2\x28\xa1", "\xc3\x28", "\xf0\x9f\x98", "\xe2\x82",
+	};
+	for (uint32_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+		uint32_t cp, ref;
+		uint32_t size = strlen(invalid[i]);
+		CHECK(utf8_decode(invalid[i], size, &cp) == 0 && glibc_decode(invalid[i], size, &ref) == 0,
+			  "sequence %u of %u bytes taken", i, size);
+	}
+	// beyond U+10FFFF, which glibc takes, cut short by size, and nothing at all
+	uint32_t cp;
+	CHECK(utf8_decode("\xf4\x90\x80\x80", 4, &cp) == 0 && utf8_decode("\xf5\x80\x80\x80", 4, &cp) == 0, "beyond unicode taken");
+	CHECK(utf8_decode("\xe6\x97\xa5", 2, &cp) == 0 && utf8_decode("a", 0, &cp) == 0, "cut sequences taken");
+
+	// random bytes are taken or refused as glibc does
+	uint32_t wrong = 0;
+	srand(24);
+	for (int i = 0; i < 200000; i++) {
+		char s[4];
+		for (int j = 0; j < 4; j++)
+			s[j] = rand() % 4 ? 0x80 + rand() % 0x80 : rand();
+		uint32_t size = 1 + rand() % 4, a = 0, b = 0;
+		uint32_t n = utf8_decode(s, size, &a), ref = glibc_decode(s, size, &b);
+		if (ref && b > 0x10ffff)
+			wrong += n != 0;
+		else
+			wrong += n != ref || (n && a != b);
+	}
+	CHECK(wrong == 0, "%u random sequences decoded otherwise than by glibc", wrong);
+}
+
+// a string of count characters (ascii, 2, 3 & 4 bytes ones) to s, returns its bytes
+static uint32_t random_text(char* s, uint32_t count)
+{
+	static const uint32_t samples[] = {'a', 'Z', '.', 0xe9, 0xc9, 0x3a3, 0x416, 0x65e5, 0xff21, 0x1f600};
+	uint32_t size = 0;
+	for (uint32_t i = 0; i < count; i++)
+		size += utf8_encode(samples[rand() % (sizeof(samples) / sizeof(samples[0]))], s + size);
+	s[size] = 0;
+	return size;
+}
+
+static void check_count_prefix()
+{
+	char s[512];
+	wchar_t w[512];
+	for (uint32_t count = 0; count < 100; count++) {
+		uint32_t size = random_text(s, count);
+		CHECK(utf8_count(s, size) == count && mbstowcs(w, s, 512) == count, "%u characters counted as %u", count, utf8_count(s, size));
+		// at any alignment, counted bytes by bytes
+		for (uint32_t skip = 1; skip < 4 && skip < size; skip++) {
+			uint32_t expected = 0;
+			for (uint32_t i = skip; i < size; i++)
+				expected += ((uint8_t)s[i] & 0xc0) != 0x80;
+			CHECK(utf8_count(s + skip, size - skip) == expected, "%u bytes from %u counted as %u", size - skip, skip, utf8_count(s + skip, size - skip));
+		}
+		// the prefix of k characters is where the k-th character of glibc ends
+		mbstate_t state;
+		memset(&state, 0, sizeof(state));
+		uint32_t off = 0;
+		for (uint32_t k = 0; k <= count + 2; k++) {
+			CHECK(utf8_prefix(s, k) == off, "the prefix of %u characters of %u is %u bytes, not %u", k, count, utf8_prefix(s, k), off);
+			if (off < size)
+				off += mbrtowc(0, s + off, size - off, &state);
+		}
+	}
+}
+
+// the simple folding covers the lower case of towlower as long as it keeps the utf8 length
+static int folded_by_table(uint32_t cp)
+{
+	return cp < 0x180 || (cp >= 0x386 && cp <= 0x3ab) || (cp >= 0x400 && cp <= 0x556) ||
+		   (cp >= 0x1e00 && cp <= 0x1eff) || (cp >= 0xff21 && cp <= 0xff3a);
+}
+
+static void check_fold_char()
+{
+	uint32_t wrong = 0, missed = 0;
+	for (uint32_t cp = 0; cp <= 0x10ffff; cp++) {
+		if (cp >= 0xd800 && cp <= 0xdfff)
+			continue;
+		char a[4], b[4];
+		uint32_t folded = fold_char(cp), lower = towlower(cp);
+		// the same length, and the case glibc lowers it to if folded at all (or that of its upper case, e.g. of the final sigma)
+		if (utf8_encode(folded, a) != utf8_encode(cp, b) || (folded != cp && folded != lower && folded != (uint32_t)towlower(towupper(cp)))) {
+			if (wrong++ < 10)
+				printf("U+%04X folded to U+%04X, towlower gives U+%04X\n", cp, folded, lower);
+		}
+		if (folded_by_table(cp) && folded == cp && lower != cp && utf8_encode(lower, a) == utf8_encode(cp, b)) {
+			if (missed++ < 10)
+				printf("U+%04X not folded to U+%04X\n", cp, lower);
+		}
+	}
+	CHECK(wrong == 0, "%u code points folded wrong", wrong);
+	CHECK(missed == 0, "%u code points not folded", missed);
+}
+
+// fold_bytes of a character at a time, stray bytes copied
+static void fold_reference(char* dst, const char* src, uint32_t size)
+{
+	for (uint32_t i = 0; i < size;) {
+		uint32_t cp, n = utf8_decode(src + i, size - i, &cp);
+		if (n == 0) {
+			dst[i] = src[i];
+			i++;
+			continue;
+		}
+		utf8_encode(fold_char(cp), dst + i);
+		i += n;
+	}
+}
+
+static void check_fold_bytes()
+{
+	static const char* pieces[] = {"A", "z", "README", "\0", "É", "ÉCHO", "Σ", "Ж", "日本語", "Ｚ", "\xf0\x9f\x98\x80", "\x80", "\xe6\x97", "\xff"};
+	uint32_t wrong = 0;
+	srand(240);
+	for (int t = 0; t < 20000; t++) {
+		char src[256], dst[256 + 16], ref[256];
+		uint32_t size = 0, skip = rand() % 16;
+		while (size < 64 + (uint32_t)(rand() % 128)) {
+			const char* p = pieces[rand() % (sizeof(pieces) / sizeof(pieces[0]))];
+			uint32_t len = *p ? strlen(p) : 1;
+			memcpy(src + size, p, len);
+			size += len;
+		}
+		size -= rand() % 8;
+		memset(dst, 0x55, sizeof(dst));
+		fold_bytes(dst + skip, src, size);
+		fold_reference(ref, src, size);
+		if (memcmp(dst + skip, ref, size) != 0 || dst[skip + size] != 0x55) {
+			if (wrong++ < 5)
+				printf("%u bytes at %u folded otherwise\n", size, skip);
+		}
+	}
+	CHECK(wrong == 0, "%u strings folded otherwise than character by character", wrong);
+}
+
+static void check_wide()
+{
+	char s[256], back[256];
+	wchar_t w[128], ref[128];
+	srand(2400);
+	for (int t = 0; t < 1000; t++) {
+		uint32_t size = random_text(s, rand() % 60);
+		size_t n = mbstowcs(ref, s, 128);
+		CHECK(utf8_to_wchar_t(s, w, sizeof(w)) == 0 && wcsncmp(w, ref, n + 1) == 0, "%s decoded otherwise than by glibc", s);
+		CHECK(wchar_t_to_utf8(w, back, sizeof(back)) == 0 && strcmp(back, s) == 0, "%s encoded back as %s", s, back);
+		// the terminating 0 takes room too
+		CHECK(utf8_to_wchar_t(s, w, (n + 1) * sizeof(wchar_t)) == 0 && wchar_t_to_utf8(ref, back, size + 1) == 0, "%s refused by buffers just as long", s);
+		if (n > 0)
+			CHECK(utf8_to_wchar_t(s, w, n * sizeof(wchar_t)) != 0 && wchar_t_to_utf8(ref, back, size) != 0, "%s taken by short buffers", s);
+	}
+	CHECK(utf8_to_wchar_t("ab\xc3", w, sizeof(w)) != 0, "a cut character taken");
+	ref[0] = 0xd800;
+	ref[1] = 0;
+	CHECK(wchar_t_to_utf8(ref, back, sizeof(back)) != 0, "a surrogate encoded");
+}
+
+int main()
+{
+	if (setlocale(LC_CTYPE, "C.UTF-8") == 0) {
+		printf("no C.UTF-8 locale\n");
+		return 1;
+	}
+	check_code_points();
+	check_invalid();
+	check_count_prefix();
+	check_fold_char();
+	check_fold_bytes();
+	check_wide();
+	printf("%s\n", test_failures ? "FAILED" : "OK");
+	return test_failures != 0;
+}
@@ -36,8 +36,10 @@ extern "C" {
 #include <QRegularExpression>
 #include <QTimer>
 #include <QLoggingCategory>
+#include <QCache>
 
 #include <unistd.h>
+#include <sys/statvfs.h>
 
 Q_GLOBAL_STATIC_WITH_ARGS(QLoggingCategory, normalLog, ("manager.normal"))
 Q_GLOBAL_STATIC_WITH_ARGS(QLoggingCategory, changesLog, ("manager.changes", QtWarningMsg))
@@ -80,6 +82,22 @@ Q_GLOBAL_STATIC(FSJobWatcherMap, _global_fsWatcherMap)
 typedef QSet<fs_buf*> FSBufList;
 Q_GLOBAL_STATIC(FSBufList, _global_fsBufDirtyList)
 Q_GLOBAL_STATIC_WITH_ARGS(QSettings, _global_settings, (_getCacheDir() + "/config.ini", QSettings::IniFormat))
+// 分页搜索返回给调用方的偏移区间所属的fs_buf版本(generation), 调用方带着它们取下一页时,
+// 据此把偏移移到当前版本, 期间的文件变动不会使下一页重复或遗漏结果
+typedef QPair<fs_buf*, QPair<quint32, quint32>> SearchCursorKey;
+typedef QCache<SearchCursorKey, quint32> SearchCursorCache;
+Q_GLOBAL_STATIC_WITH_ARGS(SearchCursorCache, _global_searchCursors, (256))
+
+static void removeSearchCursors(fs_buf *buf)
+{
+    if (!_global_searchCursors.exists())
+        return;
+
+    for (const SearchCursorKey &key : _global_searchCursors->keys()) {
+        if (key.first == buf)
+            _global_searchCursors->remove(key);
+    }
+}
 
 static QSet<fs_buf*> fsBufList()
 {
@@ -92,8 +110,10 @@ static QSet<fs_buf*> fsBufList()
 static void clearFsBufMap()
 {
     for (fs_buf *buf : fsBufList()) {
-        if (buf)
+        if (buf) {
+            removeSearchCursors(buf);
             free_fs_buf(buf);
+        }
     }
 
     if (_global_fsBufMap.exists())
@@ -125,6 +145,9 @@ static bool doLFTFileToDirty(fs_buf *buf)
     if (lft_file.isEmpty())
         return false;
 
+    // 日志文件依附于lft文件, 一并删除
+    QFile::remove(lft_file + FS_JOURNAL_SUFFIX);
+
     return QFile::remove(lft_file);
 }
 
@@ -192,6 +215,14 @@ struct FSBufDeleter
     }
 };
 
+struct FSSnapshotDeleter
+{
+    static inline void cleanup(fs_buf *pointer)
+    {
+        release_fs_snapshot(pointer);
+    }
+};
+
 static int handle_build_fs_buf_progress(uint32_t file_count, uint32_t dir_count, const char* cur_dir, const char* cur_file, void* param)
 {
     Q_UNUSED(file_count)
@@ -214,13 +245,33 @@ static bool checkFSBuf(fs_buf *buf)
     return get_tail(buf) != first_name(buf);
 }
 
+// 已用inode数超过此值的分区, 文件名总长可能超过普通fs_buf的1G上限
+#define LARGE_FS_BUF_MIN_INODES (20 * 1000 * 1000)
+
+static bool needLargeFSBuf(const QString &path)
+{
+    struct statvfs st;
+
+    if (statvfs(path.toLocal8Bit().constData(), &st) != 0)
+        return false;
+
+    return st.f_files - st.f_ffree > LARGE_FS_BUF_MIN_INODES;
+}
+
 static fs_buf *buildFSBuf(QFutureWatcherBase *futureWatcher, const QString &path)
 {
-    fs_buf *buf = new_fs_buf(1 << 24, path.toLocal8Bit().constData());
+    const QByteArray &root_path = path.toLocal8Bit();
+    fs_buf *buf = needLargeFSBuf(path) ? new_large_fs_buf(1 << 24, root_path.constData())
+                                       : new_fs_buf(1 << 24, root_path.constData());
 
     if (!buf)
         return buf;
 
+    // 目录内文件名按字节序排列, 查找路径时可提前结束, 同一目录下的搜索结果也无需再排序
+    if (_global_settings->value("sortedLFTBuf", true).toBool() && enable_sorted_kids(buf) != 0) {
+        nWarning() << "Failed on enable sorted kids of path: " << path;
+    }
+
     if (build_fstree(buf, false, handle_build_fs_buf_progress, futureWatcher) != 0) {
         free_fs_buf(buf);
 
@@ -237,6 +288,31 @@ static fs_buf *buildFSBuf(QFutureWatcherBase *futureWatcher, const QString &path
         return nullptr;
     }
 
+    // 重复的文件名只在字典中存一份, 需在生成大小写转换副本与分段之前进行, 以免重复复制
+    if (_global_settings->value("internedLFTNames", true).toBool() && enable_interned_names(buf) != 0) {
+        nWarning() << "Failed on enable interned names of path: " << path;
+    }
+
+    // 失败时搜索仍可逐个文件名转换大小写, 只是会慢一些
+    if (enable_fold_names(buf) != 0) {
+        nWarning() << "Failed on enable fold names of path: " << path;
+    }
+
+    // 大目录使用哈希索引查找路径, 加快文件变动事件的处理
+    if (enable_dir_hash(buf, 0) != 0) {
+        nWarning() << "Failed on enable dir hash of path: " << path;
+    }
+
+    // 扩展名索引在构建完成后一次性生成, 失败时按扩展名搜索会逐个扫描文件名
+    if (enable_ext_index(buf) != 0) {
+        nWarning() << "Failed on enable ext index of path: " << path;
+    }
+
+    // 分段存储, 文件变动时只需移动一个段内的数据
+    if (enable_segments(buf) != 0) {
+        nWarning() << "Failed on enable segments of path: " << path;
+    }
+
     return buf;
 }
 
@@ -308,6 +384,7 @@ static void removeBuf(fs_buf *buf, bool &removeLFTFile)
 
     _global_fsBufDirtyList->remove(buf);
     _global_fsBufToFileMap->remove(buf);
+    removeSearchCursors(buf);
     free_fs_buf(buf);
 }
 
@@ -589,7 +666,9 @@ QStringList LFTManager::refresh(const QByteArray &serialUriFilter)
 
         fs_buf *buf = nullptr;
 
-        if (load_fs_buf(&buf, lft_file.toLocal8Bit().constData()) != 0) {
+        // 未压缩的文件(compressLFTFile为false时保存)被映射而不是读入内存, 页面在访问时才加载, 首次修改时才复制;
+        // 默认保存的压缩文件无法映射, 会解压读入内存
+        if (load_fs_buf_mmap(&buf, lft_file.toLocal8Bit().constData()) != 0) {
             nWarning() << "Failed on load:" << lft_file;
             continue;
         }
@@ -608,6 +687,31 @@ QStringList LFTManager::refresh(const QByteArray &serialUriFilter)
             continue;
         }
 
+        if (_global_settings->value("internedLFTNames", true).toBool() && enable_interned_names(buf) != 0) {
+            nWarning() << "Failed on enable interned names of:" << lft_file;
+        }
+
+        if (enable_fold_names(buf) != 0) {
+            nWarning() << "Failed on enable fold names of:" << lft_file;
+        }
+
+        if (enable_dir_hash(buf, 0) != 0) {
+            nWarning() << "Failed on enable dir hash of:" << lft_file;
+        }
+
+        if (enable_ext_index(buf) != 0) {
+            nWarning() << "Failed on enable ext index of:" << lft_file;
+        }
+
+        if (enable_segments(buf) != 0) {
+            nWarning() << "Failed on enable segments of:" << lft_file;
+        }
+
+        // 之后的改动记录到日志文件中, 定时同步时无需重写整个lft文件
+        if (open_fs_journal(buf, lft_file.toLocal8Bit().constData()) != 0) {
+            nWarning() << "Failed on open journal of:" << lft_file;
+        }
+
         for (const QByteArray &path_raw : pathList) {
             const QString path = QString::fromLocal8Bit(path_raw);
 
@@ -628,6 +732,20 @@ QStringList LFTManager::refresh(const QByteArray &serialUriFilter)
     return path_list;
 }
 
+// 默认以压缩格式保存索引文件, 约为原大小的40%, 但加载时需要解压, 无法映射加载.
+// 加载后默认启用的名字字典、大小写转换副本与分段存储都会读取或复制全部页面, 映射加载省不下内存与读取,
+// 因此默认选择读取更少的压缩格式; 关闭这些功能时可将compressLFTFile设为false以映射加载
+static int lftSaveFormat()
+{
+    return _global_settings->value("compressLFTFile", true).toBool() ? FS_FORMAT_LFT2 : FS_FORMAT_LFT;
+}
+
+// 日志超过lft文件的1/8(至少1M)时合并到lft文件中
+static uint32_t journalCheckpointSize(fs_buf *buf)
+{
+    return qMax<uint32_t>(get_tail(buf) / 8, 1 << 20);
+}
+
 QStringList LFTManager::sync(const QString &mountPoint)
 {
     nDebug() << mountPoint;
@@ -676,11 +794,28 @@ QStringList LFTManager::sync(const QString &mountPoint)
             continue;
         }
 
+        // 改动已记录在日志中, 日志不大时无需重写整个文件
+        if (has_fs_journal(buf) && get_journal_size(buf) < journalCheckpointSize(buf)) {
+            nDebug() << "journal size:" << get_journal_size(buf);
+
+            saved_buf_list.append(buf);
+            path_list << buf_begin.key();
+            _global_fsBufDirtyList->remove(buf);
+            continue;
+        }
+
+        set_save_format(buf, lftSaveFormat());
+
+        // 对于有日志的buf, save_fs_buf会同时清空日志
         if (save_fs_buf(buf, lft_file.toLocal8Bit().constData()) == 0) {
             saved_buf_list.append(buf);
             path_list << buf_begin.key();
             // 从脏列表中移除
             _global_fsBufDirtyList->remove(buf);
+
+            if (!has_fs_journal(buf) && open_fs_journal(buf, lft_file.toLocal8Bit().constData()) != 0) {
+                nWarning() << "Failed on open journal of:" << lft_file;
+            }
         } else {
             path_list << QString("Failed: \"%1\"->\"%2\"").arg(buf_begin.key()).arg(lft_file);
 
@@ -703,6 +838,15 @@ static int compareStringRegExp(const char *string, void *re)
     return !match.hasMatch();
 }
 
+// 形如 \.pdf$ 或 .*\.pdf$ 的正则表达式只匹配扩展名, 返回其扩展名, 否则返回空
+static QByteArray extensionOfRegExp(const QString &pattern)
+{
+    static const QRegularExpression ext_re("^(?:\\.\\*)?\\\\\\.([0-9A-Za-z]{1,15})\\$$");
+    const QRegularExpressionMatch &match = ext_re.match(pattern);
+
+    return match.hasMatch() ? match.captured(1).toLatin1() : QByteArray();
+}
+
 static int timeoutGuard(uint32_t count, const char* cur_file, void* param)
 {
     Q_UNUSED(count)
@@ -734,18 +878,34 @@ QStringList LFTManager::search(int maxCount, qint64 maxTime, quint32 startOffset
         return QStringList();
     }
 
-    fs_buf *buf = buf_list.first().second;
+    fs_buf *live_buf = buf_list.first().second;
 
-    if (!buf) {
+    if (!live_buf) {
         sendErrorReply(QDBusError::InternalError, "Index is being generated");
 
         return QStringList();
     }
 
+    // 在快照上搜索及生成路径, 不必等待正在应用文件变动的写者; 内存不足时退回到加锁访问
+    QScopedPointer<fs_buf, FSSnapshotDeleter> snapshot(acquire_fs_snapshot(live_buf));
+    fs_buf *buf = snapshot ? snapshot.data() : live_buf;
+
     // new_path 为path在fs_buf中对应的路径
     const QString &new_path = buf_list.first().first;
 
-    if (startOffset == 0 || endOffset == 0) {
+    if (startOffset != 0 && endOffset != 0) {
+        // 继续之前的分页搜索, 偏移属于返回它们时的版本
+        if (const quint32 *generation = _global_searchCursors->object(qMakePair(live_buf, qMakePair(startOffset, endOffset)))) {
+            fs_cursor cursor = {*generation, startOffset, endOffset};
+
+            if (seek_fs_cursor(buf, &cursor) == 0) {
+                startOffset = cursor.start_off;
+                endOffset = cursor.end_off;
+            } else {
+                nDebug() << "Search cursor too old, resume from the offsets as they are";
+            }
+        }
+    } else {
         // 未指定有效的搜索区间时, 根据路径获取
         uint32_t path_offset = 0;
         get_path_range(buf, new_path.toLocal8Bit().constData(), &path_offset, &startOffset, &endOffset);
@@ -781,13 +941,29 @@ QStringList LFTManager::search(int maxCount, qint64 maxTime, quint32 startOffset
         compare = compareString;
     }
 
-#define MAX_RESULT_COUNT 100
+    // 只匹配扩展名时直接取扩展名索引中的文件
+    const QByteArray &ext = useRegExp ? extensionOfRegExp(keyword) : QByteArray();
+    // 纯ASCII的关键字可直接在预先转为小写的文件名中按字节查找, 无需为每个文件名构造QString
+    const QByteArray &ascii_keyword = keyword.toLatin1();
+    bool nocase_literal = !useRegExp;
+
+    for (const QChar &ch : keyword) {
+        if (ch.unicode() >= 0x80) {
+            nocase_literal = false;
+            break;
+        }
+    }
+
+// 多线程搜索时每次取更多结果, 减少分块和线程创建的次数
+#define MAX_RESULT_COUNT 1000
 
     uint32_t name_offsets[MAX_RESULT_COUNT];
     uint32_t count = MAX_RESULT_COUNT;
 
     QStringList list;
-    char tmp_path[PATH_MAX];
+    // 一页结果的路径一次生成, 同一目录下的结果共用目录部分; 缓冲区总能容纳至少一个路径
+    QByteArray path_buffer(MAX_RESULT_COUNT * 256, Qt::Uninitialized);
+    char *paths[MAX_RESULT_COUNT];
     // root_path 以/结尾，所以此处需要多忽略一个字符
     bool need_reset_root_path = path != new_path;
 
@@ -804,18 +980,40 @@ QStringList LFTManager::search(int maxCount, qint64 maxTime, quint32 startOffset
 
     do {
         count = qMin(uint32_t(MAX_RESULT_COUNT), uint32_t(maxCount - list.count()));
-        search_files(buf, &startOffset, endOffset, name_offsets, &count, compare, compare_param, progress, &progress_param);
+        // compare 和 progress 均只读取参数, 可在多个线程中同时调用
+        if (!ext.isEmpty()) {
+            search_files_ext(buf, &startOffset, endOffset, name_offsets, &count, ext.constData());
+        } else if (nocase_literal) {
+            search_files_nocase(buf, &startOffset, endOffset, name_offsets, &count, ascii_keyword.constData(),
+                                progress, &progress_param, 0);
+        } else {
+            search_files_parallel(buf, &startOffset, endOffset, name_offsets, &count, compare, compare_param, nullptr,
+                                  progress, &progress_param, 0);
+        }
 
-        for (uint32_t i = 0; i < count; ++i) {
-            const char *result = get_path_by_name_off(buf, name_offsets[i], tmp_path, sizeof(tmp_path));
-            const QString &origin_path = QString::fromLocal8Bit(result);
+        for (uint32_t done = 0; done < count;) {
+            uint32_t path_count = get_paths_by_name_offs(buf, name_offsets + done, count - done,
+                                                         path_buffer.data(), path_buffer.size(), paths);
 
-            if (need_reset_root_path) {
-                list << path + origin_path.mid(new_path.size());
-                nDebug() << "need reset root path:" << origin_path << ", to:" << list.last();
-             } else {
-                list << origin_path;
+            // 一个路径也没取到时(内存不足或缓冲区放不下), 继续循环不会有进展
+            if (path_count == 0) {
+                nWarning() << "Failed on get paths of name offsets from:" << name_offsets[done]
+                           << ", results dropped:" << count - done;
+                break;
             }
+
+            for (uint32_t i = 0; i < path_count; ++i) {
+                const QString &origin_path = QString::fromLocal8Bit(paths[i]);
+
+                if (need_reset_root_path) {
+                    list << path + origin_path.mid(new_path.size());
+                    nDebug() << "need reset root path:" << origin_path << ", to:" << list.last();
+                 } else {
+                    list << origin_path;
+                }
+            }
+
+            done += path_count;
         }
 
         if (maxTime >= 0 && et.elapsed() >= maxTime) {
@@ -826,170 +1024,204 @@ QStringList LFTManager::search(int maxCount, qint64 maxTime, quint32 startOffset
     startOffsetReturn = startOffset;
     endOffsetReturn = endOffset;
 
+    if (startOffset < endOffset) {
+        _global_searchCursors->insert(qMakePair(live_buf, qMakePair(startOffset, endOffset)), new quint32(get_fs_generation(buf)));
+    }
+
     return list;
 }
 
-QStringList LFTManager::insertFileToLFTBuf(const QByteArray &file)
+// 有可能索引正在构建, 需要等待构建完成
+static fs_buf *waitFsBuf(const QPair<QString, fs_buf*> &pair)
 {
-    cDebug() << file;
+    fs_buf *buf = pair.second;
 
-    auto list = getFsBufByPath(QString::fromLocal8Bit(file), false);
-    QStringList root_path_list;
+    if (!buf) {
+        cDebug() << "index buinding";
 
-    if (list.isEmpty())
-        return root_path_list;
+        // 正在构建索引时需要等待
+        if (QFutureWatcher<fs_buf*> *watcher = _global_fsWatcherMap->value(pair.first)) {
+            cDebug() << "will be wait build finished";
 
-    QFileInfo info(QString::fromLocal8Bit(file));
-    bool is_dir = info.isDir();
+            watcher->waitForFinished();
+            buf = watcher->result();
+        }
+    }
 
-    for (auto i : list) {
-        fs_buf *buf = i.second;
+    return buf;
+}
 
-        // 有可能索引正在构建
-        if (!buf) {
-            cDebug() << "index buinding";
+struct LFTChange
+{
+    int type;
+    int isDir;
+    QByteArray path;
+    QByteArray dstPath;
+};
+
+// 按fs_buf分组后一次性应用所有改动, 每个fs_buf只加一次写锁
+static QStringList applyChanges(const QList<fs_buf*> &bufList, const QHash<fs_buf*, QList<LFTChange>> &changes)
+{
+    QStringList root_path_list;
 
-            // 正在构建索引时需要等待
-            if (QFutureWatcher<fs_buf*> *watcher = _global_fsWatcherMap->value(i.first)) {
-                cDebug() << "will be wait build finished";
+    for (fs_buf *buf : bufList) {
+        const QList<LFTChange> &list = changes.value(buf);
+        QVector<fs_op> ops;
 
-                watcher->waitForFinished();
-                buf = watcher->result();
-            }
+        ops.reserve(list.size());
 
-            if (!buf)
-                continue;
+        for (const LFTChange &c : list) {
+            fs_op op;
+
+            op.type = c.type;
+            op.is_dir = c.isDir;
+            op.path = c.path.constData();
+            op.dst_path = c.dstPath.constData();
+            op.result = 0;
+            ops << op;
         }
 
-        cDebug() << "do insert:" << i.first;
+        uint32_t done = apply_changes(buf, ops.data(), ops.size());
+
+        for (int i = 0; i < ops.size(); ++i) {
+            if (ops.at(i).result == 0)
+                continue;
 
-        fs_change change;
-        int r = insert_path(buf, i.first.toLocal8Bit().constData(), is_dir, &change);
+            if (ops.at(i).result == ERR_NO_MEM) {
+                cWarning() << "Failed(No Memory):" << list.at(i).path;
+            } else {
+                cDebug() << "Failed:" << list.at(i).path << ", result:" << ops.at(i).result;
+            }
+        }
 
-        if (r == 0) {
+        if (done > 0) {
             // buf内容已改动，标记删除对应的lft文件
             markLFTFileToDirty(buf);
             root_path_list << QString::fromLocal8Bit(get_root_path(buf));
-        } else {
-            if (r == ERR_NO_MEM) {
-                cWarning() << "Failed(No Memory):" << i.first;
-            } else {
-                cDebug() << "Failed:" << i.first << ", result:" << r;
-            }
         }
     }
 
     return root_path_list;
 }
 
+QStringList LFTManager::insertFileToLFTBuf(const QByteArray &file)
+{
+    return insertFilesToLFTBuf({file});
+}
+
 QStringList LFTManager::removeFileFromLFTBuf(const QByteArray &file)
 {
-    cDebug() << file;
+    return removeFilesFromLFTBuf({file});
+}
 
-    auto list = getFsBufByPath(QString::fromLocal8Bit(file), false);
-    QStringList root_path_list;
+QStringList LFTManager::renameFileOfLFTBuf(const QByteArray &oldFile, const QByteArray &newFile)
+{
+    return renameFilesOfLFTBuf({oldFile}, {newFile});
+}
 
-    if (list.isEmpty())
-        return root_path_list;
+QStringList LFTManager::insertFilesToLFTBuf(const QByteArrayList &files)
+{
+    cDebug() << files.size();
 
-    for (auto i : list) {
-        fs_buf *buf = i.second;
+    QList<fs_buf*> buf_list;
+    QHash<fs_buf*, QList<LFTChange>> changes;
 
-        // 有可能索引正在构建
-        if (!buf) {
-            cDebug() << "index buinding";
+    for (const QByteArray &file : files) {
+        auto list = getFsBufByPath(QString::fromLocal8Bit(file), false);
 
-            // 正在构建索引时需要等待
-            if (QFutureWatcher<fs_buf*> *watcher = _global_fsWatcherMap->value(i.first)) {
-                cDebug() << "will be wait build finished";
+        if (list.isEmpty())
+            continue;
 
-                watcher->waitForFinished();
-                buf = watcher->result();
-            }
+        QFileInfo info(QString::fromLocal8Bit(file));
+        bool is_dir = info.isDir();
+
+        for (auto i : list) {
+            fs_buf *buf = waitFsBuf(i);
 
             if (!buf)
                 continue;
-        }
 
-        cDebug() << "do remove:" << i.first;
+            cDebug() << "do insert:" << i.first;
 
-        fs_change changes[10];
-        uint32_t count = 10;
-        int r = remove_path(buf, i.first.toLocal8Bit().constData(), changes, &count);
+            if (!changes.contains(buf))
+                buf_list << buf;
 
-        if (r == 0) {
-            // buf内容已改动，标记删除对应的lft文件
-            markLFTFileToDirty(buf);
-            root_path_list << QString::fromLocal8Bit(get_root_path(buf));
-        } else {
-            if (r == ERR_NO_MEM) {
-                cWarning() << "Failed(No Memory):" << i.first;
-            } else {
-                cDebug() << "Failed:" << i.first << ", result:" << r;
-            }
+            changes[buf] << LFTChange{FS_OP_INSERT, is_dir, i.first.toLocal8Bit(), QByteArray()};
         }
     }
 
-    return root_path_list;
+    return applyChanges(buf_list, changes);
 }
 
-QStringList LFTManager::renameFileOfLFTBuf(const QByteArray &oldFile, const QByteArray &newFile)
+QStringList LFTManager::removeFilesFromLFTBuf(const QByteArrayList &files)
 {
-    cDebug() << oldFile << newFile;
+    cDebug() << files.size();
 
-    auto list = getFsBufByPath(QString::fromLocal8Bit(newFile), false);
-    QStringList root_path_list;
+    QList<fs_buf*> buf_list;
+    QHash<fs_buf*, QList<LFTChange>> changes;
 
-    if (list.isEmpty())
-        return root_path_list;
+    for (const QByteArray &file : files) {
+        auto list = getFsBufByPath(QString::fromLocal8Bit(file), false);
 
-    for (int i = 0; i < list.count(); ++i) {
-        fs_buf *buf = list.at(i).second;
+        for (auto i : list) {
+            fs_buf *buf = waitFsBuf(i);
 
-        // 有可能索引正在构建
-        if (!buf) {
-            cDebug() << "index buinding";
+            if (!buf)
+                continue;
 
-            // 正在构建索引时需要等待
-            if (QFutureWatcher<fs_buf*> *watcher = _global_fsWatcherMap->value(list.at(i).first)) {
-                cDebug() << "will be wait build finished";
+            cDebug() << "do remove:" << i.first;
 
-                watcher->waitForFinished();
-                buf = watcher->result();
-            }
+            if (!changes.contains(buf))
+                buf_list << buf;
 
-            if (!buf)
-                continue;
+            changes[buf] << LFTChange{FS_OP_REMOVE, 0, i.first.toLocal8Bit(), QByteArray()};
         }
+    }
 
-        fs_change changes[10];
-        uint32_t change_count = 10;
+    return applyChanges(buf_list, changes);
+}
 
-        // newFile相对于此buf的路径
-        const QByteArray &new_file_new_path = list.at(i).first.toLocal8Bit();
-        int valid_suffix_size = new_file_new_path.size() - strlen(get_root_path(buf));
-        int invalid_prefix_size = newFile.size() - valid_suffix_size;
+QStringList LFTManager::renameFilesOfLFTBuf(const QByteArrayList &oldFiles, const QByteArrayList &newFiles)
+{
+    cDebug() << oldFiles.size() << newFiles.size();
 
-        QByteArray old_file_new_path = QByteArray(get_root_path(buf)).append(oldFile.mid(invalid_prefix_size));
+    if (oldFiles.size() != newFiles.size()) {
+        sendErrorReply(QDBusError::InvalidArgs, "The number of old files and new files is not equal");
 
-        cDebug() << "do rename:" << old_file_new_path << new_file_new_path;
+        return QStringList();
+    }
 
-        int r = rename_path(buf, old_file_new_path.constData(), new_file_new_path.constData(), changes, &change_count);
+    QList<fs_buf*> buf_list;
+    QHash<fs_buf*, QList<LFTChange>> changes;
 
-        if (r == 0) {
-            // buf内容已改动，标记删除对应的lft文件
-            markLFTFileToDirty(buf);
-            root_path_list << QString::fromLocal8Bit(get_root_path(buf));
-        } else {
-            if (r == ERR_NO_MEM) {
-                cWarning() << "Failed(No Memory)";
-            } else {
-                cDebug() << "Failed: result=" << r;
-            }
+    for (int n = 0; n < newFiles.size(); ++n) {
+        const QByteArray &oldFile = oldFiles.at(n);
+        const QByteArray &newFile = newFiles.at(n);
+        auto list = getFsBufByPath(QString::fromLocal8Bit(newFile), false);
+
+        for (auto i : list) {
+            fs_buf *buf = waitFsBuf(i);
+
+            if (!buf)
+                continue;
+
+            // newFile相对于此buf的路径
+            const QByteArray &new_file_new_path = i.first.toLocal8Bit();
+            int valid_suffix_size = new_file_new_path.size() - strlen(get_root_path(buf));
+            int invalid_prefix_size = newFile.size() - valid_suffix_size;
+
+            QByteArray old_file_new_path = QByteArray(get_root_path(buf)).append(oldFile.mid(invalid_prefix_size));
+
+            cDebug() << "do rename:" << old_file_new_path << new_file_new_path;
+
+            if (!changes.contains(buf))
+                buf_list << buf;
+
+            changes[buf] << LFTChange{FS_OP_RENAME, 0, old_file_new_path, new_file_new_path};
         }
     }
 
-    return root_path_list;
+    return applyChanges(buf_list, changes);
 }
 
 void LFTManager::quit()
@@ -1103,6 +1335,8 @@ static QStringList removeLFTFiles(const QByteArray &serialUriFilter = QByteArray
 
         nDebug() << "remove:" << lft_file;
 
+        QFile::remove(lft_file + FS_JOURNAL_SUFFIX);
+
         if (QFile::remove(lft_file)) {
             path_list << lft_file;
         } else {
@@ -60,6 +60,9 @@ public:
     QStringList insertFileToLFTBuf(const QByteArray &file);
     QStringList removeFileFromLFTBuf(const QByteArray &file);
     QStringList renameFileOfLFTBuf(const QByteArray &oldFile, const QByteArray &newFIle);
+    QStringList insertFilesToLFTBuf(const QByteArrayList &files);
+    QStringList removeFilesFromLFTBuf(const QByteArrayList &files);
+    QStringList renameFilesOfLFTBuf(const QByteArrayList &oldFiles, const QByteArrayList &newFiles);
 
     void quit();
 
@@ -28,6 +28,7 @@
 #include <QDBusConnection>
 #include <QDBusConnectionInterface>
 #include <QDBusServiceWatcher>
+#include <QDBusMetaType>
 
 DAS_BEGIN_NAMESPACE
 
@@ -61,9 +62,8 @@ public:
         if (!interface)
             return;
 
-        for (const QByteArray &f : files) {
-            interface->call(QDBus::Block, "insertFileToLFTBuf", f);
-        }
+        // 一次调用提交所有改动, 由服务端批量更新索引
+        interface->call(QDBus::Block, "insertFilesToLFTBuf", QVariant::fromValue(files));
     }
 
     void onFileDelete(const QByteArrayList &files) override
@@ -71,9 +71,7 @@ public:
         if (!interface)
             return;
 
-        for (const QByteArray &f : files) {
-            interface->call(QDBus::Block, "removeFileFromLFTBuf", f);
-        }
+        interface->call(QDBus::Block, "removeFilesFromLFTBuf", QVariant::fromValue(files));
     }
 
     void onFileRename(const QList<QPair<QByteArray, QByteArray>> &files) override
@@ -81,9 +79,14 @@ public:
         if (!interface)
             return;
 
+        QByteArrayList old_files, new_files;
+
         for (const QPair<QByteArray, QByteArray> &f : files) {
-            interface->call(QDBus::Block, "renameFileOfLFTBuf", f.first, f.second);
+            old_files << f.first;
+            new_files << f.second;
         }
+
+        interface->call(QDBus::Block, "renameFilesOfLFTBuf", QVariant::fromValue(old_files), QVariant::fromValue(new_files));
     }
 
 private:
@@ -98,6 +101,7 @@ private:
         // 如果更新的目标正在构建索引，将导致dbus调用阻塞，因此需要更长的超时时间
         // 此处设置为1个小时
         interface->setTimeout(60000 * 60);
+        qDBusRegisterMetaType<QByteArrayList>();
     }
 
     void destoryInterface()
@@ -26,6 +26,7 @@
 #include <QCommandLineOption>
 #include <QCommandLineParser>
 #include <QDBusConnection>
+#include <QDBusMetaType>
 #include<sys/utsname.h>
 #include <DLog>
 
@@ -118,6 +119,7 @@ int main(int argc, char *argv[])
             return 2;
         }
 
+        qDBusRegisterMetaType<QByteArrayList>();
         Q_UNUSED(new AnythingAdaptor(LFTManager::instance()));
 
         if (!QDBusConnection::systemBus().registerObject("/com/deepin/anything", LFTManager::instance())) {